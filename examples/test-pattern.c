@@ -24,76 +24,15 @@
 #include "ports.h"
 #include "stream.h"
 
-/* @brief returns 1 if current time exceeds the time specified by timeout. 0 otherwise */
-static int timeout_expired(struct timespec const * const timeout) {
-    struct timespec now;
-    clock_gettime(CLOCK_MONOTONIC, &now);
-    if (now.tv_sec != timeout->tv_sec) {
-        return ((now.tv_sec > timeout->tv_sec) ? 1 : 0);
-    }
-    return ((now.tv_nsec >= timeout->tv_nsec) ? 1 : 0);
-}
-
-int recv_from_uart(void *handle, uint8_t *b, unsigned int n, unsigned int offset, unsigned int timeout) {
-
-    /* calculate timeout */
-    struct timespec spec, expiry;
-    clock_gettime(CLOCK_MONOTONIC, &spec);
-    expiry.tv_sec = spec.tv_sec;
-    expiry.tv_nsec = spec.tv_nsec + timeout * 1e6;
-    if (expiry.tv_nsec > 1000000000) {
-        expiry.tv_nsec -= 1000000000;
-        ++expiry.tv_sec;
-    }
-
-    /* read (max) n bytes from queue before timeout */
-    Queue *q = (Queue *) handle;
-    unsigned int index = 0;
-    while ((q->head != q->tail) && (index <= n) && (timeout_expired(&expiry) == 0)) {
-        b[index] = q->buff[q->tail];
-        q->tail = (q->tail + 1) & q->mask;
-        ++index;
-    }
-
-    return index; /* how many were read */
-}
-
-int send_over_uart(void *handle, uint8_t const *b, unsigned int n, unsigned int timeout) {
-    int fd = * (int *) handle;
-
-    /* calculate timeout */
-    struct timespec spec, expiry;
-    clock_gettime(CLOCK_MONOTONIC, &spec);
-    expiry.tv_sec = spec.tv_sec;
-    expiry.tv_nsec = spec.tv_nsec + timeout * 1e6;
-    if (expiry.tv_nsec > 1000000000) {
-        expiry.tv_nsec -= 1000000000;
-        ++expiry.tv_sec;
-    }
-
-    unsigned int index = 0;
-    unsigned int remaining = n;
-    do {
-        int n_write = write(fd, &b[index], remaining);
-        remaining -= n_write;
-        index += n_write;
-    } while ((index <= n) && (timeout_expired(&expiry) == 0));
-
-    return index; /* how many went out */
-}
-
 int main(int argc, char **argv) {
     GenericDevice device;
+    memset(&device, 0, sizeof (device));
 
-    device.recv = recv_from_uart;
-    device.send = send_over_uart;
-
-    int verbose = 0;
+    device.recv = recv_from_desc;
+    device.send = send_over_desc;
 
     for (int i = 0; i < argc; ++i) {
-        if (strcmp(argv[i], "-verbose") == 0) {
-            verbose = 1;
-        } else if (strcmp(argv[i], "-d") == 0) {
+        if (strcmp(argv[i], "-d") == 0) {
             snprintf(device.name, sizeof (device.name), "%s", argv[++i]);
             device.fd = initialize_serial_port(device.name, 230400, 0, 0, 0);
         }
@@ -120,45 +59,33 @@ int main(int argc, char **argv) {
     memset(&rx_queue, 0, sizeof (Queue));
     memset(&rx_looper_args, 0, sizeof(RxLooperArgs));
 
-    uint8_t rx_buff[512];
-    memset(rx_buff, 0, sizeof (rx_buff));
-    rx_queue.buff = rx_buff;
-    rx_queue.mask = sizeof (rx_buff);
-    unsigned int run = 1;
-    rx_looper_args.queue = &rx_queue;
-    rx_looper_args.run = &run;
-    rx_looper_args.verbose = verbose;
-    rx_looper_args.fd = device.fd;
+    Stream link = { device.fd, &rx_queue };
+    device.handle = &link;
+    if (rx_looper_init(&rx_looper_args) || rx_looper_add(&rx_looper_args, device.fd, &rx_queue)) {
+        printf("unable to start receiver\n");
+        return 1;
+    }
     pthread_t rx_thread;
 
     pthread_create(&rx_thread, NULL, rx_looper, (void *) &rx_looper_args); /* create thread */
 
-    unsigned int trigger_level = 16; /* effective size of test */
     uint32_t total_bytes_read = 0;
-    unsigned int trigger_start = 64;
-    uint32_t byte_errors = 0;
-    uint32_t bit_errors = 0;
-    time_t next_time = 0;
-    unsigned int pattern_trapped = 0;
-    int index;
 
     while (1) {
-        Queue *q = &rx_queue;
-
-        int n_read = (q->head - q->tail) & q->mask;
+        uint8_t chunk[512];
+        int n_read = device.recv(device.handle, chunk, sizeof (chunk), 0, 0);
         total_bytes_read += n_read;
         printf("%d bytes read\nBEGIN\n", total_bytes_read);
 
         for (int i = 0; i < n_read; ++i) {
-            uint8_t byte = q->buff[q->tail];
+            uint8_t byte = chunk[i];
             if (byte == 0x0d) { byte = 0x0a; }
             printf("%c", byte);
-            q->tail = (q->tail + 1) & q->mask;
         }
         printf("\nDONE\n");
 
         command[4] = sizeof (command) - 12;
-        device.send(&device.fd, command, sizeof (command), 4000);
+        device.send(device.handle, (uint8_t const *) command, sizeof (command), 4000);
 
         sleep(1);
     }
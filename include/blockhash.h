@@ -0,0 +1,45 @@
+#ifndef BLOCKHASH_H
+#define BLOCKHASH_H
+
+#include <stdint.h>
+
+/*
+ * 128-bit hash of a block, to tell whether two copies of it differ without comparing them. 64-bit lanes multiply
+ * and accumulate 64 bytes at a time, in the manner of xxh3, so it runs at memory speed. it is strong against
+ * chance collisions, not against someone crafting them. all engines give identical results
+ */
+typedef struct {
+    uint64_t lo, hi;
+} BlockHash;
+
+enum {
+    BLOCK_HASH_ENGINE_AUTO = 0, /* fastest engine supported by this cpu */
+    BLOCK_HASH_ENGINE_SCALAR, /* reference: one lane at a time */
+    BLOCK_HASH_ENGINE_AVX2, /* four lanes per instruction */
+    BLOCK_HASH_ENGINES
+};
+
+/* hashes of a buffer are split over threads only when each gets at least this much of it */
+#define BLOCK_HASH_MIN_SPAN (256 * 1024)
+#define BLOCK_HASH_MAX_THREADS (32)
+
+void block_hash(uint8_t const *ptr, unsigned int n, BlockHash *hash);
+
+/* @brief same as block_hash() but with an explicit engine. hash is zeroed if the engine is unsupported */
+void block_hash_engine_hash(int engine, uint8_t const *ptr, unsigned int n, BlockHash *hash);
+
+/*
+ * @brief hashes of the block_size blocks of n bytes, the last one short, into hashes[(n + block_size - 1) /
+ *     block_size]. split over up to threads threads, 0 = one per cpu. whatever a thread cannot be had for is done
+ *     on this one
+ */
+void block_hash_blocks(uint8_t const *ptr, uint32_t n, unsigned int block_size, BlockHash *hashes,
+    unsigned int threads);
+
+/* @brief engine used by block_hash(). returns 0 on success, -1 if not supported on this cpu */
+int block_hash_select_engine(int engine);
+int block_hash_engine(void);
+int block_hash_engine_supported(int engine);
+char const *block_hash_engine_name(int engine);
+
+#endif
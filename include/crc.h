@@ -0,0 +1,52 @@
+#ifndef CRC_H
+#define CRC_H
+
+#include <stdint.h>
+
+/* CRC-CCITT, polynomial 0x1021, msb first, as used by xmodem. all engines give identical results */
+enum {
+    CRC16_ENGINE_AUTO = 0, /* fastest engine supported by this cpu */
+    CRC16_ENGINE_BITWISE, /* reference: 8 shift/xor steps per byte */
+    CRC16_ENGINE_TABLE, /* one 256-entry lookup per byte */
+    CRC16_ENGINE_SLICE8, /* 8 bytes per step, 8 tables */
+    CRC16_ENGINE_SLICE16, /* 16 bytes per step, 16 tables */
+    CRC16_ENGINE_CLMUL, /* pclmulqdq folding, 64 bytes per step */
+    CRC16_ENGINES
+};
+
+/* @brief continue crc over n bytes. start a new crc with crc = 0 */
+uint16_t crc16_update(uint16_t crc, uint8_t const *ptr, unsigned int n);
+uint16_t crc16(uint8_t const *ptr, unsigned int n);
+
+/* @brief same as crc16_update() but with an explicit engine. returns crc unchanged if engine is unsupported */
+uint16_t crc16_update_engine(int engine, uint16_t crc, uint8_t const *ptr, unsigned int n);
+
+/* @brief engine used by crc16_update(). returns 0 on success, -1 if not supported on this cpu */
+int crc16_select_engine(int engine);
+int crc16_engine(void);
+int crc16_engine_supported(int engine);
+char const *crc16_engine_name(int engine);
+
+/* CRC-32C (Castagnoli, reflected polynomial 0x82f63b78), as used by the extended framing */
+enum {
+    CRC32C_ENGINE_AUTO = 0, /* fastest engine supported by this cpu */
+    CRC32C_ENGINE_BITWISE, /* reference */
+    CRC32C_ENGINE_SLICE8, /* 8 bytes per step, 8 tables */
+    CRC32C_ENGINE_SSE42, /* crc32 instruction, three interleaved streams */
+    CRC32C_ENGINES
+};
+
+/* @brief continue crc over n bytes. start a new crc with crc = 0. pre and post inversion are done inside */
+uint32_t crc32c_update(uint32_t crc, uint8_t const *ptr, unsigned int n);
+uint32_t crc32c(uint8_t const *ptr, unsigned int n);
+
+/* @brief crc of a followed by b, given the crc of each. lets a crc run ahead of data that arrives out of order */
+uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, uint32_t length_b);
+
+uint32_t crc32c_update_engine(int engine, uint32_t crc, uint8_t const *ptr, unsigned int n);
+int crc32c_select_engine(int engine);
+int crc32c_engine(void);
+int crc32c_engine_supported(int engine);
+char const *crc32c_engine_name(int engine);
+
+#endif
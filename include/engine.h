@@ -0,0 +1,44 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <stdint.h>
+
+#include "xmodem.h"
+
+/*
+ * packet being sent. payload points at the source's data, or at frame[3] when the payload is staged. extended
+ * packets always point at the source's data, which may be far larger than frame
+ */
+typedef struct {
+    uint8_t frame[XMODEM_MAX_PACKET_SIZE];
+    uint8_t const *payload;
+    uint32_t payload_size;
+    uint16_t footer_offset; /* footer is at frame[footer_offset] */
+    uint8_t header_size, footer_size;
+} XmodemPacket;
+
+/*
+ * framing and checking for one block size and check kind. the specialised engines are built from the same code
+ * with both as compile time constants, so the padding and checksum loops unroll and vectorize. the generic
+ * engines read them from the struct at run time, as a baseline
+ */
+typedef struct XmodemEngine {
+    char const *name;
+    unsigned int block_size; /* XMODEM_BUFF_SIZE, XMODEM_1K_BUFF_SIZE or an extended size */
+    unsigned int kind; /* CHECKSUM_OPTION_CRC or CHECKSUM_OPTION_SUM, CHECKSUM_OPTION_CRC32C for extended sizes */
+    /* whole packet for the length bytes at data, padded with CTRL-Z. with gather, a full payload stays at data */
+    void (*build)(struct XmodemEngine const *engine, XmodemPacket *packet, uint8_t const *data, unsigned int length,
+        uint32_t packet_id, unsigned int gather);
+    /* 1 if the crc or checksum of a whole received packet (header byte first) matches */
+    int (*verify)(struct XmodemEngine const *engine, uint8_t const *packet);
+} XmodemEngine;
+
+/* @brief engine for block_size and kind, NULL if there is none */
+XmodemEngine const *xmodem_engine(unsigned int block_size, unsigned int kind);
+XmodemEngine const *xmodem_engine_generic(unsigned int block_size, unsigned int kind);
+void xmodem_extended_build_packed(XmodemPacket *packet, unsigned int block_size, uint8_t const *data,
+    unsigned int length, uint32_t packet_id);
+void xmodem_extended_build_parity(XmodemPacket *packet, unsigned int block_size, uint8_t const *parity,
+    uint32_t first_id, unsigned int k, unsigned int m, unsigned int j);
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef FEC_H
+#define FEC_H
+
+#include <stdint.h>
+
+/*
+ * erasure code over GF(2^8) for groups of up to FEC_MAX_DATA shards of equal size: FEC_MAX_PARITY or fewer parity
+ * shards, each a sum of the data shards times a coefficient from a cauchy matrix, rebuild as many lost data shards
+ * as there are parity shards to hand. the first parity row is all ones, so a single parity shard is plain xor.
+ * shards are multiplied a region at a time through nibble tables: 32 bytes per shuffle pair on avx2. all engines
+ * give identical results
+ */
+#define FEC_MAX_DATA (32)
+#define FEC_MAX_PARITY (16)
+
+enum {
+    FEC_ENGINE_AUTO = 0, /* fastest engine supported by this cpu */
+    FEC_ENGINE_SCALAR, /* reference: a table lookup per byte */
+    FEC_ENGINE_AVX2, /* 32 bytes per instruction, through pshufb on the two nibbles */
+    FEC_ENGINES
+};
+
+/* @brief what data shard i is multiplied by in parity shard j */
+uint8_t fec_coefficient(unsigned int j, unsigned int i);
+
+/* @brief dst += c src over n bytes, in GF(2^8) */
+void fec_mul_add(uint8_t *dst, uint8_t const *src, uint8_t c, unsigned int n);
+
+/* @brief same as fec_mul_add() but with an explicit engine. nothing is done if the engine is unsupported */
+void fec_engine_mul_add(int engine, uint8_t *dst, uint8_t const *src, uint8_t c, unsigned int n);
+
+/*
+ * @brief adds data shard i of n bytes to parity shards [0, m), which start out zeroed. a shard shorter than the
+ *     others is the same as one padded with zeros, so only its n bytes need adding
+ */
+void fec_encode(uint8_t * const *parity, unsigned int m, unsigned int i, uint8_t const *data, unsigned int n);
+
+/*
+ * @brief fills in the data shards of a group of k flagged in lost from the parity shards flagged in have. shards
+ *     are n bytes. the parity shards used are overwritten
+ * @return 0, or -1 if more are lost than there are parity shards
+ */
+int fec_rebuild(uint8_t * const *data, uint32_t lost, unsigned int k, uint8_t * const *parity, uint32_t have,
+    unsigned int n);
+
+/* @brief engine used by fec_mul_add(). returns 0 on success, -1 if not supported on this cpu */
+int fec_select_engine(int engine);
+int fec_engine(void);
+int fec_engine_supported(int engine);
+char const *fec_engine_name(int engine);
+
+#endif
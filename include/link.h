@@ -0,0 +1,98 @@
+#ifndef LINK_H
+#define LINK_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+
+#include "queue.h"
+#include "xmodem.h"
+
+/*
+ * emulated serial link in one process: two GenericDevice ends joined by a queue each way. bytes go out at the baud
+ * rate, 10 bits each as on an 8N1 line, and arrive a byte time apart after the one-way latency plus up to jitter
+ * more, never out of order. on the way bits are flipped, and bytes dropped or doubled, at the profile's rates from
+ * a seeded generator, so the same seed damages the same bytes run after run. a send blocks once more than
+ * buffer_bytes wait to go out, as on a uart with a fifo that size
+ */
+typedef struct {
+    unsigned int baud; /* 0 = as fast as the queues go */
+    unsigned int latency_us, jitter_us; /* one way */
+    double bit_error_rate; /* each bit flipped with this probability */
+    double drop_rate, duplicate_rate; /* each byte lost, or sent twice, with this probability */
+    uint64_t seed; /* 0 = 1 */
+    unsigned int buffer_bytes; /* 0 = LINK_BUFFER_BYTES */
+} LinkProfile;
+
+#define LINK_BUFFER_BYTES (4096)
+#define LINK_RING_SIZE (1024 * 1024) /* bytes on their way each way, a power of two */
+#define LINK_CHUNKS (16 * 1024) /* sends on their way each way, a power of two */
+
+/* what happened to the bytes sent one way so far */
+typedef struct {
+    uint64_t sent; /* bytes handed to the link */
+    uint64_t delivered; /* bytes read at the other end */
+    uint64_t flipped_bits, dropped, duplicated;
+} LinkStats;
+
+/* when the bytes of one send arrive: the first at first_ns, the rest a byte time apart */
+typedef struct {
+    uint64_t first_ns;
+    uint32_t length;
+    uint32_t reserved;
+} LinkChunk;
+
+/* one way. the sending end owns the fields up to stats, the receiving end those after */
+typedef struct {
+    Queue bytes; /* as damaged, in order */
+    Queue chunks; /* a LinkChunk per send */
+    LinkProfile profile;
+    uint64_t byte_ns; /* time one byte takes on the line, 0 = no limit */
+    uint64_t free_ns; /* the line is busy sending until then */
+    uint64_t last_ns; /* arrival of the last byte sent */
+    uint64_t state; /* generator */
+    uint64_t bits, bytes_in; /* counted for the next flip, drop and duplicate */
+    uint64_t next_flip, next_drop, next_duplicate;
+    uint8_t *scratch; /* one piece of a send, damaged. twice its size in case every byte is doubled */
+    struct {
+        atomic_ulong sent, delivered, flipped_bits, dropped, duplicated;
+    } stats;
+    LinkChunk chunk; /* receiving: the send being read */
+    unsigned int chunk_left; /* its bytes not read yet */
+    atomic_uint *closed;
+} LinkChannel;
+
+typedef struct {
+    int fd; /* -1. first member, as for Stream */
+    LinkChannel *tx, *rx;
+} LinkEnd;
+
+typedef struct {
+    LinkChannel channels[2]; /* [0] carries what end 0 sends to end 1, [1] the other way */
+    LinkEnd ends[2];
+    atomic_uint closed;
+} Link;
+
+/*
+ * @brief profiles for each way. backward = NULL uses forward's for both, with another seed. returns 0, or -1 if out
+ *     of memory
+ */
+int link_open(Link *link, LinkProfile const *forward, LinkProfile const *backward);
+
+/* @brief from now on sends and receives return what they have instead of waiting for more */
+void link_shutdown(Link *link);
+void link_close(Link *link);
+
+/* @brief device for end 0 or 1. only the link callbacks are set */
+void link_device(Link *link, unsigned int end, GenericDevice *device);
+
+/* @brief counts for direction 0 (end 0 to end 1) or 1 */
+void link_stats(Link *link, unsigned int direction, LinkStats *stats);
+
+int recv_from_link(void *handle, uint8_t *b, unsigned int n, unsigned int offset, unsigned int timeout);
+int send_over_link(void *handle, uint8_t const *b, unsigned int n, unsigned int timeout);
+int sendv_over_link(void *handle, struct iovec const *iov, int iovcnt, unsigned int timeout);
+int getc_from_link(void *handle, uint8_t *byte, unsigned int timeout);
+int putc_over_link(void *handle, uint8_t byte, unsigned int timeout);
+
+#endif
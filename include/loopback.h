@@ -0,0 +1,51 @@
+#ifndef LOOPBACK_H
+#define LOOPBACK_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "xmodem.h"
+#include "stream.h"
+
+/*
+ * pieces for the benches that run xmodem_send() against xmodem_recv() in one process: a file in memory to send
+ * from and receive into, the receiver on a thread of its own, and devices over connected descriptor pairs
+ */
+
+typedef struct {
+    uint8_t const *data;
+    unsigned int size;
+} MemorySource;
+
+typedef struct {
+    uint8_t *data;
+    unsigned int size;
+} MemorySink;
+
+/* one xmodem_recv() from link to sink, run by receiver_task() */
+typedef struct {
+    GenericDevice link, sink;
+    XmodemOptions options;
+    int result, errors;
+} Receiver;
+
+/* source device over a MemorySource */
+uint8_t const *map_from_memory(void *handle, unsigned int *size);
+void unmap_from_memory(void *handle, uint8_t const *base, unsigned int size);
+
+/* @brief sink device over a MemorySink. the padding of the last classic block past the end is left out */
+int write_to_memory(void *handle, uint8_t const *b, unsigned int n, unsigned int offset, unsigned int timeout);
+
+/* @brief thread entry point for a Receiver */
+void *receiver_task(void *ext);
+
+/* @brief dev over stream: sends go to its descriptor, receives come out of the queue an rx_looper fills */
+void stream_device(GenericDevice *dev, Stream *stream);
+
+/* @brief a listening loopback tcp socket on any free port, which goes to addr. -1 on failure */
+int listen_loopback(struct sockaddr_in *addr);
+
+/* @brief a connected pair of loopback sockets, without Nagle's delay. -1 on failure */
+int connect_loopback(int listen_fd, struct sockaddr_in const *addr, int fds[2]);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stdint.h>
+
+/*
+ * byte-aligned lz77 in the lz4 block format, fast enough to keep ahead of any serial line. a sequence is a token
+ * (literal count in the high nibble, match length - 4 in the low one, 15 = more in the bytes that follow, 255 meaning
+ * more still), the literals, then a 16-bit little endian distance back to the match. the last sequence is literals
+ * only. matches are found greedily through a hash of the next four bytes, one probe each
+ */
+#define LZ_MIN_MATCH (4)
+#define LZ_HASH_BITS (12)
+#define LZ_MAX_DISTANCE (65535)
+
+/* @brief packs n bytes of src into dst. returns the packed size, 0 if it does not fit in capacity bytes */
+unsigned int lz_compress(uint8_t const *src, unsigned int n, uint8_t *dst, unsigned int capacity);
+
+/* @brief unpacks n bytes of src into dst. returns the unpacked size, -1 if src is damaged or too big for capacity */
+int lz_decompress(uint8_t const *src, unsigned int n, uint8_t *dst, unsigned int capacity);
+
+#endif
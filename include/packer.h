@@ -0,0 +1,44 @@
+#ifndef PACKER_H
+#define PACKER_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+ * packing thread that keeps the next blocks of a file lz-packed in a ring, so packing never sits between an ACK and
+ * the next packet. it runs ahead from the block last asked for, in its size. asked for any other block, it drops
+ * what it packed ahead and starts over from there. a packed block stays valid until the consumer releases it
+ */
+typedef struct {
+    /* n bytes of the file at offset, NULL on failure. called from the packing thread */
+    uint8_t const *(*get_data)(void *context, uint32_t offset, unsigned int n);
+    void *context;
+    uint32_t file_size;
+    unsigned int max_block_size;
+    unsigned int depth; /* packed buffers in the ring */
+    uint8_t *buffers;
+    uint32_t *offsets; /* the block in each buffer */
+    unsigned int *sizes;
+    int *lengths; /* packed bytes in each buffer, 0 if the block did not shrink, -1 if it could not be had */
+    uint32_t next; /* file offset of the block to pack next */
+    unsigned int block_size; /* 0 until the first block is asked for */
+    uint32_t filled; /* blocks [0, filled) have been packed */
+    uint32_t taken; /* blocks [0, taken) have been handed out */
+    uint32_t released; /* blocks [0, released) are no longer needed by the consumer */
+    unsigned int generation; /* bumped on every start over, so a block packed for the last run is dropped */
+    unsigned int run;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+} Packer;
+
+/* a block is only sent packed if that saves at least 1/PACKER_MIN_SAVING of it */
+#define PACKER_MIN_SAVING (16)
+
+int packer_start(Packer *packer, uint8_t const *(*get_data)(void *context, uint32_t offset, unsigned int n),
+    void *context, uint32_t file_size, unsigned int max_block_size, unsigned int depth);
+uint8_t const *packer_get(Packer *packer, uint32_t offset, unsigned int n, unsigned int *length);
+void packer_release(Packer *packer, uint32_t offset);
+void packer_stop(Packer *packer);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef POLICY_H
+#define POLICY_H
+
+#include "xmodem.h"
+
+#define XMODEM_MAX_BLOCK_SIZES (8)
+
+/* what the sender has seen at the block size in use since it last changed */
+typedef struct {
+    unsigned int block_size;
+    unsigned int blocks; /* delivered */
+    unsigned int failures; /* NAKs and timeouts */
+    unsigned int const *sizes; /* block sizes the receiver takes, ascending */
+    unsigned int n_sizes;
+    unsigned int window; /* blocks in flight, 0 = stop-and-wait */
+} XmodemBlockFeedback;
+
+/*
+ * picks the sender's block size as a session goes. asked before each new block. in windowed mode a change waits
+ * until every block in flight is acknowledged, since the receiver places a window's blocks assuming one size.
+ * a larger size takes effect at the next file offset that is a multiple of it
+ */
+typedef struct XmodemBlockPolicy {
+    unsigned int (*choose)(struct XmodemBlockPolicy const *policy, XmodemBlockFeedback const *feedback);
+    unsigned int overhead; /* stop-and-wait: line time, in bytes, each block idles waiting for its reply */
+    unsigned int failure_cost; /* stop-and-wait: line time, in bytes, lost to the quiet wait before a NAK */
+    unsigned int min_samples; /* blocks sent at a size before it is judged */
+} XmodemBlockPolicy;
+
+/*
+ * @brief estimates the byte error rate from the failure rate at the current size and picks the size that costs
+ *     the least line time per payload byte delivered. switches only for a 10% gain
+ */
+unsigned int xmodem_block_policy_goodput(XmodemBlockPolicy const *policy, XmodemBlockFeedback const *feedback);
+
+/* goodput policy tuned for a 115200 baud line with a few ms of latency */
+extern XmodemBlockPolicy const xmodem_default_block_policy;
+
+#endif
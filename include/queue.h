@@ -0,0 +1,48 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+
+#define QUEUE_CACHE_LINE (64)
+
+/*
+ * single-producer / single-consumer byte ring. head and tail run freely and are masked on access, so
+ * head - tail is always the fill level. each index is written by one side only and lives on its own cache line.
+ * either side may sleep on the other's index (a futex on linux); the flags let the other side skip the wake-up
+ * system call when nobody sleeps
+ */
+typedef struct {
+    _Alignas(QUEUE_CACHE_LINE) atomic_uint head; /* producer */
+    atomic_uint producer_waiting;
+    atomic_uint closed; /* no more bytes will come */
+    _Alignas(QUEUE_CACHE_LINE) atomic_uint tail; /* consumer */
+    atomic_uint consumer_waiting;
+    _Alignas(QUEUE_CACHE_LINE) unsigned int mask;
+    uint8_t *buff;
+    size_t allocated; /* bytes mapped by queue_alloc(). 0 if the caller owns buff */
+} Queue;
+
+int queue_init(Queue *q, uint8_t *buff, unsigned int size);
+int queue_alloc(Queue *q, unsigned int size, unsigned int hugepages);
+void queue_free(Queue *q);
+unsigned int queue_size(Queue const *q);
+
+/* producer side */
+unsigned int queue_room(Queue *q);
+unsigned int queue_write(Queue *q, uint8_t const *src, unsigned int n);
+int queue_write_spans(Queue *q, struct iovec iov[2]);
+void queue_commit(Queue *q, unsigned int n);
+unsigned int queue_wait_room(Queue *q, unsigned int timeout);
+void queue_close(Queue *q);
+
+/* consumer side */
+unsigned int queue_count(Queue *q);
+unsigned int queue_read(Queue *q, uint8_t *dst, unsigned int n);
+unsigned int queue_peek(Queue *q, uint8_t *dst, unsigned int n);
+unsigned int queue_skip(Queue *q, unsigned int n);
+unsigned int queue_wait(Queue *q, unsigned int timeout);
+unsigned int queue_closed(Queue *q);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "xmodem.h"
+
+/*
+ * reader thread that keeps the next blocks of a source device in a ring of block buffers, so disk latency
+ * never sits between an ACK and the next packet. a block stays valid until the consumer releases it
+ */
+typedef struct {
+    GenericDevice *src;
+    uint32_t file_size;
+    uint32_t start; /* where block 0 starts in the file */
+    uint32_t const *list; /* or which blocks of the file to read, in order. NULL = all of them from start */
+    unsigned int block_size; /* payload bytes per block */
+    unsigned int depth; /* block buffers in the ring */
+    uint8_t *buffers;
+    int *lengths; /* bytes read into each buffer, -1 on read failure */
+    uint32_t n_blocks;
+    uint32_t filled; /* blocks [0, filled) have been read */
+    uint32_t released; /* blocks [0, released) are no longer needed by the consumer */
+    unsigned int run;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+} ReadAhead;
+
+int readahead_start(ReadAhead *ra, GenericDevice *src, uint32_t file_size, uint32_t start, unsigned int block_size,
+    unsigned int depth);
+int readahead_start_list(ReadAhead *ra, GenericDevice *src, uint32_t file_size, uint32_t const *list, uint32_t n,
+    unsigned int block_size, unsigned int depth);
+uint8_t const *readahead_get(ReadAhead *ra, uint32_t index, int *length);
+void readahead_release(ReadAhead *ra, uint32_t count);
+void readahead_stop(ReadAhead *ra);
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "xmodem.h"
+#include "ports.h"
+#include "session.h"
+
+#define XMODEM_SERVER_MAX_WORKERS (64)
+#define XMODEM_SERVER_DELTA_SIZES (7) /* delta block sizes, 1 KiB to 64 KiB */
+
+/* one accepted client: its socket and its transfer */
+typedef struct XmodemServerSession {
+    XmodemSession session;
+    int fd;
+    unsigned int heap_index; /* position in its loop's deadline heap */
+    unsigned int want_out; /* EPOLLOUT armed: the socket took less than we had */
+    struct XmodemServerSession *next;
+} XmodemServerSession;
+
+/* one event loop thread: every session it owns, their sockets in one epoll set and their deadlines in a heap */
+typedef struct {
+    struct XmodemServerArgs *args;
+    pthread_t thread;
+    int epoll_fd, event_fd; /* event_fd: new sessions or shutdown */
+    pthread_mutex_t lock;
+    XmodemServerSession *incoming; /* handed over by the acceptor, not yet in epoll */
+    unsigned int stopping;
+    XmodemServerSession **heap; /* min-heap on xmodem_session_deadline() */
+    unsigned int n_sessions;
+} XmodemServerLoop;
+
+/*
+ * serves one file to many tcp clients from one process. the file is mapped once and shared, and a few event loop
+ * threads drive every transfer as a non-blocking session, so a client costs a socket and a session, not a thread
+ */
+typedef struct XmodemServerArgs {
+    char const *file_name; /* sent to every client */
+    char const *start_command; /* optional. written to each client first, e.g. to start its receiver */
+    XmodemOptions options; /* each session works on its own copy */
+    unsigned int max_clients; /* connections at once. further clients wait in the listen backlog */
+    unsigned int n_workers; /* event loop threads. 0 = 1, at most XMODEM_SERVER_MAX_WORKERS */
+    unsigned int max_sessions; /* return after this many clients. 0 = serve forever */
+    unsigned int verbose;
+    atomic_uint completed, failed; /* transfers so far */
+
+    /* internal */
+    uint8_t const *mapping;
+    unsigned int file_size;
+    XmodemServerLoop loops[XMODEM_SERVER_MAX_WORKERS];
+    unsigned int n_loops;
+    unsigned int active; /* accepted and not yet finished */
+    BlockHash *delta_hashes[XMODEM_SERVER_DELTA_SIZES]; /* of the file, hashed once per delta block size asked for */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} XmodemServerArgs;
+
+int xmodem_server(TcpServerInfo *info, XmodemServerArgs *args);
+
+#endif
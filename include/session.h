@@ -0,0 +1,234 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "xmodem.h"
+#include "engine.h"
+#include "policy.h"
+#include "blockhash.h"
+#include "stats.h"
+
+/*
+ * one xmodem transfer as a state machine that never blocks and owns no threads or descriptors. the caller moves
+ * bytes: received bytes go in with xmodem_session_feed(), bytes to send come out of xmodem_session_next_output()
+ * and are confirmed with xmodem_session_consume_output(), and xmodem_session_poll() runs timeouts. time is
+ * milliseconds from any monotonic clock, e.g. xmodem_session_clock(). one thread can drive any number of sessions
+ */
+
+#define XMODEM_SESSION_MAX_IOV (16)
+#define XMODEM_SESSION_OUTPUTS (XMODEM_MAX_WINDOW + XMODEM_FEC_MAX_PARITY + 16)
+#define XMODEM_SESSION_NEVER (UINT64_MAX)
+
+enum {
+    XMODEM_SESSION_FAILED = -1,
+    XMODEM_SESSION_DONE = 0,
+    XMODEM_SESSION_RUNNING = 1
+};
+
+/* delta: the file a receiver holds. hashes[i] is of bytes [i block_size, (i + 1) block_size), the last block short */
+typedef struct {
+    uint32_t size;
+    unsigned int block_size;
+    uint32_t n_blocks;
+    BlockHash const *hashes;
+} XmodemSignature;
+
+/* where payloads come from (sender) or go to (receiver). the calls must not block for long */
+typedef struct {
+    void *context;
+    /* sender: n bytes of the file at offset, n being the block size or what is left of the file. NULL on failure.
+       the data must stay put until released */
+    uint8_t const *(*get_data)(void *context, uint32_t offset, unsigned int n);
+    void (*release_data)(void *context, uint32_t offset); /* sender, optional. bytes before offset are done */
+    /* receiver, optional: verified payload for file offset, padding included but for a patch. nonzero aborts */
+    int (*put_block)(void *context, uint32_t offset, uint8_t const *data, unsigned int n);
+    unsigned int gather; /* sender: output may point into get_data() data rather than copy whole blocks */
+    /* batch sender: the next file, described in info. get_data and release_data move on to it. 1 = no more files,
+       -1 on failure */
+    int (*next_file)(void *context, XmodemFileInfo *info);
+    /* batch receiver: a file starts (put_block offsets are into it from now on), and it is complete. nonzero aborts */
+    int (*open_file)(void *context, XmodemFileInfo const *info);
+    int (*end_file)(void *context, XmodemFileInfo const *info);
+    /* receiver, optional: bytes at the start of the file the sink already holds, and their crc-32c in *crc. asked
+       at the start and, in a batch, once block 0 has opened the file. 0 = nothing to offer */
+    uint32_t (*checkpoint)(void *context, uint32_t *crc);
+    /* receiver, optional: the sender goes on from offset, the offer or 0. nonzero aborts */
+    int (*restart)(void *context, uint32_t offset);
+    /* sender, optional: the receiver holds offset bytes whose crc-32c is crc. offset to go on from there if the file
+       starts with the same bytes, 0 to send it all */
+    uint32_t (*resume)(void *context, uint32_t offset, uint32_t crc);
+    /* receiver, optional: hashes of the file the sink holds, in blocks of block_size or larger. asked once at the
+       start, and read there and then. NULL = nothing to offer */
+    XmodemSignature const *(*signature)(void *context, unsigned int block_size);
+    /* receiver, optional: only blocks[0, n_blocks) of a file of size bytes come, the rest of what the sink holds
+       stays. blocks = NULL: the sender never answered, and sends all of a file of unknown size. nonzero aborts */
+    int (*patch)(void *context, uint32_t size, uint32_t const *blocks, uint32_t n_blocks);
+    /* sender, optional: the blocks of the file that differ from the receiver's, in order, into blocks. how many, or
+       -1 to send them all */
+    int (*delta)(void *context, XmodemSignature const *signature, uint32_t *blocks);
+    /* sender, optional: the n bytes at offset lz-packed, their size in *length. asked for in order, each block once,
+       and kept until released like get_data data. NULL = the block goes as it is */
+    uint8_t const *(*get_packed)(void *context, uint32_t offset, unsigned int n, unsigned int *length);
+} XmodemBlocks;
+
+/* R, then an offset and a crc-32c of 32 bits each in 7-bit groups with the top bit set, clear of control bytes */
+#define XMODEM_RESUME_FIELD_SIZE (5)
+#define XMODEM_RESUME_OFFER_SIZE (1 + 2 * XMODEM_RESUME_FIELD_SIZE)
+
+/*
+ * D, then the delta block size as log2, the size of the file held, its block hashes, and a crc-32c of all that. the
+ * sender answers D, its file size, one bit per block of it set if the block comes, and a crc-32c. fields are big
+ * endian, and each message after D goes as a stream of 7-bit groups with the top bit set
+ */
+#define XMODEM_DELTA_HASH_SIZE (16)
+
+/* bytes waiting to go out: a reply of up to XMODEM_RESUME_OFFER_SIZE bytes, or a packet */
+typedef struct {
+    XmodemPacket const *packet;
+    uint8_t bytes[XMODEM_RESUME_OFFER_SIZE];
+    uint8_t length;
+    uint64_t queued_us; /* for the stats */
+} XmodemOutput;
+
+typedef struct {
+    unsigned int retries; /* packets sent again */
+    unsigned int rtt_samples; /* ACKs timed. retransmitted blocks are not (Karn) */
+    unsigned int srtt_us, rttvar_us; /* smoothed send-to-ACK time and its mean deviation */
+    unsigned int rto_ms; /* retransmit timeout in use */
+    uint64_t data_bytes, wire_bytes; /* file bytes in the blocks sent or taken, and what they took on the line */
+    unsigned int repaired; /* receiver: blocks rebuilt from parity rather than sent again */
+} XmodemSessionStats;
+
+typedef struct {
+    XmodemOptions options; /* as requested. negotiated values replace them as the session learns them */
+    XmodemBlocks blocks;
+    unsigned int sender;
+    unsigned int state, resume_state; /* resume_state: where a lone CAN returns to */
+    int status;
+    uint64_t deadline;
+    uint64_t now; /* time of the call being handled */
+    /* optional, set by the caller: the clock now comes from, in microseconds, for the stats. NULL = now * 1000 */
+    uint64_t (*clock_us)(void);
+    uint64_t now_us;
+    XmodemStats *stats; /* options.stats, or own_stats */
+    XmodemStats own_stats;
+    uint32_t trace_id; /* tags its events in the trace */
+    unsigned int retries, total_retries;
+    unsigned int flush_input; /* drop the rest of the bytes being fed */
+    XmodemEngine const *engine; /* picked once block size and check kind are known */
+    XmodemFileInfo file; /* batch: the file being sent or received */
+
+    /* receiver */
+    uint8_t *packet; /* room for the largest packet we accept */
+    unsigned int packet_index, packet_end;
+    unsigned int header_size; /* 3, or XMODEM_EXTENDED_HEADER_SIZE */
+    unsigned int payload_size; /* block size: the offset from one block to the next */
+    unsigned int payload_length; /* bytes of it that belong to the file. short only for an extended last block */
+    uint16_t crc;
+    uint32_t crc32;
+    uint8_t sum;
+    uint32_t expected_packet_id; /* counts modulo 256, or modulo 2^32 in extended mode */
+    uint32_t expected_offset; /* where the block with expected_packet_id goes in the file */
+    uint8_t received[256]; /* windowed mode: blocks ahead of expected_packet_id already in, by low byte of id */
+    unsigned int extended_size; /* largest extended block offered, 0 = none */
+    unsigned int started, start_tries;
+    uint8_t start_byte;
+    uint8_t extended_mode; /* 0x80 | the sender's answer to X, 0 = none came */
+    uint8_t purge_reply[2]; /* sent once the line goes quiet after a damaged packet */
+    unsigned int purge_length;
+    unsigned int eot_refused; /* an EOT was NAKed just now. only a repeated EOT ends the transfer */
+    unsigned int line_noise; /* bytes that were no packet came since the last good one. an EOT or CAN may be payload */
+    unsigned int file_open; /* batch: block 0 of the current file is in, so blocks go to it */
+    unsigned int resume_offered; /* R sent, no answer yet. nothing starts until the sender says where */
+    uint32_t resume_offset, resume_crc; /* what we hold of the file */
+    uint8_t *unpacked; /* a packed block unpacked. NULL if we did not offer to take them */
+    unsigned int parity; /* the packet coming in is a parity packet */
+    uint8_t *replay; /* bytes of a damaged packet, read again for a packet that may start in them */
+    unsigned int replay_start, replay_end;
+    unsigned int rescan; /* bytes of the damaged packet just ended to read again */
+    uint64_t packet_us; /* first byte of the packet coming in */
+
+    /* sender */
+    uint32_t file_size;
+    uint32_t base, next; /* oldest unacknowledged block, next block to go out */
+    uint32_t next_offset, acked_offset; /* where block next starts, where block base starts */
+    uint32_t released; /* bytes handed back to the source */
+    uint32_t start_offset; /* where the data starts: 0, or past what the receiver holds */
+    uint8_t offer[XMODEM_RESUME_OFFER_SIZE]; /* R from the receiver, as it comes in */
+    unsigned int offer_length, offer_state; /* offer_state: where the rest of the negotiation goes on */
+    unsigned int offer_answered; /* we told the receiver where the data starts, so it waits for C */
+    unsigned int sizes[XMODEM_MAX_BLOCK_SIZES], n_sizes; /* block sizes the receiver takes */
+    unsigned int block_size; /* in use for new blocks */
+    unsigned int policy_blocks, policy_failures; /* at block_size, for options.block_policy */
+    unsigned int streaming_allowed, window_allowed, attempts;
+    unsigned int compress_allowed, compress_offered; /* we may pack blocks, and the receiver said Z */
+    unsigned int extended_allowed, extended_offer; /* largest extended block we send, and the receiver takes */
+    uint8_t file_header[XMODEM_1K_BUFF_SIZE]; /* batch: block 0 payload of the file being announced */
+    XmodemPacket *packets; /* one per window slot */
+    unsigned int n_packets;
+    uint8_t acked[XMODEM_MAX_WINDOW];
+    unsigned int retransmissions[XMODEM_MAX_WINDOW];
+    uint32_t slot_offset[XMODEM_MAX_WINDOW]; /* file offset of the block in each slot */
+    unsigned int slot_length[XMODEM_MAX_WINDOW]; /* its payload bytes, less than block size only at the end */
+    uint64_t sent_at[XMODEM_MAX_WINDOW]; /* first transmission of the block in each slot */
+    uint64_t queued_us[XMODEM_MAX_WINDOW], out_us[XMODEM_MAX_WINDOW]; /* block first queued, last one out */
+    int64_t srtt8, rttvar8; /* round trip estimate in 1/8 ms */
+    unsigned int rtt_samples;
+    unsigned int rto; /* retransmit timeout, ms */
+    uint8_t reply; /* windowed mode: ACK or NAK waiting for its block id */
+    uint64_t data_bytes, wire_bytes; /* for the stats */
+
+    /* forward error correction. options.fec_group and options.fec_parity are what was agreed */
+    unsigned int fec_group, fec_parity; /* receiver: offered. sender: the most we send */
+    unsigned int fec; /* receiver: the sender agreed, with F or a parity packet */
+    unsigned int fec_offer_group, fec_offer_parity; /* sender: what the receiver asked for with F */
+    uint8_t *fec_buffers; /* fec_parity parity blocks of the largest block size + XMODEM_FEC_DESCRIPTOR_SIZE */
+    uint32_t fec_first; /* first block of the group whose parity is being built (sender) or is in (receiver) */
+    unsigned int fec_count; /* sender: blocks added to the group so far */
+    XmodemPacket *fec_packets; /* sender: the parity packets of a group, as output */
+    uint32_t fec_have; /* receiver: parity blocks of group fec_first in, a bit each */
+    unsigned int fec_k; /* receiver: blocks in group fec_first */
+    uint8_t *fec_shards; /* receiver: the last fec_group blocks in, laid out as parity is, by id modulo fec_group */
+    uint32_t fec_shard_id[XMODEM_FEC_MAX_GROUP];
+    uint8_t fec_shard_valid[XMODEM_FEC_MAX_GROUP];
+    uint32_t fec_highest; /* receiver: newest block in */
+    uint32_t fec_checked; /* receiver: blocks before this one that never came were given up on */
+    unsigned int repaired;
+
+    /* delta: the data is the blocks that differ, one after the other. offsets are into that until mapped back */
+    unsigned int delta; /* the plan is agreed */
+    unsigned int delta_offered, delta_tries; /* receiver: hashes sent, no plan yet */
+    unsigned int delta_block_size;
+    uint32_t delta_size; /* of the file being patched */
+    uint32_t *delta_blocks, n_delta_blocks; /* the blocks that come, in order */
+    uint8_t *wire_in; /* the other side's offer or plan, decoded as it comes in */
+    unsigned int wire_length, wire_expected, wire_bits, wire_nbits;
+    uint8_t *wire_out; /* ours, encoded */
+    XmodemPacket *wire_packet; /* wire_out as output */
+
+    XmodemOutput outputs[XMODEM_SESSION_OUTPUTS];
+    unsigned int output_head, output_tail, output_offset;
+} XmodemSession;
+
+uint64_t xmodem_session_clock(void);
+uint64_t xmodem_session_clock_us(void);
+unsigned int xmodem_extended_block_size(XmodemOptions const *options);
+int xmodem_delta_blocks(XmodemSignature const *theirs, BlockHash const *ours, uint32_t size, uint32_t *blocks);
+
+int xmodem_session_start_send(XmodemSession *session, XmodemOptions const *options, XmodemBlocks const *blocks,
+    uint32_t file_size, uint64_t now);
+int xmodem_session_start_recv(XmodemSession *session, XmodemOptions const *options, XmodemBlocks const *blocks,
+    uint64_t now);
+void xmodem_session_end(XmodemSession *session);
+
+void xmodem_session_feed(XmodemSession *session, uint8_t const *b, unsigned int n, uint64_t now);
+void xmodem_session_poll(XmodemSession *session, uint64_t now);
+uint64_t xmodem_session_deadline(XmodemSession const *session);
+int xmodem_session_next_output(XmodemSession const *session, struct iovec *iov, int max_iov);
+void xmodem_session_consume_output(XmodemSession *session, unsigned int n, uint64_t now);
+int xmodem_session_status(XmodemSession const *session);
+void xmodem_session_stats(XmodemSession const *session, XmodemSessionStats *stats);
+
+#endif
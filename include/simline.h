@@ -0,0 +1,44 @@
+#ifndef SIMLINE_H
+#define SIMLINE_H
+
+#include <stdint.h>
+
+#include "session.h"
+
+/*
+ * simulated serial line for the session benches: a sender and a receiver session talk through it, one line each
+ * way, on a simulated clock, so every run is deterministic and takes no real time. a line takes a session's output
+ * a chunk at a time as it drains, as a blocking write to a uart would, so the session's timers start once its output
+ * is gone. each chunk is delivered whole once its last byte is through, with bits flipped at random on the way
+ */
+
+#define SIM_LINE_CHUNKS (1024)
+#define SIM_LINE_MAX_CHUNK (4096)
+
+typedef struct {
+    unsigned int bytes_per_second;
+    unsigned int latency_us; /* one way */
+    double bit_error_rate; /* both ways */
+    unsigned int chunk_size; /* bytes delivered at once, at most SIM_LINE_MAX_CHUNK. 0 = that */
+} SimLineModel;
+
+/* a file to send and the copy it ends up as. a bench's own transfer state starts with one */
+typedef struct {
+    uint8_t const *file;
+    uint32_t file_size;
+    uint8_t *copy;
+} SimFile;
+
+/* @brief XmodemBlocks callbacks over a SimFile. put_block leaves out the padding of a full transfer */
+uint8_t const *sim_get_data(void *context, uint32_t offset, unsigned int n);
+int sim_put_block(void *context, uint32_t offset, uint8_t const *data, unsigned int n);
+
+/*
+ * @brief runs two started sessions against each other until neither runs, or both wait on nothing. seed picks
+ *     where the bit errors fall. the sessions are left for the caller to check and end
+ * @return simulated microseconds. bytes, if not NULL = bytes on the line both ways
+ */
+uint64_t sim_run(XmodemSession *sender, XmodemSession *receiver, SimLineModel const *model, uint64_t seed,
+    uint64_t *bytes);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * log-linear histogram of microseconds: values below XMODEM_HISTOGRAM_LINEAR have a bucket each, and every power of
+ * two above is split into XMODEM_HISTOGRAM_LINEAR buckets, so a bucket is never wider than 1/8 of its values. values
+ * past the last bucket land in it
+ */
+#define XMODEM_HISTOGRAM_SHIFT (3)
+#define XMODEM_HISTOGRAM_LINEAR (1u << XMODEM_HISTOGRAM_SHIFT)
+#define XMODEM_HISTOGRAM_MAX_LOG2 (36) /* about 19 hours */
+#define XMODEM_HISTOGRAM_BUCKETS ((XMODEM_HISTOGRAM_MAX_LOG2 - XMODEM_HISTOGRAM_SHIFT + 2) * XMODEM_HISTOGRAM_LINEAR)
+
+typedef struct {
+    uint64_t count, sum, min, max;
+    uint64_t buckets[XMODEM_HISTOGRAM_BUCKETS];
+} XmodemHistogram;
+
+/*
+ * what a session did so far. the session is its only writer and stores each field whole, so another thread may read
+ * it while the transfer runs, field by field or with xmodem_stats_snapshot()
+ */
+typedef struct XmodemStats {
+    uint64_t blocks_sent; /* data packets sent, each block once */
+    uint64_t blocks_resent; /* and sent again */
+    uint64_t blocks_received; /* new blocks taken, rebuilt ones included */
+    uint64_t duplicates; /* good packets of blocks already taken */
+    uint64_t damaged; /* packets that failed their check or were cut short */
+    uint64_t repaired; /* blocks rebuilt from parity */
+    uint64_t naks_sent, naks_received;
+    uint64_t timeouts; /* waits that ran out, quiet times after damage included */
+    uint64_t cancels_sent, cancels_received;
+    uint64_t bytes_sent, bytes_received; /* on the line, every byte */
+    uint64_t data_bytes; /* file bytes in the blocks sent or taken */
+    uint64_t wall_us, cpu_us; /* kept by xmodem_send() and xmodem_recv(): time, and cpu time of their thread */
+    /* sender: last byte of a block out to its ACK, first sends only. receiver: last byte of a block in to its ACK
+       out */
+    XmodemHistogram ack_turnaround;
+    /* sender: block first queued to its ACK, resends and all. receiver: first byte of a packet in to its check
+       passing */
+    XmodemHistogram block_service;
+} XmodemStats;
+
+/* @brief counter += n, by its only writer */
+static inline void xmodem_stats_add(uint64_t *counter, uint64_t n) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+static inline void xmodem_stats_set(uint64_t *counter, uint64_t value) {
+    __atomic_store_n(counter, value, __ATOMIC_RELAXED);
+}
+
+void xmodem_stats_reset(XmodemStats *stats);
+void xmodem_stats_snapshot(XmodemStats const *stats, XmodemStats *copy);
+void xmodem_stats_json(FILE *f, XmodemStats const *stats);
+
+void xmodem_histogram_record(XmodemHistogram *h, uint64_t value);
+unsigned int xmodem_histogram_bucket(uint64_t value);
+uint64_t xmodem_histogram_lower(unsigned int bucket);
+uint64_t xmodem_histogram_quantile(XmodemHistogram const *h, double q);
+
+#endif
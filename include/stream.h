@@ -2,29 +2,77 @@
 #define STREAM_H
 
 #include <stdint.h>
+#include <sys/uio.h>
+#include <pthread.h>
 
+#include "queue.h"
+#include "xmodem.h"
+
+/* handle for the *_desc functions. sends go straight to fd, receives come out of the queue filled by rx_looper */
+typedef struct {
+    int fd; /* first member, so the handle also works wherever a bare file descriptor is expected */
+    Queue *queue;
+} Stream;
+
+#define RX_LOOPER_RING_SIZE (64 * 1024)
+
+enum {
+    RX_SOURCE_FREE = 0,
+    RX_SOURCE_ACTIVE,
+    RX_SOURCE_REMOVING /* rx_looper_remove() waits for the looper thread to let go of it */
+};
+
+/* one watched descriptor and the queue it fills */
 typedef struct {
-    unsigned int head, tail, mask;
-    uint8_t *buff;
-} Queue;
+    atomic_uint state;
+    int fd;
+    Queue *queue;
+    unsigned int owns_ring; /* ring allocated by rx_looper_add(), released by rx_looper_close() */
+    unsigned int stalled; /* ring full, fd out of the poll set until the consumer makes room */
+    atomic_uint closed; /* end of file or read error */
+    atomic_ulong overflows; /* times data was waiting but the ring was full, i.e. the consumer fell behind */
+} RxSource;
 
 typedef struct RxLooperArgs {
-    Queue *queue; /* circular queue used to hold/extract data from the stream */
     char const *name; /* name of device or file */
-    unsigned int *run;
-    int fd; /* relevant file descriptors */
-    unsigned int verbose, debug;
-    unsigned int loop_pace; /* milliseconds to pause between thread loops */
+    unsigned int debug;
+    unsigned int loop_pace; /* milliseconds between checks on a stalled source. 0 = 1 ms */
+    unsigned int ring_size; /* bytes per ring allocated by rx_looper_add(), a power of two. 0 = RX_LOOPER_RING_SIZE */
+    unsigned int hugepages; /* back those rings with huge pages where available */
+    unsigned int max_sources; /* 0 = 1 */
+    int epoll_fd, event_fd; /* event_fd wakes the thread to remove sources or shut down */
+    RxSource *sources;
+    atomic_uint n_sources; /* slots in use or used before */
+    atomic_uint stopping;
+    pthread_mutex_t lock; /* rx_looper_remove() waits on cond */
+    pthread_cond_t cond;
 } RxLooperArgs;
 
+int rx_looper_init(RxLooperArgs *args);
+int rx_looper_add(RxLooperArgs *args, int fd, Queue *queue);
+int rx_looper_remove(RxLooperArgs *args, Queue *queue);
 void *rx_looper(void *ext);
+void rx_looper_stop(RxLooperArgs *args);
+void rx_looper_close(RxLooperArgs *args);
+unsigned long rx_looper_overflows(RxLooperArgs *args);
 void *server_task(void *arg);
 void *client_task(void *arg);
 int recv_from_file(void *handle, uint8_t *b, unsigned int n, unsigned int offset, unsigned int timeout);
+int write_to_file(void *handle, uint8_t const *b, unsigned int n, unsigned int offset, unsigned int timeout);
+int sync_to_file(void *handle);
 int size_from_file(void *handle, unsigned int timeout);
+int info_from_file(void *handle, XmodemFileInfo *info);
+int open_to_file(void *handle, XmodemFileInfo const *info);
+int close_to_file(void *handle, XmodemFileInfo const *info);
+int truncate_to_file(void *handle, uint32_t size);
+int load_checkpoint_from_file(void *handle, XmodemCheckpoint *checkpoint);
+int save_checkpoint_to_file(void *handle, XmodemCheckpoint const *checkpoint);
+uint8_t const *map_from_file(void *handle, unsigned int *size);
+void unmap_from_file(void *handle, uint8_t const *base, unsigned int size);
 int recv_from_desc(void *handle, uint8_t *b, unsigned int n, unsigned int offset, unsigned int timeout);
 int getc_from_desc(void *handle, uint8_t *byte, unsigned int timeout);
 int send_over_desc(void *handle, uint8_t const * const b, unsigned int n, unsigned int timeout);
+int sendv_over_desc(void *handle, struct iovec const *iov, int iovcnt, unsigned int timeout);
 int putc_over_desc(void *handle, uint8_t byte, unsigned int timeout);
 
 #endif
@@ -0,0 +1,135 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+ * flight recorder for the hot paths: each thread records into a ring of its own, no locks and no system calls, so
+ * tracing a link leaves its timing alone. a full ring overwrites its oldest events. nothing is recorded until
+ * trace_start(), and then only a flag is checked per event. trace_dump() writes every thread's ring to a file that
+ * trace-xmodem decodes into text or a chrome://tracing timeline. rings stay for the life of the process, so threads
+ * that have exited are in the dump too
+ */
+
+enum {
+    TRACE_SESSION_START = 1, /* arg: 1 sender, 0 receiver */
+    TRACE_SESSION_END, /* arg: XMODEM_SESSION_DONE or XMODEM_SESSION_FAILED */
+    TRACE_PACKET_BUILT, /* arg: block index. length: payload bytes on the line */
+    TRACE_RETRANSMIT, /* arg: block index */
+    TRACE_SENT, /* length: bytes handed to the link */
+    TRACE_RECEIVED, /* length: bytes fed to the session */
+    TRACE_ACK_SENT, /* arg: packet id of a tagged reply */
+    TRACE_NAK_SENT,
+    TRACE_ACK_RECEIVED, /* arg: block index */
+    TRACE_NAK_RECEIVED, /* arg: oldest block not acknowledged */
+    TRACE_TIMEOUT, /* arg: retries so far */
+    TRACE_DAMAGED, /* length: bytes of the packet */
+    TRACE_CANCEL,
+    TRACE_RX_READ, /* rx_looper. arg: descriptor. length: bytes read */
+    TRACE_RX_FULL, /* rx_looper. arg: descriptor whose ring was full */
+    TRACE_EVENTS
+};
+
+#define TRACE_RING_EVENTS (64 * 1024) /* per thread, a power of two */
+
+typedef struct {
+    uint64_t ticks; /* trace_ticks() */
+    uint32_t type;
+    uint32_t session; /* trace_session_id() of the session, 0 outside one */
+    uint32_t arg, length;
+} TraceEvent;
+
+/* a slot is being written while seq is 0, and holds event number seq - 1 after */
+typedef struct {
+    atomic_ulong seq;
+    TraceEvent event;
+} TraceSlot;
+
+typedef struct TraceRing {
+    atomic_ulong head; /* events recorded. written by its thread only */
+    unsigned long mask;
+    unsigned long start; /* head at trace_start() */
+    int tid;
+    char name[16];
+    struct TraceRing *next;
+    TraceSlot slots[];
+} TraceRing;
+
+/*
+ * dump file, in the byte order of the machine that wrote it: a TraceFileHeader, then per ring a TraceFileRing and
+ * its events oldest first. ticks map to CLOCK_MONOTONIC nanoseconds through the two pairs in the header
+ */
+#define TRACE_FILE_MAGIC "XMTRACE"
+#define TRACE_FILE_VERSION (1)
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t n_rings;
+    uint64_t start_ns, start_ticks; /* taken by the first trace_start() */
+    uint64_t end_ns, end_ticks; /* by trace_dump() */
+} TraceFileHeader;
+
+typedef struct {
+    int32_t tid;
+    char name[16];
+    uint32_t n_events;
+    uint64_t lost; /* overwritten before the dump, or being written during it */
+} TraceFileRing;
+
+extern atomic_uint trace_enabled;
+extern _Thread_local TraceRing *trace_ring;
+
+/* @brief the time stamp counter where there is one, CLOCK_MONOTONIC nanoseconds elsewhere */
+static inline uint64_t trace_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec * 1000000000ull + spec.tv_nsec;
+#endif
+}
+
+TraceRing *trace_attach(void);
+
+/* @brief records an event of this thread, if tracing. cheap enough for every packet and every read */
+static inline void trace_record(unsigned int type, uint32_t session, uint32_t arg, uint32_t length) {
+    if (__builtin_expect(atomic_load_explicit(&trace_enabled, memory_order_relaxed) == 0, 1)) { return; }
+    TraceRing *ring = trace_ring;
+    if ((ring == NULL) && ((ring = trace_attach()) == NULL)) { return; }
+    unsigned long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    TraceSlot *slot = &ring->slots[head & ring->mask];
+    atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release); /* a reader sees seq 0 before any of the new event */
+    slot->event.ticks = trace_ticks();
+    slot->event.type = type;
+    slot->event.session = session;
+    slot->event.arg = arg;
+    slot->event.length = length;
+    atomic_store_explicit(&slot->seq, head + 1, memory_order_release);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/*
+ * @brief starts recording, into rings of events_per_thread (rounded up to a power of two, 0 = TRACE_RING_EVENTS)
+ *     for threads that have none yet. events from before are left out of the next dump
+ */
+void trace_start(unsigned int events_per_thread);
+void trace_stop(void);
+
+/* @brief every ring to path. may run while others record. returns 0, or -1 if the file could not be written */
+int trace_dump(char const *path);
+
+/* @brief a new tag for the events of one session, never 0 */
+uint32_t trace_session_id(void);
+
+char const *trace_event_name(unsigned int type);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef WRITEBEHIND_H
+#define WRITEBEHIND_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "xmodem.h"
+
+#define WRITEBEHIND_BATCHES (4)
+#define WRITEBEHIND_AHEAD (16)
+
+typedef struct {
+    uint8_t *data;
+    unsigned int length;
+    uint32_t offset; /* where data[0] goes in the file */
+} WriteBatch;
+
+/* a batch that landed beyond a gap in the file, e.g. after a NAKed block of a window */
+typedef struct {
+    uint32_t offset;
+    unsigned int length;
+    uint32_t crc;
+} WriteRange;
+
+/*
+ * background writer for verified blocks. contiguous blocks are coalesced into large positioned writes, so the
+ * receiver never waits on the disk before it ACKs. the block at the highest offset is held back until something
+ * lands beyond it or the transfer finishes, so the CTRL-Z padding of the final block can be stripped
+ */
+typedef struct {
+    GenericDevice *dst;
+    unsigned int batch_size;
+    unsigned int sync_bytes; /* fsync after this many bytes, 0 = only when finished */
+    WriteBatch batches[WRITEBEHIND_BATCHES];
+    unsigned int fill; /* batch being filled by the receiver */
+    unsigned int ready; /* batches handed to the writer thread, in order from fill - ready */
+    uint8_t *tail; /* held back block */
+    unsigned int tail_length;
+    uint32_t tail_offset;
+    uint32_t unsynced;
+    uint32_t size; /* end of the furthest byte written */
+    /* resume: bytes on the device in order from the start of the file and their crc, saved with every sync */
+    XmodemCheckpoint checkpoint;
+    unsigned int track;
+    WriteRange ahead[WRITEBEHIND_AHEAD]; /* folded into the checkpoint once the gap before them fills */
+    unsigned int n_ahead;
+    int failed;
+    unsigned int run;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+} WriteBehind;
+
+int writebehind_start(WriteBehind *wb, GenericDevice *dst, unsigned int batch_size, unsigned int sync_bytes);
+int writebehind_submit(WriteBehind *wb, uint32_t offset, uint8_t const *data, unsigned int n);
+int writebehind_flush(WriteBehind *wb, uint32_t size);
+void writebehind_track(WriteBehind *wb, XmodemCheckpoint const *checkpoint);
+int writebehind_finish(WriteBehind *wb, unsigned int strip_padding);
+
+#endif
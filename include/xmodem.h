@@ -2,40 +2,139 @@
 #define XMODEM_H
 
 #include <stdint.h>
+#include <sys/uio.h>
+
+#define XMODEM_MAX_FILE_NAME (256)
+
+/* one file of a batch, as announced in its block 0 */
+typedef struct {
+    char name[XMODEM_MAX_FILE_NAME];
+    uint32_t size;
+    uint64_t mtime; /* seconds since the epoch, 0 = unknown */
+    unsigned int mode; /* unix permission bits, 0 = unknown */
+} XmodemFileInfo;
+
+#define XMODEM_CHECKPOINT_MAGIC (0x584d5231) /* XMR1 */
+
+/* what a receiver keeps of an interrupted transfer, so that the next session can go on after the bytes it has */
+typedef struct {
+    uint32_t magic; /* XMODEM_CHECKPOINT_MAGIC */
+    uint32_t verified; /* bytes [0, verified) of the file are on the device */
+    uint32_t crc; /* crc-32c of those bytes */
+    uint32_t size; /* batch: the file as its block 0 announced it. another file of the same name starts over */
+    uint64_t mtime;
+} XmodemCheckpoint;
 
 typedef struct {
     int fd;
     int (*recv)(void *handle, uint8_t *dst, unsigned int n, unsigned int offset, unsigned int timeout);
     int (*send)(void *handle, uint8_t const *src, unsigned int n, unsigned int timeout);
+    int (*sendv)(void *handle, struct iovec const *iov, int iovcnt, unsigned int timeout); /* optional */
+    uint8_t const *(*map)(void *handle, unsigned int *size); /* optional. whole source, read only */
+    void (*unmap)(void *handle, uint8_t const *base, unsigned int size);
+    int (*write)(void *handle, uint8_t const *src, unsigned int n, unsigned int offset, unsigned int timeout); /* sink */
+    int (*sync)(void *handle); /* optional. make written data durable */
     int (*getc)(void *handle, uint8_t *ch, unsigned int timeout);
     int (*putc)(void *handle, uint8_t ch, unsigned int timeout);
     int (*size)(void *handle, unsigned int timeout);
+    int (*info)(void *handle, XmodemFileInfo *info); /* optional. batch source: size, time and mode for block 0 */
+    int (*open)(void *handle, XmodemFileInfo const *info); /* batch sink: start the next file, sized to info->size */
+    int (*close)(void *handle, XmodemFileInfo const *info); /* optional. batch sink: the file is complete */
+    int (*truncate)(void *handle, uint32_t size); /* optional. sink: cut the file to size */
+    /* optional. sink: the checkpoint kept with the file, -1 if there is none. saving NULL removes it */
+    int (*load_checkpoint)(void *handle, XmodemCheckpoint *checkpoint);
+    int (*save_checkpoint)(void *handle, XmodemCheckpoint const *checkpoint);
     char name[128];
-    void *handle;
+    void *handle; /* passed to every callback, e.g. &fd for files or a Stream for links */
 } GenericDevice;
 
 typedef struct {
     unsigned int packet_size_code; /* 1 = 128-byte packet, 2 = 1024-byte packet */
     unsigned int packet_size;
-    unsigned int crc_checksum; /* 0 = crc, 1 = checksum */
+    unsigned int crc_checksum; /* CHECKSUM_OPTION_CRC or CHECKSUM_OPTION_SUM. CHECKSUM_OPTION_CRC32C once extended */
     unsigned int max_retries;
     unsigned int max_retransmissions;
     unsigned int timeout_ms;
+    unsigned int min_timeout_ms, max_timeout_ms; /* sender: retransmit timeout follows ACK round trips within these */
+    unsigned int streaming; /* 1 = ymodem-g: no per-block ACK, any error aborts. negotiated with G */
+    unsigned int window; /* > 1 = sliding window of this many blocks, ACK/NAK tagged with block id. negotiated with W */
+    unsigned int readahead; /* blocks the sender reads ahead of the link, 0 = default */
+    unsigned int sync_bytes; /* receiver syncs the sink after this many bytes, 0 = only at the end */
+    struct XmodemBlockPolicy const *block_policy; /* sender: varies the block size with errors. NULL = packet_size */
+    /* 1 = large blocks with a crc-32c footer and 32-bit block numbers, for tcp and pipes. negotiated with X */
+    unsigned int extended;
+    unsigned int extended_block_size; /* largest extended block, a power of two. 0 = XMODEM_EXTENDED_MAX_BLOCK */
+    unsigned int batch; /* 1 = ymodem batch: many files in one session, each announced by a block 0. both sides */
+    /* 1 = go on from where an interrupted transfer stopped. the receiver offers the bytes its checkpoint holds with
+       R, the sender skips them if its file starts with the same bytes */
+    unsigned int resume;
+    /* receiver: offer hashes of the file dst already holds, one per block of this many bytes, so the sender only sends
+       the blocks that differ. a power of two, raised for files of more than XMODEM_DELTA_MAX_BLOCKS blocks. sender:
+       nonzero = send only the blocks a receiver's hashes say differ. offered with D, single files only */
+    unsigned int delta;
+    /* 1 = lz-pack the blocks that shrink, on a thread ahead of the link. receiver: offer to take them with Z, before
+       X. sender: pack if offered. extended packets only */
+    unsigned int compress;
+    /* forward error correction: fec_parity parity blocks after every fec_group blocks, from which the receiver
+       rebuilds up to fec_parity lost ones of the group without asking for them again. receiver: offer them with F,
+       before X. sender: send them if offered, the smaller of both sides' numbers. extended packets with a window or
+       streaming only. set to what was agreed, 0 = none */
+    unsigned int fec_group, fec_parity;
+    /* optional, one session's own. counted into as the session goes, readable from other threads meanwhile */
+    struct XmodemStats *stats;
 } XmodemOptions;
 
+#define XMODEM_MAX_WINDOW (64)
+
+#define XMODEM_1K_BUFF_SIZE (1024)
+#define XMODEM_BUFF_SIZE (128)
+#define XMODEM_MAX_PACKET_SIZE (XMODEM_1K_BUFF_SIZE + 5)
+
+/*
+ * extended packet: XTX, log2 block size, block number (32 bits), payload length - 1 (16 bits), payload, crc-32c
+ * of everything after XTX. multi-byte fields are big endian. only the last block is short, and it is not padded
+ */
+#define XMODEM_EXTENDED_MIN_BLOCK (4 * 1024)
+#define XMODEM_EXTENDED_MAX_BLOCK (64 * 1024)
+#define XMODEM_EXTENDED_HEADER_SIZE (8)
+#define XMODEM_EXTENDED_FOOTER_SIZE (4)
+
+/* set in the block size byte when the payload is lz-packed. unpacked, it is the block size or the rest of the file */
+#define XMODEM_EXTENDED_PACKED (0x80)
+
+/*
+ * parity packet: the block size byte has XMODEM_EXTENDED_PARITY set, the block number is that of the first block of
+ * its group, and the length field holds the blocks in the group - 1, then the parity blocks sent for it - 1 and
+ * which one this is in 4 bits each. the payload is the block size, then XMODEM_FEC_DESCRIPTOR_SIZE bytes: the parity
+ * of the payloads padded with zeros, and of each block's size byte and length field followed by a zero
+ */
+#define XMODEM_EXTENDED_PARITY (0x40)
+#define XMODEM_FEC_MAX_GROUP (32)
+#define XMODEM_FEC_MAX_PARITY (16)
+#define XMODEM_FEC_DESCRIPTOR_SIZE (4)
+
+/* delta blocks. the sender keeps its blocks within one, so the largest block it sends is the delta block size */
+#define XMODEM_DELTA_MIN_BLOCK (1024)
+#define XMODEM_DELTA_MAX_BLOCK (64 * 1024)
+#define XMODEM_DELTA_MAX_BLOCKS (64 * 1024)
+
 enum {
     CHECKSUM_OPTION_UNK = 0,
     CHECKSUM_OPTION_CRC,
     CHECKSUM_OPTION_SUM,
+    CHECKSUM_OPTION_CRC32C, /* extended packets only */
     CHECKSUM_OPTIONS
 };
 
 int xmodem_send(GenericDevice *src, GenericDevice *dst, XmodemOptions *options, int *errors);
+int xmodem_send_batch(GenericDevice *files, unsigned int n_files, GenericDevice *dst, XmodemOptions *options,
+    int *errors);
 int xmodem_recv(GenericDevice *src, GenericDevice *dst, XmodemOptions *options, int *errors);
 
 /* Synchronization Characters */
 #define XMODEM_SOH (0x01)
 #define XMODEM_STX (0x02)
+#define XMODEM_XTX (0x03)
 #define XMODEM_EOT (0x04)
 #define XMODEM_ACK (0x06)
 #define XMODEM_NAK (0x15)
@@ -43,5 +142,12 @@ int xmodem_recv(GenericDevice *src, GenericDevice *dst, XmodemOptions *options,
 #define XMODEM_CTZ (0x1A)
 #define XMODEM_NUL (0x00)
 #define XMODEM_CCC (0x43)
+#define XMODEM_DDD (0x44)
+#define XMODEM_FFF (0x46)
+#define XMODEM_GGG (0x47)
+#define XMODEM_RRR (0x52)
+#define XMODEM_WWW (0x57)
+#define XMODEM_XXX (0x58)
+#define XMODEM_ZZZ (0x5A)
 
 #endif
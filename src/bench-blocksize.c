@@ -0,0 +1,110 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "session.h"
+#include "policy.h"
+#include "simline.h"
+
+/*
+ * goodput of fixed 128-byte blocks, fixed 1 KiB blocks and the adaptive block size policy over a simulated serial
+ * line (simline.h) that corrupts bytes at a given rate, a flipped bit per corrupted byte as near as makes no
+ * difference. every run is deterministic and takes no real time. every received file is compared too
+ */
+
+/*
+ * @brief one transfer over the simulated line
+ * @return simulated seconds, or a negative value if the transfer failed or the copy differs
+ */
+static double run(SimFile *transfer, XmodemOptions const *options, SimLineModel const *model, uint64_t seed,
+    unsigned int *retries) {
+    XmodemSession sender, receiver;
+    memset(transfer->copy, 0, transfer->file_size);
+
+    XmodemBlocks source = { .context = transfer, .get_data = sim_get_data };
+    XmodemBlocks sink = { .context = transfer, .put_block = sim_put_block };
+    if (xmodem_session_start_send(&sender, options, &source, transfer->file_size, 0) != 0) { return -1; }
+    if (xmodem_session_start_recv(&receiver, options, &sink, 0) != 0) {
+        xmodem_session_end(&sender);
+        return -1;
+    }
+    uint64_t us = sim_run(&sender, &receiver, model, seed, NULL);
+
+    int good = (xmodem_session_status(&sender) == XMODEM_SESSION_DONE) &&
+        (memcmp(transfer->file, transfer->copy, transfer->file_size) == 0);
+    *retries = sender.total_retries;
+    xmodem_session_end(&sender);
+    xmodem_session_end(&receiver);
+    return good ? us * 1e-6 : -1;
+}
+
+int main(int argc, char **argv) {
+    uint32_t file_size = 256 * 1024;
+    unsigned int window = 0;
+    SimLineModel model = { 11520, 2000, 0, 0 }; /* 115200 baud, 2 ms each way */
+    static const double error_rates[] = { 0, 1e-5, 1e-4, 3e-4, 1e-3, 2e-3, 4e-3 };
+
+    for (int i = 0; i < argc; ++i) {
+        if (strcmp(argv[i], "-size") == 0) {
+            file_size = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-window") == 0) {
+            window = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-rate") == 0) {
+            model.bytes_per_second = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-latency") == 0) {
+            model.latency_us = atoi(argv[++i]);
+        }
+    }
+
+    SimFile transfer;
+    uint8_t *file = malloc(file_size);
+    transfer.copy = malloc(file_size);
+    if ((file == NULL) || (transfer.copy == NULL)) { return 1; }
+    uint32_t seed = 12345;
+    for (unsigned int i = 0; i < file_size; ++i) {
+        seed = seed * 1103515245 + 12345;
+        file[i] = seed >> 24;
+    }
+    transfer.file = file;
+    transfer.file_size = file_size;
+
+    XmodemOptions options;
+    memset(&options, 0, sizeof (options));
+    options.crc_checksum = CHECKSUM_OPTION_CRC;
+    options.timeout_ms = 1000;
+    options.min_timeout_ms = 20;
+    options.max_timeout_ms = 10000;
+    options.max_retries = 1000;
+    options.max_retransmissions = 1000;
+    options.window = window;
+
+    static char const *names[] = { "128", "1k", "adaptive" };
+    printf("%u bytes at %u B/s, window %u. goodput as a fraction of the line rate (retries)\n",
+        file_size, model.bytes_per_second, window);
+    printf("%-10s", "errors/B");
+    for (int mode = 0; mode < 3; ++mode) { printf(" %18s", names[mode]); }
+    printf("\n");
+
+    int failures = 0;
+    for (unsigned int e = 0; e < sizeof (error_rates) / sizeof (error_rates[0]); ++e) {
+        printf("%-10g", error_rates[e]);
+        for (int mode = 0; mode < 3; ++mode) {
+            options.packet_size_code = (mode == 0) ? XMODEM_SOH : XMODEM_STX;
+            options.block_policy = (mode == 2) ? &xmodem_default_block_policy : NULL;
+            model.bit_error_rate = error_rates[e] / 8;
+            unsigned int retries = 0;
+            double seconds = run(&transfer, &options, &model, 0x9e3779b9 + e, &retries); /* every mode, one line */
+            if (seconds < 0) {
+                printf(" %18s", "failed");
+                ++failures;
+            } else {
+                printf(" %11.3f (%4u)", file_size / seconds / model.bytes_per_second, retries);
+            }
+        }
+        printf("\n");
+    }
+
+    free(file);
+    free(transfer.copy);
+    return failures ? 1 : 0;
+}
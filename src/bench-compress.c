@@ -0,0 +1,214 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "session.h"
+#include "packer.h"
+#include "lz.h"
+#include "simline.h"
+
+/*
+ * a file of text, a sparse image and random bytes over a simulated serial line, with and without packed blocks.
+ * sender and receiver sessions run on simline.h's simulated clock, so the times are the line's, while the
+ * packer runs on its thread in real time ahead of the sender. every copy is compared. then the codec itself: how
+ * fast it packs and unpacks each kind of data on one thread
+ */
+
+typedef struct {
+    SimFile sim;
+    Packer packer;
+} Transfer;
+
+static double now_seconds(void) {
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec + spec.tv_nsec * 1e-9;
+}
+
+static uint8_t const *bench_get_packed(void *context, uint32_t offset, unsigned int n, unsigned int *length) {
+    Transfer *transfer = (Transfer *) context;
+    return packer_get(&transfer->packer, offset, n, length);
+}
+
+static void bench_release_data(void *context, uint32_t offset) {
+    Transfer *transfer = (Transfer *) context;
+    packer_release(&transfer->packer, offset);
+}
+
+/*
+ * @brief one transfer of the file over the simulated line
+ * @return simulated seconds, or a negative value if the transfer failed or the copy differs. stats = the sender's
+ */
+static double run(Transfer *transfer, XmodemOptions const *options, SimLineModel const *model,
+    XmodemSessionStats *stats) {
+    XmodemSession sender, receiver;
+    memset(transfer->sim.copy, 0, transfer->sim.file_size);
+    if (packer_start(&transfer->packer, sim_get_data, &transfer->sim, transfer->sim.file_size,
+        XMODEM_EXTENDED_MAX_BLOCK, options->window + 8) != 0) {
+        return -1;
+    }
+
+    XmodemBlocks source = { .context = transfer, .get_data = sim_get_data, .release_data = bench_release_data,
+        .gather = 1 };
+    XmodemBlocks sink = { .context = transfer, .put_block = sim_put_block };
+    source.get_packed = bench_get_packed;
+    int started = (xmodem_session_start_send(&sender, options, &source, transfer->sim.file_size, 0) == 0) ? 1 : 0;
+    if (started && (xmodem_session_start_recv(&receiver, options, &sink, 0) != 0)) {
+        xmodem_session_end(&sender);
+        started = 0;
+    }
+    if (started == 0) {
+        packer_stop(&transfer->packer);
+        return -1;
+    }
+
+    uint64_t us = sim_run(&sender, &receiver, model, 1, NULL);
+
+    int good = (xmodem_session_status(&sender) == XMODEM_SESSION_DONE) &&
+        (xmodem_session_status(&receiver) == XMODEM_SESSION_DONE) &&
+        (memcmp(transfer->sim.file, transfer->sim.copy, transfer->sim.file_size) == 0);
+    xmodem_session_stats(&sender, stats);
+    xmodem_session_end(&sender);
+    xmodem_session_end(&receiver);
+    packer_stop(&transfer->packer);
+    return good ? us * 1e-6 : -1;
+}
+
+/* @brief words of a small vocabulary, with line breaks, like a log or a config dump */
+static void make_text(uint8_t *b, uint32_t n, uint32_t seed) {
+    static char const *words[] = {
+        "the", "block", "sender", "receiver", "timeout", "packet", "error", "status", "ok", "retry", "window",
+        "offset", "0x1a2b", "config", "value", "=", "true", "false", "level", "debug", "info", "warning",
+    };
+    uint32_t i = 0;
+    while (i < n) {
+        seed = seed * 1103515245 + 12345;
+        char const *word = words[(seed >> 16) % (sizeof (words) / sizeof (words[0]))];
+        for (char const *c = word; *c && (i < n); ++c) { b[i++] = *c; }
+        if (i < n) { b[i++] = ((seed >> 8) % 9) ? ' ' : '\n'; }
+    }
+}
+
+/* @brief mostly zeros, with a run of random bytes here and there, like a firmware image with empty sections */
+static void make_sparse(uint8_t *b, uint32_t n, uint32_t seed) {
+    memset(b, 0, n);
+    for (uint32_t i = 0; i < n; i += 1024) {
+        seed = seed * 1103515245 + 12345;
+        if ((seed >> 16) % 4) { continue; }
+        for (uint32_t k = i; (k < i + 512) && (k < n); ++k) {
+            seed = seed * 1103515245 + 12345;
+            b[k] = seed >> 24;
+        }
+    }
+}
+
+static void make_random(uint8_t *b, uint32_t n, uint32_t seed) {
+    for (uint32_t i = 0; i < n; ++i) {
+        seed = seed * 1103515245 + 12345;
+        b[i] = seed >> 24;
+    }
+}
+
+/* @brief bytes per second lz_compress() and lz_decompress() get through b in blocks of block_size */
+static void codec_rates(uint8_t const *b, uint32_t n, unsigned int block_size, double *pack, double *unpack) {
+    static uint8_t packed[XMODEM_EXTENDED_MAX_BLOCK], unpacked[XMODEM_EXTENDED_MAX_BLOCK];
+    double best_pack = 0, best_unpack = 0;
+    for (int r = 0; r < 3; ++r) {
+        double pack_seconds = 0, unpack_seconds = 0;
+        for (uint32_t offset = 0; offset < n; offset += block_size) {
+            unsigned int length = (n - offset < block_size) ? n - offset : block_size;
+            double start = now_seconds();
+            unsigned int size = lz_compress(&b[offset], length, packed, sizeof (packed));
+            double middle = now_seconds();
+            lz_decompress(packed, size, unpacked, sizeof (unpacked));
+            pack_seconds += middle - start;
+            unpack_seconds += now_seconds() - middle;
+        }
+        if ((best_pack == 0) || (pack_seconds < best_pack)) { best_pack = pack_seconds; }
+        if ((best_unpack == 0) || (unpack_seconds < best_unpack)) { best_unpack = unpack_seconds; }
+    }
+    *pack = n / best_pack;
+    *unpack = n / best_unpack;
+}
+
+int main(int argc, char **argv) {
+    uint32_t file_size = 1024 * 1024;
+    SimLineModel model = { 11520, 2000, 0, 0 }; /* 115200 baud, 2 ms each way */
+
+    for (int i = 0; i < argc; ++i) {
+        if (strcmp(argv[i], "-size") == 0) {
+            file_size = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-rate") == 0) {
+            model.bytes_per_second = atoi(argv[++i]);
+        }
+    }
+
+    uint8_t *file = malloc(file_size);
+    Transfer transfer;
+    memset(&transfer, 0, sizeof (transfer));
+    transfer.sim.copy = malloc(file_size);
+    if ((file == NULL) || (transfer.sim.copy == NULL)) { return 1; }
+    transfer.sim.file = file;
+    transfer.sim.file_size = file_size;
+
+    XmodemOptions options;
+    memset(&options, 0, sizeof (options));
+    options.crc_checksum = CHECKSUM_OPTION_CRC;
+    options.packet_size_code = XMODEM_STX;
+    options.timeout_ms = 1000;
+    options.min_timeout_ms = 20;
+    options.max_timeout_ms = 10000;
+    options.max_retries = 100;
+    options.max_retransmissions = 100;
+    options.extended = 1;
+    options.window = 8;
+
+    typedef struct {
+        char const *name;
+        void (*make)(uint8_t *b, uint32_t n, uint32_t seed);
+    } Kind;
+    static const Kind kinds[] = { { "text", make_text }, { "sparse", make_sparse }, { "random", make_random } };
+    static const unsigned int block_sizes[] = { 4096, 16384 };
+
+    printf("%u bytes at %u B/s, extended blocks, window %u. effective = file bytes per second\n", file_size,
+        model.bytes_per_second, options.window);
+    printf("%-8s %6s %6s %10s %12s %8s %8s\n", "data", "block", "packed", "seconds", "effective", "ratio",
+        "speedup");
+
+    int failures = 0;
+    for (unsigned int k = 0; k < sizeof (kinds) / sizeof (kinds[0]); ++k) {
+        kinds[k].make(file, file_size, 12345);
+        for (unsigned int s = 0; s < sizeof (block_sizes) / sizeof (block_sizes[0]); ++s) {
+            options.extended_block_size = block_sizes[s];
+            double raw = 0;
+            for (unsigned int compress = 0; compress < 2; ++compress) {
+                XmodemSessionStats stats;
+                options.compress = compress;
+                double seconds = run(&transfer, &options, &model, &stats);
+                if (seconds < 0) {
+                    printf("%-8s %6u %6u %10s\n", kinds[k].name, block_sizes[s], compress, "failed");
+                    ++failures;
+                    continue;
+                }
+                if (compress == 0) { raw = seconds; }
+                printf("%-8s %6u %6u %10.2f %12.0f %8.2f %7.1fx\n", kinds[k].name, block_sizes[s], compress,
+                    seconds, file_size / seconds, stats.wire_bytes ? (double) stats.data_bytes / stats.wire_bytes : 0,
+                    raw ? raw / seconds : 0);
+            }
+        }
+    }
+
+    /* the codec on its own: it has to outrun the line by far to stay out of the way */
+    printf("\ncodec, 16 KiB blocks, MB/s\n%-8s %10s %10s\n", "data", "pack", "unpack");
+    for (unsigned int k = 0; k < sizeof (kinds) / sizeof (kinds[0]); ++k) {
+        double pack, unpack;
+        kinds[k].make(file, file_size, 12345);
+        codec_rates(file, file_size, 16384, &pack, &unpack);
+        printf("%-8s %10.1f %10.1f\n", kinds[k].name, pack * 1e-6, unpack * 1e-6);
+    }
+
+    free(file);
+    free(transfer.sim.copy);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,146 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "crc.h"
+
+/*
+ * measures each crc16 and crc-32c engine in GB/s, over 1 KiB xmodem payloads and over one large buffer.
+ * every engine is checked against the bitwise reference first
+ */
+
+static double now_seconds(void) {
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec + spec.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv) {
+    unsigned int buffer_size = 16 * 1024 * 1024;
+    unsigned int chunk_size = 1024;
+    double min_seconds = 0.5;
+
+    for (int i = 0; i < argc; ++i) {
+        if (strcmp(argv[i], "-size") == 0) {
+            buffer_size = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-chunk") == 0) {
+            chunk_size = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-time") == 0) {
+            min_seconds = atof(argv[++i]);
+        }
+    }
+
+    if ((chunk_size == 0) || (buffer_size < chunk_size)) {
+        printf("chunk size must be nonzero and no larger than buffer size\n");
+        return 1;
+    }
+
+    uint8_t *buffer = malloc(buffer_size);
+    if (buffer == NULL) { return 1; }
+    uint32_t seed = 12345;
+    for (unsigned int i = 0; i < buffer_size; ++i) {
+        seed = seed * 1103515245 + 12345;
+        buffer[i] = seed >> 24;
+    }
+
+    /* odd lengths and offsets exercise every tail path */
+    int failures = 0;
+    for (int engine = CRC16_ENGINE_BITWISE; engine < CRC16_ENGINES; ++engine) {
+        if (crc16_engine_supported(engine) == 0) { continue; }
+        for (unsigned int n = 0; n < 300; ++n) {
+            uint16_t expected = crc16_update_engine(CRC16_ENGINE_BITWISE, 0x1d0f, &buffer[n & 7], n);
+            uint16_t actual = crc16_update_engine(engine, 0x1d0f, &buffer[n & 7], n);
+            if (actual != expected) {
+                printf("%s: mismatch at n = %u: %4.4x != %4.4x\n", crc16_engine_name(engine), n, actual, expected);
+                ++failures;
+                break;
+            }
+        }
+    }
+    uint8_t const check[] = "123456789";
+    if (crc16(check, 9) != 0x31c3) { /* CRC-16/XMODEM check value */
+        printf("check value mismatch: %4.4x\n", crc16(check, 9));
+        ++failures;
+    }
+    for (int engine = CRC32C_ENGINE_BITWISE; engine < CRC32C_ENGINES; ++engine) {
+        if (crc32c_engine_supported(engine) == 0) { continue; }
+        for (unsigned int n = 0; n < 7000; n += (n < 300) ? 1 : 97) { /* past 3 KiB for the interleaved lanes */
+            uint32_t expected = crc32c_update_engine(CRC32C_ENGINE_BITWISE, 0x1d0f, &buffer[n & 7], n);
+            uint32_t actual = crc32c_update_engine(engine, 0x1d0f, &buffer[n & 7], n);
+            if (actual != expected) {
+                printf("%s: mismatch at n = %u: %8.8x != %8.8x\n", crc32c_engine_name(engine), n, actual, expected);
+                ++failures;
+                break;
+            }
+        }
+    }
+    if (crc32c(check, 9) != 0xe3069283) { /* CRC-32C check value */
+        printf("crc-32c check value mismatch: %8.8x\n", crc32c(check, 9));
+        ++failures;
+    }
+    if (failures) { return 1; }
+
+    printf("%-8s %14s %14s\n", "engine", "1 chunk GB/s", "bulk GB/s");
+    for (int engine = CRC16_ENGINE_BITWISE; engine < CRC16_ENGINES; ++engine) {
+        if (crc16_engine_supported(engine) == 0) {
+            printf("%-8s %14s %14s\n", crc16_engine_name(engine), "n/a", "n/a");
+            continue;
+        }
+
+        double rate[2];
+        volatile uint16_t sink = 0;
+        for (int bulk = 0; bulk < 2; ++bulk) {
+            uint64_t bytes = 0;
+            double start = now_seconds(), elapsed;
+            do {
+                if (bulk) {
+                    sink ^= crc16_update_engine(engine, 0, buffer, buffer_size);
+                } else {
+                    for (unsigned int off = 0; off + chunk_size <= buffer_size; off += chunk_size) {
+                        sink ^= crc16_update_engine(engine, 0, &buffer[off], chunk_size);
+                    }
+                }
+                bytes += buffer_size - (bulk ? 0 : buffer_size % chunk_size);
+                elapsed = now_seconds() - start;
+            } while (elapsed < min_seconds);
+            rate[bulk] = bytes / elapsed * 1e-9;
+        }
+        printf("%-8s %14.3f %14.3f\n", crc16_engine_name(engine), rate[0], rate[1]);
+    }
+
+    printf("auto engine: %s\n", crc16_engine_name(crc16_engine()));
+
+    printf("%-8s %14s %14s\n", "crc-32c", "1 chunk GB/s", "bulk GB/s");
+    for (int engine = CRC32C_ENGINE_BITWISE; engine < CRC32C_ENGINES; ++engine) {
+        if (crc32c_engine_supported(engine) == 0) {
+            printf("%-8s %14s %14s\n", crc32c_engine_name(engine), "n/a", "n/a");
+            continue;
+        }
+
+        double rate[2];
+        volatile uint32_t sink = 0;
+        for (int bulk = 0; bulk < 2; ++bulk) {
+            uint64_t bytes = 0;
+            double start = now_seconds(), elapsed;
+            do {
+                if (bulk) {
+                    sink ^= crc32c_update_engine(engine, 0, buffer, buffer_size);
+                } else {
+                    for (unsigned int off = 0; off + chunk_size <= buffer_size; off += chunk_size) {
+                        sink ^= crc32c_update_engine(engine, 0, &buffer[off], chunk_size);
+                    }
+                }
+                bytes += buffer_size - (bulk ? 0 : buffer_size % chunk_size);
+                elapsed = now_seconds() - start;
+            } while (elapsed < min_seconds);
+            rate[bulk] = bytes / elapsed * 1e-9;
+        }
+        printf("%-8s %14.3f %14.3f\n", crc32c_engine_name(engine), rate[0], rate[1]);
+    }
+
+    printf("auto engine: %s\n", crc32c_engine_name(crc32c_engine()));
+
+    free(buffer);
+    return 0;
+}
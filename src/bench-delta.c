@@ -0,0 +1,219 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "session.h"
+#include "blockhash.h"
+#include "simline.h"
+
+/*
+ * a receiver that holds last week's image of a file gets this week's, with a small part of it changed, over a
+ * simulated serial line: all of it, or only the blocks the hashes say differ. sender and receiver sessions run on
+ * simline.h's simulated clock, so the times are the line's. every patched copy is compared. then the
+ * hashing itself: how fast each engine gets through a large image on one thread and on many
+ */
+
+typedef struct {
+    SimFile sim; /* its copy starts out as old, and ends up as file */
+    uint8_t const *old;
+    uint32_t old_size;
+    uint32_t copy_size;
+    BlockHash *hashes;
+    XmodemSignature signature;
+} Transfer;
+
+static double now_seconds(void) {
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec + spec.tv_nsec * 1e-9;
+}
+
+static XmodemSignature const *bench_signature(void *context, unsigned int block_size) {
+    Transfer *transfer = (Transfer *) context;
+    uint32_t n_blocks = (transfer->copy_size + block_size - 1) / block_size;
+    free(transfer->hashes);
+    transfer->hashes = malloc((n_blocks ? n_blocks : 1) * sizeof (BlockHash));
+    if (transfer->hashes == NULL) { return NULL; }
+    block_hash_blocks(transfer->sim.copy, transfer->copy_size, block_size, transfer->hashes, 0);
+    transfer->signature.size = transfer->copy_size;
+    transfer->signature.block_size = block_size;
+    transfer->signature.n_blocks = n_blocks;
+    transfer->signature.hashes = transfer->hashes;
+    return &transfer->signature;
+}
+
+static int bench_patch(void *context, uint32_t size, uint32_t const *blocks, uint32_t n_blocks) {
+    Transfer *transfer = (Transfer *) context;
+    (void) n_blocks;
+    transfer->copy_size = blocks ? size : 0;
+    return 0;
+}
+
+static int bench_delta(void *context, XmodemSignature const *signature, uint32_t *blocks) {
+    Transfer *transfer = (Transfer *) context;
+    uint32_t n_blocks = (transfer->sim.file_size + signature->block_size - 1) / signature->block_size;
+    BlockHash *hashes = malloc((n_blocks ? n_blocks : 1) * sizeof (BlockHash));
+    if (hashes == NULL) { return -1; }
+    block_hash_blocks(transfer->sim.file, transfer->sim.file_size, signature->block_size, hashes, 0);
+    int n = xmodem_delta_blocks(signature, hashes, transfer->sim.file_size, blocks);
+    free(hashes);
+    return n;
+}
+
+/*
+ * @brief one transfer of file to a receiver that holds old, over the simulated line
+ * @return simulated seconds, or a negative value if the transfer failed or the copy differs. bytes = both ways
+ */
+static double run(Transfer *transfer, XmodemOptions const *options, SimLineModel const *model, uint64_t *bytes) {
+    XmodemSession sender, receiver;
+    memcpy(transfer->sim.copy, transfer->old, transfer->old_size);
+    transfer->copy_size = transfer->old_size;
+
+    XmodemBlocks source = { .context = transfer, .get_data = sim_get_data };
+    XmodemBlocks sink = { .context = transfer, .put_block = sim_put_block };
+    source.delta = bench_delta;
+    sink.signature = bench_signature;
+    sink.patch = bench_patch;
+    if (xmodem_session_start_send(&sender, options, &source, transfer->sim.file_size, 0) != 0) { return -1; }
+    if (xmodem_session_start_recv(&receiver, options, &sink, 0) != 0) {
+        xmodem_session_end(&sender);
+        return -1;
+    }
+    uint64_t us = sim_run(&sender, &receiver, model, 1, bytes);
+
+    /* a full transfer leaves the copy padded to a whole block. the sink would cut it to size */
+    int good = (xmodem_session_status(&sender) == XMODEM_SESSION_DONE) &&
+        (memcmp(transfer->sim.file, transfer->sim.copy, transfer->sim.file_size) == 0) &&
+        ((receiver.delta == 0) || (transfer->copy_size == transfer->sim.file_size));
+    xmodem_session_end(&sender);
+    xmodem_session_end(&receiver);
+    free(transfer->hashes);
+    transfer->hashes = NULL;
+    return good ? us * 1e-6 : -1;
+}
+
+/* @brief bytes per second block_hash_blocks() gets through n bytes */
+static double hash_rate(uint8_t const *b, uint32_t n, unsigned int block_size, unsigned int threads,
+    BlockHash *hashes) {
+    double best = 0;
+    for (int r = 0; r < 3; ++r) {
+        double start = now_seconds();
+        block_hash_blocks(b, n, block_size, hashes, threads);
+        double seconds = now_seconds() - start;
+        if ((best == 0) || (seconds < best)) { best = seconds; }
+    }
+    return n / best;
+}
+
+int main(int argc, char **argv) {
+    uint32_t file_size = 1024 * 1024;
+    uint32_t hash_size = 256 * 1024 * 1024;
+    double changed = 0.01;
+    SimLineModel model = { 11520, 2000, 0, 0 }; /* 115200 baud, 2 ms each way */
+
+    for (int i = 0; i < argc; ++i) {
+        if (strcmp(argv[i], "-size") == 0) {
+            file_size = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-changed") == 0) {
+            changed = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-hash-size") == 0) {
+            hash_size = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-rate") == 0) {
+            model.bytes_per_second = atoi(argv[++i]);
+        }
+    }
+
+    uint8_t *old = malloc(file_size);
+    uint8_t *file = malloc(file_size);
+    Transfer transfer;
+    memset(&transfer, 0, sizeof (transfer));
+    transfer.sim.copy = malloc(file_size + XMODEM_DELTA_MAX_BLOCK); /* room for the padding of a full transfer */
+    if ((old == NULL) || (file == NULL) || (transfer.sim.copy == NULL)) { return 1; }
+    uint32_t seed = 12345;
+    for (unsigned int i = 0; i < file_size; ++i) {
+        seed = seed * 1103515245 + 12345;
+        old[i] = seed >> 24;
+    }
+    transfer.old = old;
+    transfer.old_size = file_size;
+    transfer.sim.file = file;
+    transfer.sim.file_size = file_size;
+
+    XmodemOptions options;
+    memset(&options, 0, sizeof (options));
+    options.crc_checksum = CHECKSUM_OPTION_CRC;
+    options.packet_size_code = XMODEM_STX;
+    options.timeout_ms = 1000;
+    options.min_timeout_ms = 20;
+    options.max_timeout_ms = 10000;
+    options.max_retries = 100;
+    options.max_retransmissions = 100;
+
+    /* the same number of bytes changed: in runs of 64 bytes all over the image, or in one run in the middle */
+    static char const *layouts[] = { "scattered", "contiguous" };
+    static const unsigned int delta_sizes[] = { 0, 1024, 4096, 16384 }; /* 0 = send it all */
+    const uint32_t n_changed = file_size * changed;
+    printf("%u bytes at %u B/s, %u of them changed. seconds, bytes on the line both ways\n", file_size,
+        model.bytes_per_second, n_changed);
+    printf("%-12s %8s %10s %12s %8s\n", "layout", "delta", "seconds", "bytes", "speedup");
+
+    int failures = 0;
+    for (int layout = 0; layout < 2; ++layout) {
+        memcpy(file, old, file_size);
+        if (layout == 0) {
+            for (uint32_t done = 0; done < n_changed; done += 64) {
+                seed = seed * 1103515245 + 12345;
+                uint32_t offset = (seed >> 8) % (file_size - 64);
+                for (int k = 0; k < 64; ++k) { file[offset + k] ^= 0x5a; }
+            }
+        } else {
+            for (uint32_t k = 0; k < n_changed; ++k) { file[(file_size - n_changed) / 2 + k] ^= 0x5a; }
+        }
+        double full = 0;
+        for (unsigned int d = 0; d < sizeof (delta_sizes) / sizeof (delta_sizes[0]); ++d) {
+            options.delta = delta_sizes[d];
+            uint64_t bytes = 0;
+            double seconds = run(&transfer, &options, &model, &bytes);
+            if (seconds < 0) {
+                printf("%-12s %8u %10s\n", layouts[layout], delta_sizes[d], "failed");
+                ++failures;
+                continue;
+            }
+            if (d == 0) { full = seconds; }
+            printf("%-12s %8u %10.2f %12llu %7.1fx\n", layouts[layout], delta_sizes[d], seconds,
+                (unsigned long long) bytes, full / seconds);
+        }
+    }
+
+    /* hashing: one pass over a large image, per engine, on more and more threads */
+    uint8_t *image = malloc(hash_size);
+    BlockHash *hashes = malloc((hash_size / XMODEM_DELTA_MIN_BLOCK + 1) * sizeof (BlockHash));
+    if ((image == NULL) || (hashes == NULL)) { return 1; }
+    for (uint32_t i = 0; i < hash_size; ++i) { image[i] = i * 2654435761u >> 24; }
+    static const unsigned int threads[] = { 1, 2, 4, 8, 0 };
+    printf("\nhashing %u bytes in 4 KiB blocks, GB/s\n%-8s", hash_size, "engine");
+    for (unsigned int t = 0; t < sizeof (threads) / sizeof (threads[0]); ++t) {
+        if (threads[t]) {
+            printf(" %8u", threads[t]);
+        } else {
+            printf(" %8s", "all cpus");
+        }
+    }
+    printf("\n");
+    for (int engine = BLOCK_HASH_ENGINE_SCALAR; engine < BLOCK_HASH_ENGINES; ++engine) {
+        if (block_hash_select_engine(engine) != 0) { continue; }
+        printf("%-8s", block_hash_engine_name(engine));
+        for (unsigned int t = 0; t < sizeof (threads) / sizeof (threads[0]); ++t) {
+            printf(" %8.2f", hash_rate(image, hash_size, 4096, threads[t], hashes) * 1e-9);
+        }
+        printf("\n");
+    }
+
+    free(image);
+    free(hashes);
+    free(old);
+    free(file);
+    free(transfer.sim.copy);
+    return failures ? 1 : 0;
+}
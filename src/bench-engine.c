@@ -0,0 +1,135 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "engine.h"
+
+/*
+ * measures packet framing (build) and checking (verify) in MB/s of payload, for each block size and check kind,
+ * with the engine specialised at compile time against the generic one. both are checked to agree first
+ */
+
+static double now_seconds(void) {
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec + spec.tv_nsec * 1e-9;
+}
+
+static unsigned int const block_sizes[] = { XMODEM_BUFF_SIZE, XMODEM_1K_BUFF_SIZE };
+static unsigned int const kinds[] = { CHECKSUM_OPTION_SUM, CHECKSUM_OPTION_CRC };
+
+#define BENCH_TRIALS (7)
+
+/* @return MB/s of payload framed (verify = 0) or checked (verify = 1), best of BENCH_TRIALS to ride out noise */
+static double measure(XmodemEngine const *engine, uint8_t const *buffer, unsigned int buffer_size,
+    unsigned int gather, unsigned int verify, double min_seconds) {
+    const unsigned int block_size = engine->block_size;
+    const unsigned int n_blocks = buffer_size / block_size;
+    XmodemPacket packet;
+    volatile unsigned int sink = 0;
+    double best = 0;
+
+    /* packets to verify, framed once up front */
+    uint8_t *frames = NULL;
+    const unsigned int frame_size = 3 + block_size + ((engine->kind == CHECKSUM_OPTION_CRC) ? 2 : 1);
+    if (verify) {
+        frames = malloc((size_t) n_blocks * frame_size);
+        for (unsigned int i = 0; i < n_blocks; ++i) {
+            engine->build(engine, &packet, &buffer[i * block_size], block_size, i + 1, 0);
+            memcpy(&frames[(size_t) i * frame_size], packet.frame, frame_size);
+        }
+    }
+
+    for (int trial = 0; trial < BENCH_TRIALS; ++trial) {
+        uint64_t bytes = 0;
+        double start = now_seconds(), elapsed;
+        do {
+            for (unsigned int i = 0; i < n_blocks; ++i) {
+                if (verify) {
+                    sink += engine->verify(engine, &frames[(size_t) i * frame_size]);
+                } else {
+                    engine->build(engine, &packet, &buffer[i * block_size], block_size, i + 1, gather);
+                    sink += packet.frame[3 + block_size];
+                }
+            }
+            bytes += (uint64_t) n_blocks * block_size;
+            elapsed = now_seconds() - start;
+        } while (elapsed < min_seconds / BENCH_TRIALS);
+        if (bytes / elapsed * 1e-6 > best) { best = bytes / elapsed * 1e-6; }
+    }
+
+    free(frames);
+    return best;
+}
+
+int main(int argc, char **argv) {
+    unsigned int buffer_size = 1024 * 1024;
+    double min_seconds = 0.7;
+
+    for (int i = 0; i < argc; ++i) {
+        if (strcmp(argv[i], "-size") == 0) {
+            buffer_size = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-time") == 0) {
+            min_seconds = atof(argv[++i]);
+        }
+    }
+
+    if (buffer_size < XMODEM_1K_BUFF_SIZE) {
+        printf("buffer size must be at least %u\n", XMODEM_1K_BUFF_SIZE);
+        return 1;
+    }
+
+    uint8_t *buffer = malloc(buffer_size);
+    if (buffer == NULL) { return 1; }
+    uint32_t seed = 12345;
+    for (unsigned int i = 0; i < buffer_size; ++i) {
+        seed = seed * 1103515245 + 12345;
+        buffer[i] = seed >> 24;
+    }
+
+    /* every length, including the padded short last block, must frame identically */
+    int failures = 0;
+    for (unsigned int s = 0; s < 2; ++s) {
+        for (unsigned int k = 0; k < 2; ++k) {
+            XmodemEngine const *fast = xmodem_engine(block_sizes[s], kinds[k]);
+            XmodemEngine const *generic = xmodem_engine_generic(block_sizes[s], kinds[k]);
+            const unsigned int frame_size = 3 + block_sizes[s] + ((kinds[k] == CHECKSUM_OPTION_CRC) ? 2 : 1);
+            for (unsigned int length = 1; length <= block_sizes[s]; ++length) {
+                XmodemPacket a, b;
+                fast->build(fast, &a, &buffer[length & 7], length, length, 0);
+                generic->build(generic, &b, &buffer[length & 7], length, length, 0);
+                if ((memcmp(a.frame, b.frame, frame_size) != 0) || (fast->verify(fast, a.frame) != 1)) {
+                    printf("%s: mismatch at length %u\n", fast->name, length);
+                    ++failures;
+                    break;
+                }
+                a.frame[3 + (length % block_sizes[s])] ^= 0x01;
+                if (fast->verify(fast, a.frame) != 0) {
+                    printf("%s: damaged packet passed at length %u\n", fast->name, length);
+                    ++failures;
+                    break;
+                }
+            }
+        }
+    }
+    if (failures) { return 1; }
+
+    printf("%-8s %-12s %14s %14s %14s\n", "engine", "", "build MB/s", "gather MB/s", "verify MB/s");
+    for (unsigned int s = 0; s < 2; ++s) {
+        for (unsigned int k = 0; k < 2; ++k) {
+            XmodemEngine const *engines[2] = {
+                xmodem_engine_generic(block_sizes[s], kinds[k]), xmodem_engine(block_sizes[s], kinds[k])
+            };
+            for (int e = 0; e < 2; ++e) {
+                printf("%-8s %-12s %14.1f %14.1f %14.1f\n", engines[e]->name, e ? "specialised" : "generic",
+                    measure(engines[e], buffer, buffer_size, 0, 0, min_seconds),
+                    measure(engines[e], buffer, buffer_size, 1, 0, min_seconds),
+                    measure(engines[e], buffer, buffer_size, 0, 1, min_seconds));
+            }
+        }
+    }
+
+    free(buffer);
+    return 0;
+}
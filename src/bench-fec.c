@@ -0,0 +1,198 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "session.h"
+#include "fec.h"
+#include "simline.h"
+
+/*
+ * a file over a simulated radio link that flips bits at random, at several bit error rates, without parity blocks
+ * and with a few group and parity sizes. sender and receiver sessions run on simline.h's simulated clock, so the
+ * times are the line's. errors hit both directions. every copy is compared. then the parity arithmetic itself:
+ * how fast each engine multiplies a block into a parity block, and what a group costs to encode and rebuild
+ */
+
+static double now_seconds(void) {
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec + spec.tv_nsec * 1e-9;
+}
+
+/*
+ * @brief one transfer of the file over the simulated line
+ * @return simulated seconds, or a negative value if the transfer failed or the copy differs. stats = the sender's,
+ *     repaired the receiver's
+ */
+static double run(SimFile *transfer, XmodemOptions const *options, SimLineModel const *model, uint64_t seed,
+    XmodemSessionStats *stats, unsigned int *repaired) {
+    XmodemSession sender, receiver;
+    XmodemSessionStats receiver_stats;
+    memset(transfer->copy, 0, transfer->file_size);
+
+    XmodemBlocks source = { .context = transfer, .get_data = sim_get_data, .gather = 1 };
+    XmodemBlocks sink = { .context = transfer, .put_block = sim_put_block };
+    if (xmodem_session_start_send(&sender, options, &source, transfer->file_size, 0) != 0) { return -1; }
+    if (xmodem_session_start_recv(&receiver, options, &sink, 0) != 0) {
+        xmodem_session_end(&sender);
+        return -1;
+    }
+    uint64_t us = sim_run(&sender, &receiver, model, seed, NULL);
+
+    int good = (xmodem_session_status(&sender) == XMODEM_SESSION_DONE) &&
+        (xmodem_session_status(&receiver) == XMODEM_SESSION_DONE) &&
+        (memcmp(transfer->file, transfer->copy, transfer->file_size) == 0);
+    xmodem_session_stats(&sender, stats);
+    xmodem_session_stats(&receiver, &receiver_stats);
+    *repaired = receiver_stats.repaired;
+    xmodem_session_end(&sender);
+    xmodem_session_end(&receiver);
+    return good ? us * 1e-6 : -1;
+}
+
+/* @brief bytes per second fec_engine_mul_add() gets through n bytes with a coefficient other than 0 and 1 */
+static double engine_rate(int engine, uint8_t *dst, uint8_t const *src, unsigned int n) {
+    double best = 0;
+    for (int r = 0; r < 5; ++r) {
+        double start = now_seconds();
+        for (int k = 0; k < 16; ++k) { fec_engine_mul_add(engine, dst, src, 0x53 + k, n); }
+        double seconds = now_seconds() - start;
+        if ((best == 0) || (seconds < best)) { best = seconds; }
+    }
+    return 16.0 * n / best;
+}
+
+/* @brief bytes of data per second through encoding a group of k blocks into m parity blocks, and rebuilding m */
+static void group_rates(uint8_t *file, unsigned int block_size, unsigned int k, unsigned int m, double *encode,
+    double *rebuild) {
+    static uint8_t parity_space[FEC_MAX_PARITY][XMODEM_EXTENDED_MAX_BLOCK];
+    uint8_t *data[FEC_MAX_DATA], *parity[FEC_MAX_PARITY];
+    double best_encode = 0, best_rebuild = 0;
+    for (unsigned int i = 0; i < k; ++i) { data[i] = &file[(size_t) i * block_size]; }
+    for (unsigned int j = 0; j < m; ++j) { parity[j] = parity_space[j]; }
+    for (int r = 0; r < 5; ++r) {
+        double start = now_seconds();
+        for (unsigned int j = 0; j < m; ++j) { memset(parity[j], 0, block_size); }
+        for (unsigned int i = 0; i < k; ++i) { fec_encode(parity, m, i, data[i], block_size); }
+        double middle = now_seconds();
+        fec_rebuild(data, (1u << m) - 1, k, parity, (1u << m) - 1, block_size); /* the first m lost */
+        double end = now_seconds();
+        if ((best_encode == 0) || (middle - start < best_encode)) { best_encode = middle - start; }
+        if ((best_rebuild == 0) || (end - middle < best_rebuild)) { best_rebuild = end - middle; }
+    }
+    *encode = (double) k * block_size / best_encode;
+    *rebuild = (double) k * block_size / best_rebuild;
+}
+
+int main(int argc, char **argv) {
+    uint32_t file_size = 1024 * 1024;
+    /* 115200 baud, 20 ms each way. a chunk arrives well inside the quiet time that ends a receiver's purge */
+    SimLineModel model = { 11520, 20000, 0, 256 };
+    unsigned int runs = 3;
+
+    for (int i = 0; i < argc; ++i) {
+        if (strcmp(argv[i], "-size") == 0) {
+            file_size = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-rate") == 0) {
+            model.bytes_per_second = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-runs") == 0) {
+            runs = atoi(argv[++i]);
+        }
+    }
+
+    uint8_t *file = malloc(file_size);
+    SimFile transfer = { file, file_size, malloc(file_size) };
+    if ((file == NULL) || (transfer.copy == NULL)) { return 1; }
+    uint32_t seed = 12345;
+    for (uint32_t i = 0; i < file_size; ++i) {
+        seed = seed * 1103515245 + 12345;
+        file[i] = seed >> 24;
+    }
+
+    XmodemOptions options;
+    memset(&options, 0, sizeof (options));
+    options.crc_checksum = CHECKSUM_OPTION_CRC;
+    options.packet_size_code = XMODEM_STX;
+    options.timeout_ms = 1000;
+    options.min_timeout_ms = 50;
+    options.max_timeout_ms = 10000;
+    options.max_retries = 100;
+    options.max_retransmissions = 100;
+    options.extended = 1;
+    options.extended_block_size = 4096;
+    options.window = 16;
+
+    typedef struct {
+        unsigned int group, parity;
+    } Code;
+    static const Code codes[] = { { 0, 0 }, { 8, 1 }, { 8, 2 }, { 16, 4 } };
+    static const double rates[] = { 0, 1e-6, 3e-6, 1e-5, 3e-5 };
+
+    printf("%u bytes at %u B/s, %u ms each way, 4 KiB extended blocks, window %u, best of %u seeds\n", file_size,
+        model.bytes_per_second, model.latency_us / 1000, options.window, runs);
+    printf("goodput = file bytes per second. parity k/m = m parity blocks per k blocks\n");
+    printf("%8s %8s %10s %10s %8s %8s %9s\n", "ber", "parity", "seconds", "goodput", "retries", "rebuilt", "vs none");
+
+    int failures = 0;
+    for (unsigned int r = 0; r < sizeof (rates) / sizeof (rates[0]); ++r) {
+        model.bit_error_rate = rates[r];
+        double none = 0;
+        for (unsigned int c = 0; c < sizeof (codes) / sizeof (codes[0]); ++c) {
+            options.fec_group = codes[c].group;
+            options.fec_parity = codes[c].parity;
+            double total = 0;
+            unsigned int retries = 0, repaired = 0, done = 0;
+            for (unsigned int k = 0; k < runs; ++k) {
+                XmodemSessionStats stats;
+                unsigned int rebuilt;
+                double seconds = run(&transfer, &options, &model, 1 + k, &stats, &rebuilt);
+                if (seconds < 0) {
+                    ++failures;
+                    continue;
+                }
+                total += seconds;
+                retries += stats.retries;
+                repaired += rebuilt;
+                ++done;
+            }
+            char code[16];
+            snprintf(code, sizeof (code), "%u/%u", codes[c].group, codes[c].parity);
+            if (done == 0) {
+                printf("%8.0e %8s %10s\n", rates[r], codes[c].parity ? code : "none", "failed");
+                continue;
+            }
+            double seconds = total / done;
+            if (c == 0) { none = seconds; }
+            printf("%8.0e %8s %10.2f %10.0f %8.1f %8.1f", rates[r], codes[c].parity ? code : "none", seconds,
+                file_size / seconds, (double) retries / done, (double) repaired / done);
+            if (none) {
+                printf(" %8.2fx\n", none / seconds);
+            } else {
+                printf(" %9s\n", "-");
+            }
+        }
+    }
+
+    /* the arithmetic on its own: it has to outrun the line by far to stay out of the way */
+    static uint8_t a[XMODEM_EXTENDED_MAX_BLOCK], b[XMODEM_EXTENDED_MAX_BLOCK];
+    memcpy(b, file, (file_size < sizeof (b)) ? file_size : sizeof (b));
+    printf("\nmultiply-add, 64 KiB blocks, MB/s\n");
+    for (int engine = FEC_ENGINE_SCALAR; engine < FEC_ENGINES; ++engine) {
+        if (fec_engine_supported(engine) == 0) { continue; }
+        printf("%-8s %10.1f\n", fec_engine_name(engine), engine_rate(engine, a, b, sizeof (a)) * 1e-6);
+    }
+    fec_select_engine(FEC_ENGINE_AUTO);
+    printf("\ngroup of 4 KiB blocks with %s, MB/s of data\n%8s %10s %10s\n", fec_engine_name(fec_engine()), "parity",
+        "encode", "rebuild");
+    for (unsigned int c = 1; c < sizeof (codes) / sizeof (codes[0]); ++c) {
+        double encode, rebuild;
+        if ((size_t) codes[c].group * 4096 > file_size) { continue; }
+        group_rates(file, 4096, codes[c].group, codes[c].parity, &encode, &rebuild);
+        printf("%5u/%-2u %10.1f %10.1f\n", codes[c].group, codes[c].parity, encode * 1e-6, rebuild * 1e-6);
+    }
+
+    free(file);
+    free(transfer.copy);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,122 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "queue.h"
+
+/*
+ * moves bytes from a producer thread to a consumer thread through a Queue and reports the rate.
+ * "byte" pulls one byte per call with a clock check each time, as recv_from_desc used to; "bulk" copies whole
+ * chunks. the consumer checks every byte against the pattern the producer wrote
+ */
+
+typedef struct {
+    Queue queue;
+    uint64_t total;
+    unsigned int chunk;
+    int bulk;
+    uint64_t errors;
+} Bench;
+
+static double now_seconds(void) {
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec + spec.tv_nsec * 1e-9;
+}
+
+static uint8_t pattern(uint64_t index) {
+    return (uint8_t) ((index * 131) ^ (index >> 11));
+}
+
+static void *producer(void *ext) {
+    Bench *bench = (Bench *) ext;
+    uint8_t *chunk = malloc(bench->chunk);
+    uint64_t index = 0;
+    while (index < bench->total) {
+        unsigned int n = bench->chunk;
+        if (n > bench->total - index) { n = bench->total - index; }
+        for (unsigned int i = 0; i < n; ++i) { chunk[i] = pattern(index + i); }
+        unsigned int done = 0;
+        while (done < n) {
+            unsigned int n_write = queue_write(&bench->queue, &chunk[done], n - done);
+            if (n_write == 0) { sched_yield(); } /* full. let the consumer run */
+            done += n_write;
+        }
+        index += n;
+    }
+    free(chunk);
+    return NULL;
+}
+
+static void consume(Bench *bench) {
+    uint8_t *chunk = malloc(bench->chunk);
+    uint64_t index = 0;
+    while (index < bench->total) {
+        unsigned int n;
+        if (bench->bulk) {
+            n = queue_read(&bench->queue, chunk, bench->chunk);
+        } else {
+            struct timespec spec;
+            n = 0;
+            while ((n < bench->chunk) && queue_read(&bench->queue, &chunk[n], 1)) {
+                clock_gettime(CLOCK_MONOTONIC, &spec);
+                ++n;
+            }
+        }
+        if (n == 0) { sched_yield(); } /* empty. let the producer run */
+        for (unsigned int i = 0; i < n; ++i) {
+            if (chunk[i] != pattern(index + i)) { ++bench->errors; }
+        }
+        index += n;
+    }
+    free(chunk);
+}
+
+int main(int argc, char **argv) {
+    uint64_t total = 256 * 1024 * 1024;
+    unsigned int ring_size = 64 * 1024;
+    unsigned int chunk = 4096;
+
+    for (int i = 0; i < argc; ++i) {
+        if (strcmp(argv[i], "-size") == 0) {
+            total = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-ring") == 0) {
+            ring_size = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-chunk") == 0) {
+            chunk = atoi(argv[++i]);
+        }
+    }
+
+    uint8_t *ring = malloc(ring_size);
+    if ((ring == NULL) || (chunk == 0)) { return 1; }
+
+    printf("%-6s %12s %12s\n", "mode", "MB/s", "errors");
+    for (int bulk = 0; bulk < 2; ++bulk) {
+        Bench bench;
+        memset(&bench, 0, sizeof (bench));
+        if (queue_init(&bench.queue, ring, ring_size)) {
+            printf("ring size must be a power of two\n");
+            return 1;
+        }
+        bench.total = bulk ? total : total / 8; /* the byte loop is slow */
+        bench.chunk = chunk;
+        bench.bulk = bulk;
+
+        pthread_t thread;
+        double start = now_seconds();
+        pthread_create(&thread, NULL, producer, &bench);
+        consume(&bench);
+        pthread_join(thread, NULL);
+        double elapsed = now_seconds() - start;
+
+        printf("%-6s %12.1f %12llu\n", bulk ? "bulk" : "byte", bench.total / elapsed * 1e-6,
+               (unsigned long long) bench.errors);
+        if (bench.errors) { return 1; }
+    }
+
+    free(ring);
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "xmodem.h"
+#include "stream.h"
+#include "loopback.h"
+#include "crc.h"
+
+/*
+ * throughput of classic 1 KiB packets against extended packets over a loopback tcp connection. the file comes from
+ * and goes to memory, so the numbers are the protocol's and the link's, not the disk's. every copy is compared
+ */
+
+#define BENCH_RING_SIZE (1024 * 1024)
+
+static double now_seconds(void) {
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec + spec.tv_nsec * 1e-9;
+}
+
+/*
+ * @brief one transfer from src to sink over a fresh connection
+ * @return seconds, or a negative value if the transfer failed or the copy differs
+ */
+static double run(RxLooperArgs *looper, int listen_fd, struct sockaddr_in const *addr, XmodemOptions const *options,
+    MemorySource *src, MemorySink *dst, unsigned int *extended) {
+    int fds[2];
+    Queue queues[2];
+    Stream streams[2];
+    double seconds = -1;
+
+    if (connect_loopback(listen_fd, addr, fds) != 0) { return -1; }
+    memset(queues, 0, sizeof (queues));
+    for (int i = 0; i < 2; ++i) {
+        streams[i].fd = fds[i];
+        streams[i].queue = &queues[i];
+        if (rx_looper_add(looper, fds[i], &queues[i]) != 0) { return -1; }
+    }
+    memset(dst->data, 0, dst->size);
+
+    Receiver receiver;
+    memset(&receiver, 0, sizeof (receiver));
+    stream_device(&receiver.link, &streams[1]);
+    receiver.sink.handle = dst;
+    receiver.sink.write = write_to_memory;
+    receiver.options = *options;
+    receiver.options.crc_checksum = CHECKSUM_OPTION_CRC;
+
+    GenericDevice link, file;
+    stream_device(&link, &streams[0]);
+    memset(&file, 0, sizeof (file));
+    file.handle = src;
+    file.map = map_from_memory;
+    file.unmap = unmap_from_memory;
+    XmodemOptions sender_options = *options;
+
+    double start = now_seconds();
+    pthread_t thread;
+    pthread_create(&thread, NULL, receiver_task, &receiver);
+    int result = xmodem_send(&file, &link, &sender_options, NULL);
+    pthread_join(thread, NULL);
+    double stop = now_seconds();
+
+    if ((result == 0) && (receiver.result == 0) && (memcmp(src->data, dst->data, src->size) == 0)) {
+        seconds = stop - start;
+    }
+    *extended = sender_options.extended ? sender_options.packet_size : 0;
+
+    for (int i = 0; i < 2; ++i) {
+        rx_looper_remove(looper, &queues[i]);
+        close(fds[i]);
+    }
+    return seconds;
+}
+
+int main(int argc, char **argv) {
+    unsigned int file_size = 64 * 1024 * 1024;
+    unsigned int runs = 3;
+
+    for (int i = 0; i < argc; ++i) {
+        if (strcmp(argv[i], "-size") == 0) {
+            file_size = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-runs") == 0) {
+            runs = atoi(argv[++i]);
+        }
+    }
+
+    MemorySource src = { malloc(file_size), file_size };
+    MemorySink dst = { malloc(file_size), file_size };
+    if ((src.data == NULL) || (dst.data == NULL)) { return 1; }
+    uint32_t seed = 12345;
+    for (unsigned int i = 0; i < file_size; ++i) {
+        seed = seed * 1103515245 + 12345;
+        ((uint8_t *) src.data)[i] = seed >> 24;
+    }
+
+    struct sockaddr_in addr;
+    int listen_fd = listen_loopback(&addr);
+    if (listen_fd < 0) {
+        perror("listen");
+        return 1;
+    }
+
+    RxLooperArgs looper;
+    memset(&looper, 0, sizeof (looper));
+    looper.max_sources = 2;
+    looper.ring_size = BENCH_RING_SIZE; /* a window of extended packets in flight */
+    if (rx_looper_init(&looper) != 0) { return 1; }
+    pthread_t looper_thread;
+    pthread_create(&looper_thread, NULL, rx_looper, &looper);
+
+    typedef struct {
+        char const *name;
+        unsigned int window, extended_block_size; /* 0 = classic 1 KiB */
+    } Mode;
+    static const Mode modes[] = {
+        { "1k", 0, 0 }, { "1k window 16", 16, 0 },
+        { "4k extended", 0, 4 * 1024 }, { "16k extended", 0, 16 * 1024 }, { "64k extended", 0, 64 * 1024 },
+        { "64k extended window 4", 4, 64 * 1024 },
+    };
+
+    XmodemOptions options;
+    memset(&options, 0, sizeof (options));
+    options.packet_size_code = XMODEM_STX;
+    options.timeout_ms = 1000;
+    options.min_timeout_ms = 20;
+    options.max_timeout_ms = 10000;
+    options.max_retries = 20;
+    options.max_retransmissions = 20;
+
+    crc32c_select_engine(CRC32C_ENGINE_AUTO);
+    printf("%u bytes over loopback tcp, best of %u, crc-32c engine %s\n", file_size, runs,
+        crc32c_engine_name(crc32c_engine()));
+    printf("%-24s %10s %10s\n", "mode", "MB/s", "block");
+
+    int failures = 0;
+    for (unsigned int m = 0; m < sizeof (modes) / sizeof (modes[0]); ++m) {
+        options.window = modes[m].window;
+        options.extended = modes[m].extended_block_size ? 1 : 0;
+        options.extended_block_size = modes[m].extended_block_size;
+        double best = 0;
+        unsigned int block = 0;
+        for (unsigned int r = 0; r < runs; ++r) {
+            double seconds = run(&looper, listen_fd, &addr, &options, &src, &dst, &block);
+            if (seconds < 0) {
+                best = -1;
+                break;
+            }
+            if ((best == 0) || (seconds < best)) { best = seconds; }
+        }
+        if (best < 0) {
+            printf("%-24s %10s\n", modes[m].name, "failed");
+            ++failures;
+        } else {
+            printf("%-24s %10.1f %10u\n", modes[m].name, file_size / best * 1e-6, block ? block : XMODEM_1K_BUFF_SIZE);
+        }
+    }
+
+    rx_looper_stop(&looper);
+    pthread_join(looper_thread, NULL);
+    rx_looper_close(&looper);
+    close(listen_fd);
+    free((void *) src.data);
+    free(dst.data);
+    return failures ? 1 : 0;
+}
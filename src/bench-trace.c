@@ -0,0 +1,77 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "trace.h"
+
+/*
+ * cost of trace_record(): cpu nanoseconds per event with tracing off, and on from 1 to -threads threads at once,
+ * each into its own ring. the time stamp is most of it, and costs more under some hypervisors. -dump file also writes
+ * the last run out while its threads still record
+ */
+
+typedef struct {
+    unsigned int events;
+    double seconds;
+} Worker;
+
+static double cpu_seconds(void) {
+    struct timespec spec;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &spec);
+    return spec.tv_sec + spec.tv_nsec * 1e-9;
+}
+
+static void *record(void *ext) {
+    Worker *worker = (Worker *) ext;
+    double start = cpu_seconds();
+    for (unsigned int i = 0; i < worker->events; ++i) { trace_record(TRACE_RX_READ, 1, i, i & 0xfff); }
+    worker->seconds = cpu_seconds() - start;
+    return NULL;
+}
+
+/* @brief ns per event, the slowest thread's */
+static double run(unsigned int n_threads, unsigned int events, char const *dump) {
+    pthread_t threads[64];
+    Worker workers[64];
+    for (unsigned int t = 0; t < n_threads; ++t) {
+        workers[t].events = events;
+        pthread_create(&threads[t], NULL, record, &workers[t]);
+    }
+    if (dump && trace_dump(dump)) { printf("unable to write %s\n", dump); }
+    double seconds = 0;
+    for (unsigned int t = 0; t < n_threads; ++t) {
+        pthread_join(threads[t], NULL);
+        if (workers[t].seconds > seconds) { seconds = workers[t].seconds; }
+    }
+    return seconds * 1e9 / events;
+}
+
+int main(int argc, char **argv) {
+    unsigned int events = 10 * 1000 * 1000;
+    unsigned int max_threads = 4;
+    char const *dump = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if ((strcmp(argv[i], "-events") == 0) && (i + 1 < argc)) {
+            events = strtoul(argv[++i], NULL, 0);
+        } else if ((strcmp(argv[i], "-threads") == 0) && (i + 1 < argc)) {
+            max_threads = atoi(argv[++i]);
+        } else if ((strcmp(argv[i], "-dump") == 0) && (i + 1 < argc)) {
+            dump = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [-events n] [-threads n] [-dump file]\n", argv[0]);
+            return 1;
+        }
+    }
+    if ((max_threads == 0) || (max_threads > 64)) { max_threads = 4; }
+
+    printf("threads,tracing,ns_per_event\n");
+    printf("1,off,%.2f\n", run(1, events, NULL));
+    trace_start(0);
+    for (unsigned int n = 1; n <= max_threads; n *= 2) {
+        printf("%u,on,%.2f\n", n, run(n, events, ((n * 2 > max_threads) && dump) ? dump : NULL));
+    }
+    trace_stop();
+    return 0;
+}
@@ -0,0 +1,332 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <termios.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "xmodem.h"
+#include "stream.h"
+#include "link.h"
+#include "loopback.h"
+#include "stats.h"
+#include "trace.h"
+
+/*
+ * whole xmodem sessions, sender and receiver in one process, over each kind of link: the emulated serial link, a
+ * unix socketpair, a pty and loopback tcp. sweeps 128 and 1024 byte blocks, crc and checksum, file sizes and, on the
+ * emulated link, line rate, latency and bit errors. one row per case as csv, or a json array with -json. the file
+ * comes from and goes to memory and every copy is compared. efficiency is the file's bytes per second over the line
+ * rate, for links that have one; cpu is the whole process's, looper thread included. -trace file keeps the last
+ * events of every thread, written to file at the end for trace-xmodem
+ */
+
+#define BENCH_RING_SIZE (1024 * 1024)
+
+enum {
+    LINK_KIND_MEMORY = 0,
+    LINK_KIND_SOCKETPAIR,
+    LINK_KIND_PTY,
+    LINK_KIND_TCP,
+    LINK_KINDS
+};
+
+static char const * const link_names[LINK_KINDS] = { "memory", "socketpair", "pty", "tcp" };
+
+typedef struct {
+    char const *name;
+    LinkProfile profile;
+    unsigned int max_size; /* larger files are skipped, they take too long at this rate. 0 = no limit */
+} Profile;
+
+static const Profile profiles[] = {
+    { "ideal", { 0 }, 0 },
+    { "921600", { .baud = 921600 }, 256 * 1024 },
+    { "921600-2ms", { .baud = 921600, .latency_us = 2000, .jitter_us = 500 }, 64 * 1024 },
+    { "921600-ber1e-5", { .baud = 921600, .bit_error_rate = 1e-5 }, 256 * 1024 },
+    { "921600-ber1e-4", { .baud = 921600, .bit_error_rate = 1e-4 }, 64 * 1024 },
+};
+
+typedef struct {
+    double seconds, cpu_seconds;
+    int sender_errors, receiver_errors;
+    int ok;
+    uint64_t resent; /* blocks the sender sent again */
+    uint64_t ack_p50_us, ack_p99_us; /* the sender's wait from a block out to its ACK */
+} Outcome;
+
+static double clock_seconds(clockid_t clock) {
+    struct timespec spec;
+    clock_gettime(clock, &spec);
+    return spec.tv_sec + spec.tv_nsec * 1e-9;
+}
+
+/* @brief master and slave of a new pty, both raw, so that every byte goes through as it is */
+static int open_pty(int fds[2]) {
+    struct termios tio;
+    fds[0] = posix_openpt(O_RDWR | O_NOCTTY);
+    if (fds[0] < 0) { return -1; }
+    if ((grantpt(fds[0]) != 0) || (unlockpt(fds[0]) != 0)) { return -1; }
+    fds[1] = open(ptsname(fds[0]), O_RDWR | O_NOCTTY);
+    if (fds[1] < 0) { return -1; }
+    for (int i = 0; i < 2; ++i) {
+        if (tcgetattr(fds[i], &tio) != 0) { return -1; }
+        cfmakeraw(&tio);
+        if (tcsetattr(fds[i], TCSANOW, &tio) != 0) { return -1; }
+    }
+    return 0;
+}
+
+static int open_fds(unsigned int kind, int listen_fd, struct sockaddr_in const *addr, int fds[2]) {
+    switch (kind) {
+        case LINK_KIND_SOCKETPAIR: return socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+        case LINK_KIND_PTY: return open_pty(fds);
+        case LINK_KIND_TCP: return connect_loopback(listen_fd, addr, fds);
+        default: return -1;
+    }
+}
+
+/*
+ * @brief one transfer from src to dst over a fresh link of the given kind. the profile only applies to the
+ *     emulated link
+ */
+static Outcome run(unsigned int kind, LinkProfile const *profile, RxLooperArgs *looper, int listen_fd,
+    struct sockaddr_in const *addr, XmodemOptions const *options, unsigned int crc_checksum, MemorySource *src,
+    MemorySink *dst) {
+    Outcome outcome;
+    Link link;
+    int fds[2] = { -1, -1 };
+    Queue queues[2];
+    Stream streams[2];
+    GenericDevice ends[2];
+
+    memset(&outcome, 0, sizeof (outcome));
+    if (kind == LINK_KIND_MEMORY) {
+        if (link_open(&link, profile, NULL) != 0) { return outcome; }
+        for (int i = 0; i < 2; ++i) {
+            memset(&ends[i], 0, sizeof (GenericDevice));
+            ends[i].fd = -1;
+            link_device(&link, i, &ends[i]);
+        }
+    } else {
+        if (open_fds(kind, listen_fd, addr, fds) != 0) {
+            for (int i = 0; i < 2; ++i) { if (fds[i] >= 0) { close(fds[i]); } }
+            return outcome;
+        }
+        memset(queues, 0, sizeof (queues));
+        for (int i = 0; i < 2; ++i) {
+            streams[i].fd = fds[i];
+            streams[i].queue = &queues[i];
+            rx_looper_add(looper, fds[i], &queues[i]);
+            stream_device(&ends[i], &streams[i]);
+        }
+    }
+    memset(dst->data, 0, dst->size);
+
+    Receiver receiver;
+    memset(&receiver, 0, sizeof (receiver));
+    receiver.link = ends[1];
+    receiver.sink.handle = dst;
+    receiver.sink.write = write_to_memory;
+    receiver.options = *options;
+    receiver.options.crc_checksum = crc_checksum;
+
+    GenericDevice file;
+    memset(&file, 0, sizeof (file));
+    file.handle = src;
+    file.map = map_from_memory;
+    file.unmap = unmap_from_memory;
+    XmodemOptions sender_options = *options;
+    XmodemStats stats;
+    xmodem_stats_reset(&stats);
+    sender_options.stats = &stats;
+
+    double start = clock_seconds(CLOCK_MONOTONIC);
+    double cpu_start = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+    pthread_t thread;
+    pthread_create(&thread, NULL, receiver_task, &receiver);
+    int result = xmodem_send(&file, &ends[0], &sender_options, &outcome.sender_errors);
+    pthread_join(thread, NULL);
+    outcome.seconds = clock_seconds(CLOCK_MONOTONIC) - start;
+    outcome.cpu_seconds = clock_seconds(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+    outcome.receiver_errors = receiver.errors;
+    outcome.resent = stats.blocks_resent;
+    outcome.ack_p50_us = xmodem_histogram_quantile(&stats.ack_turnaround, 0.5);
+    outcome.ack_p99_us = xmodem_histogram_quantile(&stats.ack_turnaround, 0.99);
+    outcome.ok = (result == 0) && (receiver.result == 0) && (memcmp(src->data, dst->data, src->size) == 0);
+
+    if (kind == LINK_KIND_MEMORY) {
+        link_close(&link);
+    } else {
+        for (int i = 0; i < 2; ++i) {
+            rx_looper_remove(looper, &queues[i]);
+            close(fds[i]);
+        }
+    }
+    return outcome;
+}
+
+/* @brief comma separated numbers into list, at most max of them. returns how many */
+static unsigned int parse_list(char const *s, unsigned int *list, unsigned int max) {
+    unsigned int n = 0;
+    while (*s && (n < max)) {
+        char *end;
+        list[n] = strtoul(s, &end, 0);
+        if (end == s) { break; }
+        ++n;
+        s = (*end == ',') ? end + 1 : end;
+    }
+    return n;
+}
+
+static unsigned int parse_links(char const *s) {
+    unsigned int mask = 0;
+    for (unsigned int k = 0; k < LINK_KINDS; ++k) {
+        if (strstr(s, link_names[k])) { mask |= 1u << k; }
+    }
+    return mask;
+}
+
+int main(int argc, char **argv) {
+    unsigned int sizes[16] = { 64 * 1024, 1024 * 1024 };
+    unsigned int n_sizes = 2;
+    unsigned int runs = 1;
+    unsigned int links = (1u << LINK_KINDS) - 1;
+    unsigned int json = 0;
+    char const *trace_file = NULL;
+
+    XmodemOptions options;
+    memset(&options, 0, sizeof (options));
+    options.timeout_ms = 1000;
+    options.min_timeout_ms = 20;
+    options.max_timeout_ms = 10000;
+    options.max_retries = 20;
+    options.max_retransmissions = 20;
+
+    for (int i = 1; i < argc; ++i) {
+        if ((strcmp(argv[i], "-sizes") == 0) && (i + 1 < argc)) {
+            n_sizes = parse_list(argv[++i], sizes, sizeof (sizes) / sizeof (sizes[0]));
+        } else if ((strcmp(argv[i], "-runs") == 0) && (i + 1 < argc)) {
+            runs = atoi(argv[++i]);
+        } else if ((strcmp(argv[i], "-links") == 0) && (i + 1 < argc)) {
+            links = parse_links(argv[++i]);
+        } else if ((strcmp(argv[i], "-window") == 0) && (i + 1 < argc)) {
+            options.window = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-json") == 0) {
+            json = 1;
+        } else if ((strcmp(argv[i], "-trace") == 0) && (i + 1 < argc)) {
+            trace_file = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [-sizes n,n,...] [-runs n] [-links memory,socketpair,pty,tcp] [-window n] "
+                "[-json] [-trace file]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (runs == 0) { runs = 1; }
+    if (trace_file) { trace_start(0); }
+
+    unsigned int largest = 0;
+    for (unsigned int s = 0; s < n_sizes; ++s) { if (sizes[s] > largest) { largest = sizes[s]; } }
+    MemorySource src = { malloc(largest + 1), 0 };
+    MemorySink dst = { malloc(largest + 1), 0 };
+    if ((src.data == NULL) || (dst.data == NULL)) { return 1; }
+    uint32_t seed = 12345;
+    for (unsigned int i = 0; i < largest; ++i) {
+        seed = seed * 1103515245 + 12345;
+        ((uint8_t *) src.data)[i] = seed >> 24;
+    }
+
+    struct sockaddr_in addr;
+    int listen_fd = listen_loopback(&addr);
+    if (listen_fd < 0) {
+        perror("listen");
+        return 1;
+    }
+
+    RxLooperArgs looper;
+    memset(&looper, 0, sizeof (looper));
+    looper.max_sources = 2;
+    looper.ring_size = BENCH_RING_SIZE;
+    if (rx_looper_init(&looper) != 0) { return 1; }
+    pthread_t looper_thread;
+    pthread_create(&looper_thread, NULL, rx_looper, &looper);
+
+    static const unsigned int block_codes[] = { 1, 2 }; /* 128 and 1024 byte blocks */
+    static const unsigned int checks[] = { CHECKSUM_OPTION_CRC, CHECKSUM_OPTION_SUM };
+
+    if (json) {
+        printf("[");
+    } else {
+        printf("link,profile,block,check,size,ok,seconds,mb_per_s,efficiency,sender_errors,receiver_errors,"
+            "cpu_ms_per_mb,resent,ack_p50_us,ack_p99_us\n");
+    }
+    int failures = 0;
+    unsigned int rows = 0;
+    for (unsigned int k = 0; k < LINK_KINDS; ++k) {
+        if ((links & (1u << k)) == 0) { continue; }
+        unsigned int n_profiles = (k == LINK_KIND_MEMORY) ? sizeof (profiles) / sizeof (profiles[0]) : 1;
+        for (unsigned int p = 0; p < n_profiles; ++p) {
+            for (unsigned int s = 0; s < n_sizes; ++s) {
+                if (profiles[p].max_size && (sizes[s] > profiles[p].max_size)) { continue; }
+                src.size = dst.size = sizes[s];
+                for (unsigned int b = 0; b < 2; ++b) {
+                    for (unsigned int c = 0; c < 2; ++c) {
+                        options.packet_size_code = block_codes[b];
+                        Outcome best;
+                        memset(&best, 0, sizeof (best));
+                        for (unsigned int r = 0; r < runs; ++r) {
+                            Outcome outcome = run(k, &profiles[p].profile, &looper, listen_fd, &addr, &options,
+                                checks[c], &src, &dst);
+                            if (outcome.ok == 0) {
+                                best = outcome;
+                                break;
+                            }
+                            if ((best.ok == 0) || (outcome.seconds < best.seconds)) { best = outcome; }
+                        }
+                        if (best.ok == 0) { ++failures; }
+
+                        double rate = (best.seconds > 0) ? sizes[s] / best.seconds * 1e-6 : 0;
+                        double line_rate = profiles[p].profile.baud / 10.0 * 1e-6; /* 8N1 */
+                        double cpu_ms = best.cpu_seconds * 1e3 / (sizes[s] * 1e-6);
+                        char efficiency[32] = "";
+                        if (line_rate > 0) { snprintf(efficiency, sizeof (efficiency), "%.3f", rate / line_rate); }
+                        char const *check = (checks[c] == CHECKSUM_OPTION_CRC) ? "crc" : "sum";
+                        unsigned int block = (block_codes[b] == 1) ? XMODEM_BUFF_SIZE : XMODEM_1K_BUFF_SIZE;
+                        if (json) {
+                            printf("%s\n  {\"link\": \"%s\", \"profile\": \"%s\", \"block\": %u, \"check\": \"%s\", "
+                                "\"size\": %u, \"ok\": %s, \"seconds\": %.4f, \"mb_per_s\": %.3f, "
+                                "\"efficiency\": %s, \"sender_errors\": %d, \"receiver_errors\": %d, "
+                                "\"cpu_ms_per_mb\": %.2f, \"resent\": %llu, \"ack_p50_us\": %llu, "
+                                "\"ack_p99_us\": %llu}", rows ? "," : "", link_names[k], profiles[p].name, block,
+                                check, sizes[s], best.ok ? "true" : "false", best.seconds, rate,
+                                efficiency[0] ? efficiency : "null", best.sender_errors, best.receiver_errors, cpu_ms,
+                                (unsigned long long) best.resent, (unsigned long long) best.ack_p50_us,
+                                (unsigned long long) best.ack_p99_us);
+                        } else {
+                            printf("%s,%s,%u,%s,%u,%d,%.4f,%.3f,%s,%d,%d,%.2f,%llu,%llu,%llu\n", link_names[k],
+                                profiles[p].name, block, check, sizes[s], best.ok, best.seconds, rate, efficiency,
+                                best.sender_errors, best.receiver_errors, cpu_ms, (unsigned long long) best.resent,
+                                (unsigned long long) best.ack_p50_us, (unsigned long long) best.ack_p99_us);
+                        }
+                        fflush(stdout);
+                        ++rows;
+                    }
+                }
+            }
+        }
+    }
+    if (json) { printf("\n]\n"); }
+
+    rx_looper_stop(&looper);
+    pthread_join(looper_thread, NULL);
+    rx_looper_close(&looper);
+    close(listen_fd);
+    if (trace_file && trace_dump(trace_file)) { fprintf(stderr, "unable to write %s\n", trace_file); }
+    free((void *) src.data);
+    free(dst.data);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,320 @@
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BLOCK_HASH_HAVE_X86 (1)
+#endif
+
+#include "blockhash.h"
+
+#define BLOCK_HASH_LANES (8)
+#define BLOCK_HASH_STRIPE (64) /* bytes per step: one 64-bit word per lane */
+#define BLOCK_HASH_STRIPES (16) /* steps between scrambles */
+#define BLOCK_HASH_SCRAMBLE_KEY (24) /* key[24..32) scrambles. steps use a window of key[0..23) sliding by one */
+#define BLOCK_HASH_KEYS (32)
+
+#define BLOCK_HASH_PRIME32_1 (0x9e3779b1u)
+#define BLOCK_HASH_PRIME32_2 (0x85ebca77u)
+#define BLOCK_HASH_PRIME32_3 (0xc2b2ae3du)
+#define BLOCK_HASH_PRIME64_1 (0x9e3779b185ebca87ull)
+#define BLOCK_HASH_PRIME64_2 (0xc2b2ae3d27d4eb4full)
+#define BLOCK_HASH_PRIME64_3 (0x165667b19e3779f9ull)
+#define BLOCK_HASH_PRIME64_4 (0x85ebca77c2b2ae63ull)
+#define BLOCK_HASH_PRIME64_5 (0x27d4eb2f165667c5ull)
+
+/* a fixed pseudo-random key, so that every build and every engine hashes alike */
+static uint64_t block_hash_key[BLOCK_HASH_KEYS];
+
+static pthread_once_t block_hash_once = PTHREAD_ONCE_INIT;
+
+static void block_hash_init(void) {
+    uint64_t state = BLOCK_HASH_PRIME64_1;
+    for (unsigned int i = 0; i < BLOCK_HASH_KEYS; ++i) { /* splitmix64 */
+        uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        block_hash_key[i] = z ^ (z >> 31);
+    }
+}
+
+static uint64_t read64(uint8_t const *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof (v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+/*
+ * one step: each lane multiplies the low and high halves of its word mixed with the key and adds the product, and
+ * adds the plain word to its neighbour so no byte is lost to a zero half. stripe picks the key window
+ */
+static void stripe_scalar(uint64_t acc[BLOCK_HASH_LANES], uint8_t const *p, unsigned int stripe) {
+    for (unsigned int i = 0; i < BLOCK_HASH_LANES; ++i) {
+        uint64_t data = read64(&p[8 * i]);
+        uint64_t keyed = data ^ block_hash_key[stripe + i];
+        acc[i ^ 1] += data;
+        acc[i] += (keyed & 0xffffffff) * (keyed >> 32);
+    }
+}
+
+/* @brief keeps the high bits of the lanes flowing back into the low ones every BLOCK_HASH_STRIPES steps */
+static void scramble_scalar(uint64_t acc[BLOCK_HASH_LANES]) {
+    for (unsigned int i = 0; i < BLOCK_HASH_LANES; ++i) {
+        uint64_t a = acc[i];
+        a ^= a >> 47;
+        a ^= block_hash_key[BLOCK_HASH_SCRAMBLE_KEY + i];
+        acc[i] = a * BLOCK_HASH_PRIME32_1;
+    }
+}
+
+/* every engine: all whole stripes, then the rest padded with zeros. the length goes into the final mix */
+static void block_hash_scalar(uint64_t acc[BLOCK_HASH_LANES], uint8_t const *ptr, unsigned int n) {
+    unsigned int stripe = 0;
+    while (n >= BLOCK_HASH_STRIPE) {
+        stripe_scalar(acc, ptr, stripe);
+        ptr += BLOCK_HASH_STRIPE;
+        n -= BLOCK_HASH_STRIPE;
+        if (++stripe == BLOCK_HASH_STRIPES) {
+            scramble_scalar(acc);
+            stripe = 0;
+        }
+    }
+    if (n) {
+        uint8_t last[BLOCK_HASH_STRIPE];
+        memset(last, 0, sizeof (last));
+        memcpy(last, ptr, n);
+        stripe_scalar(acc, last, stripe);
+    }
+}
+
+#ifdef BLOCK_HASH_HAVE_X86
+
+/*
+ * the same steps four lanes to an instruction: the 32 x 32 bit multiply is vpmuludq, and the neighbour of each lane
+ * is the other half of its 128-bit pair. the 64 x 32 bit multiply of the scramble is two vpmuludq
+ */
+__attribute__((target("avx2")))
+static void block_hash_avx2(uint64_t acc[BLOCK_HASH_LANES], uint8_t const *ptr, unsigned int n) {
+    __m256i a0 = _mm256_loadu_si256((__m256i const *) &acc[0]);
+    __m256i a1 = _mm256_loadu_si256((__m256i const *) &acc[4]);
+    const __m256i prime = _mm256_set1_epi64x(BLOCK_HASH_PRIME32_1);
+    const __m256i s0 = _mm256_loadu_si256((__m256i const *) &block_hash_key[BLOCK_HASH_SCRAMBLE_KEY]);
+    const __m256i s1 = _mm256_loadu_si256((__m256i const *) &block_hash_key[BLOCK_HASH_SCRAMBLE_KEY + 4]);
+    uint8_t last[BLOCK_HASH_STRIPE];
+    unsigned int stripe = 0;
+
+#define BLOCK_HASH_STEP(a, p, k) do { \
+        __m256i data = _mm256_loadu_si256((__m256i const *) (p)); \
+        __m256i keyed = _mm256_xor_si256(data, _mm256_loadu_si256((__m256i const *) (k))); \
+        a = _mm256_add_epi64(a, _mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2))); \
+        a = _mm256_add_epi64(a, _mm256_mul_epu32(keyed, _mm256_srli_epi64(keyed, 32))); \
+    } while (0)
+
+#define BLOCK_HASH_SCRAMBLE(a, s) do { \
+        a = _mm256_xor_si256(_mm256_xor_si256(a, _mm256_srli_epi64(a, 47)), (s)); \
+        a = _mm256_add_epi64(_mm256_mul_epu32(a, prime), \
+            _mm256_slli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), prime), 32)); \
+    } while (0)
+
+    while (n >= BLOCK_HASH_STRIPE) {
+        BLOCK_HASH_STEP(a0, ptr, &block_hash_key[stripe]);
+        BLOCK_HASH_STEP(a1, ptr + 32, &block_hash_key[stripe + 4]);
+        ptr += BLOCK_HASH_STRIPE;
+        n -= BLOCK_HASH_STRIPE;
+        if (++stripe == BLOCK_HASH_STRIPES) {
+            BLOCK_HASH_SCRAMBLE(a0, s0);
+            BLOCK_HASH_SCRAMBLE(a1, s1);
+            stripe = 0;
+        }
+    }
+    if (n) {
+        memset(last, 0, sizeof (last));
+        memcpy(last, ptr, n);
+        BLOCK_HASH_STEP(a0, last, &block_hash_key[stripe]);
+        BLOCK_HASH_STEP(a1, last + 32, &block_hash_key[stripe + 4]);
+    }
+
+#undef BLOCK_HASH_STEP
+#undef BLOCK_HASH_SCRAMBLE
+
+    _mm256_storeu_si256((__m256i *) &acc[0], a0);
+    _mm256_storeu_si256((__m256i *) &acc[4], a1);
+}
+
+#endif
+
+static uint64_t mul_fold(uint64_t a, uint64_t b) {
+    __uint128_t product = (__uint128_t) a * b;
+    return (uint64_t) product ^ (uint64_t) (product >> 64);
+}
+
+static uint64_t avalanche(uint64_t h) {
+    h ^= h >> 37;
+    h *= 0x165667919e3779f9ull;
+    return h ^ (h >> 32);
+}
+
+/* @brief the lanes and the length down to 128 bits, each half from the lanes mixed with its own part of the key */
+static void block_hash_finish(uint64_t const acc[BLOCK_HASH_LANES], unsigned int n, BlockHash *hash) {
+    uint64_t lo = n * BLOCK_HASH_PRIME64_1, hi = ~(n * BLOCK_HASH_PRIME64_2);
+    for (unsigned int i = 0; i < BLOCK_HASH_LANES; i += 2) {
+        lo += mul_fold(acc[i] ^ block_hash_key[i + 11], acc[i + 1] ^ block_hash_key[i + 12]);
+        hi += mul_fold(acc[i] ^ block_hash_key[i + 3], acc[i + 1] ^ block_hash_key[i + 4]);
+    }
+    hash->lo = avalanche(lo);
+    hash->hi = avalanche(hi);
+}
+
+static void block_hash_start(uint64_t acc[BLOCK_HASH_LANES]) {
+    static const uint64_t start[BLOCK_HASH_LANES] = {
+        BLOCK_HASH_PRIME32_3, BLOCK_HASH_PRIME64_1, BLOCK_HASH_PRIME64_2, BLOCK_HASH_PRIME64_3,
+        BLOCK_HASH_PRIME64_4, BLOCK_HASH_PRIME32_2, BLOCK_HASH_PRIME64_5, BLOCK_HASH_PRIME32_1
+    };
+    memcpy(acc, start, sizeof (start));
+}
+
+int block_hash_engine_supported(int engine) {
+    switch (engine) {
+        case BLOCK_HASH_ENGINE_AUTO:
+        case BLOCK_HASH_ENGINE_SCALAR:
+            return 1;
+#ifdef BLOCK_HASH_HAVE_X86
+        case BLOCK_HASH_ENGINE_AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") ? 1 : 0;
+#endif
+        default:
+            return 0;
+    }
+}
+
+char const *block_hash_engine_name(int engine) {
+    static char const * const names[BLOCK_HASH_ENGINES] = { "auto", "scalar", "avx2" };
+    return ((engine >= 0) && (engine < BLOCK_HASH_ENGINES)) ? names[engine] : "unknown";
+}
+
+typedef void (*BlockHashFunction)(uint64_t acc[BLOCK_HASH_LANES], uint8_t const *ptr, unsigned int n);
+
+static int block_hash_best_engine(void) {
+    return block_hash_engine_supported(BLOCK_HASH_ENGINE_AVX2) ? BLOCK_HASH_ENGINE_AVX2 : BLOCK_HASH_ENGINE_SCALAR;
+}
+
+static BlockHashFunction block_hash_function(int engine) {
+    pthread_once(&block_hash_once, block_hash_init);
+    if (block_hash_engine_supported(engine) == 0) { return NULL; }
+    switch (engine) {
+        case BLOCK_HASH_ENGINE_SCALAR: return block_hash_scalar;
+#ifdef BLOCK_HASH_HAVE_X86
+        case BLOCK_HASH_ENGINE_AVX2: return block_hash_avx2;
+#endif
+        default: break;
+    }
+    return block_hash_function(block_hash_best_engine());
+}
+
+static void block_hash_resolve(uint64_t acc[BLOCK_HASH_LANES], uint8_t const *ptr, unsigned int n);
+
+static BlockHashFunction block_hash_active = block_hash_resolve;
+static int block_hash_active_engine = BLOCK_HASH_ENGINE_AUTO;
+
+/* first call picks the engine, later calls go straight to it */
+static void block_hash_resolve(uint64_t acc[BLOCK_HASH_LANES], uint8_t const *ptr, unsigned int n) {
+    block_hash_select_engine(BLOCK_HASH_ENGINE_AUTO);
+    block_hash_active(acc, ptr, n);
+}
+
+int block_hash_select_engine(int engine) {
+    BlockHashFunction function = block_hash_function(engine);
+    if (function == NULL) { return -1; }
+    block_hash_active_engine = (engine == BLOCK_HASH_ENGINE_AUTO) ? block_hash_best_engine() : engine;
+    __atomic_store_n(&block_hash_active, function, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int block_hash_engine(void) {
+    return block_hash_active_engine;
+}
+
+void block_hash(uint8_t const *ptr, unsigned int n, BlockHash *hash) {
+    uint64_t acc[BLOCK_HASH_LANES];
+    block_hash_start(acc);
+    __atomic_load_n(&block_hash_active, __ATOMIC_ACQUIRE)(acc, ptr, n);
+    block_hash_finish(acc, n, hash);
+}
+
+void block_hash_engine_hash(int engine, uint8_t const *ptr, unsigned int n, BlockHash *hash) {
+    BlockHashFunction function = block_hash_function(engine);
+    uint64_t acc[BLOCK_HASH_LANES];
+    memset(hash, 0, sizeof (BlockHash));
+    if (function == NULL) { return; }
+    block_hash_start(acc);
+    function(acc, ptr, n);
+    block_hash_finish(acc, n, hash);
+}
+
+/* blocks [first, first + count) of a buffer, for one thread */
+typedef struct {
+    uint8_t const *ptr;
+    uint32_t n;
+    unsigned int block_size;
+    BlockHash *hashes;
+    uint32_t first, count;
+    pthread_t thread;
+} BlockHashJob;
+
+static void *block_hash_task(void *ext) {
+    BlockHashJob *job = (BlockHashJob *) ext;
+    for (uint32_t i = job->first; i < job->first + job->count; ++i) {
+        uint32_t offset = i * job->block_size;
+        unsigned int length = (job->n - offset < job->block_size) ? job->n - offset : job->block_size;
+        block_hash(&job->ptr[offset], length, &job->hashes[i]);
+    }
+    return NULL;
+}
+
+void block_hash_blocks(uint8_t const *ptr, uint32_t n, unsigned int block_size, BlockHash *hashes,
+    unsigned int threads) {
+    BlockHashJob jobs[BLOCK_HASH_MAX_THREADS];
+    const uint32_t n_blocks = (n + block_size - 1) / block_size;
+    if (n_blocks == 0) { return; }
+
+    if (threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (cpus > 0) ? cpus : 1;
+    }
+    if (threads > n / BLOCK_HASH_MIN_SPAN) { threads = n / BLOCK_HASH_MIN_SPAN; } /* a thread costs tens of us */
+    if (threads > BLOCK_HASH_MAX_THREADS) { threads = BLOCK_HASH_MAX_THREADS; }
+    if (threads > n_blocks) { threads = n_blocks; }
+    if (threads == 0) { threads = 1; }
+
+    uint32_t first = 0;
+    for (unsigned int t = 0; t < threads; ++t) {
+        BlockHashJob *job = &jobs[t];
+        job->ptr = ptr;
+        job->n = n;
+        job->block_size = block_size;
+        job->hashes = hashes;
+        job->first = first;
+        job->count = n_blocks / threads + ((t < n_blocks % threads) ? 1 : 0);
+        first += job->count;
+    }
+
+    /* the last share is ours. a share whose thread cannot be had is ours too */
+    unsigned int started[BLOCK_HASH_MAX_THREADS];
+    for (unsigned int t = 0; t + 1 < threads; ++t) {
+        started[t] = (pthread_create(&jobs[t].thread, NULL, block_hash_task, &jobs[t]) == 0) ? 1 : 0;
+    }
+    block_hash_task(&jobs[threads - 1]);
+    for (unsigned int t = 0; t + 1 < threads; ++t) {
+        if (started[t]) {
+            pthread_join(jobs[t].thread, NULL);
+        } else {
+            block_hash_task(&jobs[t]);
+        }
+    }
+}
@@ -0,0 +1,437 @@
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CRC_HAVE_X86 (1)
+#endif
+
+#include "crc.h"
+
+#define CRC16_POLYNOMIAL (0x1021)
+
+/* crc16_lut[k][b] = crc of byte b followed by k zero bytes. [0] is the classic byte-at-a-time table */
+static uint16_t crc16_lut[16][256];
+
+/* x^k mod P for the clmul folding distances */
+static uint64_t crc16_k128, crc16_k192, crc16_k512, crc16_k576;
+
+static pthread_once_t crc16_once = PTHREAD_ONCE_INIT;
+
+static uint16_t crc16_bitwise(uint16_t crc, uint8_t const *ptr, unsigned int n) {
+    for (unsigned int j = 0; j < n; ++j) {
+        crc = crc ^ (uint16_t) (ptr[j] << 8);
+        for (int i = 0; i < 8; ++i) {
+            if (crc & 0x8000) { crc = (crc << 1) ^ CRC16_POLYNOMIAL; } else { crc = (crc << 1); }
+        }
+    }
+    return crc;
+}
+
+static uint16_t crc16_table(uint16_t crc, uint8_t const *ptr, unsigned int n) {
+    for (unsigned int j = 0; j < n; ++j) {
+        crc = (crc << 8) ^ crc16_lut[0][(crc >> 8) ^ ptr[j]];
+    }
+    return crc;
+}
+
+static uint16_t crc16_slice8(uint16_t crc, uint8_t const *ptr, unsigned int n) {
+    while (n >= 8) {
+        crc = crc16_lut[7][ptr[0] ^ (crc >> 8)] ^ crc16_lut[6][ptr[1] ^ (crc & 0xff)] ^
+              crc16_lut[5][ptr[2]] ^ crc16_lut[4][ptr[3]] ^ crc16_lut[3][ptr[4]] ^
+              crc16_lut[2][ptr[5]] ^ crc16_lut[1][ptr[6]] ^ crc16_lut[0][ptr[7]];
+        ptr += 8;
+        n -= 8;
+    }
+    return crc16_table(crc, ptr, n);
+}
+
+static uint16_t crc16_slice16(uint16_t crc, uint8_t const *ptr, unsigned int n) {
+    while (n >= 16) {
+        crc = crc16_lut[15][ptr[0] ^ (crc >> 8)] ^ crc16_lut[14][ptr[1] ^ (crc & 0xff)] ^
+              crc16_lut[13][ptr[2]] ^ crc16_lut[12][ptr[3]] ^ crc16_lut[11][ptr[4]] ^
+              crc16_lut[10][ptr[5]] ^ crc16_lut[9][ptr[6]] ^ crc16_lut[8][ptr[7]] ^
+              crc16_lut[7][ptr[8]] ^ crc16_lut[6][ptr[9]] ^ crc16_lut[5][ptr[10]] ^
+              crc16_lut[4][ptr[11]] ^ crc16_lut[3][ptr[12]] ^ crc16_lut[2][ptr[13]] ^
+              crc16_lut[1][ptr[14]] ^ crc16_lut[0][ptr[15]];
+        ptr += 16;
+        n -= 16;
+    }
+    return crc16_slice8(crc, ptr, n);
+}
+
+#ifdef CRC_HAVE_X86
+
+/*
+ * fold 16-byte blocks with carry-less multiplies. blocks are byte-swapped so bit 127 of the register is the first
+ * message bit. x * x^128 + y is replaced by hi(x) * (x^192 mod P) + lo(x) * (x^128 mod P) + y, which leaves the
+ * message congruent mod P. the last 16-byte remainder and the tail go through the table engine.
+ */
+__attribute__((target("pclmul,ssse3")))
+static uint16_t crc16_clmul(uint16_t crc, uint8_t const *ptr, unsigned int n) {
+    if (n < 64) { return crc16_slice8(crc, ptr, n); }
+
+    const __m128i swap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m128i k1 = _mm_set_epi64x((long long) crc16_k192, (long long) crc16_k128);
+    const __m128i k4 = _mm_set_epi64x((long long) crc16_k576, (long long) crc16_k512);
+
+    /* initial crc is xor-ed into the first two message bytes */
+    __m128i x0 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *) &ptr[0]), swap);
+    __m128i x1 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *) &ptr[16]), swap);
+    __m128i x2 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *) &ptr[32]), swap);
+    __m128i x3 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *) &ptr[48]), swap);
+    x0 = _mm_xor_si128(x0, _mm_set_epi64x((long long) ((uint64_t) crc << 48), 0));
+    ptr += 64;
+    n -= 64;
+
+#define CRC16_FOLD(x, k, y) \
+    _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128((x), (k), 0x00), _mm_clmulepi64_si128((x), (k), 0x11)), (y))
+
+    while (n >= 64) {
+        x0 = CRC16_FOLD(x0, k4, _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *) &ptr[0]), swap));
+        x1 = CRC16_FOLD(x1, k4, _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *) &ptr[16]), swap));
+        x2 = CRC16_FOLD(x2, k4, _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *) &ptr[32]), swap));
+        x3 = CRC16_FOLD(x3, k4, _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *) &ptr[48]), swap));
+        ptr += 64;
+        n -= 64;
+    }
+
+    x1 = CRC16_FOLD(x0, k1, x1);
+    x2 = CRC16_FOLD(x1, k1, x2);
+    x0 = CRC16_FOLD(x2, k1, x3);
+
+    while (n >= 16) {
+        x0 = CRC16_FOLD(x0, k1, _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *) ptr), swap));
+        ptr += 16;
+        n -= 16;
+    }
+
+#undef CRC16_FOLD
+
+    uint8_t folded[16];
+    _mm_storeu_si128((__m128i *) folded, _mm_shuffle_epi8(x0, swap));
+    crc = crc16_slice8(0, folded, sizeof (folded));
+    return crc16_table(crc, ptr, n);
+}
+
+#endif
+
+/* @brief x^k mod P */
+static uint64_t crc16_xpow(unsigned int k) {
+    uint32_t r = 1;
+    for (unsigned int i = 0; i < k; ++i) {
+        r <<= 1;
+        if (r & 0x10000) { r ^= (0x10000 | CRC16_POLYNOMIAL); }
+    }
+    return r;
+}
+
+static void crc16_init(void) {
+    for (unsigned int b = 0; b < 256; ++b) {
+        uint8_t byte = b;
+        crc16_lut[0][b] = crc16_bitwise(0, &byte, 1);
+    }
+    for (unsigned int k = 1; k < 16; ++k) {
+        for (unsigned int b = 0; b < 256; ++b) {
+            uint16_t prev = crc16_lut[k - 1][b];
+            crc16_lut[k][b] = (prev << 8) ^ crc16_lut[0][prev >> 8];
+        }
+    }
+    crc16_k128 = crc16_xpow(128);
+    crc16_k192 = crc16_xpow(192);
+    crc16_k512 = crc16_xpow(512);
+    crc16_k576 = crc16_xpow(576);
+}
+
+int crc16_engine_supported(int engine) {
+    switch (engine) {
+        case CRC16_ENGINE_AUTO:
+        case CRC16_ENGINE_BITWISE:
+        case CRC16_ENGINE_TABLE:
+        case CRC16_ENGINE_SLICE8:
+        case CRC16_ENGINE_SLICE16:
+            return 1;
+#ifdef CRC_HAVE_X86
+        case CRC16_ENGINE_CLMUL:
+            __builtin_cpu_init();
+            return (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3")) ? 1 : 0;
+#endif
+        default:
+            return 0;
+    }
+}
+
+char const *crc16_engine_name(int engine) {
+    static char const * const names[CRC16_ENGINES] = { "auto", "bitwise", "table", "slice8", "slice16", "clmul" };
+    return ((engine >= 0) && (engine < CRC16_ENGINES)) ? names[engine] : "unknown";
+}
+
+typedef uint16_t (*Crc16Function)(uint16_t crc, uint8_t const *ptr, unsigned int n);
+
+static Crc16Function crc16_function(int engine) {
+    pthread_once(&crc16_once, crc16_init);
+    if (crc16_engine_supported(engine) == 0) { return NULL; }
+    switch (engine) {
+        case CRC16_ENGINE_BITWISE: return crc16_bitwise;
+        case CRC16_ENGINE_TABLE: return crc16_table;
+        case CRC16_ENGINE_SLICE8: return crc16_slice8;
+        case CRC16_ENGINE_SLICE16: return crc16_slice16;
+#ifdef CRC_HAVE_X86
+        case CRC16_ENGINE_CLMUL: return crc16_clmul;
+#endif
+        default: break;
+    }
+    return crc16_function(crc16_engine_supported(CRC16_ENGINE_CLMUL) ? CRC16_ENGINE_CLMUL : CRC16_ENGINE_SLICE16);
+}
+
+static uint16_t crc16_resolve(uint16_t crc, uint8_t const *ptr, unsigned int n);
+
+static Crc16Function crc16_active = crc16_resolve;
+static int crc16_active_engine = CRC16_ENGINE_AUTO;
+
+/* first call picks the engine, later calls go straight to it */
+static uint16_t crc16_resolve(uint16_t crc, uint8_t const *ptr, unsigned int n) {
+    crc16_select_engine(CRC16_ENGINE_AUTO);
+    return crc16_active(crc, ptr, n);
+}
+
+int crc16_select_engine(int engine) {
+    Crc16Function function = crc16_function(engine);
+    if (function == NULL) { return -1; }
+    if (engine == CRC16_ENGINE_AUTO) {
+        engine = crc16_engine_supported(CRC16_ENGINE_CLMUL) ? CRC16_ENGINE_CLMUL : CRC16_ENGINE_SLICE16;
+    }
+    crc16_active_engine = engine;
+    __atomic_store_n(&crc16_active, function, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int crc16_engine(void) {
+    return crc16_active_engine;
+}
+
+uint16_t crc16_update(uint16_t crc, uint8_t const *ptr, unsigned int n) {
+    return __atomic_load_n(&crc16_active, __ATOMIC_ACQUIRE)(crc, ptr, n);
+}
+
+uint16_t crc16(uint8_t const *ptr, unsigned int n) {
+    return crc16_update(0, ptr, n);
+}
+
+uint16_t crc16_update_engine(int engine, uint16_t crc, uint8_t const *ptr, unsigned int n) {
+    Crc16Function function = crc16_function(engine);
+    return function ? function(crc, ptr, n) : crc;
+}
+
+/* crc-32c. the functions below work on the raw register: crc32c_update() does the pre and post inversion */
+
+#define CRC32C_POLYNOMIAL (0x82f63b78)
+
+/* crc32c_lut[k][b] = register after byte b followed by k zero bytes */
+static uint32_t crc32c_lut[8][256];
+
+/* crc32c_shift1k[k][b] = register b << 8k after 1 KiB of zeros. the sse4.2 engine stitches its lanes with these */
+static uint32_t crc32c_shift1k[4][256], crc32c_shift2k[4][256];
+
+/* crc32c_x2n[k] = x^(2^k) mod P, reflected. crc32c_combine() shifts a crc over any 32-bit byte count with them */
+static uint32_t crc32c_x2n[3 + 32];
+
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static uint32_t crc32c_bitwise(uint32_t crc, uint8_t const *ptr, unsigned int n) {
+    for (unsigned int j = 0; j < n; ++j) {
+        crc ^= ptr[j];
+        for (int i = 0; i < 8; ++i) { crc = (crc >> 1) ^ (CRC32C_POLYNOMIAL & (0 - (crc & 1))); }
+    }
+    return crc;
+}
+
+static uint32_t crc32c_slice8(uint32_t crc, uint8_t const *ptr, unsigned int n) {
+    while (n >= 8) {
+        uint32_t lo = crc ^ (ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | ((uint32_t) ptr[3] << 24));
+        uint32_t hi = ptr[4] | (ptr[5] << 8) | (ptr[6] << 16) | ((uint32_t) ptr[7] << 24);
+        crc = crc32c_lut[7][lo & 0xff] ^ crc32c_lut[6][(lo >> 8) & 0xff] ^
+              crc32c_lut[5][(lo >> 16) & 0xff] ^ crc32c_lut[4][lo >> 24] ^
+              crc32c_lut[3][hi & 0xff] ^ crc32c_lut[2][(hi >> 8) & 0xff] ^
+              crc32c_lut[1][(hi >> 16) & 0xff] ^ crc32c_lut[0][hi >> 24];
+        ptr += 8;
+        n -= 8;
+    }
+    for (unsigned int j = 0; j < n; ++j) { crc = (crc >> 8) ^ crc32c_lut[0][(crc ^ ptr[j]) & 0xff]; }
+    return crc;
+}
+
+#if defined(__x86_64__)
+
+/* the crc32 instruction has a latency of 3 and a throughput of 1, so three independent streams keep it busy */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, uint8_t const *ptr, unsigned int n) {
+    uint64_t c0 = crc;
+    while (n && ((uintptr_t) ptr & 7)) {
+        c0 = _mm_crc32_u8(c0, *ptr++);
+        --n;
+    }
+
+    /* 3 x 1 KiB lanes, stitched together by shifting the first two lanes' crcs over what follows them */
+    while (n >= 3 * 1024) {
+        uint64_t c1 = 0, c2 = 0;
+        uint64_t const *p = (uint64_t const *) ptr;
+        for (unsigned int i = 0; i < 1024 / 8; ++i) {
+            c0 = _mm_crc32_u64(c0, p[i]);
+            c1 = _mm_crc32_u64(c1, p[i + 1024 / 8]);
+            c2 = _mm_crc32_u64(c2, p[i + 2 * 1024 / 8]);
+        }
+        uint64_t a = 0, b = 0;
+        for (int k = 0; k < 4; ++k) { /* crc of c0 followed by 2 KiB of zeros, and of c1 followed by 1 KiB */
+            a ^= crc32c_shift2k[k][(c0 >> (8 * k)) & 0xff];
+            b ^= crc32c_shift1k[k][(c1 >> (8 * k)) & 0xff];
+        }
+        c0 = a ^ b ^ c2;
+        ptr += 3 * 1024;
+        n -= 3 * 1024;
+    }
+
+    while (n >= 8) {
+        uint64_t v;
+        memcpy(&v, ptr, 8);
+        c0 = _mm_crc32_u64(c0, v);
+        ptr += 8;
+        n -= 8;
+    }
+    while (n--) { c0 = _mm_crc32_u8(c0, *ptr++); }
+    return c0;
+}
+
+#endif
+
+/* @brief the register is linear in its start value: zeros shift each of its 32 bits to a fixed pattern */
+static void crc32c_shift_table(uint32_t table[4][256], unsigned int zeros) {
+    static const uint8_t zero[2048];
+    uint32_t bit[32];
+    for (unsigned int i = 0; i < 32; ++i) { bit[i] = crc32c_slice8((uint32_t) 1 << i, zero, zeros); }
+    for (unsigned int k = 0; k < 4; ++k) {
+        for (unsigned int b = 0; b < 256; ++b) {
+            uint32_t r = 0;
+            for (unsigned int i = 0; i < 8; ++i) { r ^= (b & (1 << i)) ? bit[8 * k + i] : 0; }
+            table[k][b] = r;
+        }
+    }
+}
+
+/* @brief a * b mod P, both reflected: bit 31 is x^0 */
+static uint32_t crc32c_multmodp(uint32_t a, uint32_t b) {
+    uint32_t product = 0;
+    for (uint32_t m = (uint32_t) 1 << 31; m; m >>= 1) {
+        if (a & m) { product ^= b; }
+        b = (b >> 1) ^ (CRC32C_POLYNOMIAL & (0 - (b & 1)));
+    }
+    return product;
+}
+
+static void crc32c_init(void) {
+    for (unsigned int b = 0; b < 256; ++b) {
+        uint8_t byte = b;
+        crc32c_lut[0][b] = crc32c_bitwise(0, &byte, 1);
+    }
+    for (unsigned int k = 1; k < 8; ++k) {
+        for (unsigned int b = 0; b < 256; ++b) {
+            uint32_t prev = crc32c_lut[k - 1][b];
+            crc32c_lut[k][b] = (prev >> 8) ^ crc32c_lut[0][prev & 0xff];
+        }
+    }
+    crc32c_shift_table(crc32c_shift1k, 1024);
+    crc32c_shift_table(crc32c_shift2k, 2048);
+    crc32c_x2n[0] = (uint32_t) 1 << 30; /* x^1 */
+    for (unsigned int k = 1; k < 3 + 32; ++k) { crc32c_x2n[k] = crc32c_multmodp(crc32c_x2n[k - 1], crc32c_x2n[k - 1]); }
+}
+
+int crc32c_engine_supported(int engine) {
+    switch (engine) {
+        case CRC32C_ENGINE_AUTO:
+        case CRC32C_ENGINE_BITWISE:
+        case CRC32C_ENGINE_SLICE8:
+            return 1;
+#if defined(__x86_64__)
+        case CRC32C_ENGINE_SSE42:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("sse4.2") ? 1 : 0;
+#endif
+        default:
+            return 0;
+    }
+}
+
+char const *crc32c_engine_name(int engine) {
+    static char const * const names[CRC32C_ENGINES] = { "auto", "bitwise", "slice8", "sse4.2" };
+    return ((engine >= 0) && (engine < CRC32C_ENGINES)) ? names[engine] : "unknown";
+}
+
+typedef uint32_t (*Crc32cFunction)(uint32_t crc, uint8_t const *ptr, unsigned int n);
+
+static int crc32c_best_engine(void) {
+    return crc32c_engine_supported(CRC32C_ENGINE_SSE42) ? CRC32C_ENGINE_SSE42 : CRC32C_ENGINE_SLICE8;
+}
+
+static Crc32cFunction crc32c_function(int engine) {
+    pthread_once(&crc32c_once, crc32c_init);
+    if (crc32c_engine_supported(engine) == 0) { return NULL; }
+    switch (engine) {
+        case CRC32C_ENGINE_BITWISE: return crc32c_bitwise;
+        case CRC32C_ENGINE_SLICE8: return crc32c_slice8;
+#if defined(__x86_64__)
+        case CRC32C_ENGINE_SSE42: return crc32c_sse42;
+#endif
+        default: break;
+    }
+    return crc32c_function(crc32c_best_engine());
+}
+
+static uint32_t crc32c_resolve(uint32_t crc, uint8_t const *ptr, unsigned int n);
+
+static Crc32cFunction crc32c_active = crc32c_resolve;
+static int crc32c_active_engine = CRC32C_ENGINE_AUTO;
+
+/* first call picks the engine, later calls go straight to it */
+static uint32_t crc32c_resolve(uint32_t crc, uint8_t const *ptr, unsigned int n) {
+    crc32c_select_engine(CRC32C_ENGINE_AUTO);
+    return crc32c_active(crc, ptr, n);
+}
+
+int crc32c_select_engine(int engine) {
+    Crc32cFunction function = crc32c_function(engine);
+    if (function == NULL) { return -1; }
+    crc32c_active_engine = (engine == CRC32C_ENGINE_AUTO) ? crc32c_best_engine() : engine;
+    __atomic_store_n(&crc32c_active, function, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int crc32c_engine(void) {
+    return crc32c_active_engine;
+}
+
+uint32_t crc32c_update(uint32_t crc, uint8_t const *ptr, unsigned int n) {
+    return ~__atomic_load_n(&crc32c_active, __ATOMIC_ACQUIRE)(~crc, ptr, n);
+}
+
+uint32_t crc32c(uint8_t const *ptr, unsigned int n) {
+    return crc32c_update(0, ptr, n);
+}
+
+uint32_t crc32c_update_engine(int engine, uint32_t crc, uint8_t const *ptr, unsigned int n) {
+    Crc32cFunction function = crc32c_function(engine);
+    return function ? ~function(~crc, ptr, n) : crc;
+}
+
+/*
+ * @brief crc of a followed by b, from the crc of each and the length of b. a run of zeros shifts the register
+ *     the same whatever the bytes before it, so crc(a b) is crc(a) times x^(8 length) mod P, plus crc(b)
+ */
+uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, uint32_t length_b) {
+    pthread_once(&crc32c_once, crc32c_init);
+    uint32_t shift = (uint32_t) 1 << 31; /* x^0 */
+    for (unsigned int k = 3; length_b; length_b >>= 1, ++k) { /* 8 length = length << 3 */
+        if (length_b & 1) { shift = crc32c_multmodp(crc32c_x2n[k], shift); }
+    }
+    return crc32c_multmodp(shift, crc_a) ^ crc_b;
+}
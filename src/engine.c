@@ -0,0 +1,178 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "engine.h"
+#include "crc.h"
+
+#define XMODEM_ENGINE_INLINE static inline __attribute__((always_inline))
+
+/* the one body behind every engine. block_size and kind are constants in the specialised instances */
+XMODEM_ENGINE_INLINE void engine_build(XmodemPacket *packet, uint8_t const *data, unsigned int length,
+    uint8_t packet_id, unsigned int gather, const unsigned int block_size, const unsigned int kind) {
+    uint8_t * const staging = &packet->frame[3];
+    uint8_t * const footer = &packet->frame[3 + block_size];
+
+    packet->frame[0] = (block_size == XMODEM_1K_BUFF_SIZE) ? XMODEM_STX : XMODEM_SOH;
+    packet->frame[1] = packet_id;
+    packet->frame[2] = ~packet_id;
+    packet->payload_size = block_size;
+    packet->header_size = 3;
+    packet->footer_offset = 3 + block_size;
+    packet->footer_size = (kind == CHECKSUM_OPTION_CRC) ? 2 : 1;
+
+    if (gather && (length == block_size)) {
+        packet->payload = data;
+    } else { /* length stays a run time value: libc copies 1 KiB faster than the inline rep movs a constant gets */
+        packet->payload = staging;
+        memcpy(staging, data, length);
+        if (length < block_size) { memset(&staging[length], XMODEM_CTZ, block_size - length); } /* pad with 0x1a */
+    }
+
+    if (kind == CHECKSUM_OPTION_CRC) {
+        uint16_t crc = crc16(packet->payload, block_size);
+        footer[0] = (crc >> 8) & 0xff;
+        footer[1] = crc & 0xff;
+    } else {
+        uint8_t checksum = 0;
+        for (unsigned int i = 0; i < block_size; ++i) { checksum += packet->payload[i]; }
+        footer[0] = checksum;
+    }
+}
+
+XMODEM_ENGINE_INLINE int engine_verify(uint8_t const *packet, const unsigned int block_size, const unsigned int kind) {
+    uint8_t const * const payload = &packet[3];
+    uint8_t const * const footer = &packet[3 + block_size];
+    if (kind == CHECKSUM_OPTION_CRC) {
+        return (crc16(payload, block_size) == ((footer[0] << 8) | footer[1])) ? 1 : 0;
+    }
+    uint8_t checksum = 0;
+    for (unsigned int i = 0; i < block_size; ++i) { checksum += payload[i]; }
+    return (checksum == footer[0]) ? 1 : 0;
+}
+
+static void generic_build(XmodemEngine const *engine, XmodemPacket *packet, uint8_t const *data, unsigned int length,
+    uint32_t packet_id, unsigned int gather) {
+    engine_build(packet, data, length, packet_id, gather, engine->block_size, engine->kind);
+}
+
+static int generic_verify(XmodemEngine const *engine, uint8_t const *packet) {
+    return engine_verify(packet, engine->block_size, engine->kind);
+}
+
+#define XMODEM_ENGINE(name, block_size, kind) \
+    static void name##_build(XmodemEngine const *engine, XmodemPacket *packet, uint8_t const *data, \
+        unsigned int length, uint32_t packet_id, unsigned int gather) { \
+        (void) engine; \
+        engine_build(packet, data, length, packet_id, gather, (block_size), (kind)); \
+    } \
+    static int name##_verify(XmodemEngine const *engine, uint8_t const *packet) { \
+        (void) engine; \
+        return engine_verify(packet, (block_size), (kind)); \
+    }
+
+XMODEM_ENGINE(engine_128_sum, XMODEM_BUFF_SIZE, CHECKSUM_OPTION_SUM)
+XMODEM_ENGINE(engine_128_crc, XMODEM_BUFF_SIZE, CHECKSUM_OPTION_CRC)
+XMODEM_ENGINE(engine_1k_sum, XMODEM_1K_BUFF_SIZE, CHECKSUM_OPTION_SUM)
+XMODEM_ENGINE(engine_1k_crc, XMODEM_1K_BUFF_SIZE, CHECKSUM_OPTION_CRC)
+
+#undef XMODEM_ENGINE
+
+/*
+ * @brief extended packets carry their length, so the payload is never padded or copied. field goes where the length
+ *     - 1 goes, but for parity packets
+ */
+static void extended_frame(XmodemPacket *packet, uint8_t size_byte, uint8_t const *data, unsigned int length,
+    uint32_t packet_id, uint16_t field) {
+    uint8_t * const frame = packet->frame;
+    frame[0] = XMODEM_XTX;
+    frame[1] = size_byte;
+    frame[2] = packet_id >> 24;
+    frame[3] = packet_id >> 16;
+    frame[4] = packet_id >> 8;
+    frame[5] = packet_id;
+    frame[6] = field >> 8;
+    frame[7] = field;
+    packet->payload = data;
+    packet->payload_size = length;
+    packet->header_size = XMODEM_EXTENDED_HEADER_SIZE;
+    packet->footer_offset = XMODEM_EXTENDED_HEADER_SIZE;
+    packet->footer_size = XMODEM_EXTENDED_FOOTER_SIZE;
+
+    uint32_t crc = crc32c_update(crc32c(&frame[1], XMODEM_EXTENDED_HEADER_SIZE - 1), data, length);
+    uint8_t * const footer = &frame[XMODEM_EXTENDED_HEADER_SIZE];
+    footer[0] = crc >> 24;
+    footer[1] = crc >> 16;
+    footer[2] = crc >> 8;
+    footer[3] = crc;
+}
+
+static void extended_build(XmodemEngine const *engine, XmodemPacket *packet, uint8_t const *data, unsigned int length,
+    uint32_t packet_id, unsigned int gather) {
+    (void) gather;
+    extended_frame(packet, __builtin_ctz(engine->block_size), data, length, packet_id, length - 1);
+}
+
+static int extended_verify(XmodemEngine const *engine, uint8_t const *packet) {
+    unsigned int length = ((packet[6] << 8) | packet[7]) + 1;
+    if (((packet[1] & ~XMODEM_EXTENDED_PACKED) != __builtin_ctz(engine->block_size)) || (length > engine->block_size)) {
+        return 0;
+    }
+    uint8_t const *footer = &packet[XMODEM_EXTENDED_HEADER_SIZE + length];
+    uint32_t crc = crc32c(&packet[1], XMODEM_EXTENDED_HEADER_SIZE - 1 + length);
+    return (crc == (((uint32_t) footer[0] << 24) | (footer[1] << 16) | (footer[2] << 8) | footer[3])) ? 1 : 0;
+}
+
+static XmodemEngine const xmodem_engines[] = {
+    { "128/sum", XMODEM_BUFF_SIZE, CHECKSUM_OPTION_SUM, engine_128_sum_build, engine_128_sum_verify },
+    { "128/crc", XMODEM_BUFF_SIZE, CHECKSUM_OPTION_CRC, engine_128_crc_build, engine_128_crc_verify },
+    { "1k/sum", XMODEM_1K_BUFF_SIZE, CHECKSUM_OPTION_SUM, engine_1k_sum_build, engine_1k_sum_verify },
+    { "1k/crc", XMODEM_1K_BUFF_SIZE, CHECKSUM_OPTION_CRC, engine_1k_crc_build, engine_1k_crc_verify },
+    { "4k/crc32c", 4 * 1024, CHECKSUM_OPTION_CRC32C, extended_build, extended_verify },
+    { "8k/crc32c", 8 * 1024, CHECKSUM_OPTION_CRC32C, extended_build, extended_verify },
+    { "16k/crc32c", 16 * 1024, CHECKSUM_OPTION_CRC32C, extended_build, extended_verify },
+    { "32k/crc32c", 32 * 1024, CHECKSUM_OPTION_CRC32C, extended_build, extended_verify },
+    { "64k/crc32c", 64 * 1024, CHECKSUM_OPTION_CRC32C, extended_build, extended_verify },
+};
+
+static XmodemEngine const xmodem_generic_engines[] = {
+    { "128/sum", XMODEM_BUFF_SIZE, CHECKSUM_OPTION_SUM, generic_build, generic_verify },
+    { "128/crc", XMODEM_BUFF_SIZE, CHECKSUM_OPTION_CRC, generic_build, generic_verify },
+    { "1k/sum", XMODEM_1K_BUFF_SIZE, CHECKSUM_OPTION_SUM, generic_build, generic_verify },
+    { "1k/crc", XMODEM_1K_BUFF_SIZE, CHECKSUM_OPTION_CRC, generic_build, generic_verify },
+};
+
+static XmodemEngine const *find_engine(XmodemEngine const *engines, unsigned int n, unsigned int block_size,
+    unsigned int kind) {
+    for (unsigned int i = 0; i < n; ++i) {
+        if ((engines[i].block_size == block_size) && (engines[i].kind == kind)) { return &engines[i]; }
+    }
+    return NULL;
+}
+
+XmodemEngine const *xmodem_engine(unsigned int block_size, unsigned int kind) {
+    return find_engine(xmodem_engines, sizeof (xmodem_engines) / sizeof (xmodem_engines[0]), block_size, kind);
+}
+
+XmodemEngine const *xmodem_engine_generic(unsigned int block_size, unsigned int kind) {
+    return find_engine(xmodem_generic_engines, sizeof (xmodem_generic_engines) / sizeof (xmodem_generic_engines[0]),
+        block_size, kind);
+}
+
+/*
+ * @brief extended packet for a block of block_size bytes, or the rest of the file, whose payload is the length
+ *     bytes at data that it lz-packs to
+ */
+void xmodem_extended_build_packed(XmodemPacket *packet, unsigned int block_size, uint8_t const *data,
+    unsigned int length, uint32_t packet_id) {
+    extended_frame(packet, XMODEM_EXTENDED_PACKED | __builtin_ctz(block_size), data, length, packet_id, length - 1);
+}
+
+/*
+ * @brief parity packet j of m for the group of k blocks of block_size bytes from first_id, whose payload is the
+ *     block_size + XMODEM_FEC_DESCRIPTOR_SIZE bytes at parity
+ */
+void xmodem_extended_build_parity(XmodemPacket *packet, unsigned int block_size, uint8_t const *parity,
+    uint32_t first_id, unsigned int k, unsigned int m, unsigned int j) {
+    extended_frame(packet, XMODEM_EXTENDED_PARITY | __builtin_ctz(block_size), parity,
+        block_size + XMODEM_FEC_DESCRIPTOR_SIZE, first_id, ((k - 1) << 8) | ((m - 1) << 4) | j);
+}
@@ -0,0 +1,239 @@
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FEC_HAVE_X86 (1)
+#endif
+
+#include "fec.h"
+
+#define FEC_POLYNOMIAL (0x11d) /* x^8 + x^4 + x^3 + x^2 + 1, as in most reed-solomon codes */
+
+static uint8_t gf_exp[2 * 255];
+static uint8_t gf_log[256];
+static uint8_t gf_product[256][256];
+static uint8_t gf_nibbles[256][2][16]; /* c times each low nibble, and times each high nibble */
+
+static pthread_once_t fec_once = PTHREAD_ONCE_INIT;
+
+static void fec_init(void) {
+    unsigned int x = 1;
+    for (unsigned int i = 0; i < 255; ++i) {
+        gf_exp[i] = gf_exp[i + 255] = x;
+        gf_log[x] = i;
+        x <<= 1;
+        if (x & 0x100) { x ^= FEC_POLYNOMIAL; }
+    }
+    for (unsigned int a = 1; a < 256; ++a) {
+        for (unsigned int b = 1; b < 256; ++b) { gf_product[a][b] = gf_exp[gf_log[a] + gf_log[b]]; }
+        for (unsigned int v = 0; v < 16; ++v) {
+            gf_nibbles[a][0][v] = gf_product[a][v];
+            gf_nibbles[a][1][v] = gf_product[a][v << 4];
+        }
+    }
+}
+
+static uint8_t gf_inverse(uint8_t a) {
+    return gf_exp[255 - gf_log[a]];
+}
+
+/*
+ * c(j, i) = 1 / (x_j + y_i) with x_j = FEC_MAX_DATA + j and y_i = i, all distinct, so that every square submatrix
+ * can be inverted. each column is divided by its first row, which keeps that true and makes the first row ones
+ */
+uint8_t fec_coefficient(unsigned int j, unsigned int i) {
+    pthread_once(&fec_once, fec_init);
+    if (j == 0) { return 1; }
+    return gf_product[FEC_MAX_DATA ^ i][gf_inverse((FEC_MAX_DATA + j) ^ i)];
+}
+
+static void xor_region(uint8_t *dst, uint8_t const *src, unsigned int n) {
+    unsigned int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t a, b;
+        memcpy(&a, &dst[i], sizeof (a));
+        memcpy(&b, &src[i], sizeof (b));
+        a ^= b;
+        memcpy(&dst[i], &a, sizeof (a));
+    }
+    for (; i < n; ++i) { dst[i] ^= src[i]; }
+}
+
+static void fec_mul_add_scalar(uint8_t *dst, uint8_t const *src, uint8_t c, unsigned int n) {
+    uint8_t const *row = gf_product[c];
+    for (unsigned int i = 0; i < n; ++i) { dst[i] ^= row[src[i]]; }
+}
+
+#ifdef FEC_HAVE_X86
+
+/* each byte is split into nibbles, and each nibble looks its product up in a 16-entry table with vpshufb */
+__attribute__((target("avx2")))
+static void fec_mul_add_avx2(uint8_t *dst, uint8_t const *src, uint8_t c, unsigned int n) {
+    const __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const *) gf_nibbles[c][0]));
+    const __m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const *) gf_nibbles[c][1]));
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    unsigned int i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i x = _mm256_loadu_si256((__m256i const *) &src[i]);
+        __m256i product = _mm256_xor_si256(_mm256_shuffle_epi8(lo, _mm256_and_si256(x, nibble)),
+            _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi64(x, 4), nibble)));
+        __m256i d = _mm256_loadu_si256((__m256i const *) &dst[i]);
+        _mm256_storeu_si256((__m256i *) &dst[i], _mm256_xor_si256(d, product));
+    }
+    fec_mul_add_scalar(&dst[i], &src[i], c, n - i);
+}
+
+#endif
+
+int fec_engine_supported(int engine) {
+    switch (engine) {
+        case FEC_ENGINE_AUTO:
+        case FEC_ENGINE_SCALAR:
+            return 1;
+#ifdef FEC_HAVE_X86
+        case FEC_ENGINE_AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") ? 1 : 0;
+#endif
+        default:
+            return 0;
+    }
+}
+
+char const *fec_engine_name(int engine) {
+    static char const * const names[FEC_ENGINES] = { "auto", "scalar", "avx2" };
+    return ((engine >= 0) && (engine < FEC_ENGINES)) ? names[engine] : "unknown";
+}
+
+typedef void (*FecFunction)(uint8_t *dst, uint8_t const *src, uint8_t c, unsigned int n);
+
+static int fec_best_engine(void) {
+    return fec_engine_supported(FEC_ENGINE_AVX2) ? FEC_ENGINE_AVX2 : FEC_ENGINE_SCALAR;
+}
+
+static FecFunction fec_function(int engine) {
+    pthread_once(&fec_once, fec_init);
+    if (fec_engine_supported(engine) == 0) { return NULL; }
+    switch (engine) {
+        case FEC_ENGINE_SCALAR: return fec_mul_add_scalar;
+#ifdef FEC_HAVE_X86
+        case FEC_ENGINE_AVX2: return fec_mul_add_avx2;
+#endif
+        default: break;
+    }
+    return fec_function(fec_best_engine());
+}
+
+static void fec_resolve(uint8_t *dst, uint8_t const *src, uint8_t c, unsigned int n);
+
+static FecFunction fec_active = fec_resolve;
+static int fec_active_engine = FEC_ENGINE_AUTO;
+
+/* first call picks the engine, later calls go straight to it */
+static void fec_resolve(uint8_t *dst, uint8_t const *src, uint8_t c, unsigned int n) {
+    fec_select_engine(FEC_ENGINE_AUTO);
+    fec_active(dst, src, c, n);
+}
+
+int fec_select_engine(int engine) {
+    FecFunction function = fec_function(engine);
+    if (function == NULL) { return -1; }
+    fec_active_engine = (engine == FEC_ENGINE_AUTO) ? fec_best_engine() : engine;
+    __atomic_store_n(&fec_active, function, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int fec_engine(void) {
+    return fec_active_engine;
+}
+
+/* times 0 adds nothing and times 1 is a plain xor, whatever the engine */
+void fec_mul_add(uint8_t *dst, uint8_t const *src, uint8_t c, unsigned int n) {
+    if (c == 0) { return; }
+    if (c == 1) {
+        xor_region(dst, src, n);
+        return;
+    }
+    __atomic_load_n(&fec_active, __ATOMIC_ACQUIRE)(dst, src, c, n);
+}
+
+void fec_engine_mul_add(int engine, uint8_t *dst, uint8_t const *src, uint8_t c, unsigned int n) {
+    FecFunction function = fec_function(engine);
+    if (function) { function(dst, src, c, n); }
+}
+
+void fec_encode(uint8_t * const *parity, unsigned int m, unsigned int i, uint8_t const *data, unsigned int n) {
+    for (unsigned int j = 0; j < m; ++j) { fec_mul_add(parity[j], data, fec_coefficient(j, i), n); }
+}
+
+/* @brief a = its inverse, e x e, by gauss-jordan. -1 if it has none */
+static int invert(uint8_t a[FEC_MAX_PARITY][FEC_MAX_PARITY], unsigned int e) {
+    uint8_t b[FEC_MAX_PARITY][FEC_MAX_PARITY];
+    memset(b, 0, sizeof (b));
+    for (unsigned int r = 0; r < e; ++r) { b[r][r] = 1; }
+    for (unsigned int col = 0; col < e; ++col) {
+        unsigned int pivot = col;
+        while ((pivot < e) && (a[pivot][col] == 0)) { ++pivot; }
+        if (pivot == e) { return -1; }
+        if (pivot != col) { /* swap the pivot row up */
+            uint8_t t[2][FEC_MAX_PARITY];
+            memcpy(t[0], a[col], e);
+            memcpy(t[1], b[col], e);
+            memcpy(a[col], a[pivot], e);
+            memcpy(b[col], b[pivot], e);
+            memcpy(a[pivot], t[0], e);
+            memcpy(b[pivot], t[1], e);
+        }
+        uint8_t scale = gf_inverse(a[col][col]);
+        for (unsigned int k = 0; k < e; ++k) {
+            a[col][k] = gf_product[a[col][k]][scale];
+            b[col][k] = gf_product[b[col][k]][scale];
+        }
+        for (unsigned int r = 0; r < e; ++r) {
+            uint8_t f = a[r][col];
+            if ((r == col) || (f == 0)) { continue; }
+            for (unsigned int k = 0; k < e; ++k) {
+                a[r][k] ^= gf_product[f][a[col][k]];
+                b[r][k] ^= gf_product[f][b[col][k]];
+            }
+        }
+    }
+    memcpy(a, b, sizeof (b));
+    return 0;
+}
+
+/*
+ * each parity shard used, less what the data shards we hold add to it, leaves a sum over the lost ones alone. that
+ * is e equations in e unknowns, solved by inverting their coefficients
+ */
+int fec_rebuild(uint8_t * const *data, uint32_t lost, unsigned int k, uint8_t * const *parity, uint32_t have,
+    unsigned int n) {
+    unsigned int lost_index[FEC_MAX_PARITY], rows[FEC_MAX_PARITY], e = 0, n_rows = 0;
+    pthread_once(&fec_once, fec_init);
+    for (unsigned int i = 0; i < k; ++i) {
+        if ((lost & (1u << i)) == 0) { continue; }
+        if (e == FEC_MAX_PARITY) { return -1; }
+        lost_index[e++] = i;
+    }
+    for (unsigned int j = 0; (j < FEC_MAX_PARITY) && (n_rows < e); ++j) {
+        if (have & (1u << j)) { rows[n_rows++] = j; }
+    }
+    if (n_rows < e) { return -1; }
+    if (e == 0) { return 0; }
+
+    uint8_t a[FEC_MAX_PARITY][FEC_MAX_PARITY];
+    for (unsigned int r = 0; r < e; ++r) {
+        for (unsigned int i = 0; i < k; ++i) {
+            if ((lost & (1u << i)) == 0) { fec_mul_add(parity[rows[r]], data[i], fec_coefficient(rows[r], i), n); }
+        }
+        for (unsigned int c = 0; c < e; ++c) { a[r][c] = fec_coefficient(rows[r], lost_index[c]); }
+    }
+    if (invert(a, e) != 0) { return -1; }
+    for (unsigned int c = 0; c < e; ++c) {
+        memset(data[lost_index[c]], 0, n);
+        for (unsigned int r = 0; r < e; ++r) { fec_mul_add(data[lost_index[c]], parity[rows[r]], a[c][r], n); }
+    }
+    return 0;
+}
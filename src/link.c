@@ -0,0 +1,257 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "link.h"
+
+#define LINK_PIECE (256) /* a send goes on the line this much at a time, each with its own jitter */
+
+static uint64_t monotonic_ns(void) {
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec * 1000000000ull + spec.tv_nsec;
+}
+
+static void sleep_until(uint64_t ns) {
+    struct timespec spec = { ns / 1000000000ull, ns % 1000000000ull };
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &spec, NULL);
+}
+
+/* @brief whole milliseconds left before deadline, rounded up, for the queue waits */
+static unsigned int remaining_ms(uint64_t deadline, uint64_t now) {
+    return (deadline > now) ? (unsigned int) ((deadline - now + 999999) / 1000000) : 0;
+}
+
+/* @brief uniform in (0, 1], xorshift64* */
+static double link_random(LinkChannel *c) {
+    c->state ^= c->state >> 12;
+    c->state ^= c->state << 25;
+    c->state ^= c->state >> 27;
+    return ((c->state * 0x2545f4914f6cdd1dull) >> 11) * (1.0 / 9007199254740992.0) + 1e-18;
+}
+
+/* @brief trials from one hit to the next, for hits with probability p. never, if p is 0 */
+static uint64_t link_gap(LinkChannel *c, double p) {
+    if (p <= 0) { return UINT64_MAX / 2; }
+    if (p >= 1) { return 1; }
+    return 1 + (uint64_t) (log(link_random(c)) / log1p(-p));
+}
+
+static int channel_open(LinkChannel *c, LinkProfile const *profile, atomic_uint *closed) {
+    memset(c, 0, sizeof (*c));
+    c->profile = *profile;
+    if (c->profile.buffer_bytes == 0) { c->profile.buffer_bytes = LINK_BUFFER_BYTES; }
+    c->state = c->profile.seed ? c->profile.seed : 1;
+    c->byte_ns = c->profile.baud ? 10000000000ull / c->profile.baud : 0;
+    c->next_flip = link_gap(c, c->profile.bit_error_rate) - 1;
+    c->next_drop = link_gap(c, c->profile.drop_rate) - 1;
+    c->next_duplicate = link_gap(c, c->profile.duplicate_rate) - 1;
+    c->closed = closed;
+    c->scratch = malloc(2 * LINK_PIECE);
+    if (c->scratch == NULL) { return -1; }
+    if (queue_alloc(&c->bytes, LINK_RING_SIZE, 0) != 0) { return -1; }
+    if (queue_alloc(&c->chunks, LINK_CHUNKS * sizeof (LinkChunk), 0) != 0) { return -1; }
+    return 0;
+}
+
+static void channel_close(LinkChannel *c) {
+    queue_free(&c->bytes);
+    queue_free(&c->chunks);
+    free(c->scratch);
+    c->scratch = NULL;
+}
+
+int link_open(Link *link, LinkProfile const *forward, LinkProfile const *backward) {
+    LinkProfile reverse;
+    if (backward == NULL) {
+        reverse = *forward;
+        reverse.seed = (forward->seed ? forward->seed : 1) ^ 0x9e3779b97f4a7c15ull;
+        backward = &reverse;
+    }
+    memset(link, 0, sizeof (*link));
+    atomic_init(&link->closed, 0);
+    if ((channel_open(&link->channels[0], forward, &link->closed) != 0)
+        || (channel_open(&link->channels[1], backward, &link->closed) != 0)) {
+        link_close(link);
+        return -1;
+    }
+    for (unsigned int i = 0; i < 2; ++i) {
+        link->ends[i].fd = -1;
+        link->ends[i].tx = &link->channels[i];
+        link->ends[i].rx = &link->channels[i ^ 1];
+    }
+    return 0;
+}
+
+void link_shutdown(Link *link) {
+    atomic_store(&link->closed, 1);
+}
+
+void link_close(Link *link) {
+    link_shutdown(link);
+    channel_close(&link->channels[0]);
+    channel_close(&link->channels[1]);
+}
+
+void link_device(Link *link, unsigned int end, GenericDevice *device) {
+    device->handle = &link->ends[end & 1];
+    device->recv = recv_from_link;
+    device->send = send_over_link;
+    device->sendv = sendv_over_link;
+    device->getc = getc_from_link;
+    device->putc = putc_over_link;
+}
+
+void link_stats(Link *link, unsigned int direction, LinkStats *stats) {
+    LinkChannel *c = &link->channels[direction & 1];
+    stats->sent = atomic_load_explicit(&c->stats.sent, memory_order_relaxed);
+    stats->delivered = atomic_load_explicit(&c->stats.delivered, memory_order_relaxed);
+    stats->flipped_bits = atomic_load_explicit(&c->stats.flipped_bits, memory_order_relaxed);
+    stats->dropped = atomic_load_explicit(&c->stats.dropped, memory_order_relaxed);
+    stats->duplicated = atomic_load_explicit(&c->stats.duplicated, memory_order_relaxed);
+}
+
+/* @brief src as it comes out of the line, into scratch. returns its length, 0 to twice n */
+static unsigned int impair(LinkChannel *c, uint8_t const *src, unsigned int n) {
+    uint64_t first = c->bytes_in;
+    c->bytes_in += n;
+    c->bits += 8ull * n;
+    if ((c->next_flip >= c->bits) && (c->next_drop >= c->bytes_in) && (c->next_duplicate >= c->bytes_in)) {
+        memcpy(c->scratch, src, n); /* the usual case: nothing happens to this piece */
+        return n;
+    }
+    unsigned int m = 0;
+    uint64_t bit = 8 * first;
+    for (unsigned int i = 0; i < n; ++i, bit += 8) {
+        uint8_t byte = src[i];
+        while (c->next_flip < bit + 8) {
+            byte ^= 1u << (c->next_flip - bit);
+            c->next_flip += link_gap(c, c->profile.bit_error_rate);
+            atomic_fetch_add_explicit(&c->stats.flipped_bits, 1, memory_order_relaxed);
+        }
+        unsigned int copies = 1;
+        if (c->next_duplicate == first + i) {
+            c->next_duplicate += link_gap(c, c->profile.duplicate_rate);
+            copies = 2;
+        }
+        if (c->next_drop == first + i) {
+            c->next_drop += link_gap(c, c->profile.drop_rate);
+            copies = 0; /* a byte both lost and doubled is lost */
+        }
+        if (copies == 0) { atomic_fetch_add_explicit(&c->stats.dropped, 1, memory_order_relaxed); }
+        if (copies == 2) { atomic_fetch_add_explicit(&c->stats.duplicated, 1, memory_order_relaxed); }
+        for (unsigned int k = 0; k < copies; ++k) { c->scratch[m++] = byte; }
+    }
+    return m;
+}
+
+/*
+ * @brief puts b on the line a piece at a time, waiting while the line has more than buffer_bytes to send or the
+ *     queues are full. returns how many went out before timeout milliseconds passed or the link shut down
+ */
+int send_over_link(void *handle, uint8_t const *b, unsigned int n, unsigned int timeout) {
+    LinkChannel *c = ((LinkEnd *) handle)->tx;
+    uint64_t deadline = monotonic_ns() + timeout * 1000000ull;
+    uint64_t buffer_ns = c->profile.buffer_bytes * c->byte_ns;
+    unsigned int done = 0;
+    while ((done < n) && (atomic_load_explicit(c->closed, memory_order_relaxed) == 0)) {
+        uint64_t now = monotonic_ns();
+        unsigned int piece = n - done;
+        if (piece > LINK_PIECE) { piece = LINK_PIECE; }
+        if (piece > c->profile.buffer_bytes) { piece = c->profile.buffer_bytes; }
+        if (piece > queue_room(&c->bytes) / 2) { piece = queue_room(&c->bytes) / 2; }
+        if (c->byte_ns && (c->free_ns > now + buffer_ns)) { /* the fifo is full */
+            if (now >= deadline) { break; }
+            sleep_until((c->free_ns - buffer_ns < deadline) ? c->free_ns - buffer_ns : deadline);
+            continue;
+        }
+        if ((piece == 0) || (queue_room(&c->chunks) < sizeof (LinkChunk))) { /* the far end is not reading */
+            if (now >= deadline) { break; }
+            if (piece) {
+                queue_wait_room(&c->chunks, remaining_ms(deadline, now));
+            } else {
+                sleep_until((now + 100000 < deadline) ? now + 100000 : deadline);
+            }
+            continue;
+        }
+
+        unsigned int m = impair(c, &b[done], piece);
+        uint64_t start = (c->free_ns > now) ? c->free_ns : now;
+        c->free_ns = start + piece * c->byte_ns;
+        if (m) {
+            LinkChunk chunk = { 0, m, 0 };
+            chunk.first_ns = start + c->byte_ns + c->profile.latency_us * 1000ull;
+            if (c->profile.jitter_us) {
+                chunk.first_ns += (uint64_t) (link_random(c) * c->profile.jitter_us * 1000.0);
+            }
+            if (chunk.first_ns < c->last_ns + c->byte_ns) { chunk.first_ns = c->last_ns + c->byte_ns; } /* in order */
+            c->last_ns = chunk.first_ns + (m - 1) * c->byte_ns;
+            queue_write(&c->bytes, c->scratch, m);
+            queue_write(&c->chunks, (uint8_t const *) &chunk, sizeof (chunk));
+        }
+        atomic_fetch_add_explicit(&c->stats.sent, piece, memory_order_relaxed);
+        done += piece;
+    }
+    return done;
+}
+
+/* @brief the pieces one after the other, so that sources mapped for zero-copy sends work over the link too */
+int sendv_over_link(void *handle, struct iovec const *iov, int iovcnt, unsigned int timeout) {
+    uint64_t deadline = monotonic_ns() + timeout * 1000000ull;
+    int sent = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        int n = send_over_link(handle, iov[i].iov_base, iov[i].iov_len, remaining_ms(deadline, monotonic_ns()));
+        sent += n;
+        if (n < (int) iov[i].iov_len) { break; }
+    }
+    return sent;
+}
+
+/*
+ * @brief sleeps until at least one byte has arrived or timeout milliseconds pass, then copies what has arrived, up
+ *     to n bytes. bytes still on their way stay there. returns how many were read
+ */
+int recv_from_link(void *handle, uint8_t *b, unsigned int n, unsigned int offset, unsigned int timeout) {
+    LinkChannel *c = ((LinkEnd *) handle)->rx;
+    (void) offset;
+    uint64_t deadline = monotonic_ns() + timeout * 1000000ull;
+    unsigned int got = 0;
+    while (got < n) {
+        int closed = atomic_load_explicit(c->closed, memory_order_relaxed) != 0;
+        uint64_t now = monotonic_ns();
+        if (c->chunk_left == 0) {
+            if (queue_count(&c->chunks) < sizeof (LinkChunk)) {
+                if (got || closed || (now >= deadline)) { break; }
+                queue_wait(&c->chunks, remaining_ms(deadline, now));
+                continue;
+            }
+            queue_read(&c->chunks, (uint8_t *) &c->chunk, sizeof (LinkChunk));
+            c->chunk_left = c->chunk.length;
+        }
+        if (c->chunk.first_ns > now) { /* still on its way */
+            if (got || closed || (now >= deadline)) { break; }
+            sleep_until((c->chunk.first_ns < deadline) ? c->chunk.first_ns : deadline);
+            continue;
+        }
+        unsigned int arrived = c->chunk_left;
+        if (c->byte_ns && ((now - c->chunk.first_ns) / c->byte_ns + 1 < arrived)) {
+            arrived = (now - c->chunk.first_ns) / c->byte_ns + 1;
+        }
+        if (arrived > n - got) { arrived = n - got; }
+        queue_read(&c->bytes, &b[got], arrived);
+        got += arrived;
+        c->chunk_left -= arrived;
+        c->chunk.first_ns += arrived * c->byte_ns;
+    }
+    atomic_fetch_add_explicit(&c->stats.delivered, got, memory_order_relaxed);
+    return got;
+}
+
+int getc_from_link(void *handle, uint8_t *byte, unsigned int timeout) {
+    return recv_from_link(handle, byte, 1, 0, timeout);
+}
+
+int putc_over_link(void *handle, uint8_t byte, unsigned int timeout) {
+    return send_over_link(handle, &byte, 1, timeout);
+}
@@ -0,0 +1,72 @@
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "loopback.h"
+
+uint8_t const *map_from_memory(void *handle, unsigned int *size) {
+    MemorySource *source = (MemorySource *) handle;
+    *size = source->size;
+    return source->data;
+}
+
+void unmap_from_memory(void *handle, uint8_t const *base, unsigned int size) {
+    (void) handle;
+    (void) base;
+    (void) size;
+}
+
+int write_to_memory(void *handle, uint8_t const *b, unsigned int n, unsigned int offset, unsigned int timeout) {
+    MemorySink *sink = (MemorySink *) handle;
+    (void) timeout;
+    if (offset < sink->size) {
+        memcpy(&sink->data[offset], b, (n < sink->size - offset) ? n : sink->size - offset);
+    }
+    return n;
+}
+
+void *receiver_task(void *ext) {
+    Receiver *receiver = (Receiver *) ext;
+    receiver->result = xmodem_recv(&receiver->link, &receiver->sink, &receiver->options, &receiver->errors);
+    return NULL;
+}
+
+void stream_device(GenericDevice *dev, Stream *stream) {
+    memset(dev, 0, sizeof (GenericDevice));
+    dev->fd = stream->fd;
+    dev->handle = stream;
+    dev->recv = recv_from_desc;
+    dev->getc = getc_from_desc;
+    dev->send = send_over_desc;
+    dev->sendv = sendv_over_desc;
+    dev->putc = putc_over_desc;
+}
+
+int listen_loopback(struct sockaddr_in *addr) {
+    socklen_t addr_size = sizeof (*addr);
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) { return -1; }
+    memset(addr, 0, sizeof (*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr->sin_port = 0; /* any free port */
+    if ((bind(listen_fd, (struct sockaddr *) addr, sizeof (*addr)) != 0) || (listen(listen_fd, 2) != 0) ||
+        (getsockname(listen_fd, (struct sockaddr *) addr, &addr_size) != 0)) {
+        close(listen_fd);
+        return -1;
+    }
+    return listen_fd;
+}
+
+int connect_loopback(int listen_fd, struct sockaddr_in const *addr, int fds[2]) {
+    int one = 1;
+    fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fds[0], (struct sockaddr const *) addr, sizeof (*addr)) != 0) { return -1; }
+    fds[1] = accept(listen_fd, NULL, NULL);
+    if (fds[1] < 0) { return -1; }
+    setsockopt(fds[0], IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+    setsockopt(fds[1], IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+    return 0;
+}
@@ -0,0 +1,152 @@
+#include <string.h>
+
+#include "lz.h"
+
+/* the format leaves the last bytes as literals, and starts no match this close to the end */
+#define LZ_LAST_LITERALS (5)
+#define LZ_MATCH_LIMIT (12)
+
+/* misses in a row before the search starts skipping ahead, so data that does not pack is given up on quickly */
+#define LZ_SKIP_TRIGGER (6)
+
+static uint32_t read32(uint8_t const *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof (v));
+    return v;
+}
+
+static uint64_t read64(uint8_t const *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof (v));
+    return v;
+}
+
+static unsigned int hash32(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* @brief 255s and a remainder for a length past 15. NULL if they do not fit */
+static uint8_t *put_length(uint8_t *op, uint8_t const *end, unsigned int length) {
+    for (; length >= 255; length -= 255) {
+        if (op == end) { return NULL; }
+        *op++ = 255;
+    }
+    if (op == end) { return NULL; }
+    *op++ = length;
+    return op;
+}
+
+/* @brief one sequence: literals, then a match of length bytes distance back unless length is 0. NULL if full */
+static uint8_t *put_sequence(uint8_t *op, uint8_t const *end, uint8_t const *literals, unsigned int n_literals,
+    unsigned int distance, unsigned int length) {
+    if (op == end) { return NULL; }
+    uint8_t *token = op++;
+    unsigned int match = length ? length - LZ_MIN_MATCH : 0;
+    *token = ((n_literals < 15) ? n_literals : 15) << 4;
+    if ((n_literals >= 15) && ((op = put_length(op, end, n_literals - 15)) == NULL)) { return NULL; }
+    if (n_literals > (unsigned int) (end - op)) { return NULL; }
+    memcpy(op, literals, n_literals);
+    op += n_literals;
+    if (length == 0) { return op; }
+
+    if (end - op < 2) { return NULL; }
+    *op++ = distance;
+    *op++ = distance >> 8;
+    *token |= (match < 15) ? match : 15;
+    if ((match >= 15) && ((op = put_length(op, end, match - 15)) == NULL)) { return NULL; }
+    return op;
+}
+
+unsigned int lz_compress(uint8_t const *src, unsigned int n, uint8_t *dst, unsigned int capacity) {
+    uint8_t *op = dst;
+    uint8_t const * const end = dst + capacity;
+    unsigned int anchor = 0;
+
+    if (n > LZ_MATCH_LIMIT) {
+        uint32_t table[1 << LZ_HASH_BITS];
+        memset(table, 0, sizeof (table));
+        unsigned int const limit = n - LZ_MATCH_LIMIT;
+        unsigned int i = 1, misses = 0;
+        while (i < limit) {
+            uint32_t v = read32(&src[i]);
+            unsigned int h = hash32(v);
+            uint32_t candidate = table[h];
+            table[h] = i;
+            if ((i - candidate > LZ_MAX_DISTANCE) || (read32(&src[candidate]) != v)) {
+                i += 1 + (misses++ >> LZ_SKIP_TRIGGER);
+                continue;
+            }
+            misses = 0;
+            while ((i > anchor) && (candidate > 0) && (src[i - 1] == src[candidate - 1])) { /* back over literals */
+                --i;
+                --candidate;
+            }
+            unsigned int length = LZ_MIN_MATCH;
+            unsigned int const longest = n - LZ_LAST_LITERALS - i;
+            while (length + 8 <= longest) { /* eight bytes at a time, then the first that differs */
+                uint64_t diff = read64(&src[i + length]) ^ read64(&src[candidate + length]);
+                if (diff) {
+                    length += __builtin_ctzll(diff) / 8;
+                    break;
+                }
+                length += 8;
+            }
+            if (length + 8 > longest) {
+                while ((length < longest) && (src[i + length] == src[candidate + length])) { ++length; }
+            }
+
+            op = put_sequence(op, end, &src[anchor], i - anchor, i - candidate, length);
+            if (op == NULL) { return 0; }
+            i += length;
+            anchor = i;
+            if (i - 2 < limit) { table[hash32(read32(&src[i - 2]))] = i - 2; }
+        }
+    }
+    op = put_sequence(op, end, &src[anchor], n - anchor, 0, 0);
+    return op ? op - dst : 0;
+}
+
+int lz_decompress(uint8_t const *src, unsigned int n, uint8_t *dst, unsigned int capacity) {
+    unsigned int ip = 0, op = 0;
+    while (ip < n) {
+        uint8_t token = src[ip++];
+        unsigned int literals = token >> 4;
+        if (literals == 15) {
+            uint8_t b;
+            do {
+                if ((ip == n) || (literals > capacity)) { return -1; }
+                b = src[ip++];
+                literals += b;
+            } while (b == 255);
+        }
+        if ((literals > n - ip) || (literals > capacity - op)) { return -1; }
+        memcpy(&dst[op], &src[ip], literals);
+        ip += literals;
+        op += literals;
+        if (ip == n) { break; } /* the last sequence has no match */
+
+        if (n - ip < 2) { return -1; }
+        unsigned int distance = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        if ((distance == 0) || (distance > op)) { return -1; }
+        unsigned int length = token & 15;
+        if (length == 15) {
+            uint8_t b;
+            do {
+                if ((ip == n) || (length > capacity)) { return -1; }
+                b = src[ip++];
+                length += b;
+            } while (b == 255);
+        }
+        length += LZ_MIN_MATCH;
+        if (length > capacity - op) { return -1; }
+        uint8_t const *from = &dst[op - distance];
+        if (distance >= length) {
+            memcpy(&dst[op], from, length);
+        } else { /* overlapping: a run repeating the last distance bytes */
+            for (unsigned int k = 0; k < length; ++k) { dst[op + k] = from[k]; }
+        }
+        op += length;
+    }
+    return op;
+}
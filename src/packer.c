@@ -0,0 +1,140 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "packer.h"
+#include "lz.h"
+
+static void *packer_task(void *ext) {
+    Packer *packer = (Packer *) ext;
+    pthread_mutex_lock(&packer->lock);
+    while (packer->run) {
+        if ((packer->block_size == 0) || (packer->next >= packer->file_size) ||
+            (packer->filled - packer->released >= packer->depth)) {
+            pthread_cond_wait(&packer->cond, &packer->lock); /* nothing asked for yet, done, or the ring is full */
+            continue;
+        }
+        uint32_t index = packer->filled;
+        unsigned int generation = packer->generation;
+        uint32_t offset = packer->next;
+        unsigned int n = packer->file_size - offset;
+        if (n > packer->block_size) { n = packer->block_size; }
+        uint8_t *b = &packer->buffers[(size_t) (index % packer->depth) * packer->max_block_size];
+        pthread_mutex_unlock(&packer->lock);
+
+        /* pack outside the lock, the consumer never touches a slot that is not yet filled */
+        uint8_t const *data = packer->get_data(packer->context, offset, n);
+        int length = data ? (int) lz_compress(data, n, b, n - n / PACKER_MIN_SAVING) : -1;
+
+        pthread_mutex_lock(&packer->lock);
+        if (generation != packer->generation) { continue; } /* started over meanwhile */
+        unsigned int slot = index % packer->depth;
+        packer->offsets[slot] = offset;
+        packer->sizes[slot] = n;
+        packer->lengths[slot] = length;
+        packer->filled = index + 1;
+        packer->next = offset + n;
+        pthread_cond_broadcast(&packer->cond);
+    }
+    pthread_mutex_unlock(&packer->lock);
+    return NULL;
+}
+
+/*
+ * @param get_data = the file's blocks. it must be safe to call from another thread, and it must have what it hands
+ *     out until the consumer releases it
+ * @param depth = how many blocks may be packed at once. blocks the consumer still holds (e.g. a sliding window)
+ *     count against it, so depth should be the most blocks held plus how far to pack ahead
+ */
+int packer_start(Packer *packer, uint8_t const *(*get_data)(void *context, uint32_t offset, unsigned int n),
+    void *context, uint32_t file_size, unsigned int max_block_size, unsigned int depth) {
+    memset(packer, 0, sizeof (Packer));
+    packer->get_data = get_data;
+    packer->context = context;
+    packer->file_size = file_size;
+    packer->max_block_size = max_block_size;
+    packer->depth = depth ? depth : 1;
+    packer->buffers = malloc((size_t) packer->depth * max_block_size);
+    packer->offsets = malloc(packer->depth * sizeof (uint32_t));
+    packer->sizes = malloc(packer->depth * sizeof (unsigned int));
+    packer->lengths = malloc(packer->depth * sizeof (int));
+    if ((packer->buffers == NULL) || (packer->offsets == NULL) || (packer->sizes == NULL) ||
+        (packer->lengths == NULL)) {
+        packer_stop(packer);
+        return -1;
+    }
+    packer->run = 1;
+    pthread_mutex_init(&packer->lock, NULL);
+    pthread_cond_init(&packer->cond, NULL);
+    if (pthread_create(&packer->thread, NULL, packer_task, packer) != 0) {
+        packer->run = 0;
+        pthread_mutex_destroy(&packer->lock);
+        pthread_cond_destroy(&packer->cond);
+        packer_stop(packer); /* frees the ring */
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * @brief waits until the n bytes at offset are packed. blocks are asked for in order, each once
+ * @return the packed block and its size in *length, valid until released. NULL if it did not shrink or could not
+ *     be had, or n is more than the largest block or the ring holds
+ */
+uint8_t const *packer_get(Packer *packer, uint32_t offset, unsigned int n, unsigned int *length) {
+    uint8_t const *b = NULL;
+    if ((n == 0) || (n > packer->max_block_size) || (offset >= packer->file_size)) { return NULL; }
+    pthread_mutex_lock(&packer->lock);
+    if (packer->taken - packer->released >= packer->depth) { /* more held than the ring takes: send it raw */
+        pthread_mutex_unlock(&packer->lock);
+        return NULL;
+    }
+    unsigned int slot = packer->taken % packer->depth;
+    unsigned int expected = packer->file_size - offset;
+    if (expected > packer->block_size) { expected = packer->block_size; }
+    unsigned int ahead = (packer->next == offset) && (expected == n);
+    if (packer->taken < packer->filled) { ahead = (packer->offsets[slot] == offset) && (packer->sizes[slot] == n); }
+    if (ahead == 0) { /* start over from here, in this block size */
+        ++packer->generation;
+        packer->filled = packer->taken;
+        packer->next = offset;
+        packer->block_size = n;
+        pthread_cond_broadcast(&packer->cond);
+    }
+    while (packer->run && (packer->filled <= packer->taken)) { pthread_cond_wait(&packer->cond, &packer->lock); }
+    if ((packer->filled > packer->taken) && (packer->lengths[slot] > 0)) {
+        b = &packer->buffers[(size_t) slot * packer->max_block_size];
+        *length = packer->lengths[slot];
+    }
+    ++packer->taken;
+    pthread_mutex_unlock(&packer->lock);
+    return b;
+}
+
+/* @brief bytes before offset are done with, the packer may reuse their buffers */
+void packer_release(Packer *packer, uint32_t offset) {
+    pthread_mutex_lock(&packer->lock);
+    uint32_t released = packer->released;
+    while (packer->released < packer->taken) {
+        unsigned int slot = packer->released % packer->depth;
+        if (packer->offsets[slot] + packer->sizes[slot] > offset) { break; }
+        ++packer->released;
+    }
+    if (packer->released != released) { pthread_cond_broadcast(&packer->cond); }
+    pthread_mutex_unlock(&packer->lock);
+}
+
+void packer_stop(Packer *packer) {
+    if (packer->run) {
+        pthread_mutex_lock(&packer->lock);
+        packer->run = 0;
+        pthread_cond_broadcast(&packer->cond);
+        pthread_mutex_unlock(&packer->lock);
+        pthread_join(packer->thread, NULL);
+        pthread_mutex_destroy(&packer->lock);
+        pthread_cond_destroy(&packer->cond);
+    }
+    free(packer->buffers);
+    free(packer->offsets);
+    free(packer->sizes);
+    free(packer->lengths);
+}
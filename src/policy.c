@@ -0,0 +1,40 @@
+#include <math.h>
+
+#include "policy.h"
+
+/* header, block id pair and crc around every payload */
+#define XMODEM_FRAME_BYTES (5)
+
+XmodemBlockPolicy const xmodem_default_block_policy = { xmodem_block_policy_goodput, 48, 1024, 16 };
+
+/*
+ * @brief line time, in bytes, per payload byte delivered at block size with byte error rate p. a block goes out
+ *     1 / survive times on average. a window keeps the line busy through replies and retransmissions
+ */
+static double block_cost(XmodemBlockPolicy const *policy, XmodemBlockFeedback const *feedback, unsigned int size,
+    double p) {
+    double survive = exp(-p * (size + XMODEM_FRAME_BYTES));
+    double cost = size + XMODEM_FRAME_BYTES;
+    if (feedback->window == 0) { cost += policy->overhead + (1 - survive) * policy->failure_cost; }
+    return cost / (size * survive);
+}
+
+unsigned int xmodem_block_policy_goodput(XmodemBlockPolicy const *policy, XmodemBlockFeedback const *feedback) {
+    const unsigned int attempts = feedback->blocks + feedback->failures;
+    if (attempts < policy->min_samples) { return feedback->block_size; }
+
+    /* half a failure of prior keeps a short clean run from reading as a perfect link */
+    double f = (feedback->failures + 0.5) / (attempts + 1.0);
+    double p = -log1p(-f) / (feedback->block_size + XMODEM_FRAME_BYTES);
+
+    unsigned int best = feedback->block_size;
+    double best_cost = block_cost(policy, feedback, best, p) * 0.9;
+    for (unsigned int i = 0; i < feedback->n_sizes; ++i) {
+        double cost = block_cost(policy, feedback, feedback->sizes[i], p);
+        if (cost < best_cost) {
+            best = feedback->sizes[i];
+            best_cost = cost;
+        }
+    }
+    return best;
+}
@@ -5,6 +5,7 @@
 #include <sys/unistd.h>
 
 #include <netdb.h>
+#include <sys/socket.h>
 #include <netinet/in.h>
 
 #include <string.h>
@@ -66,7 +67,6 @@ void initialize_tcp_client_info(TcpClientInfo *info) {
 }
 
 int initialize_server_socket(TcpServerInfo *info, unsigned int portno) {
-    char buffer[256];
     struct sockaddr_in serv_addr;
 
     /* First call to socket() function */
@@ -77,6 +77,9 @@ int initialize_server_socket(TcpServerInfo *info, unsigned int portno) {
         return 1;
     }
 
+    int one = 1; /* rebind straight away after a restart */
+    setsockopt(info->server_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+
     /* Initialize socket structure */
     bzero((char *) &serv_addr, sizeof(serv_addr));
 
@@ -92,7 +95,11 @@ int initialize_server_socket(TcpServerInfo *info, unsigned int portno) {
 
     /*** listen for the clients. process will sleep while waiting for incoming connections ***/
 
-    listen(info->server_fd, info->max_clients);
+    if (listen(info->server_fd, info->max_clients) < 0) {
+        perror("ERROR on listen");
+        return 1;
+    }
+    return 0;
 }
 
 int initialize_client_socket(const char *addr, unsigned int portno) {
@@ -0,0 +1,234 @@
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#include <sys/mman.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "queue.h"
+
+#define QUEUE_HUGE_PAGE (2 * 1024 * 1024)
+
+_Static_assert(sizeof (atomic_uint) == sizeof (uint32_t), "queue indices double as futex words");
+
+static long long monotonic_ns(void) {
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec * 1000000000LL + spec.tv_nsec;
+}
+
+/* @brief sleeps while *word == expected, for at most timeout_ns. may return early, callers re-check */
+static void futex_wait(atomic_uint *word, unsigned int expected, long long timeout_ns) {
+#ifdef __linux__
+    struct timespec spec = { timeout_ns / 1000000000LL, timeout_ns % 1000000000LL };
+    syscall(SYS_futex, (uint32_t *) word, FUTEX_WAIT_PRIVATE, expected, &spec, NULL, 0);
+#else
+    if (timeout_ns > 100000) { timeout_ns = 100000; } /* no futex. poll every 100 us */
+    struct timespec remaining, request = { 0, timeout_ns };
+    if (atomic_load_explicit(word, memory_order_relaxed) == expected) { nanosleep(&request, &remaining); }
+#endif
+}
+
+/* @brief called after advancing word. pairs with the fence in wait_for() so a sleeper is never missed */
+static void wake_waiter(atomic_uint *word, atomic_uint *waiting) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(waiting, memory_order_relaxed) == 0) { return; }
+#ifdef __linux__
+    syscall(SYS_futex, (uint32_t *) word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+/*
+ * @brief sleeps until ready(q) is nonzero or timeout milliseconds pass. word is the index the other side advances.
+ *     the waiting flag is raised before the last check, so either that check sees new data or the other side sees
+ *     the flag and wakes us. if word moved in between, the futex does not sleep at all
+ */
+static unsigned int wait_for(Queue *q, unsigned int (*ready)(Queue *), atomic_uint *word, atomic_uint *waiting,
+    unsigned int timeout) {
+    unsigned int n = ready(q);
+    if (n || (timeout == 0)) { return n; }
+    long long deadline = monotonic_ns() + timeout * 1000000LL;
+    while (1) {
+        unsigned int observed = atomic_load_explicit(word, memory_order_relaxed);
+        atomic_store_explicit(waiting, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        n = ready(q);
+        if (n || atomic_load_explicit(&q->closed, memory_order_acquire)) { break; }
+        long long remaining = deadline - monotonic_ns();
+        if (remaining <= 0) { break; }
+        futex_wait(word, observed, remaining);
+    }
+    atomic_store_explicit(waiting, 0, memory_order_relaxed);
+    return n;
+}
+
+/* @brief size must be a power of two. returns -1 otherwise */
+int queue_init(Queue *q, uint8_t *buff, unsigned int size) {
+    if ((size == 0) || (size & (size - 1))) { return -1; }
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->producer_waiting, 0);
+    atomic_init(&q->consumer_waiting, 0);
+    atomic_init(&q->closed, 0);
+    q->mask = size - 1;
+    q->buff = buff;
+    q->allocated = 0;
+    return 0;
+}
+
+/*
+ * @brief queue_init() with a ring of its own. hugepages asks for 2 MiB pages, from the reserved pool if there is one,
+ *     else as a transparent hugepage hint. release with queue_free(). returns -1 if size is not a power of two or
+ *     memory is short
+ */
+int queue_alloc(Queue *q, unsigned int size, unsigned int hugepages) {
+    if ((size == 0) || (size & (size - 1))) { return -1; }
+    size_t length = size;
+    void *base = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (hugepages) {
+        length = (size + QUEUE_HUGE_PAGE - 1) & ~((size_t) QUEUE_HUGE_PAGE - 1);
+        base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+#endif
+    if (base == MAP_FAILED) {
+        length = size;
+        base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) { return -1; }
+#ifdef MADV_HUGEPAGE
+        if (hugepages) { madvise(base, length, MADV_HUGEPAGE); }
+#endif
+    }
+    queue_init(q, base, size);
+    q->allocated = length;
+    return 0;
+}
+
+void queue_free(Queue *q) {
+    if (q->allocated) { munmap(q->buff, q->allocated); }
+    q->buff = NULL;
+    q->allocated = 0;
+}
+
+unsigned int queue_size(Queue const *q) {
+    return q->mask + 1;
+}
+
+/* @brief copy n bytes at ring position index (masked here) into dst, in at most two pieces */
+static void copy_out(Queue const *q, unsigned int index, uint8_t *dst, unsigned int n) {
+    unsigned int start = index & q->mask;
+    unsigned int first = q->mask + 1 - start;
+    if (first > n) { first = n; }
+    memcpy(dst, &q->buff[start], first);
+    memcpy(&dst[first], q->buff, n - first);
+}
+
+unsigned int queue_room(Queue *q) {
+    unsigned int head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    return q->mask + 1 - (head - tail);
+}
+
+/* @brief copies as much of src as fits. returns bytes written */
+unsigned int queue_write(Queue *q, uint8_t const *src, unsigned int n) {
+    unsigned int head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    unsigned int room = q->mask + 1 - (head - tail);
+    if (n > room) { n = room; }
+    unsigned int start = head & q->mask;
+    unsigned int first = q->mask + 1 - start;
+    if (first > n) { first = n; }
+    memcpy(&q->buff[start], src, first);
+    memcpy(q->buff, &src[first], n - first);
+    atomic_store_explicit(&q->head, head + n, memory_order_release);
+    if (n) { wake_waiter(&q->head, &q->consumer_waiting); }
+    return n;
+}
+
+/*
+ * @brief free space as up to two contiguous spans, e.g. to readv() straight into the ring.
+ *     follow with queue_commit() for the bytes actually filled
+ * @return number of spans, 0 if full
+ */
+int queue_write_spans(Queue *q, struct iovec iov[2]) {
+    unsigned int head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    unsigned int room = queue_room(q);
+    if (room == 0) { return 0; }
+    unsigned int start = head & q->mask;
+    unsigned int first = q->mask + 1 - start;
+    if (first > room) { first = room; }
+    iov[0].iov_base = &q->buff[start];
+    iov[0].iov_len = first;
+    if (first == room) { return 1; }
+    iov[1].iov_base = q->buff;
+    iov[1].iov_len = room - first;
+    return 2;
+}
+
+void queue_commit(Queue *q, unsigned int n) {
+    unsigned int head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    atomic_store_explicit(&q->head, head + n, memory_order_release);
+    if (n) { wake_waiter(&q->head, &q->consumer_waiting); }
+}
+
+/* @brief blocks the producer until there is room or timeout milliseconds pass. returns the room */
+unsigned int queue_wait_room(Queue *q, unsigned int timeout) {
+    return wait_for(q, queue_room, &q->tail, &q->producer_waiting, timeout);
+}
+
+/* @brief tells the consumer nothing more will be written, waking it if it sleeps in queue_wait() */
+void queue_close(Queue *q) {
+    atomic_store_explicit(&q->closed, 1, memory_order_release);
+    wake_waiter(&q->head, &q->consumer_waiting);
+}
+
+unsigned int queue_count(Queue *q) {
+    unsigned int tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&q->head, memory_order_acquire);
+    return head - tail;
+}
+
+/* @brief copies up to n bytes out and consumes them. returns bytes read */
+unsigned int queue_read(Queue *q, uint8_t *dst, unsigned int n) {
+    unsigned int tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    unsigned int count = atomic_load_explicit(&q->head, memory_order_acquire) - tail;
+    if (n > count) { n = count; }
+    copy_out(q, tail, dst, n);
+    atomic_store_explicit(&q->tail, tail + n, memory_order_release);
+    if (n) { wake_waiter(&q->tail, &q->producer_waiting); }
+    return n;
+}
+
+/* @brief copies up to n bytes out, leaving them in the queue. returns bytes copied */
+unsigned int queue_peek(Queue *q, uint8_t *dst, unsigned int n) {
+    unsigned int tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    unsigned int count = atomic_load_explicit(&q->head, memory_order_acquire) - tail;
+    if (n > count) { n = count; }
+    copy_out(q, tail, dst, n);
+    return n;
+}
+
+/* @brief consumes up to n bytes without copying. returns bytes consumed */
+unsigned int queue_skip(Queue *q, unsigned int n) {
+    unsigned int tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    unsigned int count = atomic_load_explicit(&q->head, memory_order_acquire) - tail;
+    if (n > count) { n = count; }
+    atomic_store_explicit(&q->tail, tail + n, memory_order_release);
+    if (n) { wake_waiter(&q->tail, &q->producer_waiting); }
+    return n;
+}
+
+/* @brief blocks the consumer until data arrives or timeout milliseconds pass. returns the fill level */
+unsigned int queue_wait(Queue *q, unsigned int timeout) {
+    return wait_for(q, queue_count, &q->head, &q->consumer_waiting, timeout);
+}
+
+/* @brief 1 once the producer has called queue_close(). bytes written before may still be queued */
+unsigned int queue_closed(Queue *q) {
+    return atomic_load_explicit(&q->closed, memory_order_acquire);
+}
@@ -0,0 +1,138 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "readahead.h"
+
+static void *readahead_task(void *ext) {
+    ReadAhead *ra = (ReadAhead *) ext;
+    pthread_mutex_lock(&ra->lock);
+    while (ra->run && (ra->filled < ra->n_blocks)) {
+        if (ra->filled - ra->released >= ra->depth) { /* ring full. wait for the sender to move on */
+            pthread_cond_wait(&ra->cond, &ra->lock);
+            continue;
+        }
+        uint32_t index = ra->filled;
+        pthread_mutex_unlock(&ra->lock);
+
+        /* read outside the lock, the consumer never touches a slot that is not yet filled */
+        uint32_t offset = ra->list ? ra->list[index] * ra->block_size : ra->start + index * ra->block_size;
+        unsigned int n = ra->file_size - offset;
+        if (n > ra->block_size) { n = ra->block_size; }
+        uint8_t *b = &ra->buffers[(index % ra->depth) * ra->block_size];
+        unsigned int length = 0;
+        while (length < n) {
+            int n_read = ra->src->recv(ra->src->handle, &b[length], n - length, offset + length, 0);
+            if (n_read <= 0) { break; }
+            length += (unsigned int) n_read;
+        }
+
+        pthread_mutex_lock(&ra->lock);
+        ra->lengths[index % ra->depth] = (length == n) ? (int) length : -1;
+        ra->filled = index + 1;
+        pthread_cond_broadcast(&ra->cond);
+        if (length != n) { break; }
+    }
+    pthread_mutex_unlock(&ra->lock);
+    return NULL;
+}
+
+/* @brief the ring, and the reader going through the blocks ra describes */
+static int readahead_run(ReadAhead *ra, unsigned int depth)
+{
+    ra->depth = depth ? depth : 1;
+    ra->buffers = malloc((size_t) ra->depth * ra->block_size);
+    ra->lengths = malloc(ra->depth * sizeof (int));
+    if ((ra->buffers == NULL) || (ra->lengths == NULL)) {
+        free(ra->buffers);
+        free(ra->lengths);
+        return -1;
+    }
+    ra->run = 1;
+    pthread_mutex_init(&ra->lock, NULL);
+    pthread_cond_init(&ra->cond, NULL);
+    if (pthread_create(&ra->thread, NULL, readahead_task, ra) != 0) {
+        ra->run = 0;
+        free(ra->buffers);
+        free(ra->lengths);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * @param start = file offset to read from, e.g. past what a resumed transfer already delivered
+ * @param depth = how many blocks may be buffered at once. blocks the consumer still holds (e.g. a sliding window)
+ *     count against it, so depth should be the most blocks held plus how far to read ahead
+ */
+int readahead_start(ReadAhead *ra, GenericDevice *src, uint32_t file_size, uint32_t start, unsigned int block_size,
+    unsigned int depth)
+{
+    memset(ra, 0, sizeof (ReadAhead));
+    ra->src = src;
+    ra->file_size = file_size;
+    ra->start = (start < file_size) ? start : file_size;
+    ra->block_size = block_size;
+    ra->n_blocks = (file_size - ra->start + block_size - 1) / block_size;
+    return readahead_run(ra, depth);
+}
+
+/*
+ * @brief same, but ring block i is block list[i] of the file, e.g. the blocks of a delta. list must outlive the
+ *     reader
+ */
+int readahead_start_list(ReadAhead *ra, GenericDevice *src, uint32_t file_size, uint32_t const *list, uint32_t n,
+    unsigned int block_size, unsigned int depth)
+{
+    memset(ra, 0, sizeof (ReadAhead));
+    ra->src = src;
+    ra->file_size = file_size;
+    ra->list = list;
+    ra->block_size = block_size;
+    ra->n_blocks = n;
+    return readahead_run(ra, depth);
+}
+
+/*
+ * @brief waits until block index is read
+ * @return the block, valid until released. NULL if it could not be read or is outside the ring
+ */
+uint8_t const *readahead_get(ReadAhead *ra, uint32_t index, int *length)
+{
+    uint8_t const *b = NULL;
+    pthread_mutex_lock(&ra->lock);
+    if ((index >= ra->released) && (index - ra->released < ra->depth) && (index < ra->n_blocks)) {
+        while (ra->run && (ra->filled <= index) && ((ra->filled == 0) || (ra->lengths[(ra->filled - 1) % ra->depth] >= 0))) {
+            pthread_cond_wait(&ra->cond, &ra->lock);
+        }
+        if ((ra->filled > index) && (ra->lengths[index % ra->depth] >= 0)) {
+            b = &ra->buffers[(index % ra->depth) * ra->block_size];
+            *length = ra->lengths[index % ra->depth];
+        }
+    }
+    pthread_mutex_unlock(&ra->lock);
+    return b;
+}
+
+/* @brief blocks [0, count) are done with, the reader may reuse their buffers */
+void readahead_release(ReadAhead *ra, uint32_t count)
+{
+    pthread_mutex_lock(&ra->lock);
+    if (count > ra->released) {
+        ra->released = (count < ra->filled) ? count : ra->filled;
+        pthread_cond_broadcast(&ra->cond);
+    }
+    pthread_mutex_unlock(&ra->lock);
+}
+
+void readahead_stop(ReadAhead *ra)
+{
+    pthread_mutex_lock(&ra->lock);
+    ra->run = 0;
+    pthread_cond_broadcast(&ra->cond);
+    pthread_mutex_unlock(&ra->lock);
+    pthread_join(ra->thread, NULL);
+    pthread_mutex_destroy(&ra->lock);
+    pthread_cond_destroy(&ra->cond);
+    free(ra->buffers);
+    free(ra->lengths);
+}
@@ -26,24 +26,6 @@
 
 #if 0
 
-int recv_from_file(void *handle, uint8_t *b, unsigned int n, unsigned int offset, unsigned int timeout) {
-    int fd = * (int *) handle;
-    unsigned int remaining = n;
-    if (offset) { printf("read from offset not supported\n"); }
-    do {
-        int n_read = read(fd, b, remaining);
-        remaining -= n_read;
-        b += n_read;
-    } while (remaining >= 0);
-}
-
-int size_from_file(void *handle, unsigned int timeout) {
-    int fd = * (int *) handle;
-    unsigned int size = lseek(fd, 0, SEEK_END);
-    close(fd);
-    return size;
-}
-
 /* @brief returns 1 if current time exceeds the time specified by timeout. 0 otherwise */
 static int timeout_expired(struct timespec const * const timeout) {
     struct timespec now;
@@ -128,7 +110,6 @@ enum {
 };
 
 int main(int argc, char **argv) {
-    XmodemOptions options;
     GenericDevice i_device, o_device;
 
     o_device.name[0] = 0;
@@ -142,15 +123,13 @@ int main(int argc, char **argv) {
     o_device.getc = getc_from_desc;
     o_device.putc = putc_over_desc;
 
-    int verbose = 0;
+    unsigned int ring_size = 0, hugepages = 0;
     int direction = Directions; /* invalid value */
     int mode = TcpModes;
     int port = 0;
 
     for (int i = 0; i < argc; ++i) {
-        if (strcmp(argv[i], "-verbose") == 0) {
-            verbose = 1;
-        } else if ((strcmp(argv[i], "-s") == 0) || (strcmp(argv[i], "--send") == 0)) {
+        if ((strcmp(argv[i], "-s") == 0) || (strcmp(argv[i], "--send") == 0)) {
             direction = DirectionSend;
         } else if ((strcmp(argv[i], "-r") == 0) || (strcmp(argv[i], "--receive") == 0)) {
             direction = DirectionRecv;
@@ -159,6 +138,10 @@ int main(int argc, char **argv) {
             i_device.fd = open(i_device.name, S_IREAD, O_RDWR);
         } else if (strcmp(argv[i], "-d") == 0) {
             snprintf(o_device.name, sizeof (o_device.name), "%s", argv[++i]);
+        } else if (strcmp(argv[i], "-ring") == 0) {
+            ring_size = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-hugepages") == 0) {
+            hugepages = 1;
         } else if (strcmp(argv[i], "-server") == 0) {
             mode = TcpModeServer;
         } else if (strcmp(argv[i], "-client") == 0) {
@@ -195,16 +178,23 @@ int main(int argc, char **argv) {
     RxLooperArgs rx_looper_args;
     Queue rx_queue;
     memset(&rx_looper_args, 0, sizeof(RxLooperArgs));
+    memset(&rx_queue, 0, sizeof (rx_queue));
 
-    unsigned int run = 1;
-    rx_looper_args.queue = &rx_queue;
-    rx_looper_args.run = &run;
-    rx_looper_args.verbose = verbose;
+    int fd = o_device.fd;
     if (mode == TcpModeClient) {
-        rx_looper_args.fd = tcp_client_info.infrastructure.fd;
+        fd = tcp_client_info.infrastructure.fd;
     } else if (mode == TcpModeServer) {
-        rx_looper_args.fd = tcp_server_info.infrastructure.fd;
+        fd = tcp_server_info.infrastructure.fd;
     }
+    rx_looper_args.ring_size = ring_size;
+    rx_looper_args.hugepages = hugepages;
+    if (rx_looper_init(&rx_looper_args) || rx_looper_add(&rx_looper_args, fd, &rx_queue)) {
+        printf("unable to start receiver (ring size must be a power of two)\n");
+        return 1;
+    }
+    Stream link = { fd, &rx_queue };
+    o_device.handle = &link;
+    i_device.handle = &i_device.fd;
     pthread_t rx_thread;
 
     pthread_create(&rx_thread, NULL, rx_looper, (void *) &rx_looper_args); /* create thread */
@@ -219,6 +209,7 @@ int main(int argc, char **argv) {
     }
 
     int errors = 0;
+    XmodemOptions options;
     options.timeout_ms = 100000;
     options.max_retries = 25000;
     options.max_retransmissions = 25000;
@@ -229,17 +220,17 @@ int main(int argc, char **argv) {
 
     while (1) {
         int n;
-        char buff[64];
+        uint8_t buff[64];
         sleep(1);
         if (mode == TcpModeClient) {
             printf("\nreceived: ");
-            n = recv_from_desc(&rx_queue, buff, sizeof (buff), 0, 0);
+            n = recv_from_desc(&link, buff, sizeof (buff), 0, 0);
             for (int i = 0; i < n; ++i) {
                 printf("%2.2x %c", buff[i], buff[i]);
             }
         } else if (mode == TcpModeServer) {
             const char *str = "hello, world\n";
-            send_over_desc(&tcp_server_info.infrastructure.fd, str, sizeof (str), 0);
+            send_over_desc(&tcp_server_info.infrastructure.fd, (uint8_t const *) str, sizeof (str), 0);
         }
     }
 
@@ -23,6 +23,10 @@
 #include "xmodem.h"
 #include "ports.h"
 #include "stream.h"
+#include "server.h"
+#include "policy.h"
+#include "stats.h"
+#include "trace.h"
 
 enum {
     DirectionTx = 0,
@@ -38,38 +42,111 @@ enum {
     TcpModes
 };
 
+#define SEND_MAX_FILES (64)
+
 /*
  * sends a file over xmodem protocol
- * runs as either TCP server or UART
+ * runs as either TCP server or UART. as a server, -clients n serves up to n devices at once from -workers event
+ * loop threads (1 by default), and exits after -sessions transfers (0 = keep serving). one transfer by default.
+ * -batch sends every -i file in one ymodem batch session over UART. -resume lets receivers that kept a checkpoint
+ * of an interrupted transfer go on from there. -delta sends receivers that hold an older copy of the file only the
+ * blocks that changed. -compress lz-packs the blocks of an extended transfer that shrink, if the receiver takes them.
+ * -window n lets receivers that ask for a sliding window keep up to n blocks in flight, and -streaming lets them
+ * ask for ymodem-g streaming. -fec k m sends up to m parity blocks after every k extended blocks to receivers that
+ * ask for them, so a few damaged blocks are rebuilt rather than sent again. it needs -extended and -window or
+ * -streaming. over UART, the bytes of the files per second are reported at the end, and -stats adds the session's
+ * counts and latencies as json on stderr. -trace file records what the sessions and the reader thread do, and
+ * writes it to file at the end for trace-xmodem
  */
 
 int main(int argc, char **argv) {
     XmodemOptions options;
     GenericDevice i_device, o_device;
+    GenericDevice files[SEND_MAX_FILES];
+    unsigned int n_files = 0;
 
-    o_device.name[0] = 0;
-    i_device.name[0] = 0;
+    memset(&i_device, 0, sizeof (i_device));
+    memset(&o_device, 0, sizeof (o_device));
 
-    /* read from file */
+    /* read from file, mapped for zero-copy sends */
     i_device.recv = recv_from_file;
     i_device.size = size_from_file;
+    i_device.map = map_from_file;
+    i_device.unmap = unmap_from_file;
+    i_device.info = info_from_file;
 
     /* and send out to port */
     o_device.recv = recv_from_desc;
     o_device.send = send_over_desc;
+    o_device.sendv = sendv_over_desc;
     o_device.getc = getc_from_desc;
     o_device.putc = putc_over_desc;
 
     int verbose = 0;
     int port = 0;
+    unsigned int ring_size = 0, hugepages = 0;
+    unsigned int clients = 0, workers = 0, sessions = 1;
+    unsigned int min_timeout_ms = 20, max_timeout_ms = 10000;
+    unsigned int adaptive = 0;
+    unsigned int extended = 0, extended_block_size = 0;
+    unsigned int window = 0, streaming = 0;
+    unsigned int batch = 0;
+    unsigned int resume = 0;
+    unsigned int delta = 0;
+    unsigned int compress = 0;
+    unsigned int fec_group = 0, fec_parity = 0;
+    unsigned int stats = 0;
+    char const *trace_file = NULL;
 
     for (int i = 0; i < argc; ++i) {
         if (strcmp(argv[i], "-verbose") == 0) {
             verbose = 1;
         } else if (strcmp(argv[i], "-i") == 0) {
             snprintf(i_device.name, sizeof (i_device.name), "%s", argv[++i]);
+            if (n_files < SEND_MAX_FILES) { files[n_files++] = i_device; }
         } else if (strcmp(argv[i], "-d") == 0) {
             snprintf(o_device.name, sizeof (o_device.name), "%s", argv[++i]);
+        } else if (strcmp(argv[i], "-ring") == 0) {
+            ring_size = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-hugepages") == 0) {
+            hugepages = 1;
+        } else if (strcmp(argv[i], "-clients") == 0) {
+            clients = atoi(argv[++i]);
+            sessions = 0;
+        } else if (strcmp(argv[i], "-workers") == 0) {
+            workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-sessions") == 0) {
+            sessions = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-rto-min") == 0) {
+            min_timeout_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-rto-max") == 0) {
+            max_timeout_ms = atoi(argv[++i]); /* 0 = fixed timeout */
+        } else if (strcmp(argv[i], "-adaptive") == 0) {
+            adaptive = 1; /* drop to 128-byte blocks while the line is noisy */
+        } else if (strcmp(argv[i], "-batch") == 0) {
+            batch = 1;
+        } else if (strcmp(argv[i], "-resume") == 0) {
+            resume = 1; /* skip what a receiver kept of an interrupted transfer */
+        } else if (strcmp(argv[i], "-delta") == 0) {
+            delta = 1; /* only the blocks that differ from the receiver's copy, if it offers its hashes */
+        } else if (strcmp(argv[i], "-compress") == 0) {
+            compress = 1; /* packed extended blocks if the receiver offers to take them */
+        } else if (strcmp(argv[i], "-window") == 0) {
+            window = atoi(argv[++i]); /* the receiver picks up to this many blocks in flight */
+        } else if (strcmp(argv[i], "-streaming") == 0) {
+            streaming = 1;
+        } else if (strcmp(argv[i], "-fec") == 0) {
+            fec_group = atoi(argv[++i]); /* the receiver picks up to these, each no more than it offers */
+            fec_parity = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-trace") == 0) {
+            trace_file = argv[++i];
+        } else if (strcmp(argv[i], "-stats") == 0) {
+            stats = 1;
+        } else if (strcmp(argv[i], "-extended") == 0) {
+            extended = 1; /* large crc-32c blocks if the receiver offers them. optional largest size follows */
+            if ((i + 1 < argc) && (argv[i + 1][0] >= '0') && (argv[i + 1][0] <= '9')) {
+                extended_block_size = strtoul(argv[++i], NULL, 0);
+            }
         } else if (
             (strcmp(argv[i], "-p") == 0) ||
             (strcmp(argv[i], "--port") == 0)) {
@@ -77,21 +154,76 @@ int main(int argc, char **argv) {
         }
     }
 
+    if (fec_parity && ((extended == 0) || ((window == 0) && (streaming == 0)))) {
+        printf("-fec needs -extended and -window or -streaming\n");
+        return 1;
+    }
+
+    int errors = 0;
+    memset(&options, 0, sizeof (options));
+    options.timeout_ms = 100000;
+    options.max_retries = 25000;
+    options.max_retransmissions = 25000;
+    options.min_timeout_ms = min_timeout_ms; /* lost ACKs cost a few round trips, not timeout_ms */
+    options.max_timeout_ms = max_timeout_ms;
+    options.block_policy = adaptive ? &xmodem_default_block_policy : NULL;
+    options.packet_size_code = XMODEM_STX;
+    options.packet_size = 1024;
+    options.extended = extended;
+    options.extended_block_size = extended_block_size;
+    options.window = window;
+    options.streaming = streaming;
+    options.batch = batch;
+    options.resume = resume;
+    options.delta = delta;
+    options.compress = compress;
+    options.fec_group = fec_group;
+    options.fec_parity = fec_parity;
+    XmodemStats session_stats;
+    xmodem_stats_reset(&session_stats);
+    options.stats = stats ? &session_stats : NULL;
+    const char *start_command = batch ? "<xmodem rb\r" : "<xmodem r RADIO9.BIN\r"; /* a batch names its files */
+
     /* open device */
     TcpServerInfo tcp_server_info;
     tcp_server_info.infrastructure.fd = 0;
     o_device.fd = 0;
 
-    if (strlen(i_device.name)) {
-        i_device.fd = open(i_device.name, S_IREAD, O_RDWR);
+    for (unsigned int i = 0; i < n_files; ++i) {
+        files[i].fd = open(files[i].name, O_RDONLY);
+        files[i].handle = &files[i].fd;
+        if (files[i].fd < 0) {
+            printf("unable to open %s\n", files[i].name);
+            return 1;
+        }
     }
+    if (n_files) { i_device = files[0]; } /* a single transfer sends the first file */
 
     if (strlen(o_device.name)) {
         o_device.fd = initialize_serial_port(o_device.name, 115200, 0, 0, 0);
+    } else if (port && batch) {
+        printf("batch transfers go over UART (-d)\n");
+        return 1;
     } else if (port) {
+        XmodemServerArgs server_args;
+        memset(&server_args, 0, sizeof (server_args));
+        server_args.file_name = i_device.name;
+        server_args.start_command = start_command;
+        server_args.options = options;
+        server_args.options.stats = NULL; /* one writer each: not shared by the server's sessions */
+        server_args.max_clients = clients ? clients : 1;
+        server_args.n_workers = workers;
+        server_args.max_sessions = sessions;
+        server_args.verbose = verbose;
+
         initialize_tcp_server_info(&tcp_server_info);
-        initialize_server_socket(&tcp_server_info, port);
-        server_task(&tcp_server_info);
+        tcp_server_info.max_clients = server_args.max_clients;
+        if (initialize_server_socket(&tcp_server_info, port)) { return 1; }
+        if (trace_file) { trace_start(0); }
+        int result = xmodem_server(&tcp_server_info, &server_args);
+        printf("%u transfers done, %u failed\n", atomic_load(&server_args.completed), atomic_load(&server_args.failed));
+        if (trace_file && trace_dump(trace_file)) { printf("unable to write %s\n", trace_file); }
+        return result ? 1 : 0;
     } else {
         printf("specify either device (/dev/ttyUSB0) or port number for TCP\n");
         return 1;
@@ -101,28 +233,58 @@ int main(int argc, char **argv) {
     RxLooperArgs rx_looper_args;
     Queue rx_queue;
     memset(&rx_looper_args, 0, sizeof(RxLooperArgs));
+    memset(&rx_queue, 0, sizeof (rx_queue));
 
-    unsigned int run = 1;
-    rx_looper_args.queue = &rx_queue;
-    rx_looper_args.run = &run;
-    rx_looper_args.verbose = verbose;
-    rx_looper_args.fd = o_device.fd ? o_device.fd : tcp_server_info.infrastructure.fd;
+    /* sends go out on the descriptor, replies come back through the queue */
+    Stream link = { o_device.fd, &rx_queue };
+    i_device.handle = &i_device.fd;
+    o_device.handle = &link;
+
+    rx_looper_args.ring_size = ring_size;
+    rx_looper_args.hugepages = hugepages;
+    if (rx_looper_init(&rx_looper_args) || rx_looper_add(&rx_looper_args, o_device.fd, &rx_queue)) {
+        printf("unable to start receiver (ring size must be a power of two)\n");
+        return 1;
+    }
 
     pthread_t rx_thread;
 
+    if (trace_file) { trace_start(0); }
     pthread_create(&rx_thread, NULL, rx_looper, (void *) &rx_looper_args); /* create thread */
 
-    int errors = 0;
-    options.timeout_ms = 100000;
-    options.max_retries = 25000;
-    options.max_retransmissions = 25000;
-    options.packet_size_code = XMODEM_CCC;
-    options.packet_size = 1024;
-    const char *start_command = "<xmodem r RADIO9.BIN\r";
-    write(o_device.fd, start_command, sizeof (start_command) - 1);
-    xmodem_send(&o_device, &i_device, &options, &errors);
+    struct timespec started, stopped;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    write(o_device.fd, start_command, strlen(start_command));
+    int result;
+    if (batch) {
+        result = xmodem_send_batch(files, n_files, &o_device, &options, &errors);
+    } else {
+        result = xmodem_send(&i_device, &o_device, &options, &errors);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stopped);
+
+    /* what the link was worth: file bytes over time, however few went over the line */
+    double seconds = (stopped.tv_sec - started.tv_sec) + (stopped.tv_nsec - started.tv_nsec) * 1e-9;
+    double bytes = 0;
+    for (unsigned int i = 0; i < (batch ? n_files : 1); ++i) {
+        GenericDevice *file = batch ? &files[i] : &i_device;
+        int size = size_from_file(file->handle, 0);
+        if (size > 0) { bytes += size; }
+    }
+    if ((result == 0) && (seconds > 0)) {
+        printf("%.0f bytes in %.1f s, %.0f bytes/s%s, %d errors\n", bytes, seconds, bytes / seconds,
+            options.compress ? " packed" : "", errors);
+    }
+    if (stats) { xmodem_stats_json(stderr, &session_stats); }
 
+    rx_looper_stop(&rx_looper_args);
     pthread_join(rx_thread, NULL);
+    if (rx_looper_overflows(&rx_looper_args)) {
+        printf("receiver fell behind %lu times\n", rx_looper_overflows(&rx_looper_args));
+    }
+    rx_looper_close(&rx_looper_args);
+    if (trace_file && trace_dump(trace_file)) { printf("unable to write %s\n", trace_file); }
+    for (unsigned int i = 0; i < n_files; ++i) { close(files[i].fd); }
 
-    return 0;
+    return result ? 1 : 0;
 }
@@ -0,0 +1,356 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "server.h"
+#include "stream.h"
+#include "crc.h"
+
+#define SERVER_EVENTS (64)
+#define SERVER_CHUNK (16 * 1024)
+
+/* every session reads straight out of the one shared mapping */
+static uint8_t const *server_get_data(void *context, uint32_t offset, unsigned int n) {
+    XmodemServerArgs *args = (XmodemServerArgs *) context;
+    if ((offset > args->file_size) || (n > args->file_size - offset)) { return NULL; }
+    return &args->mapping[offset];
+}
+
+/* @brief a device that lost its link part way through gets the rest, once what it holds matches our file */
+static uint32_t server_resume(void *context, uint32_t offset, uint32_t crc) {
+    XmodemServerArgs *args = (XmodemServerArgs *) context;
+    return (crc32c(args->mapping, offset) == crc) ? offset : 0;
+}
+
+/* @brief a device that holds an older image gets the blocks that changed. the file is hashed once per block size */
+static int server_delta(void *context, XmodemSignature const *signature, uint32_t *blocks) {
+    XmodemServerArgs *args = (XmodemServerArgs *) context;
+    unsigned int size_index = __builtin_ctz(signature->block_size) - __builtin_ctz(XMODEM_DELTA_MIN_BLOCK);
+    uint32_t n_blocks = (args->file_size + (uint64_t) signature->block_size - 1) / signature->block_size;
+    pthread_mutex_lock(&args->lock);
+    BlockHash *hashes = args->delta_hashes[size_index];
+    if ((hashes == NULL) && ((hashes = malloc((n_blocks ? n_blocks : 1) * sizeof (BlockHash))) != NULL)) {
+        block_hash_blocks(args->mapping, args->file_size, signature->block_size, hashes, 0);
+        args->delta_hashes[size_index] = hashes;
+    }
+    pthread_mutex_unlock(&args->lock);
+    if (hashes == NULL) { return -1; }
+    return xmodem_delta_blocks(signature, hashes, args->file_size, blocks);
+}
+
+/* deadline heap */
+
+static uint64_t heap_key(XmodemServerLoop const *loop, unsigned int i) {
+    return xmodem_session_deadline(&loop->heap[i]->session);
+}
+
+static void heap_swap(XmodemServerLoop *loop, unsigned int i, unsigned int j) {
+    XmodemServerSession *tmp = loop->heap[i];
+    loop->heap[i] = loop->heap[j];
+    loop->heap[j] = tmp;
+    loop->heap[i]->heap_index = i;
+    loop->heap[j]->heap_index = j;
+}
+
+/* @brief restore heap order around entry i after its deadline changed */
+static void heap_fix(XmodemServerLoop *loop, unsigned int i) {
+    while ((i > 0) && (heap_key(loop, i) < heap_key(loop, (i - 1) / 2))) {
+        heap_swap(loop, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    while (1) {
+        unsigned int smallest = i, left = 2 * i + 1, right = 2 * i + 2;
+        if ((left < loop->n_sessions) && (heap_key(loop, left) < heap_key(loop, smallest))) { smallest = left; }
+        if ((right < loop->n_sessions) && (heap_key(loop, right) < heap_key(loop, smallest))) { smallest = right; }
+        if (smallest == i) { break; }
+        heap_swap(loop, i, smallest);
+        i = smallest;
+    }
+}
+
+static void heap_insert(XmodemServerLoop *loop, XmodemServerSession *session) {
+    session->heap_index = loop->n_sessions;
+    loop->heap[loop->n_sessions++] = session;
+    heap_fix(loop, session->heap_index);
+}
+
+static void heap_remove(XmodemServerLoop *loop, XmodemServerSession *session) {
+    unsigned int i = session->heap_index;
+    heap_swap(loop, i, --loop->n_sessions);
+    if (i < loop->n_sessions) { heap_fix(loop, i); }
+}
+
+/* sessions */
+
+static void close_session(XmodemServerLoop *loop, XmodemServerSession *session) {
+    XmodemServerArgs *args = loop->args;
+    int result = (xmodem_session_status(&session->session) == XMODEM_SESSION_DONE) ? 0 : -1;
+    atomic_fetch_add((result == 0) ? &args->completed : &args->failed, 1);
+    if (args->verbose) {
+        XmodemSessionStats stats;
+        xmodem_session_stats(&session->session, &stats);
+        printf("client %d: %s, %u retries, rtt %.3f ms +/- %.3f, rto %u ms\n", session->fd,
+            (result == 0) ? "done" : "failed", stats.retries, stats.srtt_us * 1e-3, stats.rttvar_us * 1e-3,
+            stats.rto_ms);
+    }
+
+    heap_remove(loop, session);
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, session->fd, NULL);
+    close(session->fd);
+    xmodem_session_end(&session->session);
+    free(session);
+
+    pthread_mutex_lock(&args->lock);
+    --args->active;
+    pthread_cond_broadcast(&args->cond);
+    pthread_mutex_unlock(&args->lock);
+}
+
+/* @brief everything received so far goes into the session. returns -1 once the client is gone */
+static int receive(XmodemServerSession *session, uint64_t now) {
+    uint8_t chunk[SERVER_CHUNK];
+    while (1) {
+        ssize_t n = recv(session->fd, chunk, sizeof (chunk), 0);
+        if (n > 0) {
+            xmodem_session_feed(&session->session, chunk, n, now);
+            continue;
+        }
+        if (n == 0) { return -1; }
+        if (errno == EINTR) { continue; }
+        return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -1;
+    }
+}
+
+/* @brief as much of the session's output as the socket takes. returns -1 once the client is gone */
+static int flush(XmodemServerLoop *loop, XmodemServerSession *session, uint64_t now) {
+    struct iovec iov[XMODEM_SESSION_MAX_IOV];
+    unsigned int want_out = 0;
+    int iovcnt;
+    while ((iovcnt = xmodem_session_next_output(&session->session, iov, XMODEM_SESSION_MAX_IOV)) > 0) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof (msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        ssize_t n = sendmsg(session->fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) { continue; }
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) { return -1; }
+            want_out = 1;
+            break;
+        }
+        xmodem_session_consume_output(&session->session, n, now);
+    }
+
+    if (want_out != session->want_out) { /* only ask to hear about room while we are short of it */
+        struct epoll_event event;
+        event.events = EPOLLIN | (want_out ? EPOLLOUT : 0);
+        event.data.ptr = session;
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, session->fd, &event);
+        session->want_out = want_out;
+    }
+    return 0;
+}
+
+/* @brief after any input or timeout: send what the session has to say, then retire it or requeue its deadline */
+static void service(XmodemServerLoop *loop, XmodemServerSession *session, uint64_t now, int gone) {
+    if ((gone == 0) && (flush(loop, session, now) != 0)) { gone = 1; }
+    if (gone || (xmodem_session_status(&session->session) != XMODEM_SESSION_RUNNING)) {
+        close_session(loop, session);
+    } else {
+        heap_fix(loop, session->heap_index);
+    }
+}
+
+/* @brief sessions the acceptor handed over start here */
+static void adopt(XmodemServerLoop *loop, uint64_t now) {
+    XmodemServerArgs *args = loop->args;
+    XmodemBlocks blocks = { .context = args, .get_data = server_get_data, .gather = 1 };
+    if (args->options.resume) { blocks.resume = server_resume; }
+    if (args->options.delta) { blocks.delta = server_delta; }
+
+    pthread_mutex_lock(&loop->lock);
+    XmodemServerSession *session = loop->incoming;
+    loop->incoming = NULL;
+    pthread_mutex_unlock(&loop->lock);
+
+    while (session) {
+        XmodemServerSession *next = session->next;
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = session;
+        int gone = xmodem_session_start_send(&session->session, &args->options, &blocks, args->file_size, now);
+        if ((gone == 0) && (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, session->fd, &event) != 0)) { gone = 1; }
+        heap_insert(loop, session);
+        service(loop, session, now, gone);
+        session = next;
+    }
+}
+
+static void *server_loop(void *ext) {
+    XmodemServerLoop *loop = (XmodemServerLoop *) ext;
+    struct epoll_event events[SERVER_EVENTS];
+
+    while (1) {
+        pthread_mutex_lock(&loop->lock);
+        unsigned int done = (loop->stopping && (loop->incoming == NULL) && (loop->n_sessions == 0)) ? 1 : 0;
+        pthread_mutex_unlock(&loop->lock);
+        if (done) { break; }
+
+        int timeout = -1;
+        if (loop->n_sessions) {
+            uint64_t deadline = heap_key(loop, 0), now = xmodem_session_clock();
+            if (deadline != XMODEM_SESSION_NEVER) {
+                timeout = (deadline <= now) ? 0 : ((deadline - now > INT_MAX) ? INT_MAX : (int) (deadline - now));
+            }
+        }
+
+        int n_events = epoll_wait(loop->epoll_fd, events, SERVER_EVENTS, timeout);
+        if ((n_events < 0) && (errno != EINTR)) {
+            perror("epoll_wait");
+            break;
+        }
+        uint64_t now = xmodem_session_clock();
+
+        for (int i = 0; i < n_events; ++i) {
+            XmodemServerSession *session = (XmodemServerSession *) events[i].data.ptr;
+            if (session == NULL) {
+                uint64_t value;
+                if (read(loop->event_fd, &value, sizeof (value)) < 0) { ; }
+                adopt(loop, now);
+                continue;
+            }
+            int gone = 0;
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) { gone = receive(session, now) ? 1 : 0; }
+            service(loop, session, now, gone);
+        }
+
+        while (loop->n_sessions && (heap_key(loop, 0) <= now)) {
+            XmodemServerSession *session = loop->heap[0];
+            xmodem_session_poll(&session->session, now);
+            service(loop, session, now, 0);
+        }
+    }
+    return NULL;
+}
+
+static void wake(XmodemServerLoop *loop) {
+    uint64_t value = 1;
+    if (write(loop->event_fd, &value, sizeof (value)) < 0) { ; }
+}
+
+/*
+ * @brief accepts clients on the listening socket of info and sends each one file_name.
+ *     returns once max_sessions clients have been served (never if 0), 0 if all transfers succeeded, -1 otherwise
+ */
+int xmodem_server(TcpServerInfo *info, XmodemServerArgs *args) {
+    if (args->max_clients == 0) { args->max_clients = 1; }
+    args->n_loops = args->n_workers ? args->n_workers : 1;
+    if (args->n_loops > XMODEM_SERVER_MAX_WORKERS) { args->n_loops = XMODEM_SERVER_MAX_WORKERS; }
+    args->options.packet_size = (args->options.packet_size_code == XMODEM_STX) ? XMODEM_1K_BUFF_SIZE : XMODEM_BUFF_SIZE;
+
+    int fd = open(args->file_name, O_RDONLY);
+    args->mapping = (fd >= 0) ? map_from_file(&fd, &args->file_size) : NULL;
+    if (fd >= 0) { close(fd); }
+    if (args->mapping == NULL) {
+        printf("unable to map %s\n", args->file_name);
+        return -1;
+    }
+
+    atomic_init(&args->completed, 0);
+    atomic_init(&args->failed, 0);
+    args->active = 0;
+    memset(args->delta_hashes, 0, sizeof (args->delta_hashes));
+    pthread_mutex_init(&args->lock, NULL);
+    pthread_cond_init(&args->cond, NULL);
+
+    unsigned int n_loops = 0;
+    for (; n_loops < args->n_loops; ++n_loops) {
+        XmodemServerLoop *loop = &args->loops[n_loops];
+        memset(loop, 0, sizeof (XmodemServerLoop));
+        loop->args = args;
+        loop->heap = malloc(args->max_clients * sizeof (XmodemServerSession *));
+        loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        loop->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = NULL;
+        if ((loop->heap == NULL) || (loop->epoll_fd < 0) || (loop->event_fd < 0) ||
+            epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->event_fd, &event)) {
+            free(loop->heap);
+            if (loop->epoll_fd >= 0) { close(loop->epoll_fd); }
+            if (loop->event_fd >= 0) { close(loop->event_fd); }
+            break;
+        }
+        pthread_mutex_init(&loop->lock, NULL);
+        pthread_create(&loop->thread, NULL, server_loop, loop);
+    }
+
+    for (unsigned int accepted = 0; n_loops && ((args->max_sessions == 0) || (accepted < args->max_sessions)); ) {
+        pthread_mutex_lock(&args->lock);
+        while (args->active >= args->max_clients) { pthread_cond_wait(&args->cond, &args->lock); }
+        pthread_mutex_unlock(&args->lock);
+
+        int client_fd = accept(info->server_fd, NULL, NULL);
+        if (client_fd < 0) {
+            if (errno == EINTR) { continue; }
+            perror("ERROR on accept");
+            break;
+        }
+        int one = 1;
+        setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one)); /* ACKs are tiny and latency bound */
+        if (args->start_command) { /* still blocking, and the socket buffer is empty */
+            if (send(client_fd, args->start_command, strlen(args->start_command), MSG_NOSIGNAL) < 0) { ; }
+        }
+        fcntl(client_fd, F_SETFL, fcntl(client_fd, F_GETFL) | O_NONBLOCK);
+
+        XmodemServerSession *session = malloc(sizeof (XmodemServerSession));
+        if (session == NULL) {
+            close(client_fd);
+            continue;
+        }
+        memset(session, 0, sizeof (XmodemServerSession));
+        session->fd = client_fd;
+
+        pthread_mutex_lock(&args->lock);
+        ++args->active;
+        pthread_mutex_unlock(&args->lock);
+
+        XmodemServerLoop *loop = &args->loops[accepted++ % n_loops]; /* round robin */
+        pthread_mutex_lock(&loop->lock);
+        session->next = loop->incoming;
+        loop->incoming = session;
+        pthread_mutex_unlock(&loop->lock);
+        wake(loop);
+    }
+
+    for (unsigned int i = 0; i < n_loops; ++i) {
+        pthread_mutex_lock(&args->loops[i].lock);
+        args->loops[i].stopping = 1;
+        pthread_mutex_unlock(&args->loops[i].lock);
+        wake(&args->loops[i]);
+    }
+    for (unsigned int i = 0; i < n_loops; ++i) {
+        XmodemServerLoop *loop = &args->loops[i];
+        pthread_join(loop->thread, NULL);
+        close(loop->epoll_fd);
+        close(loop->event_fd);
+        pthread_mutex_destroy(&loop->lock);
+        free(loop->heap);
+    }
+
+    pthread_cond_destroy(&args->cond);
+    pthread_mutex_destroy(&args->lock);
+    for (unsigned int i = 0; i < XMODEM_SERVER_DELTA_SIZES; ++i) { free(args->delta_hashes[i]); }
+    unmap_from_file(NULL, args->mapping, args->file_size);
+
+    return ((n_loops == 0) || atomic_load(&args->failed)) ? -1 : 0;
+}
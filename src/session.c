@@ -0,0 +1,2310 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "session.h"
+#include "crc.h"
+#include "lz.h"
+#include "fec.h"
+#include "trace.h"
+
+/* Delays/Timeouts */
+#define XMODEM_DELAY_TOKEN (100) /* quiet line that ends a purge */
+
+/* X, G or W requests sent before the receiver falls back to the next best offer */
+#define XMODEM_NEGOTIATE_TRIES (3)
+
+/* window byte of an X offer that asks for streaming */
+#define XMODEM_EXTENDED_STREAMING (0x7f)
+
+/* Retransmit timeout before the first round trip is measured, as in RFC 6298 */
+#define XMODEM_INITIAL_RTO (1000)
+
+enum {
+    STATE_END = 0,
+
+    /* receiver */
+    STATE_RECV_WAIT, /* between packets: start, header, EOT or CAN */
+    STATE_RECV_PACKET, /* rest of a packet whose header is in packet[0] */
+    STATE_RECV_PURGE, /* damaged packet. reply once the line goes quiet */
+    STATE_RECV_RESUME, /* the sender's answer to R: where its data starts */
+    STATE_RECV_DELTA, /* the sender's answer to D: which blocks come */
+    STATE_RECV_CANCEL, /* CAN CAN after noise: a cancel once the line goes quiet, payload if more follows */
+    STATE_RECV_MODE, /* the sender's answer to X: the window it took, XMODEM_EXTENDED_STREAMING or 0 */
+
+    /* sender */
+    STATE_SEND_NEGOTIATE, /* waiting for NAK, C, G, W or X */
+    STATE_SEND_NEGOTIATE_W, /* window size after W */
+    STATE_SEND_NEGOTIATE_X, /* largest block size after X */
+    STATE_SEND_NEGOTIATE_XW, /* then the window, or XMODEM_EXTENDED_STREAMING */
+    STATE_SEND_NEGOTIATE_F, /* group and parity blocks after F */
+    STATE_SEND_BLOCK, /* stop-and-wait: packet out, waiting for ACK */
+    STATE_SEND_STREAM, /* ymodem-g: packets back to back */
+    STATE_SEND_WINDOW, /* sliding window: waiting for a reply */
+    STATE_SEND_WINDOW_TAG, /* block id after ACK or NAK */
+    STATE_SEND_EOT, /* EOT out, waiting for ACK */
+    STATE_SEND_EOT_TAG, /* window: block id after a NAK of the EOT */
+    STATE_SEND_FILE_HEADER, /* batch: block 0 out, waiting for ACK */
+    STATE_SEND_FILE_READY, /* batch: block 0 taken, waiting for C before the data */
+    STATE_SEND_RESUME, /* rest of an R offer: what the receiver already holds */
+    STATE_SEND_DELTA, /* rest of a D offer: hashes of the blocks the receiver holds */
+
+    STATE_CAN /* one CAN seen. need another to confirm */
+};
+
+uint64_t xmodem_session_clock(void) {
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return (uint64_t) spec.tv_sec * 1000 + spec.tv_nsec / 1000000;
+}
+
+/* @brief xmodem_session_clock() in microseconds, e.g. for XmodemSession.clock_us */
+uint64_t xmodem_session_clock_us(void) {
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return (uint64_t) spec.tv_sec * 1000000 + spec.tv_nsec / 1000;
+}
+
+/* @brief largest extended block the options allow: a power of two between the extended limits, 0 if not extended */
+unsigned int xmodem_extended_block_size(XmodemOptions const *options) {
+    if (options->extended == 0) { return 0; }
+    unsigned int size = options->extended_block_size ? options->extended_block_size : XMODEM_EXTENDED_MAX_BLOCK;
+    if (size < XMODEM_EXTENDED_MIN_BLOCK) { return XMODEM_EXTENDED_MIN_BLOCK; }
+    if (size > XMODEM_EXTENDED_MAX_BLOCK) { return XMODEM_EXTENDED_MAX_BLOCK; }
+    return 1u << (31 - __builtin_clz(size)); /* round down */
+}
+
+/*
+ * @brief sender: the blocks of our file of size bytes, hashed in ours at the receiver's block size, that differ from
+ *     the receiver's or that it does not have, in order, into blocks
+ * @return how many
+ */
+int xmodem_delta_blocks(XmodemSignature const *theirs, BlockHash const *ours, uint32_t size, uint32_t *blocks) {
+    const uint32_t n_blocks = (size + (uint64_t) theirs->block_size - 1) / theirs->block_size;
+    int n = 0;
+    for (uint32_t i = 0; i < n_blocks; ++i) {
+        if ((i >= theirs->n_blocks) || (ours[i].lo != theirs->hashes[i].lo) || (ours[i].hi != theirs->hashes[i].hi)) {
+            blocks[n++] = i;
+        }
+    }
+    return n;
+}
+
+static int output_pending(XmodemSession const *session) {
+    return (session->output_head != session->output_tail) ? 1 : 0;
+}
+
+static unsigned int output_length(XmodemOutput const *output) {
+    if (output->packet) {
+        return output->packet->header_size + output->packet->payload_size + output->packet->footer_size;
+    }
+    return output->length;
+}
+
+static void trace(XmodemSession const *session, unsigned int type, uint32_t arg, uint32_t length) {
+    trace_record(type, session->trace_id, arg, length);
+}
+
+/* @brief queue a reply. a full queue drops it, the same as a byte lost on the line */
+static void emit(XmodemSession *session, uint8_t const *b, unsigned int n) {
+    unsigned int tail = (session->output_tail + 1) % XMODEM_SESSION_OUTPUTS;
+    if (tail == session->output_head) { return; }
+    XmodemOutput *output = &session->outputs[session->output_tail];
+    output->packet = NULL;
+    memcpy(output->bytes, b, n);
+    output->length = n;
+    output->queued_us = session->now_us;
+    session->output_tail = tail;
+    if ((session->sender == 0) && session->started && (b[0] == XMODEM_NAK)) {
+        xmodem_stats_add(&session->stats->naks_sent, 1);
+        trace(session, TRACE_NAK_SENT, (n > 1) ? b[1] : 0, 0);
+    } else if ((session->sender == 0) && (b[0] == XMODEM_ACK)) {
+        trace(session, TRACE_ACK_SENT, (n > 1) ? b[1] : 0, 0);
+    }
+}
+
+static void emit_byte(XmodemSession *session, uint8_t byte) {
+    emit(session, &byte, 1);
+}
+
+static void emit_tagged(XmodemSession *session, uint8_t reply, uint8_t packet_id) {
+    uint8_t b[2] = { reply, packet_id };
+    emit(session, b, sizeof (b));
+}
+
+static void emit_packet(XmodemSession *session, XmodemPacket const *packet) {
+    unsigned int tail = (session->output_tail + 1) % XMODEM_SESSION_OUTPUTS;
+    if (tail == session->output_head) { return; }
+    session->outputs[session->output_tail].packet = packet;
+    session->outputs[session->output_tail].queued_us = session->now_us;
+    session->output_tail = tail;
+}
+
+static void finish(XmodemSession *session, int status) {
+    session->state = STATE_END;
+    session->status = status;
+    trace(session, TRACE_SESSION_END, status, 0);
+}
+
+/* @brief give up and tell the other side */
+static void cancel(XmodemSession *session) {
+    for (int i = 0; i < 3; ++i) { emit_byte(session, XMODEM_CAN); }
+    xmodem_stats_add(&session->stats->cancels_sent, 1);
+    trace(session, TRACE_CANCEL, 0, 0);
+    finish(session, XMODEM_SESSION_FAILED);
+}
+
+/* @brief sender waiting on a reply to a packet or EOT, where the measured round trip sets the timeout */
+static int awaiting_reply(XmodemSession const *session) {
+    unsigned int state = (session->state == STATE_CAN) ? session->resume_state : session->state;
+    return (session->sender && session->options.max_timeout_ms && (state != STATE_SEND_NEGOTIATE) &&
+        (state != STATE_SEND_NEGOTIATE_W) && (state != STATE_SEND_NEGOTIATE_X) && (state != STATE_SEND_NEGOTIATE_XW) &&
+        (state != STATE_SEND_NEGOTIATE_F) && (state != STATE_SEND_RESUME) && (state != STATE_SEND_DELTA)) ? 1 : 0;
+}
+
+/* @brief the state's timeout starts over, e.g. after bytes arrive or the output drains */
+static void rearm(XmodemSession *session, uint64_t now) {
+    unsigned int timeout = session->options.timeout_ms;
+    if ((session->state == STATE_RECV_PURGE) || (session->state == STATE_RECV_CANCEL)) { timeout = XMODEM_DELAY_TOKEN; }
+    else if (awaiting_reply(session)) {
+        /*
+         * the receiver only NAKs a damaged block after XMODEM_DELAY_TOKEN of silence. giving up sooner puts a second
+         * copy on the line, and the ACK of the spare copy would be taken for the next block. an EOT is answered at
+         * once, and a clean line ACKs long before either timeout
+         */
+        unsigned int purged = (session->state == STATE_SEND_BLOCK) || (session->state == STATE_SEND_FILE_HEADER);
+        timeout = session->rto + (purged ? XMODEM_DELAY_TOKEN : 0);
+    }
+    session->deadline = now + timeout;
+}
+
+static unsigned int clamp_rto(XmodemOptions const *options, uint64_t rto) {
+    if (rto < options->min_timeout_ms) { return options->min_timeout_ms; }
+    return (rto > options->max_timeout_ms) ? options->max_timeout_ms : rto;
+}
+
+/*
+ * @brief one send-to-ACK time (Jacobson/Karels). srtt and rttvar are kept in 1/8 ms.
+ *     rto = srtt + 4 rttvar, at least one clock tick more than srtt
+ */
+static void rtt_sample(XmodemSession *session, uint64_t sent_at) {
+    if (session->options.max_timeout_ms == 0) { return; }
+    int64_t r8 = (int64_t) (session->now - sent_at) * 8;
+    if (session->rtt_samples++ == 0) {
+        session->srtt8 = r8;
+        session->rttvar8 = r8 / 2;
+    } else {
+        int64_t delta = session->srtt8 - r8;
+        session->rttvar8 += ((delta < 0 ? -delta : delta) - session->rttvar8) / 4;
+        session->srtt8 += (r8 - session->srtt8) / 8;
+    }
+    int64_t spread = (4 * session->rttvar8 > 8) ? 4 * session->rttvar8 : 8;
+    session->rto = clamp_rto(&session->options, (session->srtt8 + spread + 7) / 8);
+}
+
+/* @brief a reply never came: wait twice as long for the next one, until a fresh sample says otherwise */
+static void rto_backoff(XmodemSession *session) {
+    if (session->options.max_timeout_ms) { session->rto = clamp_rto(&session->options, 2 * (uint64_t) session->rto); }
+}
+
+/* @brief sender: the block in slot is ACKed for the first time. first_send = it went out only once (Karn) */
+static void block_acked(XmodemSession *session, unsigned int slot, unsigned int first_send) {
+    xmodem_histogram_record(&session->stats->block_service, session->now_us - session->queued_us[slot]);
+    uint64_t out_us = session->out_us[slot];
+    if (first_send && (out_us >= session->queued_us[slot]) && (session->now_us >= out_us)) {
+        xmodem_histogram_record(&session->stats->ack_turnaround, session->now_us - out_us);
+    }
+}
+
+static void nak_received(XmodemSession *session) {
+    xmodem_stats_add(&session->stats->naks_received, 1);
+    trace(session, TRACE_NAK_RECEIVED, session->base, 0);
+}
+
+static int retries_exhausted(XmodemSession const *session) {
+    return (session->options.max_retries && (session->retries >= session->options.max_retries)) ? 1 : 0;
+}
+
+/* batch */
+
+/*
+ * @brief block 0 as ymodem has it: name, NUL, then size in decimal, mtime and mode in octal. an empty name ends
+ *     the batch. the rest of the block is NUL
+ * @return bytes used
+ */
+static unsigned int encode_file_info(XmodemFileInfo const *info, uint8_t *b, unsigned int n) {
+    memset(b, 0, n);
+    if (info->name[0] == 0) { return 1; }
+    unsigned int length = strnlen(info->name, XMODEM_MAX_FILE_NAME - 1);
+    memcpy(b, info->name, length);
+    int fields = snprintf((char *) &b[length + 1], n - length - 1, "%u %llo %o", info->size,
+        (unsigned long long) info->mtime, info->mode);
+    return length + 1 + fields + 1;
+}
+
+/* @return 0, or -1 if the block cannot be block 0 */
+static int decode_file_info(XmodemFileInfo *info, uint8_t const *b, unsigned int n) {
+    char text[XMODEM_1K_BUFF_SIZE + 1];
+    memset(info, 0, sizeof (XmodemFileInfo));
+    if (n > XMODEM_1K_BUFF_SIZE) { n = XMODEM_1K_BUFF_SIZE; }
+    memcpy(text, b, n);
+    text[n] = 0;
+    unsigned int length = strlen(text);
+    if (length == 0) { return 0; } /* end of batch */
+    if ((length >= XMODEM_MAX_FILE_NAME) || (length + 1 >= n)) { return -1; }
+    memcpy(info->name, text, length + 1);
+    unsigned long long mtime = 0;
+    if (sscanf(&text[length + 1], "%u %llo %o", &info->size, &mtime, &info->mode) < 1) { return -1; }
+    info->mtime = mtime;
+    return 0;
+}
+
+/* resume */
+
+static void put_resume_field(uint8_t *b, uint32_t value) {
+    for (int i = XMODEM_RESUME_FIELD_SIZE - 1; i >= 0; --i) {
+        b[i] = 0x80 | (value & 0x7f);
+        value >>= 7;
+    }
+}
+
+/* @return 0, or -1 if the field was damaged */
+static int get_resume_field(uint8_t const *b, uint32_t *value) {
+    uint64_t v = 0;
+    for (int i = 0; i < XMODEM_RESUME_FIELD_SIZE; ++i) {
+        if ((b[i] & 0x80) == 0) { return -1; }
+        v = (v << 7) | (b[i] & 0x7f);
+    }
+    if (v > 0xffffffff) { return -1; }
+    *value = v;
+    return 0;
+}
+
+/* delta */
+
+/* 7-bit groups that carry n bytes */
+#define WIRE_GROUPS(n) ((8 * (n) + 6) / 7)
+
+static void put_be32(uint8_t *b, uint32_t value) {
+    b[0] = value >> 24;
+    b[1] = value >> 16;
+    b[2] = value >> 8;
+    b[3] = value;
+}
+
+static uint32_t get_be32(uint8_t const *b) {
+    return ((uint32_t) b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+}
+
+/* @brief n bytes as 7-bit groups with the top bit set, msb first, the last group padded with zeros. @return groups */
+static unsigned int put_groups(uint8_t *groups, uint8_t const *b, unsigned int n) {
+    unsigned int bits = 0, n_bits = 0, k = 0;
+    for (unsigned int i = 0; i < n; ++i) {
+        bits = (bits << 8) | b[i];
+        n_bits += 8;
+        while (n_bits >= 7) {
+            n_bits -= 7;
+            groups[k++] = 0x80 | ((bits >> n_bits) & 0x7f);
+        }
+        bits &= (1u << n_bits) - 1;
+    }
+    if (n_bits) { groups[k++] = 0x80 | ((bits << (7 - n_bits)) & 0x7f); }
+    return k;
+}
+
+/* @brief the message is n bytes in all. -1 if no room */
+static int wire_expect(XmodemSession *session, unsigned int n) {
+    uint8_t *b = realloc(session->wire_in, n);
+    if (b == NULL) { return -1; }
+    session->wire_in = b;
+    session->wire_expected = n;
+    return 0;
+}
+
+/* @brief the other side's message starts: a header of n bytes first, which says how long the rest is. -1 if no room */
+static int wire_start(XmodemSession *session, unsigned int n) {
+    session->wire_length = 0;
+    session->wire_bits = 0;
+    session->wire_nbits = 0;
+    return wire_expect(session, n);
+}
+
+/* @return 1 once the bytes expected are in, 0 while more are to come, -1 if the byte cannot be part of the message */
+static int wire_feed(XmodemSession *session, uint8_t byte) {
+    if ((byte & 0x80) == 0) { return -1; }
+    session->wire_bits = ((session->wire_bits << 7) | (byte & 0x7f)) & 0x3fff;
+    session->wire_nbits += 7;
+    if (session->wire_nbits >= 8) {
+        session->wire_nbits -= 8;
+        session->wire_in[session->wire_length++] = session->wire_bits >> session->wire_nbits;
+    }
+    return (session->wire_length == session->wire_expected) ? 1 : 0;
+}
+
+/* @brief the crc-32c in the last 4 bytes of the message matches the rest */
+static int wire_intact(XmodemSession const *session) {
+    const unsigned int n = session->wire_length - 4;
+    return (get_be32(&session->wire_in[n]) == crc32c(session->wire_in, n)) ? 1 : 0;
+}
+
+/* @brief D and the n bytes of raw in groups to wire_out, and out. -1 if no room, or the last one is still going out */
+static int wire_send(XmodemSession *session, uint8_t const *raw, unsigned int n) {
+    if (output_pending(session)) { return -1; } /* it may be in wire_out. the other side asks again */
+    uint8_t *b = realloc(session->wire_out, 1 + WIRE_GROUPS(n));
+    if (b == NULL) { return -1; }
+    session->wire_out = b;
+    if ((session->wire_packet == NULL) && ((session->wire_packet = malloc(sizeof (XmodemPacket))) == NULL)) {
+        return -1;
+    }
+    b[0] = XMODEM_DDD;
+    XmodemPacket *packet = session->wire_packet; /* far longer than a reply, so it goes out as a bare payload */
+    packet->payload = b;
+    packet->payload_size = 1 + put_groups(&b[1], raw, n);
+    packet->header_size = 0;
+    packet->footer_size = 0;
+    packet->footer_offset = 0;
+    emit_packet(session, packet);
+    return 0;
+}
+
+/* @brief where an offset into the data lies in the file. the same unless a delta was agreed */
+static uint32_t file_offset(XmodemSession const *session, uint32_t offset) {
+    if (session->delta == 0) { return offset; }
+    uint32_t index = offset / session->delta_block_size;
+    if (index >= session->n_delta_blocks) { return session->delta_size; }
+    return session->delta_blocks[index] * session->delta_block_size + offset % session->delta_block_size;
+}
+
+/* receiver */
+
+/* @brief windowed replies name their block, except around block 0 of a batch, which is stop-and-wait */
+static int tagged_replies(XmodemSession const *session) {
+    return (session->options.window && ((session->options.batch == 0) || session->file_open)) ? 1 : 0;
+}
+
+/*
+ * @brief X size window = extended packets, G = streaming, W n = window, C = crc, NAK = checksum. repeated until
+ *     the sender starts, each offer a few times before falling back to the next. before X, Z: packed blocks welcome,
+ *     and F group parity: parity blocks welcome. the sender answers X with X and the window it took, or streaming
+ */
+static void send_start(XmodemSession *session) {
+    XmodemOptions const *options = &session->options;
+    uint8_t start_byte = (options->crc_checksum == CHECKSUM_OPTION_CRC) ? XMODEM_CCC : XMODEM_NAK;
+    unsigned int tier = session->start_tries++ / XMODEM_NEGOTIATE_TRIES;
+    if (session->extended_size == 0) { ++tier; }
+    if (tier == 0) { start_byte = XMODEM_XXX; }
+    else if ((tier == 1) && options->streaming) { start_byte = XMODEM_GGG; }
+    else if ((tier == 1) && options->window) { start_byte = XMODEM_WWW; }
+
+    if ((start_byte == XMODEM_XXX) && session->unpacked) { emit_byte(session, XMODEM_ZZZ); }
+    if ((start_byte == XMODEM_XXX) && session->fec_parity) {
+        uint8_t offer[3] = { XMODEM_FFF, 0x80 | session->fec_group, 0x80 | session->fec_parity };
+        emit(session, offer, sizeof (offer));
+    }
+    if (start_byte == XMODEM_XXX) { /* clear of C, G, NAK, CAN */
+        uint8_t offer[3] = {
+            XMODEM_XXX, 0x80 | __builtin_ctz(session->extended_size),
+            0x80 | (options->streaming ? XMODEM_EXTENDED_STREAMING : options->window)
+        };
+        emit(session, offer, sizeof (offer));
+    } else if (start_byte == XMODEM_WWW) {
+        emit_tagged(session, XMODEM_WWW, 0x80 | options->window);
+    } else {
+        emit_byte(session, start_byte);
+    }
+    session->start_byte = start_byte;
+}
+
+/* @brief R offset crc: the file starts with offset bytes we already hold. repeated until the sender answers */
+static void send_resume(XmodemSession *session) {
+    uint8_t offer[XMODEM_RESUME_OFFER_SIZE] = { XMODEM_RRR };
+    put_resume_field(&offer[1], session->resume_offset);
+    put_resume_field(&offer[1 + XMODEM_RESUME_FIELD_SIZE], session->resume_crc);
+    emit(session, offer, sizeof (offer));
+}
+
+/* @brief offer what the sink holds of the file, if anything. 1 if offered */
+static int offer_resume(XmodemSession *session) {
+    session->resume_offset = 0;
+    session->resume_crc = 0;
+    if (session->options.resume && session->blocks.checkpoint) {
+        session->resume_offset = session->blocks.checkpoint(session->blocks.context, &session->resume_crc);
+    }
+    if (session->resume_offset == 0) { return 0; }
+    session->resume_offered = 1;
+    send_resume(session);
+    return 1;
+}
+
+/* @brief the data starts at offset: what we offered, or 0 if the sender sends it all. -1 if the sink says no */
+static int restart_at(XmodemSession *session, uint32_t offset) {
+    session->resume_offered = 0;
+    if (session->blocks.restart && session->blocks.restart(session->blocks.context, offset)) {
+        cancel(session);
+        return -1;
+    }
+    session->expected_offset = offset;
+    session->retries = 0;
+    return 0;
+}
+
+/* @brief the sender answered R. the usual start follows, or C for the data of a batch file */
+static void resume_answer(XmodemSession *session) {
+    uint32_t offset;
+    session->state = STATE_RECV_WAIT;
+    if (get_resume_field(&session->packet[0], &offset) || ((offset != 0) && (offset != session->resume_offset))) {
+        return; /* damaged. we ask again when the line goes quiet */
+    }
+    if (restart_at(session, offset) != 0) { return; }
+    if (session->file_open) {
+        emit_byte(session, XMODEM_CCC);
+    } else {
+        send_start(session);
+    }
+}
+
+/* @brief D: hashes of the file the sink holds, so that only the blocks that differ come. 1 if offered */
+static int offer_delta(XmodemSession *session) {
+    XmodemOptions const *options = &session->options;
+    if ((options->delta == 0) || (session->blocks.signature == NULL) || (session->blocks.patch == NULL)) { return 0; }
+
+    unsigned int block_size = XMODEM_DELTA_MIN_BLOCK;
+    while ((block_size * 2 <= options->delta) && (block_size < XMODEM_DELTA_MAX_BLOCK)) { block_size *= 2; }
+    if (session->extended_size && (block_size < XMODEM_EXTENDED_MIN_BLOCK)) {
+        block_size = XMODEM_EXTENDED_MIN_BLOCK; /* extended blocks never straddle two delta blocks */
+    }
+    XmodemSignature const *signature = session->blocks.signature(session->blocks.context, block_size);
+    if ((signature == NULL) || (signature->block_size < block_size) ||
+        (signature->block_size > XMODEM_DELTA_MAX_BLOCK) || (signature->block_size & (signature->block_size - 1)) ||
+        (signature->n_blocks > XMODEM_DELTA_MAX_BLOCKS) ||
+        (signature->n_blocks != (signature->size + (uint64_t) signature->block_size - 1) / signature->block_size)) {
+        return 0;
+    }
+
+    const unsigned int n = 1 + 4 + signature->n_blocks * XMODEM_DELTA_HASH_SIZE + 4;
+    uint8_t *raw = malloc(n);
+    if (raw == NULL) { return 0; }
+    raw[0] = __builtin_ctz(signature->block_size);
+    put_be32(&raw[1], signature->size);
+    for (uint32_t i = 0; i < signature->n_blocks; ++i) {
+        uint8_t *b = &raw[5 + i * XMODEM_DELTA_HASH_SIZE];
+        put_be32(&b[0], signature->hashes[i].lo >> 32);
+        put_be32(&b[4], signature->hashes[i].lo);
+        put_be32(&b[8], signature->hashes[i].hi >> 32);
+        put_be32(&b[12], signature->hashes[i].hi);
+    }
+    put_be32(&raw[n - 4], crc32c(raw, n - 4));
+    session->delta_block_size = signature->block_size;
+    int status = wire_send(session, raw, n);
+    free(raw);
+    if (status != 0) { return 0; }
+    session->delta_offered = 1;
+    session->delta_tries = 1;
+    return 1;
+}
+
+/* @brief the sender never answered D, so it knows nothing of it and sends the whole file */
+static void delta_refused(XmodemSession *session) {
+    session->delta_offered = 0;
+    if (session->blocks.patch(session->blocks.context, 0, NULL, 0)) {
+        cancel(session);
+        return;
+    }
+    session->retries = 0;
+    send_start(session);
+}
+
+/* @brief the sender's plan is in: which blocks of its file come. the usual start follows */
+static void delta_plan(XmodemSession *session) {
+    uint8_t const *raw = session->wire_in;
+    session->state = STATE_RECV_WAIT;
+    if (wire_intact(session) == 0) { return; } /* damaged. we ask again when the line goes quiet */
+
+    const uint32_t size = get_be32(raw);
+    const uint32_t n_blocks = (size + (uint64_t) session->delta_block_size - 1) / session->delta_block_size;
+    uint32_t *blocks = malloc((n_blocks ? n_blocks : 1) * sizeof (uint32_t));
+    if (blocks == NULL) {
+        cancel(session);
+        return;
+    }
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < n_blocks; ++i) {
+        if (raw[4 + i / 8] & (1u << (i % 8))) { blocks[n++] = i; }
+    }
+    if (session->blocks.patch(session->blocks.context, size, blocks, n)) {
+        free(blocks);
+        cancel(session);
+        return;
+    }
+    session->delta = 1;
+    session->delta_offered = 0;
+    session->delta_size = size;
+    session->delta_blocks = blocks;
+    session->n_delta_blocks = n;
+    session->retries = 0;
+    send_start(session);
+}
+
+/* @brief SOH and STX start packets in classic mode, XTX in extended mode. anything else is noise */
+static int packet_header(XmodemSession const *session, uint8_t byte) {
+    if (session->started && session->options.extended) { return (byte == XMODEM_XTX) ? 1 : 0; }
+    if (byte == XMODEM_XTX) { return ((session->started == 0) && (session->start_byte == XMODEM_XXX)) ? 1 : 0; }
+    return ((byte == XMODEM_SOH) || (byte == XMODEM_STX)) ? 1 : 0;
+}
+
+static void begin_packet(XmodemSession *session, uint8_t header) {
+    XmodemOptions *options = &session->options;
+    if (session->started == 0) { /* did the sender take our offer */
+        unsigned int extended = (header == XMODEM_XTX) ? 1 : 0;
+        unsigned int mode = session->extended_mode & 0x7f;
+        options->streaming = ((session->start_byte == XMODEM_GGG) || (extended && options->streaming)) ? 1 : 0;
+        options->window = ((session->start_byte == XMODEM_WWW) || extended) ? options->window : 0;
+        if (extended && session->extended_mode) { /* it may take less than we offered. no answer came: all of it */
+            options->streaming = (options->streaming && (mode == XMODEM_EXTENDED_STREAMING)) ? 1 : 0;
+            if ((mode < 2) || (mode == XMODEM_EXTENDED_STREAMING)) { options->window = 0; }
+            else if (mode < options->window) { options->window = mode; }
+        }
+        options->extended = extended;
+        if (extended) {
+            options->crc_checksum = CHECKSUM_OPTION_CRC32C;
+            options->extended_block_size = session->extended_size;
+        }
+        session->started = 1;
+    }
+    session->packet[0] = header;
+    session->packet_us = session->now_us;
+    session->parity = 0;
+    if (header == XMODEM_XTX) { /* block size and length follow in the header */
+        session->header_size = XMODEM_EXTENDED_HEADER_SIZE;
+        session->payload_size = 0;
+        session->payload_length = 0;
+        session->packet_end = XMODEM_EXTENDED_HEADER_SIZE;
+        session->crc32 = 0;
+    } else {
+        session->header_size = 3;
+        session->payload_size = (header == XMODEM_STX) ? XMODEM_1K_BUFF_SIZE : XMODEM_BUFF_SIZE;
+        session->payload_length = session->payload_size;
+        session->engine = xmodem_engine(session->payload_size, options->crc_checksum);
+        session->packet_end = 3 + session->payload_size + ((options->crc_checksum == CHECKSUM_OPTION_CRC) ? 2 : 1);
+    }
+    session->packet_index = 1;
+    session->crc = 0;
+    session->sum = 0;
+    session->state = STATE_RECV_PACKET;
+}
+
+/* @brief the sender sends parity blocks: said so with F, or sent one */
+static void fec_agreed(XmodemSession *session) {
+    session->fec = 1;
+    session->options.fec_group = session->fec_group;
+    session->options.fec_parity = session->fec_parity;
+}
+
+/*
+ * @brief extended header in: size the rest of the packet. 0 if the header cannot be right. once parity blocks come,
+ *     a block number far from the window is taken for damage too, so a packet found by rescanning is more likely real
+ */
+static int extended_header(XmodemSession *session) {
+    uint8_t const *packet = session->packet;
+    unsigned int length = ((packet[6] << 8) | packet[7]) + 1;
+    unsigned int shift = packet[1] & ~(XMODEM_EXTENDED_PACKED | XMODEM_EXTENDED_PARITY);
+    uint32_t packet_id = get_be32(&packet[2]);
+    if ((shift < (unsigned int) __builtin_ctz(XMODEM_EXTENDED_MIN_BLOCK))
+        || (shift > (unsigned int) __builtin_ctz(session->extended_size))) {
+        return 0;
+    }
+    if ((packet[1] & XMODEM_EXTENDED_PACKED) && (session->unpacked == NULL)) { return 0; } /* we never offered */
+    if (session->fec && (packet_id - session->expected_packet_id + XMODEM_MAX_WINDOW > 2 * XMODEM_MAX_WINDOW)) {
+        return 0;
+    }
+    session->payload_size = 1u << shift;
+    session->parity = (packet[1] & XMODEM_EXTENDED_PARITY) ? 1 : 0;
+    if (session->parity) { /* group size, parity blocks - 1 and which one in the length field */
+        unsigned int m = (packet[7] >> 4) + 1;
+        if ((session->fec_parity == 0) || (packet[1] & XMODEM_EXTENDED_PACKED) || (packet[6] >= session->fec_group) ||
+            (m > session->fec_parity) || ((packet[7] & 0x0f) >= m)) {
+            return 0;
+        }
+        if (session->fec == 0) { fec_agreed(session); }
+        length = session->payload_size + XMODEM_FEC_DESCRIPTOR_SIZE;
+    } else if (length > session->payload_size) {
+        return 0;
+    }
+    session->payload_length = length;
+    session->engine = xmodem_engine(session->payload_size, CHECKSUM_OPTION_CRC32C);
+    session->packet_end = XMODEM_EXTENDED_HEADER_SIZE + length + XMODEM_EXTENDED_FOOTER_SIZE;
+    return 1;
+}
+
+/* @brief nothing more to read of a damaged packet. reply with reply (and tag) once the line goes quiet */
+static void purge(XmodemSession *session, uint8_t reply, uint32_t packet_id) {
+    session->purge_reply[0] = reply;
+    session->purge_reply[1] = packet_id;
+    session->purge_length = tagged_replies(session) ? 2 : 1;
+    session->state = STATE_RECV_PURGE;
+}
+
+/* @brief the payload of the packet in is lz-packed */
+static unsigned int packet_packed(XmodemSession const *session) {
+    return ((session->header_size == XMODEM_EXTENDED_HEADER_SIZE) && (session->packet[1] & XMODEM_EXTENDED_PACKED)) ?
+        1 : 0;
+}
+
+/* @brief verified payload of length bytes out to the sink, unpacked first if it was packed. nonzero aborts */
+static int put_block(XmodemSession *session, uint32_t offset, uint8_t const *data, unsigned int length,
+    unsigned int packed) {
+    session->wire_bytes += length;
+    if (packed) {
+        int n = lz_decompress(data, length, session->unpacked, session->payload_size);
+        if (n <= 0) { return -1; } /* the crc matched, so the sender packed it wrong */
+        data = session->unpacked;
+        length = n;
+        session->options.compress = 1;
+    }
+    session->data_bytes += length;
+    xmodem_stats_add(&session->stats->data_bytes, length);
+    xmodem_stats_add(&session->stats->blocks_received, 1);
+    if (session->blocks.put_block == NULL) { return 0; }
+    if (session->delta) { /* padding would overwrite the blocks that stay */
+        offset = file_offset(session, offset);
+        if (offset >= session->delta_size) { return 0; }
+        if (length > session->delta_size - offset) { length = session->delta_size - offset; }
+    }
+    return session->blocks.put_block(session->blocks.context, offset, data, length);
+}
+
+/* @brief blocks ahead of the one expected we take: the window, or a group when streaming with parity blocks */
+static unsigned int recv_window(XmodemSession const *session) {
+    return session->options.window ? session->options.window : session->fec_group;
+}
+
+/* @brief windowed: block packet_id, ahead blocks past the one expected, is in. nonzero if the sink failed */
+static int take_block(XmodemSession *session, uint32_t packet_id, uint32_t ahead, uint8_t const *data,
+    unsigned int length, unsigned int packed) {
+    const uint32_t mask = session->options.extended ? 0xffffffff : 0xff;
+    if (session->received[packet_id & 0xff]) {
+        xmodem_stats_add(&session->stats->duplicates, 1);
+    } else if (put_block(session, session->expected_offset + ahead * session->payload_size, data, length, packed)) {
+        cancel(session);
+        return -1;
+    }
+    session->received[packet_id & 0xff] = 1;
+    while (session->received[session->expected_packet_id & 0xff]) {
+        session->received[session->expected_packet_id & 0xff] = 0;
+        session->expected_packet_id = (session->expected_packet_id + 1) & mask;
+        session->expected_offset += session->payload_size;
+    }
+    session->retries = 0;
+    return 0;
+}
+
+/* forward error correction */
+
+/* @brief a new file: no block of it is in yet */
+static void fec_reset(XmodemSession *session) {
+    session->fec_highest = session->expected_packet_id - 1;
+    session->fec_checked = session->expected_packet_id;
+    session->fec_have = 0;
+    memset(session->fec_shard_valid, 0, sizeof (session->fec_shard_valid));
+}
+
+static uint8_t *fec_shard(XmodemSession const *session, unsigned int slot) {
+    return &session->fec_shards[(size_t) slot * (session->extended_size + XMODEM_FEC_DESCRIPTOR_SIZE)];
+}
+
+/*
+ * @brief keeps the block in for rebuilding others of its group: the payload padded to the block size, then its size
+ *     byte and length field. a block older than the last fec_group is not part of a group still to come
+ */
+static void fec_keep(XmodemSession *session, uint32_t packet_id) {
+    uint8_t const *packet = session->packet;
+    if ((int32_t) (packet_id - session->fec_highest) > 0) { session->fec_highest = packet_id; }
+    if (session->fec_highest - packet_id >= session->fec_group) { return; }
+    const unsigned int slot = packet_id % session->fec_group;
+    uint8_t *shard = fec_shard(session, slot);
+    memcpy(shard, &packet[XMODEM_EXTENDED_HEADER_SIZE], session->payload_length);
+    memset(&shard[session->payload_length], 0, session->payload_size - session->payload_length);
+    shard += session->payload_size;
+    shard[0] = packet[1];
+    shard[1] = packet[6];
+    shard[2] = packet[7];
+    shard[3] = 0;
+    session->fec_shard_id[slot] = packet_id;
+    session->fec_shard_valid[slot] = 1;
+}
+
+/* @brief block packet_id cannot be rebuilt. a window asks for it again, streaming has no way back */
+static void fec_lost(XmodemSession *session, uint32_t packet_id) {
+    if ((packet_id - session->expected_packet_id >= recv_window(session)) || session->received[packet_id & 0xff]) {
+        return; /* in after all */
+    }
+    if (session->options.window) {
+        emit_tagged(session, XMODEM_NAK, packet_id);
+    } else {
+        cancel(session);
+    }
+}
+
+/* @brief blocks fec_group or more behind the newest that never came. the parity of their group has been and gone */
+static void fec_age(XmodemSession *session) {
+    if ((int32_t) (session->expected_packet_id - session->fec_checked) > 0) {
+        session->fec_checked = session->expected_packet_id;
+    }
+    while ((session->state != STATE_END) &&
+        ((int32_t) (session->fec_highest - session->fec_checked) >= (int32_t) session->fec_group)) {
+        fec_lost(session, session->fec_checked++);
+    }
+}
+
+/* @brief the line went quiet, so no parity is on its way: every block missing short of the newest is asked for */
+static void fec_quiet(XmodemSession *session) {
+    for (uint32_t id = session->expected_packet_id + 1; (int32_t) (session->fec_highest - id) > 0; ++id) {
+        fec_lost(session, id);
+    }
+    if ((int32_t) (session->fec_highest - session->fec_checked) >= 0) {
+        session->fec_checked = session->fec_highest + 1;
+    }
+}
+
+/*
+ * @brief parity block j of m for the group of fec_k blocks from fec_first is in. once as many are in as blocks of
+ *     the group are missing, those are rebuilt and taken as if they had come. if the last is in and that is not
+ *     enough, the missing blocks are lost
+ */
+static void fec_repair(XmodemSession *session, unsigned int m, unsigned int j) {
+    const unsigned int k = session->fec_k, size = session->payload_size;
+    uint8_t *data[XMODEM_FEC_MAX_GROUP], *parity[XMODEM_FEC_MAX_PARITY];
+    uint32_t lost = 0, wanted = 0;
+    for (unsigned int i = 0; i < k; ++i) {
+        const uint32_t packet_id = session->fec_first + i;
+        const unsigned int slot = packet_id % session->fec_group;
+        data[i] = fec_shard(session, slot);
+        if ((session->fec_shard_valid[slot] == 0) || (session->fec_shard_id[slot] != packet_id)) { lost |= 1u << i; }
+        if ((packet_id - session->expected_packet_id < recv_window(session)) &&
+            (session->received[packet_id & 0xff] == 0)) {
+            wanted |= 1u << i;
+        }
+    }
+    if ((wanted == 0) || (lost == 0)) { return; }
+    if (__builtin_popcount(lost) > __builtin_popcount(session->fec_have)) {
+        if (j + 1 < m) { return; } /* more to come */
+        for (unsigned int i = 0; (i < k) && (session->state != STATE_END); ++i) {
+            if (wanted & (1u << i)) { fec_lost(session, session->fec_first + i); }
+        }
+        if ((int32_t) (session->fec_first + k - session->fec_checked) > 0) {
+            session->fec_checked = session->fec_first + k; /* asked for already */
+        }
+        return;
+    }
+
+    for (unsigned int p = 0; p < session->fec_parity; ++p) {
+        parity[p] = &session->fec_buffers[(size_t) p * (session->extended_size + XMODEM_FEC_DESCRIPTOR_SIZE)];
+    }
+    const int status = fec_rebuild(data, lost, k, parity, session->fec_have, size + XMODEM_FEC_DESCRIPTOR_SIZE);
+    session->fec_have = 0; /* used up */
+    if (status != 0) { return; }
+    for (unsigned int i = 0; (i < k) && (session->state != STATE_END); ++i) {
+        const uint32_t packet_id = session->fec_first + i;
+        uint8_t const *descriptor = &data[i][size];
+        const unsigned int length = ((descriptor[1] << 8) | descriptor[2]) + 1;
+        if ((lost & (1u << i)) == 0) { continue; }
+        if (((descriptor[0] & ~XMODEM_EXTENDED_PACKED) != __builtin_ctz(size)) || (length > size)) { continue; }
+        session->fec_shard_id[packet_id % session->fec_group] = packet_id;
+        session->fec_shard_valid[packet_id % session->fec_group] = 1;
+        if ((wanted & (1u << i)) == 0) { continue; }
+        if (take_block(session, packet_id, packet_id - session->expected_packet_id, data[i], length,
+            (descriptor[0] & XMODEM_EXTENDED_PACKED) ? 1 : 0) != 0) {
+            return;
+        }
+        ++session->repaired;
+        xmodem_stats_add(&session->stats->repaired, 1);
+        if (session->options.window) { emit_tagged(session, XMODEM_ACK, packet_id); }
+    }
+}
+
+/* @brief a parity packet is in. a group other than the last one starts over */
+static void fec_take_parity(XmodemSession *session) {
+    uint8_t const *packet = session->packet;
+    const uint32_t first = get_be32(&packet[2]);
+    const unsigned int k = packet[6] + 1, m = (packet[7] >> 4) + 1, j = packet[7] & 0x0f;
+    if ((first != session->fec_first) || (k != session->fec_k)) {
+        session->fec_first = first;
+        session->fec_k = k;
+        session->fec_have = 0;
+    }
+    memcpy(&session->fec_buffers[(size_t) j * (session->extended_size + XMODEM_FEC_DESCRIPTOR_SIZE)],
+        &packet[XMODEM_EXTENDED_HEADER_SIZE], session->payload_length);
+    session->fec_have |= 1u << j;
+    fec_repair(session, m, j);
+}
+
+/* @brief batch: block 0 is in. good = 0 if it was damaged */
+static void file_header(XmodemSession *session, unsigned int good) {
+    XmodemFileInfo *info = &session->file;
+    if (good && (decode_file_info(info, &session->packet[session->header_size], session->payload_length) != 0)) {
+        good = 0;
+    }
+    if (good == 0) {
+        ++session->retries;
+        ++session->total_retries;
+        if (retries_exhausted(session)) {
+            cancel(session);
+        } else {
+            purge(session, XMODEM_NAK, 0);
+        }
+        return;
+    }
+    if (info->name[0] == 0) { /* end of the batch */
+        emit_byte(session, XMODEM_ACK);
+        finish(session, XMODEM_SESSION_DONE);
+        return;
+    }
+    if (session->blocks.open_file && session->blocks.open_file(session->blocks.context, info)) {
+        cancel(session);
+        return;
+    }
+    session->file_open = 1;
+    session->expected_packet_id = 1;
+    session->expected_offset = 0;
+    session->retries = 0;
+    memset(session->received, 0, sizeof (session->received));
+    fec_reset(session);
+    emit_byte(session, XMODEM_ACK);
+    if (offer_resume(session) == 0) { emit_byte(session, XMODEM_CCC); } /* ready for its data */
+}
+
+/* @brief the sender's EOT is accepted. a batch goes on to the next block 0 */
+static void end_file(XmodemSession *session) {
+    if (session->fec && ((int32_t) (session->fec_highest - session->expected_packet_id) >= 0)) {
+        cancel(session); /* streaming: blocks before the last ones in never came */
+        return;
+    }
+    emit_byte(session, XMODEM_ACK);
+    if (session->options.batch == 0) {
+        finish(session, XMODEM_SESSION_DONE);
+        return;
+    }
+    if (session->blocks.end_file && session->blocks.end_file(session->blocks.context, &session->file)) {
+        cancel(session);
+        return;
+    }
+    session->file_open = 0;
+    session->retries = 0;
+    emit_byte(session, XMODEM_CCC); /* ready for the next block 0 */
+}
+
+/* @brief whole packet in and checked (status 1 if good), or the line went silent part way through (status 0) */
+static void end_packet(XmodemSession *session, unsigned int status) {
+    XmodemOptions const *options = &session->options;
+    uint8_t const *packet = session->packet;
+    uint32_t packet_id, mask;
+    unsigned int header_ok;
+    if (options->extended) { /* the crc covers the header */
+        packet_id = ((uint32_t) packet[2] << 24) | (packet[3] << 16) | (packet[4] << 8) | packet[5];
+        mask = 0xffffffff;
+        header_ok = status;
+    } else {
+        packet_id = packet[1];
+        mask = 0xff;
+        header_ok = ((session->packet_index >= 3) && (packet[2] == (uint8_t) ~packet_id)) ? 1 : 0;
+    }
+    session->state = STATE_RECV_WAIT;
+    if (status && header_ok) {
+        xmodem_histogram_record(&session->stats->block_service, session->now_us - session->packet_us);
+        session->line_noise = 0;
+    } else if ((session->fec == 0) || session->payload_length) { /* with parity, a header may not have been one */
+        xmodem_stats_add(&session->stats->damaged, 1);
+        trace(session, TRACE_DAMAGED, 0, session->packet_index);
+    }
+
+    if (options->batch && (session->file_open == 0)) {
+        file_header(session, (status && header_ok && (packet_id == 0)) ? 1 : 0);
+        return;
+    }
+    if (options->batch && status && header_ok && (packet_id == 0) && (session->expected_offset == 0)) {
+        emit_byte(session, XMODEM_ACK); /* block 0 again: our ACK was lost */
+        if (session->resume_offered) {
+            send_resume(session);
+        } else {
+            emit_byte(session, XMODEM_CCC);
+        }
+        return;
+    }
+    if (session->resume_offered && status && header_ok && (restart_at(session, 0) != 0)) {
+        return; /* data before an answer to R: the sender never saw it, and sends the file from the start */
+    }
+
+    /*
+     * blocks may arrive out of order. each reply names its block by the low byte of its id. with parity blocks a
+     * damaged packet gets no reply: its group's parity rebuilds it, or it is asked for once that has gone by. its
+     * bytes are read again instead of waiting for the line to go quiet, as the packets after it follow straight on
+     */
+    if (options->window || session->fec) {
+        if (status && header_ok && session->parity) {
+            fec_take_parity(session);
+        } else if (status && header_ok) {
+            uint32_t ahead = (packet_id - session->expected_packet_id) & mask;
+            uint32_t behind = (session->expected_packet_id - packet_id) & mask;
+            if (ahead < recv_window(session)) {
+                if (session->fec) { fec_keep(session, packet_id); }
+                if (take_block(session, packet_id, ahead, &packet[session->header_size], session->payload_length,
+                    packet_packed(session)) != 0) {
+                    return;
+                }
+            } else if (options->window == 0) { /* streaming: too far ahead to rebuild what is missing */
+                cancel(session);
+                return;
+            } else if ((behind == 0) || (behind > options->window)) {
+                return; /* neither in the window nor a repeat of a block from it */
+            } else {
+                xmodem_stats_add(&session->stats->duplicates, 1);
+            }
+            if (options->window) { emit_tagged(session, XMODEM_ACK, packet_id); }
+            if (session->fec) { fec_age(session); }
+        } else if (session->fec && (session->payload_length == 0)) {
+            session->rescan = session->packet_index - 1; /* not a header after all, likely bytes of a damaged one */
+        } else {
+            ++session->retries;
+            ++session->total_retries;
+            if (retries_exhausted(session)) {
+                cancel(session);
+            } else if (session->fec) {
+                session->rescan = session->packet_index - 1;
+            } else if (header_ok == 0) {
+                purge(session, XMODEM_NAK, session->expected_packet_id);
+            } else {
+                emit_tagged(session, XMODEM_NAK, packet_id);
+            }
+        }
+        return;
+    }
+
+    const uint32_t last_packet_id = (session->expected_packet_id - 1) & mask;
+    if (status && header_ok) {
+        if (packet_id == session->expected_packet_id) { /* new block */
+            if (put_block(session, session->expected_offset, &packet[session->header_size], session->payload_length,
+                packet_packed(session))) {
+                cancel(session);
+                return;
+            }
+            session->expected_packet_id = (session->expected_packet_id + 1) & mask;
+            session->expected_offset += session->payload_size;
+            session->retries = 0;
+        } else if (packet_id != last_packet_id) { /* not a repeat of the last block */
+            status = 0;
+        } else {
+            xmodem_stats_add(&session->stats->duplicates, 1);
+        }
+    } else {
+        status = 0;
+    }
+
+    if (options->streaming) { /* silent while all is well. no retransmissions, so any error aborts */
+        if ((status == 0) || (packet_id != ((session->expected_packet_id - 1) & mask))) { cancel(session); }
+        return;
+    }
+
+    if (status == 0) {
+        ++session->retries;
+        ++session->total_retries;
+        if (retries_exhausted(session)) {
+            cancel(session);
+        } else {
+            purge(session, XMODEM_NAK, 0);
+        }
+        return;
+    }
+    emit_byte(session, XMODEM_ACK);
+}
+
+/*
+ * @brief bulk copy into the packet buffer. a packet that arrives in one piece is checked by the engine in one
+ *     pass of known length. otherwise payload bytes are folded into the check while they are still hot from the
+ *     copy, so the verdict is known as soon as the last footer byte arrives. the crc-32c of extended packets
+ *     covers their header too
+ * @return bytes taken
+ */
+static unsigned int feed_packet(XmodemSession *session, uint8_t const *b, unsigned int n) {
+    const unsigned int kind = session->options.crc_checksum;
+    const unsigned int payload_end = session->header_size + session->payload_length;
+    unsigned int index = session->packet_index;
+    unsigned int take = session->packet_end - index;
+    if (take > n) { take = n; }
+    memcpy(&session->packet[index], b, take);
+    session->packet_index = index + take;
+
+    if ((index <= session->header_size) && (session->packet_index == session->packet_end) && session->payload_length &&
+        (session->parity == 0)) {
+        end_packet(session, session->engine->verify(session->engine, session->packet));
+        return take;
+    }
+
+    unsigned int lo = (index > session->header_size) ? index : session->header_size;
+    if (kind == CHECKSUM_OPTION_CRC32C) { lo = (index > 1) ? index : 1; }
+    unsigned int hi = index + take;
+    if (hi > payload_end) { hi = payload_end; }
+    if (hi > lo) {
+        if (kind == CHECKSUM_OPTION_CRC32C) {
+            session->crc32 = crc32c_update(session->crc32, &session->packet[lo], hi - lo);
+        } else if (kind == CHECKSUM_OPTION_CRC) {
+            session->crc = crc16_update(session->crc, &session->packet[lo], hi - lo);
+        } else {
+            for (unsigned int i = lo; i < hi; ++i) { session->sum += session->packet[i]; }
+        }
+    }
+
+    if (session->packet_index == session->packet_end) {
+        uint8_t const *footer = &session->packet[payload_end];
+        if (session->payload_length == 0) { /* extended header only */
+            if (extended_header(session) == 0) { end_packet(session, 0); }
+        } else if (kind == CHECKSUM_OPTION_CRC32C) {
+            uint32_t crc = ((uint32_t) footer[0] << 24) | (footer[1] << 16) | (footer[2] << 8) | footer[3];
+            end_packet(session, (session->crc32 == crc) ? 1 : 0);
+        } else if (kind == CHECKSUM_OPTION_CRC) {
+            end_packet(session, (session->crc == ((footer[0] << 8) | footer[1])) ? 1 : 0);
+        } else {
+            end_packet(session, (session->sum == footer[0]) ? 1 : 0);
+        }
+    }
+    return take;
+}
+
+static void recv_timeout(XmodemSession *session) {
+    XmodemOptions const *options = &session->options;
+    if (session->state == STATE_RECV_PURGE) {
+        emit(session, session->purge_reply, session->purge_length);
+        session->state = STATE_RECV_WAIT;
+        session->line_noise = 0;
+        return;
+    }
+    if (session->state == STATE_RECV_CANCEL) {
+        xmodem_stats_add(&session->stats->cancels_received, 1);
+        finish(session, XMODEM_SESSION_FAILED);
+        return;
+    }
+    if (session->state == STATE_RECV_PACKET) {
+        end_packet(session, 0);
+        return;
+    }
+    if (session->state == STATE_RECV_RESUME) {
+        resume_answer(session); /* cut short, so damaged */
+        return;
+    }
+    if (session->state == STATE_RECV_DELTA) { /* cut short. we ask again when the line goes quiet */
+        session->state = STATE_RECV_WAIT;
+        return;
+    }
+    session->state = STATE_RECV_WAIT;
+    if (session->started && options->streaming) {
+        cancel(session);
+        return;
+    }
+    ++session->retries;
+    if (retries_exhausted(session)) {
+        cancel(session);
+    } else if (session->resume_offered) {
+        send_resume(session);
+    } else if (session->delta_offered && (session->delta_tries++ < XMODEM_NEGOTIATE_TRIES)) {
+        emit_packet(session, session->wire_packet);
+    } else if (session->delta_offered) {
+        delta_refused(session);
+    } else if (session->started == 0) {
+        send_start(session);
+    } else if (tagged_replies(session)) {
+        if (session->fec) { fec_quiet(session); }
+        emit_tagged(session, XMODEM_NAK, session->expected_packet_id);
+    } else {
+        emit_byte(session, XMODEM_NAK);
+    }
+}
+
+static unsigned int recv_feed(XmodemSession *session, uint8_t const *b, unsigned int n) {
+    switch (session->state) {
+        case STATE_RECV_PACKET:
+            return feed_packet(session, b, n);
+
+        case STATE_RECV_PURGE:
+            return n;
+
+        case STATE_RECV_RESUME:
+            session->packet[session->packet_index++] = b[0];
+            if (session->packet_index == XMODEM_RESUME_FIELD_SIZE) { resume_answer(session); }
+            return 1;
+
+        case STATE_RECV_DELTA: {
+            int status = wire_feed(session, b[0]);
+            if (status < 0) { /* not the plan after all */
+                session->state = STATE_RECV_WAIT;
+                return 0;
+            }
+            if (status && (session->wire_expected == 4)) { /* the size: one bit per block follows */
+                uint32_t size = get_be32(session->wire_in);
+                uint32_t n_blocks = (size + (uint64_t) session->delta_block_size - 1) / session->delta_block_size;
+                if (wire_expect(session, 4 + (n_blocks + 7) / 8 + 4) != 0) { cancel(session); }
+            } else if (status) {
+                delta_plan(session);
+            }
+            return 1;
+        }
+
+        case STATE_CAN:
+            if ((b[0] == XMODEM_CAN) && session->line_noise) {
+                session->state = STATE_RECV_CANCEL; /* may be payload of a packet whose header we missed */
+            } else if (b[0] == XMODEM_CAN) {
+                xmodem_stats_add(&session->stats->cancels_received, 1);
+                finish(session, XMODEM_SESSION_FAILED);
+            } else {
+                session->state = STATE_RECV_WAIT;
+            }
+            return 1;
+
+        case STATE_RECV_CANCEL:
+            if (b[0] == XMODEM_CAN) { return 1; }
+            session->state = STATE_RECV_WAIT; /* it was payload, and so is this */
+            return 0;
+
+        case STATE_RECV_MODE:
+            session->state = STATE_RECV_WAIT;
+            if ((b[0] & 0x80) == 0) { return 0; } /* not an answer after all */
+            session->extended_mode = b[0];
+            return 1;
+
+        default:
+            break;
+    }
+
+    /*
+     * after a damaged header we read payload as if between packets, and it may hold an EOT. so the first EOT is
+     * NAKed, and only an EOT straight after that ends the transfer. the NAK goes at once unless noise came since
+     * the last packet: then the EOT may be payload, and we wait for the line to go quiet first. in a batch an EOT
+     * once the announced size is in cannot be payload, and between files it repeats one already taken
+     */
+    const unsigned int eot_refused = session->eot_refused;
+    const unsigned int batch = session->options.batch;
+    session->eot_refused = 0;
+    if ((b[0] == XMODEM_EOT) && batch && (session->file_open == 0)) {
+        if (session->started) { emit_byte(session, XMODEM_ACK); }
+    } else if ((b[0] == XMODEM_EOT) && (eot_refused || (batch && (session->expected_offset >= session->file.size)))) {
+        end_file(session);
+    } else if (b[0] == XMODEM_EOT) {
+        purge(session, XMODEM_NAK, session->expected_packet_id);
+        if (session->line_noise == 0) { recv_timeout(session); } /* the reply now */
+        session->eot_refused = 1;
+    } else if (b[0] == XMODEM_CAN) {
+        session->state = STATE_CAN;
+    } else if ((b[0] == XMODEM_FFF) && session->fec_parity && (session->started == 0)) {
+        fec_agreed(session);
+    } else if ((b[0] == XMODEM_XXX) && (session->start_byte == XMODEM_XXX) && (session->started == 0)) {
+        session->state = STATE_RECV_MODE;
+    } else if ((b[0] == XMODEM_RRR) && session->resume_offered) {
+        session->packet_index = 0;
+        session->state = STATE_RECV_RESUME;
+    } else if ((b[0] == XMODEM_DDD) && session->delta_offered) {
+        if (wire_start(session, 4) != 0) {
+            cancel(session);
+        } else {
+            session->state = STATE_RECV_DELTA;
+        }
+    } else if ((session->resume_offered || session->delta_offered) && (session->file_open == 0)) {
+        /* no data before the sender has said where it starts */
+    } else if (packet_header(session, b[0])) {
+        begin_packet(session, b[0]);
+    } else {
+        session->line_noise = 1; /* e.g. a packet whose header we missed */
+    }
+    return 1;
+}
+
+/* sender */
+
+static uint8_t *fec_parity_buffer(XmodemSession const *session, unsigned int j) {
+    return &session->fec_buffers[(size_t) j * (session->extended_allowed + XMODEM_FEC_DESCRIPTOR_SIZE)];
+}
+
+/* @brief the block just built in slot, number index, is added to the parity of its group, which it starts if first */
+static void fec_add(XmodemSession *session, unsigned int slot, uint32_t index) {
+    XmodemPacket const *packet = &session->packets[slot];
+    const unsigned int m = session->options.fec_parity, size = session->block_size;
+    const uint8_t descriptor[XMODEM_FEC_DESCRIPTOR_SIZE] = { packet->frame[1], packet->frame[6], packet->frame[7], 0 };
+    uint8_t *parity[XMODEM_FEC_MAX_PARITY], *tail[XMODEM_FEC_MAX_PARITY];
+    for (unsigned int j = 0; j < m; ++j) {
+        parity[j] = fec_parity_buffer(session, j);
+        tail[j] = &parity[j][size];
+        if (session->fec_count == 0) { memset(parity[j], 0, size + XMODEM_FEC_DESCRIPTOR_SIZE); }
+    }
+    if (session->fec_count == 0) { session->fec_first = index + 1; }
+    fec_encode(parity, m, session->fec_count, packet->payload, packet->payload_size);
+    fec_encode(tail, m, session->fec_count, descriptor, sizeof (descriptor));
+    ++session->fec_count;
+}
+
+/*
+ * @brief the group is complete, or the file is: its parity packets go out after its blocks. nothing more is built
+ *     until they are out, as the next group would overwrite them
+ * @return 1 if sent
+ */
+static int fec_send(XmodemSession *session) {
+    const unsigned int m = session->options.fec_parity;
+    if ((session->fec_count == 0) ||
+        ((session->fec_count < session->options.fec_group) && (session->next_offset < session->file_size))) {
+        return 0;
+    }
+    for (unsigned int j = 0; j < m; ++j) {
+        xmodem_extended_build_parity(&session->fec_packets[j], session->block_size, fec_parity_buffer(session, j),
+            session->fec_first, session->fec_count, m, j);
+        emit_packet(session, &session->fec_packets[j]);
+    }
+    session->wire_bytes += m * (session->block_size + XMODEM_FEC_DESCRIPTOR_SIZE);
+    session->fec_count = 0;
+    return 1;
+}
+
+/*
+ * @brief fill a whole packet for block number index (counting from 0) at offset in the file, and note the block
+ *     in slot. whole blocks are not copied when the link can gather: the payload is left where the source has it.
+ *     once packing is agreed, a block that packs goes as the source packed it
+ * @return 0 on success, -1 if the block could not be had
+ */
+static int build_packet(XmodemSession *session, unsigned int slot, uint32_t index, uint32_t offset) {
+    unsigned int payload_size = session->file_size - offset;
+    if (payload_size > session->block_size) { payload_size = session->block_size; }
+
+    unsigned int packed_size = payload_size;
+    uint8_t const *packed = NULL;
+    if (session->options.compress) {
+        packed = session->blocks.get_packed(session->blocks.context, file_offset(session, offset), payload_size,
+            &packed_size);
+    }
+    if (packed) {
+        xmodem_extended_build_packed(&session->packets[slot], session->block_size, packed, packed_size, index + 1);
+    } else {
+        uint8_t const *data = session->blocks.get_data(session->blocks.context, file_offset(session, offset),
+            payload_size);
+        if (data == NULL) { return -1; }
+        session->engine->build(session->engine, &session->packets[slot], data, payload_size, index + 1,
+            session->blocks.gather);
+        packed_size = payload_size;
+    }
+    session->data_bytes += payload_size;
+    session->wire_bytes += packed_size;
+    xmodem_stats_add(&session->stats->blocks_sent, 1);
+    xmodem_stats_add(&session->stats->data_bytes, payload_size);
+    trace(session, TRACE_PACKET_BUILT, index, packed_size);
+    session->slot_offset[slot] = offset;
+    session->slot_length[slot] = payload_size;
+    if (session->options.fec_parity) { fec_add(session, slot, index); }
+    return 0;
+}
+
+/*
+ * @brief the size the policy wants for the block at next_offset. a larger one waits for an offset aligned to it, and
+ *     any other for the end of the parity group
+ */
+static unsigned int wanted_block_size(XmodemSession const *session) {
+    XmodemBlockPolicy const *policy = session->options.block_policy;
+    if ((policy == NULL) || (session->n_sizes < 2) || session->fec_count) { return session->block_size; }
+
+    XmodemBlockFeedback feedback = {
+        session->block_size, session->policy_blocks, session->policy_failures, session->sizes, session->n_sizes,
+        session->options.window
+    };
+    unsigned int size = policy->choose(policy, &feedback);
+    if ((size > session->block_size) && (session->next_offset % size)) { return session->block_size; }
+    return (xmodem_engine(size, session->options.crc_checksum) == NULL) ? session->block_size : size;
+}
+
+static void set_block_size(XmodemSession *session, unsigned int size) {
+    if (size == session->block_size) { return; }
+    session->engine = xmodem_engine(size, session->options.crc_checksum);
+    session->block_size = size;
+    session->policy_blocks = 0;
+    session->policy_failures = 0;
+}
+
+static void send_eot(XmodemSession *session) {
+    session->state = STATE_SEND_EOT;
+    session->flush_input = 1; /* late replies to repeated blocks */
+    emit_byte(session, XMODEM_EOT);
+}
+
+/* @brief stop-and-wait: (re)send block base, unless it has been sent too often already */
+static void send_block(XmodemSession *session) {
+    session->state = STATE_SEND_BLOCK;
+    session->flush_input = 1; /* a reply is only good for the packet it follows */
+    if (session->attempts++ > session->options.max_retransmissions) {
+        cancel(session);
+        return;
+    }
+    if (session->attempts > 1) {
+        xmodem_stats_add(&session->stats->blocks_resent, 1);
+        trace(session, TRACE_RETRANSMIT, session->base, 0);
+    }
+    session->sent_at[0] = session->now;
+    emit_packet(session, &session->packets[0]);
+}
+
+/* @brief stop-and-wait: block base is in, on to the next */
+static void next_block(XmodemSession *session) {
+    if (session->next_offset >= session->file_size) {
+        send_eot(session);
+        return;
+    }
+    set_block_size(session, wanted_block_size(session));
+    if (build_packet(session, 0, session->base, session->next_offset) != 0) {
+        cancel(session);
+        return;
+    }
+    session->next_offset += session->slot_length[0];
+    session->next = session->base + 1;
+    session->attempts = 0;
+    session->queued_us[0] = session->now_us;
+    send_block(session);
+}
+
+/* @brief sliding window: send block index again, the oldest one when the receiver has gone quiet */
+static void resend_window(XmodemSession *session, uint32_t index) {
+    unsigned int slot = index % session->options.window;
+    if (++session->retransmissions[slot] > session->options.max_retransmissions) {
+        cancel(session);
+        return;
+    }
+    ++session->total_retries;
+    ++session->policy_failures;
+    xmodem_stats_add(&session->stats->blocks_resent, 1);
+    trace(session, TRACE_RETRANSMIT, index, 0);
+    emit_packet(session, &session->packets[slot]);
+}
+
+/*
+ * @brief new packets only go out once the output has drained, so a window slot or the streaming packet is never
+ *     rebuilt while the link still reads from it. acknowledged blocks are released to the source then too
+ */
+static void pump(XmodemSession *session) {
+    if (output_pending(session)) { return; }
+    if ((session->released < session->acked_offset) && session->blocks.release_data) {
+        session->blocks.release_data(session->blocks.context, file_offset(session, session->acked_offset));
+    }
+    session->released = session->acked_offset;
+
+    if (session->state == STATE_SEND_STREAM) { /* back to back. the receiver only speaks up to cancel */
+        if (session->next_offset >= session->file_size) {
+            send_eot(session);
+            return;
+        }
+        set_block_size(session, wanted_block_size(session));
+        if (build_packet(session, 0, session->next, session->next_offset) != 0) {
+            cancel(session);
+            return;
+        }
+        emit_packet(session, &session->packets[0]);
+        session->base = ++session->next;
+        session->next_offset += session->slot_length[0];
+        session->acked_offset = session->next_offset; /* released once this packet is out */
+        ++session->policy_blocks;
+        if (session->options.fec_parity) { fec_send(session); }
+    } else if ((session->state == STATE_SEND_WINDOW) || (session->state == STATE_SEND_WINDOW_TAG)) {
+        const unsigned int window = session->options.window;
+        if ((session->base == session->next) && (session->next_offset >= session->file_size)) {
+            send_eot(session);
+            return;
+        }
+        unsigned int size = wanted_block_size(session);
+        if (size != session->block_size) {
+            if (session->base != session->next) { return; } /* a new size waits for the window to drain */
+            set_block_size(session, size);
+        }
+        while ((session->next_offset < session->file_size) && (session->next - session->base < window)) {
+            unsigned int slot = session->next % window;
+            if (build_packet(session, slot, session->next, session->next_offset) != 0) {
+                cancel(session);
+                return;
+            }
+            session->acked[slot] = 0;
+            session->retransmissions[slot] = 0;
+            session->sent_at[slot] = session->now;
+            session->queued_us[slot] = session->now_us;
+            emit_packet(session, &session->packets[slot]);
+            session->next_offset += session->slot_length[slot];
+            ++session->next;
+            if (session->options.fec_parity && fec_send(session)) { return; }
+        }
+    }
+}
+
+/* @brief the data of the file, in the mode negotiated for the session, from where the receiver needs it */
+static void begin_data(XmodemSession *session) {
+    session->retries = 0;
+    session->next_offset = session->acked_offset = session->released = session->start_offset;
+    session->fec_count = 0;
+    session->engine = xmodem_engine(session->block_size, session->options.crc_checksum);
+    if (session->options.window) {
+        session->state = STATE_SEND_WINDOW;
+    } else if (session->options.streaming) {
+        session->state = STATE_SEND_STREAM;
+    } else {
+        next_block(session);
+    }
+}
+
+/* @brief batch: (re)send block 0, unless it has been sent too often already */
+static void send_header(XmodemSession *session) {
+    session->state = STATE_SEND_FILE_HEADER;
+    session->flush_input = 1; /* e.g. the C the receiver sends after the last EOT */
+    if (session->attempts++ > session->options.max_retransmissions) {
+        cancel(session);
+        return;
+    }
+    session->sent_at[0] = session->now;
+    emit_packet(session, &session->packets[0]);
+}
+
+/* @brief batch: announce the next file in block 0, or the end of the batch with an empty one */
+static void announce_file(XmodemSession *session) {
+    XmodemFileInfo *info = &session->file;
+    memset(info, 0, sizeof (XmodemFileInfo));
+    int more = session->blocks.next_file ? session->blocks.next_file(session->blocks.context, info) : 1;
+    if (more < 0) {
+        cancel(session);
+        return;
+    }
+    if (more > 0) { memset(info, 0, sizeof (XmodemFileInfo)); }
+
+    session->file_size = info->size;
+    session->base = session->next = 0;
+    session->next_offset = session->acked_offset = session->released = 0;
+    session->start_offset = 0;
+    session->offer_answered = 0;
+    session->retries = 0;
+    session->attempts = 0;
+
+    /* classic block 0 is a whole block of NUL padding. an extended one carries its length */
+    const unsigned int kind = session->options.crc_checksum;
+    unsigned int length = encode_file_info(info, session->file_header, sizeof (session->file_header));
+    unsigned int block_size = (length <= XMODEM_BUFF_SIZE) ? XMODEM_BUFF_SIZE : XMODEM_1K_BUFF_SIZE;
+    if (session->options.extended) { block_size = session->block_size; }
+    XmodemEngine const *engine = xmodem_engine(block_size, kind);
+    engine->build(engine, &session->packets[0], session->file_header, session->options.extended ? length : block_size,
+        0, session->blocks.gather);
+    send_header(session);
+}
+
+/* @brief the receiver picked checksum, crc, streaming or a window. setting valid for whole session */
+static void begin_transfer(XmodemSession *session) {
+    if (session->options.batch) {
+        announce_file(session);
+    } else {
+        begin_data(session);
+    }
+}
+
+/*
+ * @brief the receiver holds the start of the file. we go on after it if our file starts with the same bytes, and
+ *     say where the data starts: there, or 0. a damaged offer gets no answer, the receiver asks again
+ */
+static void answer_resume(XmodemSession *session) {
+    uint32_t offset, crc, start = 0;
+    session->state = session->offer_state;
+    if (get_resume_field(&session->offer[0], &offset) ||
+        get_resume_field(&session->offer[XMODEM_RESUME_FIELD_SIZE], &crc)) {
+        return;
+    }
+    if (session->options.resume && session->blocks.resume && (offset <= session->file_size)) {
+        start = session->blocks.resume(session->blocks.context, offset, crc);
+    }
+    session->start_offset = (start == offset) ? start : 0;
+    session->offer_answered = 1;
+
+    uint8_t answer[1 + XMODEM_RESUME_FIELD_SIZE] = { XMODEM_RRR };
+    put_resume_field(&answer[1], session->start_offset);
+    emit(session, answer, sizeof (answer));
+}
+
+/* @brief the header of a D offer is in: the receiver's block size and file size, so the length of the rest */
+static int delta_header(XmodemSession *session) {
+    uint8_t const *raw = session->wire_in;
+    if ((raw[0] < __builtin_ctz(XMODEM_DELTA_MIN_BLOCK)) || (raw[0] > __builtin_ctz(XMODEM_DELTA_MAX_BLOCK))) {
+        return -1;
+    }
+    const uint32_t n_blocks = (get_be32(&raw[1]) + (1ull << raw[0]) - 1) >> raw[0];
+    if (n_blocks > XMODEM_DELTA_MAX_BLOCKS) { return -1; }
+    return wire_expect(session, 5 + n_blocks * XMODEM_DELTA_HASH_SIZE + 4);
+}
+
+/*
+ * @brief the receiver's hashes are in. answer with the blocks of our file that differ from its own, and send only
+ *     those, one after the other, in packets no larger than its blocks. a damaged offer gets no answer
+ */
+static void answer_delta(XmodemSession *session) {
+    uint8_t const *raw = session->wire_in;
+    session->state = STATE_SEND_NEGOTIATE;
+    if (wire_intact(session) == 0) { return; }
+    if (session->delta) { session->file_size = session->delta_size; } /* asked again: our answer got lost */
+
+    const unsigned int block_size = 1u << raw[0];
+    const uint32_t size = session->file_size;
+    const uint32_t n_blocks = (size + (uint64_t) block_size - 1) / block_size;
+    XmodemSignature theirs = { get_be32(&raw[1]), block_size, (session->wire_length - 9) / XMODEM_DELTA_HASH_SIZE, 0 };
+    BlockHash *hashes = malloc((theirs.n_blocks ? theirs.n_blocks : 1) * sizeof (BlockHash));
+    uint32_t *blocks = malloc((n_blocks ? n_blocks : 1) * sizeof (uint32_t));
+    const unsigned int n = 4 + (n_blocks + 7) / 8 + 4;
+    uint8_t *answer = calloc(n, 1);
+    if ((hashes == NULL) || (blocks == NULL) || (answer == NULL)) {
+        free(hashes);
+        free(blocks);
+        free(answer);
+        return;
+    }
+    for (uint32_t i = 0; i < theirs.n_blocks; ++i) {
+        uint8_t const *b = &raw[5 + i * XMODEM_DELTA_HASH_SIZE];
+        hashes[i].lo = ((uint64_t) get_be32(&b[0]) << 32) | get_be32(&b[4]);
+        hashes[i].hi = ((uint64_t) get_be32(&b[8]) << 32) | get_be32(&b[12]);
+    }
+    theirs.hashes = hashes;
+    int changed = -1;
+    if (session->options.delta && session->blocks.delta) {
+        changed = session->blocks.delta(session->blocks.context, &theirs, blocks);
+    }
+    free(hashes);
+    if ((changed < 0) || ((uint32_t) changed > n_blocks)) { /* all of it */
+        for (uint32_t i = 0; i < n_blocks; ++i) { blocks[i] = i; }
+        changed = n_blocks;
+    }
+
+    put_be32(answer, size);
+    for (int k = 0; k < changed; ++k) { answer[4 + blocks[k] / 8] |= 1u << (blocks[k] % 8); }
+    put_be32(&answer[n - 4], crc32c(answer, n - 4));
+    int status = wire_send(session, answer, n);
+    free(answer);
+    if (status != 0) {
+        free(blocks);
+        return;
+    }
+
+    free(session->delta_blocks);
+    session->delta = 1;
+    session->delta_size = size;
+    session->delta_block_size = block_size;
+    session->delta_blocks = blocks;
+    session->n_delta_blocks = changed;
+    session->file_size = 0; /* the data: the blocks that come, back to back. only the last block of the file is short */
+    if (changed) {
+        uint32_t last = blocks[changed - 1] * block_size;
+        session->file_size = (changed - 1) * block_size + (((size - last) < block_size) ? size - last : block_size);
+    }
+    if (session->extended_allowed > block_size) {
+        session->extended_allowed = (block_size >= XMODEM_EXTENDED_MIN_BLOCK) ? block_size : 0;
+    }
+}
+
+static void negotiate_attempt(XmodemSession *session) {
+    session->state = STATE_SEND_NEGOTIATE;
+    ++session->retries;
+    if (retries_exhausted(session)) { cancel(session); }
+}
+
+static void send_timeout(XmodemSession *session) {
+    switch (session->state) {
+        case STATE_SEND_NEGOTIATE:
+        case STATE_SEND_NEGOTIATE_W:
+        case STATE_SEND_NEGOTIATE_X:
+        case STATE_SEND_NEGOTIATE_XW:
+        case STATE_SEND_NEGOTIATE_F:
+            negotiate_attempt(session);
+            break;
+
+        case STATE_SEND_BLOCK:
+            rto_backoff(session);
+            ++session->policy_failures;
+            send_block(session);
+            break;
+
+        case STATE_SEND_WINDOW:
+            rto_backoff(session);
+            resend_window(session, session->base); /* the oldest block is the one holding things up */
+            break;
+
+        case STATE_SEND_WINDOW_TAG:
+            session->state = STATE_SEND_WINDOW;
+            break;
+
+        case STATE_SEND_FILE_HEADER:
+            rto_backoff(session);
+            send_header(session);
+            break;
+
+        case STATE_SEND_FILE_READY:
+            if (session->offer_answered == 0) { /* the C got lost. the receiver waits for data all the same */
+                begin_data(session);
+            } else { /* the receiver waits for our answer to R, and asks again if it was lost */
+                ++session->retries;
+                if (retries_exhausted(session)) { cancel(session); }
+            }
+            break;
+
+        case STATE_SEND_RESUME: /* the offer was cut short */
+            session->state = session->offer_state;
+            send_timeout(session);
+            break;
+
+        case STATE_SEND_DELTA:
+            negotiate_attempt(session);
+            break;
+
+        case STATE_SEND_EOT_TAG: /* the tag got lost */
+            session->state = STATE_SEND_EOT;
+            send_timeout(session);
+            break;
+
+        case STATE_SEND_EOT:
+            rto_backoff(session);
+            ++session->retries;
+            if (retries_exhausted(session)) {
+                finish(session, XMODEM_SESSION_FAILED);
+            } else {
+                emit_byte(session, XMODEM_EOT);
+            }
+            break;
+
+        case STATE_CAN:
+            session->state = session->resume_state;
+            if (session->state == STATE_SEND_NEGOTIATE) { negotiate_attempt(session); }
+            else if (session->state == STATE_SEND_BLOCK) { send_block(session); }
+            else if (session->state == STATE_SEND_FILE_HEADER) { send_header(session); }
+            break;
+
+        default:
+            break;
+    }
+}
+
+static unsigned int send_feed(XmodemSession *session, uint8_t const *b, unsigned int n) {
+    XmodemOptions *options = &session->options;
+    const uint8_t byte = b[0];
+
+    if ((session->state != STATE_CAN) && (byte == XMODEM_CAN) && (session->state != STATE_SEND_NEGOTIATE_W) &&
+        (session->state != STATE_SEND_NEGOTIATE_X) && (session->state != STATE_SEND_NEGOTIATE_XW) &&
+        (session->state != STATE_SEND_NEGOTIATE_F) && (session->state != STATE_SEND_WINDOW_TAG) &&
+        (session->state != STATE_SEND_EOT_TAG)) {
+        session->resume_state = session->state;
+        session->state = STATE_CAN;
+        return 1;
+    }
+
+    switch (session->state) {
+        case STATE_SEND_NEGOTIATE:
+            if (byte == XMODEM_CCC) {
+                options->crc_checksum = CHECKSUM_OPTION_CRC;
+            } else if ((byte == XMODEM_GGG) && session->streaming_allowed) {
+                options->crc_checksum = CHECKSUM_OPTION_CRC;
+                options->streaming = 1;
+            } else if ((byte == XMODEM_WWW) && (session->window_allowed > 1)) {
+                session->state = STATE_SEND_NEGOTIATE_W;
+                return 1;
+            } else if ((byte == XMODEM_XXX) && session->extended_allowed) {
+                session->state = STATE_SEND_NEGOTIATE_X;
+                return 1;
+            } else if (byte == XMODEM_NAK) {
+                options->crc_checksum = CHECKSUM_OPTION_SUM;
+            } else if (byte == XMODEM_RRR) {
+                session->offer_state = STATE_SEND_NEGOTIATE;
+                session->offer_length = 0;
+                session->state = STATE_SEND_RESUME;
+                return 1;
+            } else if ((byte == XMODEM_DDD) && (options->batch == 0)) {
+                if (wire_start(session, 5) == 0) { session->state = STATE_SEND_DELTA; }
+                return 1;
+            } else if (byte == XMODEM_ZZZ) { /* the X that follows may agree to packed blocks */
+                session->compress_offered = 1;
+                return 1;
+            } else if (byte == XMODEM_FFF) { /* and to parity blocks */
+                session->offer_length = 0;
+                session->state = STATE_SEND_NEGOTIATE_F;
+                return 1;
+            } else if (byte & 0x80) { /* rest of an offer we passed on */
+                return 1;
+            } else {
+                negotiate_attempt(session);
+                return 1;
+            }
+            begin_transfer(session);
+            break;
+
+        case STATE_SEND_NEGOTIATE_W:
+            if ((byte & 0x7f) > 1) {
+                options->crc_checksum = CHECKSUM_OPTION_CRC;
+                options->window = ((byte & 0x7f) < session->window_allowed) ? (byte & 0x7f) : session->window_allowed;
+                begin_transfer(session);
+            } else {
+                negotiate_attempt(session);
+            }
+            break;
+
+        case STATE_SEND_NEGOTIATE_X: {
+            unsigned int shift = byte & 0x7f;
+            if ((shift >= __builtin_ctz(XMODEM_EXTENDED_MIN_BLOCK)) &&
+                (shift <= __builtin_ctz(XMODEM_EXTENDED_MAX_BLOCK))) {
+                session->extended_offer = 1u << shift;
+                session->state = STATE_SEND_NEGOTIATE_XW;
+            } else {
+                negotiate_attempt(session);
+            }
+            break;
+        }
+
+        case STATE_SEND_NEGOTIATE_F:
+            if ((byte & 0x80) == 0) { /* not an offer after all */
+                session->state = STATE_SEND_NEGOTIATE;
+                return send_feed(session, b, n);
+            }
+            if (session->offer_length++ == 0) {
+                session->fec_offer_group = byte & 0x7f;
+            } else {
+                session->fec_offer_parity = byte & 0x7f;
+                session->state = STATE_SEND_NEGOTIATE;
+            }
+            break;
+
+        case STATE_SEND_NEGOTIATE_XW: {
+            unsigned int window = byte & 0x7f;
+            options->crc_checksum = CHECKSUM_OPTION_CRC32C;
+            options->extended = 1;
+            if ((window == XMODEM_EXTENDED_STREAMING) && session->streaming_allowed) {
+                options->streaming = 1;
+            } else if ((window > 1) && (window != XMODEM_EXTENDED_STREAMING) && (session->window_allowed > 1)) {
+                options->window = (window < session->window_allowed) ? window : session->window_allowed;
+            } /* else stop-and-wait */
+            unsigned int size = (session->extended_offer < session->extended_allowed) ?
+                session->extended_offer : session->extended_allowed;
+            options->packet_size = size;
+            options->extended_block_size = size;
+            session->n_sizes = 0;
+            for (unsigned int k = XMODEM_EXTENDED_MIN_BLOCK; (k <= size) && (session->n_sizes < XMODEM_MAX_BLOCK_SIZES);
+                k *= 2) {
+                session->sizes[session->n_sizes++] = k;
+            }
+            session->block_size = size;
+            options->compress = (session->compress_allowed && session->compress_offered) ? 1 : 0;
+            if (session->fec_parity && session->fec_offer_group && session->fec_offer_parity &&
+                (options->window || options->streaming)) { /* agreed: F, before the first packet */
+                unsigned int group = (session->fec_offer_group < session->fec_group) ? session->fec_offer_group :
+                    session->fec_group;
+                if (options->window && (group > options->window)) { group = options->window; }
+                options->fec_group = group;
+                options->fec_parity = (session->fec_offer_parity < session->fec_parity) ? session->fec_offer_parity :
+                    session->fec_parity;
+                emit_byte(session, XMODEM_FFF);
+            }
+            emit_tagged(session, XMODEM_XXX, 0x80 | (options->streaming ? XMODEM_EXTENDED_STREAMING : options->window));
+            begin_transfer(session);
+            break;
+        }
+
+        case STATE_SEND_BLOCK:
+            if (byte == XMODEM_ACK) {
+                if (session->attempts == 1) { rtt_sample(session, session->sent_at[0]); } /* Karn: first sends only */
+                block_acked(session, 0, session->attempts == 1);
+                trace(session, TRACE_ACK_RECEIVED, session->base, 0);
+                ++session->base;
+                ++session->policy_blocks;
+                session->acked_offset = session->next_offset;
+                next_block(session);
+            } else if (byte & 0x80) { /* the rest of an offer sent again before our answer got there */
+            } else { /* resubmit on anything but an ACK or CANCEL */
+                if (byte == XMODEM_NAK) { nak_received(session); }
+                ++session->total_retries;
+                ++session->policy_failures;
+                send_block(session);
+            }
+            break;
+
+        case STATE_SEND_FILE_HEADER:
+            if ((byte == XMODEM_ACK) && (session->file.name[0] == 0)) { /* end of the batch taken */
+                finish(session, XMODEM_SESSION_DONE);
+            } else if (byte == XMODEM_ACK) {
+                if (session->attempts == 1) { rtt_sample(session, session->sent_at[0]); }
+                session->state = STATE_SEND_FILE_READY;
+            } else if (byte == XMODEM_NAK) {
+                nak_received(session);
+                ++session->total_retries;
+                send_header(session);
+            } /* anything else, e.g. the C after an EOT, is not a reply to block 0 */
+            break;
+
+        case STATE_SEND_FILE_READY:
+            if (byte == XMODEM_CCC) {
+                begin_data(session);
+            } else if (byte == XMODEM_RRR) {
+                session->offer_state = STATE_SEND_FILE_READY;
+                session->offer_length = 0;
+                session->state = STATE_SEND_RESUME;
+            }
+            break;
+
+        case STATE_SEND_RESUME:
+            if ((byte & 0x80) == 0) { /* not an offer after all */
+                session->state = session->offer_state;
+                return send_feed(session, b, n);
+            }
+            session->offer[session->offer_length++] = byte;
+            if (session->offer_length == 2 * XMODEM_RESUME_FIELD_SIZE) { answer_resume(session); }
+            break;
+
+        case STATE_SEND_DELTA: {
+            int status = wire_feed(session, byte);
+            if (status < 0) { /* not an offer after all */
+                session->state = STATE_SEND_NEGOTIATE;
+                return send_feed(session, b, n);
+            }
+            if (status && (session->wire_expected == 5)) {
+                if (delta_header(session) != 0) { session->state = STATE_SEND_NEGOTIATE; } /* the rest is passed on */
+            } else if (status) {
+                answer_delta(session);
+            }
+            break;
+        }
+
+        case STATE_SEND_WINDOW:
+            if ((byte == XMODEM_ACK) || (byte == XMODEM_NAK)) {
+                if (byte == XMODEM_NAK) { nak_received(session); }
+                session->reply = byte;
+                session->state = STATE_SEND_WINDOW_TAG;
+            }
+            break;
+
+        case STATE_SEND_WINDOW_TAG: {
+            session->state = STATE_SEND_WINDOW;
+            uint32_t offset = (uint8_t) (byte - (uint8_t) (session->base + 1));
+            if ((session->reply == XMODEM_NAK) && (offset == session->next - session->base)) {
+                resend_window(session, session->base); /* it has all we sent but an ACK got lost on the way */
+                break;
+            }
+            if (offset >= session->next - session->base) { break; } /* stale or mangled id */
+            uint32_t index = session->base + offset;
+            if (session->reply == XMODEM_ACK) {
+                unsigned int slot = index % options->window;
+                if ((session->acked[slot] == 0) && (session->retransmissions[slot] == 0)) {
+                    rtt_sample(session, session->sent_at[slot]); /* Karn: retransmitted blocks are ambiguous */
+                }
+                if (session->acked[slot] == 0) { block_acked(session, slot, session->retransmissions[slot] == 0); }
+                trace(session, TRACE_ACK_RECEIVED, index, 0);
+                session->policy_blocks += (session->acked[slot] == 0) ? 1 : 0;
+                session->acked[slot] = 1;
+                while ((session->base < session->next) && session->acked[session->base % options->window]) {
+                    slot = session->base++ % options->window;
+                    session->acked_offset = session->slot_offset[slot] + session->slot_length[slot];
+                }
+            } else {
+                resend_window(session, index);
+            }
+            break;
+        }
+
+        case STATE_SEND_EOT:
+            if (byte == XMODEM_NAK) { nak_received(session); }
+            if ((byte == XMODEM_ACK) && options->batch) {
+                announce_file(session);
+            } else if (byte == XMODEM_ACK) {
+                finish(session, XMODEM_SESSION_DONE);
+            } else if ((byte == XMODEM_NAK) && options->window) { /* its tag may look like ACK or CAN */
+                session->state = STATE_SEND_EOT_TAG;
+            } else if (byte == XMODEM_NAK) { /* receivers may NAK the first EOT */
+                send_timeout(session);
+            }
+            break;
+
+        case STATE_SEND_EOT_TAG:
+            session->state = STATE_SEND_EOT;
+            send_timeout(session);
+            break;
+
+        case STATE_CAN:
+            if (byte == XMODEM_CAN) {
+                xmodem_stats_add(&session->stats->cancels_received, 1);
+                if (session->resume_state != STATE_SEND_STREAM) { emit_byte(session, XMODEM_ACK); }
+                finish(session, XMODEM_SESSION_FAILED);
+            } else {
+                session->state = session->resume_state;
+                if (session->state == STATE_SEND_BLOCK) { send_block(session); }
+                else if (session->state == STATE_SEND_FILE_HEADER) { send_header(session); }
+            }
+            break;
+
+        default:
+            return n;
+    }
+    return 1;
+}
+
+/* api */
+
+static void session_init(XmodemSession *session, XmodemOptions const *options, XmodemBlocks const *blocks) {
+    memset(session, 0, sizeof (XmodemSession));
+    session->options = *options;
+    session->blocks = *blocks;
+    session->status = XMODEM_SESSION_RUNNING;
+    session->stats = options->stats ? options->stats : &session->own_stats;
+    session->trace_id = trace_session_id();
+}
+
+/* @brief time of the call being handled */
+static void set_clock(XmodemSession *session, uint64_t now) {
+    session->now = now;
+    session->now_us = session->clock_us ? session->clock_us() : now * 1000;
+}
+
+/*
+ * @param
+ *     options->packet_size_code = XMODEM_SOH (128-byte packets) or XMODEM_STX (1024-byte packets)
+ *     options->streaming = allow ymodem-g streaming if the receiver asks for it with G. set to the negotiated mode
+ *     options->window = most blocks in flight we allow if the receiver asks for a window with W.
+ *         set to the negotiated window, 0 for classic stop-and-wait
+ *     options->extended = allow extended packets of up to options->extended_block_size if the receiver asks with X.
+ *         set if they were negotiated
+ *     options->batch = send the files blocks->next_file() hands out, each after its block 0. file_size is unused
+ *     options->resume = skip what the receiver already holds of a file when it offers it with R and
+ *         blocks->resume() agrees. a receiver's offer is answered either way
+ *     options->delta = send only the blocks blocks->delta() finds differ from those the receiver offers with D.
+ *         otherwise a D offer is answered with all of them. file_size becomes the size of the blocks sent
+ *     options->compress = send the blocks blocks->get_packed() packs as such, if the receiver said Z before its X.
+ *         set if agreed
+ *     options->fec_group, options->fec_parity = send fec_parity parity blocks after every fec_group blocks if the
+ *         receiver asks for them with F, the smaller of its numbers and ours. extended packets with a window or
+ *         streaming only. set to what was agreed
+ * @return 0 on success, -1 if out of memory
+ */
+int xmodem_session_start_send(XmodemSession *session, XmodemOptions const *options, XmodemBlocks const *blocks,
+    uint32_t file_size, uint64_t now) {
+    session_init(session, options, blocks);
+    session->sender = 1;
+
+    XmodemOptions *negotiated = &session->options;
+    negotiated->packet_size = (negotiated->packet_size_code == XMODEM_STX) ? XMODEM_1K_BUFF_SIZE : XMODEM_BUFF_SIZE;
+    session->streaming_allowed = negotiated->streaming;
+    session->window_allowed = (negotiated->window > XMODEM_MAX_WINDOW) ? XMODEM_MAX_WINDOW : negotiated->window;
+    session->extended_allowed = xmodem_extended_block_size(negotiated);
+    session->compress_allowed = (negotiated->compress && blocks->get_packed) ? 1 : 0;
+    if (negotiated->fec_group && negotiated->fec_parity && session->extended_allowed) {
+        session->fec_group = (negotiated->fec_group < XMODEM_FEC_MAX_GROUP) ? negotiated->fec_group :
+            XMODEM_FEC_MAX_GROUP;
+        session->fec_parity = (negotiated->fec_parity < XMODEM_FEC_MAX_PARITY) ? negotiated->fec_parity :
+            XMODEM_FEC_MAX_PARITY;
+    }
+    negotiated->fec_group = 0;
+    negotiated->fec_parity = 0;
+    negotiated->crc_checksum = CHECKSUM_OPTION_UNK;
+    negotiated->streaming = 0;
+    negotiated->window = 0;
+    negotiated->extended = 0;
+    negotiated->compress = 0;
+
+    session->file_size = file_size;
+    session->block_size = negotiated->packet_size;
+    session->sizes[session->n_sizes++] = XMODEM_BUFF_SIZE;
+    if (negotiated->packet_size == XMODEM_1K_BUFF_SIZE) { session->sizes[session->n_sizes++] = XMODEM_1K_BUFF_SIZE; }
+    session->n_packets = session->window_allowed ? session->window_allowed : 1; /* stop-and-wait only uses one */
+    session->packets = malloc(session->n_packets * sizeof (XmodemPacket));
+    if (session->packets == NULL) { return -1; }
+    if (session->fec_parity) {
+        session->fec_packets = malloc(session->fec_parity * sizeof (XmodemPacket));
+        session->fec_buffers = malloc(session->fec_parity *
+            (size_t) (session->extended_allowed + XMODEM_FEC_DESCRIPTOR_SIZE));
+        if ((session->fec_packets == NULL) || (session->fec_buffers == NULL)) { return -1; }
+    }
+
+    if (negotiated->max_timeout_ms) { /* otherwise every wait is timeout_ms */
+        if (negotiated->min_timeout_ms > negotiated->max_timeout_ms) {
+            negotiated->min_timeout_ms = negotiated->max_timeout_ms;
+        }
+        session->rto = clamp_rto(negotiated, XMODEM_INITIAL_RTO);
+    }
+
+    session->state = STATE_SEND_NEGOTIATE;
+    set_clock(session, now);
+    trace(session, TRACE_SESSION_START, 1, 0);
+    rearm(session, now);
+    return 0;
+}
+
+/*
+ * @param
+ *     options->crc_checksum = CHECKSUM_OPTION_CRC (default) or CHECKSUM_OPTION_SUM
+ *     options->streaming = offer ymodem-g streaming with G. set to the negotiated mode
+ *     options->window = offer a sliding window of this many blocks with W. set to the negotiated window
+ *     options->extended = offer extended packets of up to options->extended_block_size with X, before G or W.
+ *         needs crc. set if the sender took the offer
+ *     options->batch = take files until an empty block 0, each announced to blocks->open_file(). implies crc
+ *     options->resume = offer the sender what blocks->checkpoint() says the sink holds, before the start or, in a
+ *         batch, after each block 0. the transfer goes on from there if the sender agrees
+ *     options->delta = offer the sender the hashes blocks->signature() has of the sink's file in blocks of this
+ *         size (1 KiB to 64 KiB, rounded down to a power of two), before the start, instead of R. only the blocks
+ *         that differ come, and blocks->patch() is told which. not in a batch
+ *     options->compress = offer to take packed blocks with Z, before X. they are unpacked before blocks->put_block().
+ *         set if the sender packed any
+ *     options->fec_group, options->fec_parity = offer with F, before X, to take fec_parity parity blocks after every
+ *         fec_group blocks (no more than the window), and rebuild up to fec_parity lost blocks of a group from them
+ *         rather than ask for them again. set to the offer if the sender agreed
+ * @return 0 on success, -1 if out of memory
+ */
+int xmodem_session_start_recv(XmodemSession *session, XmodemOptions const *options, XmodemBlocks const *blocks,
+    uint64_t now) {
+    session_init(session, options, blocks);
+
+    XmodemOptions *negotiated = &session->options;
+    unsigned int kind = (negotiated->crc_checksum == CHECKSUM_OPTION_SUM) ? CHECKSUM_OPTION_SUM : CHECKSUM_OPTION_CRC;
+    if (negotiated->batch) { kind = CHECKSUM_OPTION_CRC; } /* ymodem implies crc */
+    negotiated->crc_checksum = kind;
+    if (negotiated->window > XMODEM_MAX_WINDOW) { negotiated->window = XMODEM_MAX_WINDOW; }
+    if (kind != CHECKSUM_OPTION_CRC) { negotiated->streaming = 0; } /* ymodem-g implies crc */
+    if ((kind != CHECKSUM_OPTION_CRC) || negotiated->streaming || (negotiated->window < 2)) { negotiated->window = 0; }
+    session->extended_size = (kind == CHECKSUM_OPTION_CRC) ? xmodem_extended_block_size(negotiated) : 0;
+    negotiated->extended = 0;
+
+    unsigned int group = (negotiated->fec_group < XMODEM_FEC_MAX_GROUP) ? negotiated->fec_group : XMODEM_FEC_MAX_GROUP;
+    if (negotiated->window && (group > negotiated->window)) { group = negotiated->window; }
+    if (group && negotiated->fec_parity && session->extended_size && (negotiated->window || negotiated->streaming)) {
+        session->fec_group = group;
+        session->fec_parity = (negotiated->fec_parity < XMODEM_FEC_MAX_PARITY) ? negotiated->fec_parity :
+            XMODEM_FEC_MAX_PARITY;
+    }
+    negotiated->fec_group = 0;
+    negotiated->fec_parity = 0;
+
+    unsigned int packet_size = XMODEM_MAX_PACKET_SIZE;
+    if (session->extended_size) {
+        packet_size = XMODEM_EXTENDED_HEADER_SIZE + session->extended_size + XMODEM_EXTENDED_FOOTER_SIZE;
+    }
+    if (session->fec_parity) { packet_size += XMODEM_FEC_DESCRIPTOR_SIZE; } /* parity packets are a little longer */
+    session->packet = malloc(packet_size);
+    if (session->packet == NULL) { return -1; }
+    if (session->fec_parity) {
+        const size_t shard = session->extended_size + XMODEM_FEC_DESCRIPTOR_SIZE;
+        session->fec_shards = malloc(session->fec_group * shard);
+        session->fec_buffers = malloc(session->fec_parity * shard);
+        session->replay = malloc(packet_size);
+        if ((session->fec_shards == NULL) || (session->fec_buffers == NULL) || (session->replay == NULL)) { return -1; }
+    }
+    if (negotiated->compress && session->extended_size) {
+        session->unpacked = malloc(session->extended_size);
+        if (session->unpacked == NULL) { return -1; }
+    }
+    negotiated->compress = 0;
+
+    session->expected_packet_id = 1;
+    fec_reset(session);
+    session->state = STATE_RECV_WAIT;
+    set_clock(session, now);
+    trace(session, TRACE_SESSION_START, 0, 0);
+    if (negotiated->batch || ((offer_delta(session) == 0) && (offer_resume(session) == 0))) { send_start(session); }
+    rearm(session, now);
+    return 0;
+}
+
+/* @brief frees what the session allocated. the session must not be used afterwards */
+void xmodem_session_end(XmodemSession *session) {
+    free(session->packets);
+    session->packets = NULL;
+    free(session->packet);
+    session->packet = NULL;
+    free(session->unpacked);
+    session->unpacked = NULL;
+    free(session->replay);
+    session->replay = NULL;
+    free(session->fec_shards);
+    session->fec_shards = NULL;
+    free(session->fec_buffers);
+    session->fec_buffers = NULL;
+    free(session->fec_packets);
+    session->fec_packets = NULL;
+    free(session->delta_blocks);
+    session->delta_blocks = NULL;
+    free(session->wire_in);
+    session->wire_in = NULL;
+    free(session->wire_out);
+    session->wire_out = NULL;
+    free(session->wire_packet);
+    session->wire_packet = NULL;
+    session->output_head = session->output_tail = 0;
+    if (session->state != STATE_END) { finish(session, XMODEM_SESSION_FAILED); }
+}
+
+/*
+ * @brief receiver: the bytes of the damaged packet just ended are read again from after its header byte, for a
+ *     packet whose header its own damaged one swallowed. replaying = they were themselves being read again, so they
+ *     are the ones just before where that got to
+ */
+static void rescan(XmodemSession *session, unsigned int replaying) {
+    const unsigned int n = session->rescan;
+    session->rescan = 0;
+    if (replaying) {
+        session->replay_start -= n;
+        return;
+    }
+    memcpy(session->replay, &session->packet[1], n);
+    session->replay_start = 0;
+    session->replay_end = n;
+}
+
+/* @brief the next of the bytes being read again. between packets only a header counts, the rest is damaged payload */
+static void replay(XmodemSession *session) {
+    uint8_t const *b = &session->replay[session->replay_start];
+    unsigned int n = session->replay_end - session->replay_start;
+    if (session->state == STATE_RECV_WAIT) {
+        uint8_t const *header = memchr(b, XMODEM_XTX, n);
+        if (header == NULL) {
+            session->replay_start = session->replay_end;
+            return;
+        }
+        session->replay_start += header - b;
+        n -= header - b;
+        b = header;
+    }
+    session->replay_start += recv_feed(session, b, n);
+    if (session->rescan) { rescan(session, 1); }
+}
+
+static void feed(XmodemSession *session, uint8_t const *b, unsigned int n) {
+    session->flush_input = 0;
+    while ((session->state != STATE_END) && (session->flush_input == 0)) {
+        if (session->replay_start < session->replay_end) {
+            replay(session);
+            continue;
+        }
+        if (n == 0) { break; }
+        unsigned int taken = session->sender ? send_feed(session, b, n) : recv_feed(session, b, n);
+        b += taken;
+        n -= taken;
+        if (session->rescan) { rescan(session, 0); }
+    }
+}
+
+/* @brief bytes from the other side */
+void xmodem_session_feed(XmodemSession *session, uint8_t const *b, unsigned int n, uint64_t now) {
+    if ((n == 0) || (session->state == STATE_END)) { return; }
+    set_clock(session, now);
+    xmodem_stats_add(&session->stats->bytes_received, n);
+    trace(session, TRACE_RECEIVED, 0, n);
+    feed(session, b, n);
+    if (session->state != STATE_END) {
+        rearm(session, now);
+        pump(session);
+    }
+}
+
+/* @brief runs the timeout of the current state once its deadline has passed. cheap to call at any time */
+void xmodem_session_poll(XmodemSession *session, uint64_t now) {
+    if ((session->state == STATE_END) || output_pending(session)) { return; }
+    set_clock(session, now);
+    if (now >= session->deadline) {
+        xmodem_stats_add(&session->stats->timeouts, 1);
+        trace(session, TRACE_TIMEOUT, session->retries, 0);
+        if (session->sender) { send_timeout(session); } else { recv_timeout(session); }
+        if (session->rescan) { /* a packet cut short by silence */
+            rescan(session, 0);
+            feed(session, NULL, 0);
+        }
+        if (session->state == STATE_END) { return; }
+        rearm(session, now);
+    }
+    pump(session);
+}
+
+/* @brief when xmodem_session_poll() next has work to do. XMODEM_SESSION_NEVER while output is waiting to go out */
+uint64_t xmodem_session_deadline(XmodemSession const *session) {
+    if ((session->state == STATE_END) || output_pending(session)) { return XMODEM_SESSION_NEVER; }
+    return session->deadline;
+}
+
+/*
+ * @brief describes the bytes waiting to go out, in order, without copying them. packets whose payload stays in
+ *     the source take three entries
+ * @return entries filled in iov, 0 if there is nothing to send
+ */
+int xmodem_session_next_output(XmodemSession const *session, struct iovec *iov, int max_iov) {
+    int iovcnt = 0;
+    unsigned int skip = session->output_offset;
+    for (unsigned int i = session->output_head; (i != session->output_tail) && (iovcnt + 3 <= max_iov);
+        i = (i + 1) % XMODEM_SESSION_OUTPUTS) {
+        XmodemOutput const *output = &session->outputs[i];
+        struct iovec parts[3];
+        int n_parts = 1;
+        if (output->packet == NULL) {
+            parts[0].iov_base = (void *) output->bytes;
+            parts[0].iov_len = output->length;
+        } else if (output->packet->payload == &output->packet->frame[output->packet->header_size]) {
+            parts[0].iov_base = (void *) output->packet->frame;
+            parts[0].iov_len = output_length(output);
+        } else {
+            XmodemPacket const *packet = output->packet;
+            parts[0].iov_base = (void *) packet->frame;
+            parts[0].iov_len = packet->header_size;
+            parts[1].iov_base = (void *) packet->payload;
+            parts[1].iov_len = packet->payload_size;
+            parts[2].iov_base = (void *) &packet->frame[packet->footer_offset];
+            parts[2].iov_len = packet->footer_size;
+            n_parts = 3;
+        }
+        for (int k = 0; k < n_parts; ++k) {
+            if (skip >= parts[k].iov_len) { /* already sent */
+                skip -= parts[k].iov_len;
+                continue;
+            }
+            iov[iovcnt].iov_base = (uint8_t *) parts[k].iov_base + skip;
+            iov[iovcnt].iov_len = parts[k].iov_len - skip;
+            ++iovcnt;
+            skip = 0;
+        }
+    }
+    return iovcnt;
+}
+
+/* @brief the last byte of output is out: a window slot's packet, or a receiver's ACK */
+static void output_done(XmodemSession *session, XmodemOutput const *output) {
+    XmodemPacket const *packet = output->packet;
+    if (packet && (packet >= session->packets) && (packet < session->packets + session->n_packets)) {
+        session->out_us[packet - session->packets] = session->now_us;
+    } else if ((packet == NULL) && (session->sender == 0) && (output->bytes[0] == XMODEM_ACK)) {
+        xmodem_histogram_record(&session->stats->ack_turnaround, session->now_us - output->queued_us);
+    }
+}
+
+/* @brief n bytes described by xmodem_session_next_output() are sent. timeouts start once everything is out */
+void xmodem_session_consume_output(XmodemSession *session, unsigned int n, uint64_t now) {
+    set_clock(session, now);
+    xmodem_stats_add(&session->stats->bytes_sent, n);
+    trace(session, TRACE_SENT, 0, n);
+    while (n && output_pending(session)) {
+        XmodemOutput const *output = &session->outputs[session->output_head];
+        unsigned int left = output_length(output) - session->output_offset;
+        if (n < left) {
+            session->output_offset += n;
+            return;
+        }
+        n -= left;
+        output_done(session, output);
+        session->output_offset = 0;
+        session->output_head = (session->output_head + 1) % XMODEM_SESSION_OUTPUTS;
+    }
+    if ((output_pending(session) == 0) && (session->state != STATE_END)) {
+        rearm(session, now);
+        pump(session);
+    }
+}
+
+void xmodem_session_stats(XmodemSession const *session, XmodemSessionStats *stats) {
+    stats->retries = session->total_retries;
+    stats->rtt_samples = session->rtt_samples;
+    stats->srtt_us = session->srtt8 * 125;
+    stats->rttvar_us = session->rttvar8 * 125;
+    stats->rto_ms = session->options.max_timeout_ms ? session->rto : session->options.timeout_ms;
+    stats->data_bytes = session->data_bytes;
+    stats->wire_bytes = session->wire_bytes;
+    stats->repaired = session->repaired;
+}
+
+/* @brief XMODEM_SESSION_RUNNING until the transfer is over and its last bytes are out */
+int xmodem_session_status(XmodemSession const *session) {
+    if ((session->state != STATE_END) || output_pending(session)) { return XMODEM_SESSION_RUNNING; }
+    return session->status;
+}
@@ -0,0 +1,127 @@
+#include <math.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "simline.h"
+
+/* one direction of the line */
+typedef struct {
+    uint8_t data[SIM_LINE_CHUNKS][SIM_LINE_MAX_CHUNK];
+    unsigned int length[SIM_LINE_CHUNKS];
+    uint64_t arrive_us[SIM_LINE_CHUNKS];
+    unsigned int head, tail;
+    uint64_t free_us; /* the line is busy sending until then */
+    uint64_t bits; /* sent so far */
+    uint64_t next_error; /* bit the next error hits */
+    uint64_t seed;
+} Line;
+
+uint8_t const *sim_get_data(void *context, uint32_t offset, unsigned int n) {
+    SimFile *file = (SimFile *) context;
+    return (offset + n <= file->file_size) ? &file->file[offset] : NULL;
+}
+
+int sim_put_block(void *context, uint32_t offset, uint8_t const *data, unsigned int n) {
+    SimFile *file = (SimFile *) context;
+    if (offset >= file->file_size) { return 0; }
+    if (n > file->file_size - offset) { n = file->file_size - offset; }
+    memcpy(&file->copy[offset], data, n);
+    return 0;
+}
+
+/* @brief uniform in (0, 1], xorshift64* */
+static double line_random(Line *line) {
+    line->seed ^= line->seed >> 12;
+    line->seed ^= line->seed << 25;
+    line->seed ^= line->seed >> 27;
+    return ((line->seed * 0x2545f4914f6cdd1dull) >> 11) * (1.0 / 9007199254740992.0) + 1e-18;
+}
+
+/* @brief bits from one error to the next are exponentially distributed */
+static uint64_t error_gap(Line *line, double rate) {
+    return 1 + (uint64_t) (-log(line_random(line)) / rate);
+}
+
+static void line_start(Line *line, SimLineModel const *model, uint64_t seed) {
+    memset(line, 0, sizeof (Line));
+    line->seed = seed ? seed : 1;
+    if (model->bit_error_rate) { line->next_error = error_gap(line, model->bit_error_rate); }
+}
+
+/* @brief puts what a session has to say on the line, a chunk at a time as the line drains */
+static void line_send(Line *line, SimLineModel const *model, XmodemSession *session, uint64_t now_us) {
+    struct iovec iov[XMODEM_SESSION_MAX_IOV];
+    unsigned int chunk_size = model->chunk_size;
+    if ((chunk_size == 0) || (chunk_size > SIM_LINE_MAX_CHUNK)) { chunk_size = SIM_LINE_MAX_CHUNK; }
+    int iovcnt = xmodem_session_next_output(session, iov, XMODEM_SESSION_MAX_IOV);
+    for (int i = 0; i < iovcnt; ++i) {
+        uint8_t const *b = (uint8_t const *) iov[i].iov_base;
+        for (unsigned int done = 0; done < iov[i].iov_len;) {
+            if ((line->free_us > now_us) || (line->tail - line->head == SIM_LINE_CHUNKS)) { return; } /* busy */
+            unsigned int slot = line->tail % SIM_LINE_CHUNKS;
+            unsigned int n = iov[i].iov_len - done;
+            if (n > chunk_size) { n = chunk_size; }
+            memcpy(line->data[slot], &b[done], n);
+            while (model->bit_error_rate && (line->next_error < line->bits + 8ull * n)) {
+                uint64_t bit = line->next_error - line->bits;
+                line->data[slot][bit / 8] ^= 1u << (bit % 8);
+                line->next_error += error_gap(line, model->bit_error_rate);
+            }
+            if (line->free_us < now_us) { line->free_us = now_us; }
+            line->free_us += n * 1000000ull / model->bytes_per_second;
+            line->length[slot] = n;
+            line->arrive_us[slot] = line->free_us + model->latency_us;
+            line->bits += 8ull * n;
+            ++line->tail;
+            done += n;
+            xmodem_session_consume_output(session, n, now_us / 1000);
+        }
+    }
+}
+
+static void line_deliver(Line *line, XmodemSession *session, uint64_t now_us) {
+    while ((line->head != line->tail) && (line->arrive_us[line->head % SIM_LINE_CHUNKS] <= now_us)) {
+        unsigned int slot = line->head++ % SIM_LINE_CHUNKS;
+        xmodem_session_feed(session, line->data[slot], line->length[slot], now_us / 1000);
+    }
+}
+
+/* @brief when the line has something to do next: a chunk arrives, or the one going out is through */
+static uint64_t line_next(Line const *line, uint64_t now_us) {
+    uint64_t next = (line->head == line->tail) ? UINT64_MAX : line->arrive_us[line->head % SIM_LINE_CHUNKS];
+    return ((line->free_us > now_us) && (line->free_us < next)) ? line->free_us : next;
+}
+
+static uint64_t deadline_us(XmodemSession const *session) {
+    uint64_t deadline = xmodem_session_deadline(session);
+    return (deadline == XMODEM_SESSION_NEVER) ? UINT64_MAX : deadline * 1000;
+}
+
+uint64_t sim_run(XmodemSession *sender, XmodemSession *receiver, SimLineModel const *model, uint64_t seed,
+    uint64_t *bytes) {
+    static Line forward, backward; /* too large for the stack */
+    uint64_t now_us = 0;
+
+    line_start(&forward, model, seed);
+    line_start(&backward, model, seed * 31 + 7);
+    while ((xmodem_session_status(sender) == XMODEM_SESSION_RUNNING) ||
+        (xmodem_session_status(receiver) == XMODEM_SESSION_RUNNING)) {
+        line_send(&forward, model, sender, now_us);
+        line_send(&backward, model, receiver, now_us);
+
+        uint64_t next = line_next(&forward, now_us);
+        if (line_next(&backward, now_us) < next) { next = line_next(&backward, now_us); }
+        if (deadline_us(sender) < next) { next = deadline_us(sender); }
+        if (deadline_us(receiver) < next) { next = deadline_us(receiver); }
+        if (next == UINT64_MAX) { break; } /* both sides wait on nothing */
+        if (next > now_us) { now_us = next; }
+
+        line_deliver(&forward, receiver, now_us);
+        line_deliver(&backward, sender, now_us);
+        xmodem_session_poll(sender, now_us / 1000);
+        xmodem_session_poll(receiver, now_us / 1000);
+    }
+
+    if (bytes) { *bytes = (forward.bits + backward.bits) / 8; }
+    return now_us;
+}
@@ -0,0 +1,104 @@
+#include <string.h>
+#include <stdio.h>
+
+#include "stats.h"
+
+void xmodem_stats_reset(XmodemStats *stats) {
+    memset(stats, 0, sizeof (*stats));
+}
+
+/* @brief every field of a live stats block, each read whole */
+void xmodem_stats_snapshot(XmodemStats const *stats, XmodemStats *copy) {
+    uint64_t const *from = (uint64_t const *) stats;
+    uint64_t *to = (uint64_t *) copy;
+    for (size_t i = 0; i < sizeof (XmodemStats) / sizeof (uint64_t); ++i) {
+        to[i] = __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+    }
+}
+
+_Static_assert(sizeof (XmodemStats) % sizeof (uint64_t) == 0, "stats are read as 64-bit words");
+
+unsigned int xmodem_histogram_bucket(uint64_t value) {
+    if (value < XMODEM_HISTOGRAM_LINEAR) { return value; }
+    unsigned int log2 = 63 - __builtin_clzll(value);
+    if (log2 > XMODEM_HISTOGRAM_MAX_LOG2) { return XMODEM_HISTOGRAM_BUCKETS - 1; }
+    unsigned int sub = (value >> (log2 - XMODEM_HISTOGRAM_SHIFT)) & (XMODEM_HISTOGRAM_LINEAR - 1);
+    return (log2 - XMODEM_HISTOGRAM_SHIFT + 1) * XMODEM_HISTOGRAM_LINEAR + sub;
+}
+
+/* @brief smallest value in the bucket */
+uint64_t xmodem_histogram_lower(unsigned int bucket) {
+    if (bucket < XMODEM_HISTOGRAM_LINEAR) { return bucket; }
+    unsigned int log2 = bucket / XMODEM_HISTOGRAM_LINEAR + XMODEM_HISTOGRAM_SHIFT - 1;
+    uint64_t sub = bucket % XMODEM_HISTOGRAM_LINEAR;
+    return (XMODEM_HISTOGRAM_LINEAR + sub) << (log2 - XMODEM_HISTOGRAM_SHIFT);
+}
+
+void xmodem_histogram_record(XmodemHistogram *h, uint64_t value) {
+    uint64_t count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+    if ((count == 0) || (value < h->min)) { xmodem_stats_set(&h->min, value); }
+    if (value > h->max) { xmodem_stats_set(&h->max, value); }
+    xmodem_stats_add(&h->buckets[xmodem_histogram_bucket(value)], 1);
+    xmodem_stats_add(&h->sum, value);
+    xmodem_stats_set(&h->count, count + 1);
+}
+
+/* @brief the value below which a fraction q of them lie, to within its bucket: the middle of it, inside min and max */
+uint64_t xmodem_histogram_quantile(XmodemHistogram const *h, double q) {
+    if (h->count == 0) { return 0; }
+    uint64_t rank = (uint64_t) (q * h->count);
+    if (rank >= h->count) { rank = h->count - 1; }
+    uint64_t seen = 0;
+    unsigned int b = 0;
+    for (; b < XMODEM_HISTOGRAM_BUCKETS - 1; ++b) {
+        seen += h->buckets[b];
+        if (seen > rank) { break; }
+    }
+    uint64_t value = (xmodem_histogram_lower(b) + xmodem_histogram_lower(b + 1)) / 2;
+    if (b >= XMODEM_HISTOGRAM_BUCKETS - 1) { value = h->max; }
+    if (value < h->min) { return h->min; }
+    return (value > h->max) ? h->max : value;
+}
+
+static void histogram_json(FILE *f, char const *name, XmodemHistogram const *h) {
+    fprintf(f, "  \"%s\": {\"count\": %llu, \"min\": %llu, \"max\": %llu, \"mean\": %llu, ", name,
+        (unsigned long long) h->count, (unsigned long long) h->min, (unsigned long long) h->max,
+        (unsigned long long) (h->count ? h->sum / h->count : 0));
+    fprintf(f, "\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"buckets\": [",
+        (unsigned long long) xmodem_histogram_quantile(h, 0.5), (unsigned long long) xmodem_histogram_quantile(h, 0.9),
+        (unsigned long long) xmodem_histogram_quantile(h, 0.99),
+        (unsigned long long) xmodem_histogram_quantile(h, 0.999));
+    unsigned int n = 0;
+    for (unsigned int b = 0; b < XMODEM_HISTOGRAM_BUCKETS; ++b) { /* [lowest value, count] of those in use */
+        if (h->buckets[b] == 0) { continue; }
+        fprintf(f, "%s[%llu, %llu]", n++ ? ", " : "", (unsigned long long) xmodem_histogram_lower(b),
+            (unsigned long long) h->buckets[b]);
+    }
+    fprintf(f, "]}");
+}
+
+/* @brief stats as one json object, times in microseconds. a live block is snapshotted first */
+void xmodem_stats_json(FILE *f, XmodemStats const *stats) {
+    XmodemStats copy;
+    xmodem_stats_snapshot(stats, &copy);
+    struct {
+        char const *name;
+        uint64_t value;
+    } const counters[] = {
+        { "blocks_sent", copy.blocks_sent }, { "blocks_resent", copy.blocks_resent },
+        { "blocks_received", copy.blocks_received }, { "duplicates", copy.duplicates }, { "damaged", copy.damaged },
+        { "repaired", copy.repaired }, { "naks_sent", copy.naks_sent }, { "naks_received", copy.naks_received },
+        { "timeouts", copy.timeouts }, { "cancels_sent", copy.cancels_sent },
+        { "cancels_received", copy.cancels_received }, { "bytes_sent", copy.bytes_sent },
+        { "bytes_received", copy.bytes_received }, { "data_bytes", copy.data_bytes }, { "wall_us", copy.wall_us },
+        { "cpu_us", copy.cpu_us },
+    };
+    fprintf(f, "{\n");
+    for (size_t i = 0; i < sizeof (counters) / sizeof (counters[0]); ++i) {
+        fprintf(f, "  \"%s\": %llu,\n", counters[i].name, (unsigned long long) counters[i].value);
+    }
+    histogram_json(f, "ack_turnaround_us", &copy.ack_turnaround);
+    fprintf(f, ",\n");
+    histogram_json(f, "block_service_us", &copy.block_service);
+    fprintf(f, "\n}\n");
+}
@@ -1,7 +1,15 @@
-#include <sys/select.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/xattr.h>
 
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -13,46 +21,199 @@
 
 #include "ports.h"
 #include "stream.h"
+#include "trace.h"
+
+/* extended attribute that keeps a receiver's checkpoint with the partial file it describes */
+#define STREAM_CHECKPOINT_XATTR "user.xmodem.checkpoint"
+
+/* @brief creates the poll set and wake-up event. set ring_size, hugepages, max_sources etc. first */
+int rx_looper_init(RxLooperArgs *args) {
+    if (args->ring_size == 0) { args->ring_size = RX_LOOPER_RING_SIZE; }
+    if (args->max_sources == 0) { args->max_sources = 1; }
+    atomic_init(&args->n_sources, 0);
+    atomic_init(&args->stopping, 0);
+    pthread_mutex_init(&args->lock, NULL);
+    pthread_cond_init(&args->cond, NULL);
+    args->sources = calloc(args->max_sources, sizeof (RxSource));
+    args->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    args->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    struct epoll_event event = { EPOLLIN, { .ptr = NULL } };
+    if ((args->sources == NULL) || (args->epoll_fd < 0) || (args->event_fd < 0) ||
+        epoll_ctl(args->epoll_fd, EPOLL_CTL_ADD, args->event_fd, &event)) {
+        rx_looper_close(args);
+        return -1;
+    }
+    return 0;
+}
+
+static void rx_looper_wake(RxLooperArgs *args) {
+    uint64_t one = 1;
+    if (write(args->event_fd, &one, sizeof (one)) != sizeof (one)) { perror("rx_looper_wake"); }
+}
 
+/*
+ * @brief starts watching fd, feeding queue. a queue without a buffer gets a ring of ring_size bytes.
+ *     may be called while rx_looper runs, from one thread at a time. returns -1 when full or on error
+ */
+int rx_looper_add(RxLooperArgs *args, int fd, Queue *queue) {
+    unsigned int n_sources = atomic_load_explicit(&args->n_sources, memory_order_relaxed);
+    unsigned int index = 0;
+    while ((index < n_sources) &&
+        (atomic_load_explicit(&args->sources[index].state, memory_order_acquire) != RX_SOURCE_FREE)) { ++index; }
+    if (index >= args->max_sources) { return -1; }
+    RxSource *source = &args->sources[index];
+    source->fd = fd;
+    source->queue = queue;
+    source->owns_ring = 0;
+    source->stalled = 0;
+    atomic_store_explicit(&source->closed, 0, memory_order_relaxed);
+    atomic_store_explicit(&source->overflows, 0, memory_order_relaxed);
+    if (queue->buff == NULL) {
+        if (queue_alloc(queue, args->ring_size, args->hugepages)) { return -1; }
+        source->owns_ring = 1;
+    }
+    atomic_store_explicit(&queue->closed, 0, memory_order_relaxed); /* a ring of the caller's may be used again */
+    atomic_store_explicit(&source->state, RX_SOURCE_ACTIVE, memory_order_release);
+    if (index == n_sources) { atomic_store_explicit(&args->n_sources, index + 1, memory_order_release); }
+    struct epoll_event event = { EPOLLIN | EPOLLRDHUP, { .ptr = source } };
+    if (epoll_ctl(args->epoll_fd, EPOLL_CTL_ADD, fd, &event)) {
+        atomic_store_explicit(&source->closed, 1, memory_order_release);
+        queue_close(queue);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * @brief stops feeding queue and frees the ring rx_looper_add() gave it. blocks until the looper thread has let go,
+ *     so it must be running. the descriptor is left open. returns -1 if queue is not being fed
+ */
+int rx_looper_remove(RxLooperArgs *args, Queue *queue) {
+    unsigned int n_sources = atomic_load_explicit(&args->n_sources, memory_order_acquire);
+    for (unsigned int i = 0; i < n_sources; ++i) {
+        RxSource *source = &args->sources[i];
+        if ((atomic_load_explicit(&source->state, memory_order_acquire) != RX_SOURCE_ACTIVE) ||
+            (source->queue != queue)) { continue; }
+        pthread_mutex_lock(&args->lock);
+        atomic_store_explicit(&source->state, RX_SOURCE_REMOVING, memory_order_release);
+        rx_looper_wake(args);
+        while (atomic_load_explicit(&source->state, memory_order_acquire) != RX_SOURCE_FREE) {
+            pthread_cond_wait(&args->cond, &args->lock);
+        }
+        pthread_mutex_unlock(&args->lock);
+        return 0;
+    }
+    return -1;
+}
+
+/* @brief one read straight into the ring, around the wrap if need be. returns 1 if the ring was full */
+static int rx_source_read(RxLooperArgs *args, RxSource *source) {
+    struct iovec iov[2];
+    int n_iov = queue_write_spans(source->queue, iov);
+    if (n_iov == 0) { /* leave the data in the kernel until there is room */
+        atomic_fetch_add_explicit(&source->overflows, 1, memory_order_relaxed);
+        trace_record(TRACE_RX_FULL, 0, source->fd, 0);
+        epoll_ctl(args->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+        source->stalled = 1;
+        return 1;
+    }
+    ssize_t n_read = readv(source->fd, iov, n_iov);
+    if ((n_read == 0) || ((n_read < 0) && (errno != EAGAIN) && (errno != EINTR))) {
+        epoll_ctl(args->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+        atomic_store_explicit(&source->closed, 1, memory_order_release);
+        queue_close(source->queue);
+        return 0;
+    }
+    if (n_read < 0) { return 0; }
+    trace_record(TRACE_RX_READ, 0, source->fd, n_read);
+    queue_commit(source->queue, n_read);
+    return 0;
+}
+
+/* @brief reader thread. runs until rx_looper_stop(). sources only leave the poll set from here */
 void *rx_looper(void *ext) {
     RxLooperArgs *args = (RxLooperArgs *) ext;
-    Queue *q = args->queue;
-    uint8_t buffer[512];
-    q->buff = buffer;
-    q->mask = sizeof (buffer) - 1;
-    while (*args->run) {
-        fd_set fds;
-        FD_ZERO (&fds);
-        FD_SET (args->fd, &fds);
-        // printf("waiting for %d ...\n", args->fd);
-        int res = select (args->fd + 1, &fds, NULL, NULL, NULL);
-        // printf("and it came and it went ...\n");
-        if (res && FD_ISSET(args->fd, &fds)) {
-            unsigned int room;
-            if (q->head >= q->tail) { room = 1 + q->mask - q->head; } /* how much fits to top of queue */
-            else { room = q->tail - q->head - 1; }
-            if (room) {
-                int n_read = read(args->fd, &q->buff[q->head], room);
-                // printf("and i saw %d (room = %d)...\n", n_read, room);
-                if (args->verbose) {
-                    for (int i = 0; i < n_read; ++i) {
-                        uint8_t byte = q->buff[(q->head + i) & q->mask];
-                        if (args->verbose) { printf("%2.2x ", byte); }
-                    }
-                    if (n_read > 0) { printf("\n"); }
+    int pace = args->loop_pace ? (int) args->loop_pace : 1;
+    unsigned int n_stalled = 0;
+    while (1) {
+        struct epoll_event events[16];
+        int n = epoll_wait(args->epoll_fd, events, 16, n_stalled ? pace : -1);
+        if ((n < 0) && (errno != EINTR)) { break; }
+        unsigned int woken = 0;
+        for (int i = 0; i < n; ++i) {
+            RxSource *source = (RxSource *) events[i].data.ptr;
+            if (source == NULL) { woken = 1; continue; }
+            if (atomic_load_explicit(&source->state, memory_order_acquire) != RX_SOURCE_ACTIVE) { continue; }
+            n_stalled += rx_source_read(args, source);
+        }
+
+        if (woken) {
+            uint64_t count;
+            if (read(args->event_fd, &count, sizeof (count)) < 0) { ; } /* reset. nonblocking */
+            if (atomic_load_explicit(&args->stopping, memory_order_acquire)) { break; }
+        }
+        if ((woken == 0) && (n_stalled == 0)) { continue; }
+
+        /* hand back removed sources, and put stalled ones back into the poll set once there is room */
+        unsigned int n_sources = atomic_load_explicit(&args->n_sources, memory_order_acquire);
+        for (unsigned int i = 0; i < n_sources; ++i) {
+            RxSource *source = &args->sources[i];
+            unsigned int state = atomic_load_explicit(&source->state, memory_order_acquire);
+            if (state == RX_SOURCE_REMOVING) {
+                if (source->stalled) {
+                    source->stalled = 0;
+                    --n_stalled;
+                } else if (atomic_load_explicit(&source->closed, memory_order_acquire) == 0) {
+                    epoll_ctl(args->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
                 }
-                q->head = (q->head + n_read) & q->mask;
+                if (source->owns_ring) { queue_free(source->queue); }
+                pthread_mutex_lock(&args->lock);
+                atomic_store_explicit(&source->state, RX_SOURCE_FREE, memory_order_release);
+                pthread_cond_broadcast(&args->cond);
+                pthread_mutex_unlock(&args->lock);
+            } else if ((state == RX_SOURCE_ACTIVE) && source->stalled && queue_room(source->queue)) {
+                struct epoll_event event = { EPOLLIN | EPOLLRDHUP, { .ptr = source } };
+                epoll_ctl(args->epoll_fd, EPOLL_CTL_ADD, source->fd, &event);
+                source->stalled = 0;
+                --n_stalled;
             }
         }
-#ifdef SLEEP_NOT_SELECT
-        struct timespec remaining, request = {0, 1000000};
-        nanosleep(&request, &remaining);
-#endif
     }
 
     return NULL;
 }
 
+void rx_looper_stop(RxLooperArgs *args) {
+    atomic_store_explicit(&args->stopping, 1, memory_order_release);
+    rx_looper_wake(args);
+}
+
+/* @brief releases what rx_looper_init() and rx_looper_add() acquired. the thread must have been joined */
+void rx_looper_close(RxLooperArgs *args) {
+    unsigned int n_sources = atomic_load_explicit(&args->n_sources, memory_order_acquire);
+    for (unsigned int i = 0; args->sources && (i < n_sources); ++i) {
+        RxSource *source = &args->sources[i];
+        if ((atomic_load(&source->state) != RX_SOURCE_FREE) && source->owns_ring) { queue_free(source->queue); }
+    }
+    if (args->epoll_fd >= 0) { close(args->epoll_fd); }
+    if (args->event_fd >= 0) { close(args->event_fd); }
+    free(args->sources);
+    args->sources = NULL;
+    args->epoll_fd = args->event_fd = -1;
+    atomic_store(&args->n_sources, 0);
+    pthread_cond_destroy(&args->cond);
+    pthread_mutex_destroy(&args->lock);
+}
+
+unsigned long rx_looper_overflows(RxLooperArgs *args) {
+    unsigned long total = 0;
+    unsigned int n_sources = atomic_load_explicit(&args->n_sources, memory_order_acquire);
+    for (unsigned int i = 0; i < n_sources; ++i) {
+        total += atomic_load_explicit(&args->sources[i].overflows, memory_order_relaxed);
+    }
+    return total;
+}
+
 void *server_task(void *arg)
 {
     TcpServerInfo *info = (TcpServerInfo *) arg;
@@ -60,7 +221,7 @@ void *server_task(void *arg)
     do {
 
         struct sockaddr_in cli_addr;
-        int clilen = sizeof(cli_addr);
+        socklen_t clilen = sizeof(cli_addr);
 
         /* accept connection from client */
         info->infrastructure.fd = accept(info->server_fd, (struct sockaddr *) &cli_addr, &clilen);
@@ -71,6 +232,8 @@ void *server_task(void *arg)
         }
 
     } while (0);
+
+    return 0;
 }
 
 void *client_task(void *ext) {
@@ -95,24 +258,127 @@ void *client_task(void *ext) {
         return 0;
     }
 
+    return 0;
 }
 
+/* @brief positioned read of up to n bytes. returns how many were read, 0 at end of file, -1 on error */
 int recv_from_file(void *handle, uint8_t *b, unsigned int n, unsigned int offset, unsigned int timeout) {
     int fd = * (int *) handle;
-    unsigned int remaining = n;
-    if (offset) { printf("read from offset not supported\n"); }
-    do {
-        int n_read = read(fd, b, remaining);
-        remaining -= n_read;
-        b += n_read;
-    } while (remaining >= 0);
+    (void) timeout;
+    unsigned int index = 0;
+    while (index < n) {
+        ssize_t n_read = pread(fd, &b[index], n - index, (off_t) offset + index);
+        if (n_read < 0) { return index ? (int) index : -1; }
+        if (n_read == 0) { break; }
+        index += n_read;
+    }
+    return index;
+}
+
+/* @brief positioned write of n bytes. returns how many were written, -1 on error */
+int write_to_file(void *handle, uint8_t const *b, unsigned int n, unsigned int offset, unsigned int timeout) {
+    int fd = * (int *) handle;
+    (void) timeout;
+    unsigned int index = 0;
+    while (index < n) {
+        ssize_t n_write = pwrite(fd, &b[index], n - index, (off_t) offset + index);
+        if (n_write <= 0) { return index ? (int) index : -1; }
+        index += n_write;
+    }
+    return index;
+}
+
+int sync_to_file(void *handle) {
+    int fd = * (int *) handle;
+    return (fdatasync(fd) == 0) ? 0 : -1;
 }
 
 int size_from_file(void *handle, unsigned int timeout) {
     int fd = * (int *) handle;
-    unsigned int size = lseek(fd, 0, SEEK_END);
-    close(fd);
-    return size;
+    (void) timeout;
+    struct stat st;
+    if (fstat(fd, &st) != 0) { return -1; }
+    return st.st_size;
+}
+
+int info_from_file(void *handle, XmodemFileInfo *info) {
+    int fd = * (int *) handle;
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || (st.st_size > 0xffffffffL)) { return -1; }
+    info->size = st.st_size;
+    info->mtime = st.st_mtime;
+    info->mode = st.st_mode & 07777;
+    return 0;
+}
+
+/*
+ * @brief batch sink: closes the file being written, if any (*handle >= 0), and creates the next one in the working
+ *     directory. only the last part of the announced name is used. the file is preallocated to its size. a file
+ *     with a checkpoint is left as it is, for the transfer to go on after what it holds
+ */
+int open_to_file(void *handle, XmodemFileInfo const *info) {
+    int *fd = (int *) handle;
+    char const *name = strrchr(info->name, '/');
+    name = name ? name + 1 : info->name;
+    if ((name[0] == 0) || (strcmp(name, ".") == 0) || (strcmp(name, "..") == 0)) { return -1; }
+    if (*fd >= 0) { close(*fd); }
+    int keep = (getxattr(name, STREAM_CHECKPOINT_XATTR, NULL, 0) == sizeof (XmodemCheckpoint)) ? 1 : 0;
+    *fd = open(name, O_RDWR | O_CREAT | (keep ? 0 : O_TRUNC), (info->mode & 0777) ? (info->mode & 0777) : 0644);
+    if (*fd < 0) { return -1; }
+    if (info->size) {
+        int result = posix_fallocate(*fd, 0, info->size);
+        if ((result != 0) && (result != EOPNOTSUPP) && (result != EINVAL)) { return -1; } /* e.g. out of space */
+    }
+    return 0;
+}
+
+/* @brief batch sink: the file is all written. cuts it to its announced size and gives it its time */
+int close_to_file(void *handle, XmodemFileInfo const *info) {
+    int fd = * (int *) handle;
+    if (ftruncate(fd, info->size) != 0) { return -1; }
+    if (info->mtime) {
+        struct timespec times[2] = { { info->mtime, 0 }, { info->mtime, 0 } };
+        futimens(fd, times);
+    }
+    return 0;
+}
+
+int truncate_to_file(void *handle, uint32_t size) {
+    int fd = * (int *) handle;
+    return (ftruncate(fd, size) == 0) ? 0 : -1;
+}
+
+/* @brief the checkpoint of a partial file lives in an extended attribute of it, so it goes wherever the file goes */
+int load_checkpoint_from_file(void *handle, XmodemCheckpoint *checkpoint) {
+    int fd = * (int *) handle;
+    ssize_t n = fgetxattr(fd, STREAM_CHECKPOINT_XATTR, checkpoint, sizeof (XmodemCheckpoint));
+    return (n == sizeof (XmodemCheckpoint)) ? 0 : -1;
+}
+
+/* @brief -1 where the file system has no extended attributes. the transfer goes on, it just cannot be resumed */
+int save_checkpoint_to_file(void *handle, XmodemCheckpoint const *checkpoint) {
+    int fd = * (int *) handle;
+    if (checkpoint == NULL) {
+        return ((fremovexattr(fd, STREAM_CHECKPOINT_XATTR) == 0) || (errno == ENODATA)) ? 0 : -1;
+    }
+    return (fsetxattr(fd, STREAM_CHECKPOINT_XATTR, checkpoint, sizeof (XmodemCheckpoint), 0) == 0) ? 0 : -1;
+}
+
+/* @brief maps the whole file read only for zero-copy sends. returns NULL if it cannot be mapped */
+uint8_t const *map_from_file(void *handle, unsigned int *size) {
+    int fd = * (int *) handle;
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || (st.st_size <= 0) || (st.st_size > 0xffffffffL)) { return NULL; }
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) { return NULL; }
+    madvise(base, st.st_size, MADV_SEQUENTIAL);
+    *size = st.st_size;
+    return base;
+}
+
+void unmap_from_file(void *handle, uint8_t const *base, unsigned int size) {
+    (void) handle;
+    munmap((void *) base, size);
 }
 
 /* @brief returns 1 if current time exceeds the time specified by timeout. 0 otherwise */
@@ -125,28 +391,19 @@ static int timeout_expired(struct timespec const * const timeout) {
     return ((now.tv_nsec >= timeout->tv_nsec) ? 1 : 0);
 }
 
+/*
+ * @brief sleeps until at least one byte is queued or timeout milliseconds pass, then copies whatever is queued,
+ *     up to n bytes. rx_looper wakes us as bytes land. returns how many were read, or -1 once the descriptor has
+ *     hit end of file or an error and everything read before is gone
+ */
 int recv_from_desc(void *handle, uint8_t *b, unsigned int n, unsigned int offset, unsigned int timeout) {
-
-    /* calculate timeout */
-    struct timespec spec, expiry;
-    clock_gettime(CLOCK_MONOTONIC, &spec);
-    expiry.tv_sec = spec.tv_sec;
-    expiry.tv_nsec = spec.tv_nsec + timeout * 1e6;
-    if (expiry.tv_nsec > 1e9) {
-        expiry.tv_nsec -= 1e9;
-        ++expiry.tv_sec;
-    }
-
-    /* read (max) n bytes from queue before timeout */
-    Queue *q = (Queue *) handle;
-    unsigned int index = 0;
-    while ((q->head != q->tail) && (index <= n) && (timeout_expired(&expiry) == 0)) {
-        b[index] = q->buff[q->tail];
-        q->tail = (q->tail + 1) & q->mask;
-        ++index;
+    Stream *stream = (Stream *) handle;
+    (void) offset;
+    if (queue_wait(stream->queue, timeout) == 0) {
+        /* bytes committed just before the close are seen by the second count */
+        if (queue_closed(stream->queue) && (queue_count(stream->queue) == 0)) { return -1; }
     }
-
-    return index; /* how many were read */
+    return queue_read(stream->queue, b, n);
 }
 
 int getc_from_desc(void *handle, uint8_t *byte, unsigned int timeout) {
@@ -154,26 +411,60 @@ int getc_from_desc(void *handle, uint8_t *byte, unsigned int timeout) {
 }
 
 #define ONE_BILLION (1000000000L)
+
+/* @brief timeout milliseconds from now, on the clock timeout_expired() reads */
+static void deadline(struct timespec *expiry, unsigned int timeout) {
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    int64_t ns = spec.tv_nsec + timeout * 1000000LL;
+    expiry->tv_sec = spec.tv_sec + ns / ONE_BILLION;
+    expiry->tv_nsec = ns % ONE_BILLION;
+}
+
 int send_over_desc(void *handle, uint8_t const * const b, unsigned int n, unsigned int timeout) {
     int fd = * (int *) handle;
 
-    /* calculate timeout */
-    struct timespec spec, expiry;
-    clock_gettime(CLOCK_MONOTONIC, &spec);
-    expiry.tv_sec = spec.tv_sec;
-    expiry.tv_nsec = spec.tv_nsec + timeout * 1e6;
-    if (expiry.tv_nsec > ONE_BILLION) {
-        expiry.tv_nsec -= ONE_BILLION;
-        ++expiry.tv_sec;
-    }
+    struct timespec expiry;
+    deadline(&expiry, timeout);
 
     unsigned int index = 0;
     unsigned int remaining = n;
     do {
         int n_write = write(fd, &b[index], remaining);
+        if (n_write < 0) { break; }
         remaining -= n_write;
         index += n_write;
-    } while ((index <= n) && (timeout_expired(&expiry) == 0));
+    } while (remaining && (timeout_expired(&expiry) == 0));
+
+    return index; /* how many went out */
+}
+
+/* @brief gathered write, e.g. packet header, payload and footer from separate buffers in one system call */
+int sendv_over_desc(void *handle, struct iovec const *iov, int iovcnt, unsigned int timeout) {
+    int fd = * (int *) handle;
+    struct iovec local[16];
+    if ((iovcnt <= 0) || (iovcnt > 16)) { return -1; }
+    memcpy(local, iov, iovcnt * sizeof (struct iovec));
+
+    struct timespec expiry;
+    deadline(&expiry, timeout);
+
+    unsigned int index = 0;
+    struct iovec *v = local;
+    do {
+        ssize_t n_write = writev(fd, v, iovcnt);
+        if (n_write < 0) { break; }
+        index += n_write;
+        while (iovcnt && (n_write >= (ssize_t) v->iov_len)) { /* skip what went out whole */
+            n_write -= v->iov_len;
+            ++v;
+            --iovcnt;
+        }
+        if (iovcnt) {
+            v->iov_base = (uint8_t *) v->iov_base + n_write;
+            v->iov_len -= n_write;
+        }
+    } while (iovcnt && (timeout_expired(&expiry) == 0));
 
     return index; /* how many went out */
 }
@@ -0,0 +1,102 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "session.h"
+#include "simline.h"
+
+/*
+ * extended transfers where the sender takes less than the receiver offers with X: a window or streaming it does not
+ * allow, or a smaller window. sender and receiver sessions run over simline.h's simulated line, once delivered in
+ * chunks and once a byte at a time. each pair has to finish with both sides in the same mode and the copy intact
+ */
+
+typedef struct {
+    char const *name;
+    unsigned int recv_window, recv_streaming; /* what the receiver offers */
+    unsigned int send_window, send_streaming; /* what the sender allows */
+    unsigned int window, streaming; /* what both have to end up with */
+} Pair;
+
+static const Pair pairs[] = {
+    { "streaming receiver, no streaming sender", 0, 1, 0, 0, 0, 0 },
+    { "window 8 receiver, no window sender", 8, 0, 0, 0, 0, 0 },
+    { "window 8 receiver, window 4 sender", 8, 0, 4, 0, 4, 0 },
+    { "streaming receiver, window 8 sender", 0, 1, 8, 0, 0, 0 },
+    { "window 8 receiver, window 8 sender", 8, 0, 8, 0, 8, 0 },
+    { "streaming receiver, streaming sender", 0, 1, 0, 1, 0, 1 },
+};
+
+static void base_options(XmodemOptions *options) {
+    memset(options, 0, sizeof (XmodemOptions));
+    options->crc_checksum = CHECKSUM_OPTION_CRC;
+    options->packet_size_code = XMODEM_STX;
+    options->timeout_ms = 1000;
+    options->min_timeout_ms = 50;
+    options->max_timeout_ms = 10000;
+    options->max_retries = 10;
+    options->max_retransmissions = 10;
+    options->extended = 1;
+    options->extended_block_size = 4096;
+}
+
+/* @return 0 if the pair agreed on the expected mode and the copy is intact */
+static int run(SimFile *transfer, Pair const *pair, SimLineModel const *model) {
+    XmodemSession sender, receiver;
+    XmodemOptions send_options, recv_options;
+    base_options(&send_options);
+    send_options.window = pair->send_window;
+    send_options.streaming = pair->send_streaming;
+    base_options(&recv_options);
+    recv_options.window = pair->recv_window;
+    recv_options.streaming = pair->recv_streaming;
+    memset(transfer->copy, 0, transfer->file_size);
+
+    XmodemBlocks source = { .context = transfer, .get_data = sim_get_data, .gather = 1 };
+    XmodemBlocks sink = { .context = transfer, .put_block = sim_put_block };
+    if (xmodem_session_start_send(&sender, &send_options, &source, transfer->file_size, 0) != 0) { return -1; }
+    if (xmodem_session_start_recv(&receiver, &recv_options, &sink, 0) != 0) {
+        xmodem_session_end(&sender);
+        return -1;
+    }
+    sim_run(&sender, &receiver, model, 1, NULL);
+
+    int good = (xmodem_session_status(&sender) == XMODEM_SESSION_DONE) &&
+        (xmodem_session_status(&receiver) == XMODEM_SESSION_DONE) &&
+        (sender.options.window == pair->window) && (receiver.options.window == pair->window) &&
+        (sender.options.streaming == pair->streaming) && (receiver.options.streaming == pair->streaming) &&
+        (memcmp(transfer->file, transfer->copy, transfer->file_size) == 0);
+    xmodem_session_end(&sender);
+    xmodem_session_end(&receiver);
+    return good ? 0 : -1;
+}
+
+int main(void) {
+    const uint32_t file_size = 64 * 1024 + 100;
+    uint8_t *file = malloc(file_size);
+    SimFile transfer = { file, file_size, malloc(file_size) };
+    if ((file == NULL) || (transfer.copy == NULL)) { return 1; }
+    uint32_t seed = 12345;
+    for (uint32_t i = 0; i < file_size; ++i) {
+        seed = seed * 1103515245 + 12345;
+        file[i] = seed >> 24;
+    }
+
+    /* 115200 baud, 5 ms each way. chunks of 256 bytes, then single bytes */
+    SimLineModel model = { 11520, 5000, 0, 256 };
+    static const unsigned int chunks[] = { 256, 1 };
+
+    int failures = 0;
+    for (unsigned int c = 0; c < sizeof (chunks) / sizeof (chunks[0]); ++c) {
+        model.chunk_size = chunks[c];
+        for (unsigned int i = 0; i < sizeof (pairs) / sizeof (pairs[0]); ++i) {
+            int result = run(&transfer, &pairs[i], &model);
+            printf("%-4s %s, %u byte chunks\n", result ? "FAIL" : "ok", pairs[i].name, chunks[c]);
+            if (result) { ++failures; }
+        }
+    }
+
+    free(file);
+    free(transfer.copy);
+    return failures ? 1 : 0;
+}
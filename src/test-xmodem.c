@@ -24,6 +24,8 @@
 #include "ports.h"
 #include "stream.h"
 
+#if 0
+
 int recv_from_file(void *handle, uint8_t *b, unsigned int n, unsigned int offset, unsigned int timeout) {
     int fd = * (int *) handle;
     unsigned int remaining = n;
@@ -109,6 +111,8 @@ int putc_over_desc(void *handle, uint8_t byte, unsigned int timeout) {
     return send_over_desc(handle, &byte, 1, timeout);
 }
 
+#endif
+
 enum {
     DirectionTx = 0,
     DirectionSend = DirectionTx,
@@ -124,7 +128,6 @@ enum {
 };
 
 int main(int argc, char **argv) {
-    XmodemOptions options;
     GenericDevice i_device, o_device;
 
     o_device.name[0] = 0;
@@ -138,15 +141,12 @@ int main(int argc, char **argv) {
     o_device.getc = getc_from_desc;
     o_device.putc = putc_over_desc;
 
-    int verbose = 0;
     int direction = Directions; /* invalid value */
     int mode = TcpModes;
     int port = 0;
 
     for (int i = 0; i < argc; ++i) {
-        if (strcmp(argv[i], "-verbose") == 0) {
-            verbose = 1;
-        } else if ((strcmp(argv[i], "-s") == 0) || (strcmp(argv[i], "--send") == 0)) {
+        if ((strcmp(argv[i], "-s") == 0) || (strcmp(argv[i], "--send") == 0)) {
             direction = DirectionSend;
         } else if ((strcmp(argv[i], "-r") == 0) || (strcmp(argv[i], "--receive") == 0)) {
             direction = DirectionRecv;
@@ -183,7 +183,7 @@ int main(int argc, char **argv) {
         server_task(&tcp_server_info);
     } else if (mode == TcpModeClient) {
         initialize_tcp_client_info(&tcp_client_info);
-        tcp_client_info.portno = port;
+        tcp_client_info.infrastructure.portno = port;
         client_task(&tcp_client_info);
     }
 
@@ -191,16 +191,21 @@ int main(int argc, char **argv) {
     RxLooperArgs rx_looper_args;
     Queue rx_queue;
     memset(&rx_looper_args, 0, sizeof(RxLooperArgs));
+    memset(&rx_queue, 0, sizeof (rx_queue));
 
-    unsigned int run = 1;
-    rx_looper_args.queue = &rx_queue;
-    rx_looper_args.run = &run;
-    rx_looper_args.verbose = verbose;
+    int fd = o_device.fd;
     if (mode == TcpModeClient) {
-        rx_looper_args.fd = tcp_client_info.client_fd;
+        fd = tcp_client_info.infrastructure.fd;
     } else if (mode == TcpModeServer) {
-        rx_looper_args.fd = tcp_server_info.client_fd;
+        fd = tcp_server_info.infrastructure.fd;
+    }
+    if (rx_looper_init(&rx_looper_args) || rx_looper_add(&rx_looper_args, fd, &rx_queue)) {
+        printf("unable to start receiver\n");
+        return 1;
     }
+    Stream link = { fd, &rx_queue };
+    o_device.handle = &link;
+    i_device.handle = &i_device.fd;
     pthread_t rx_thread;
 
     pthread_create(&rx_thread, NULL, rx_looper, (void *) &rx_looper_args); /* create thread */
@@ -215,6 +220,7 @@ int main(int argc, char **argv) {
     }
 
     int errors = 0;
+    XmodemOptions options;
     options.timeout_ms = 100000;
     options.max_retries = 25000;
     options.max_retransmissions = 25000;
@@ -225,21 +231,23 @@ int main(int argc, char **argv) {
 
     while (1) {
         int n;
-        char buff[64];
+        uint8_t buff[64];
         sleep(1);
         if (mode == TcpModeClient) {
             printf("\nreceived: ");
-            n = recv_from_desc(&rx_queue, buff, sizeof (buff), 0, 0);
+            n = recv_from_desc(&link, buff, sizeof (buff), 0, 0);
             for (int i = 0; i < n; ++i) {
                 printf("%2.2x %c", buff[i], buff[i]);
             }
         } else if (mode == TcpModeServer) {
             const char *str = "hello, world\n";
-            send_over_desc(&tcp_server_info.client_fd, str, sizeof (str), 0);
+            send_over_desc(&tcp_server_info.infrastructure.fd, (uint8_t const *) str, sizeof (str), 0);
         }
     }
 
+    rx_looper_stop(&rx_looper_args);
     pthread_join(rx_thread, NULL);
+    rx_looper_close(&rx_looper_args);
 
     return 0;
 }
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+/*
+ * decodes a trace_dump() file: every thread's events merged by time, one per line as text, or with -json as a
+ * chrome://tracing (or Perfetto) timeline with a row per thread. times are microseconds from the first event
+ */
+
+typedef struct {
+    TraceEvent event;
+    unsigned int ring;
+} Entry;
+
+static int by_time(void const *a, void const *b) {
+    uint64_t x = ((Entry const *) a)->event.ticks, y = ((Entry const *) b)->event.ticks;
+    return (x > y) - (x < y);
+}
+
+/* @brief name with anything that would need escaping in json left out */
+static void print_name(char const *name) {
+    for (unsigned int i = 0; (i < 16) && name[i]; ++i) {
+        if ((name[i] >= ' ') && (name[i] != '"') && (name[i] != '\\')) { putchar(name[i]); }
+    }
+}
+
+int main(int argc, char **argv) {
+    unsigned int json = 0;
+    char const *path = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-json") == 0) {
+            json = 1;
+        } else {
+            path = argv[i];
+        }
+    }
+    if (path == NULL) {
+        fprintf(stderr, "usage: %s [-json] trace-file\n", argv[0]);
+        return 1;
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        printf("unable to open %s\n", path);
+        return 1;
+    }
+    TraceFileHeader header;
+    if ((fread(&header, sizeof (header), 1, f) != 1) || memcmp(header.magic, TRACE_FILE_MAGIC, sizeof (header.magic))
+        || (header.version != TRACE_FILE_VERSION)) {
+        printf("%s is not a trace\n", path);
+        fclose(f);
+        return 1;
+    }
+
+    TraceFileRing *rings = calloc(header.n_rings ? header.n_rings : 1, sizeof (TraceFileRing));
+    Entry *entries = NULL;
+    size_t n = 0;
+    uint64_t lost = 0;
+    for (unsigned int r = 0; r < header.n_rings; ++r) {
+        if (fread(&rings[r], sizeof (TraceFileRing), 1, f) != 1) { break; }
+        Entry *more = realloc(entries, (n + rings[r].n_events) * sizeof (Entry));
+        if (more == NULL) { break; }
+        entries = more;
+        uint32_t i = 0;
+        for (; i < rings[r].n_events; ++i, ++n) {
+            if (fread(&entries[n].event, sizeof (TraceEvent), 1, f) != 1) { break; }
+            entries[n].ring = r;
+        }
+        lost += rings[r].lost;
+        if (i < rings[r].n_events) { break; } /* cut short */
+    }
+    fclose(f);
+    qsort(entries, n, sizeof (Entry), by_time);
+
+    /* ticks to nanoseconds by the rate between the first trace_start() and the dump */
+    double ns_per_tick = 1.0;
+    if (header.end_ticks > header.start_ticks) {
+        ns_per_tick = (double) (header.end_ns - header.start_ns) / (header.end_ticks - header.start_ticks);
+    }
+    uint64_t origin = n ? entries[0].event.ticks : 0;
+
+    if (json) {
+        printf("{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+        for (unsigned int r = 0; r < header.n_rings; ++r) {
+            printf("%s\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"",
+                r ? "," : "", rings[r].tid);
+            print_name(rings[r].name);
+            printf("\"}}");
+        }
+        for (size_t i = 0; i < n; ++i) {
+            TraceEvent const *e = &entries[i].event;
+            printf("%s\n  {\"name\": \"%s\", \"cat\": \"xmodem\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, "
+                "\"pid\": 1, \"tid\": %d, \"args\": {\"session\": %u, \"arg\": %u, \"length\": %u}}",
+                (header.n_rings || i) ? "," : "", trace_event_name(e->type), (e->ticks - origin) * ns_per_tick * 1e-3,
+                rings[entries[i].ring].tid, e->session, e->arg, e->length);
+        }
+        printf("\n]}\n");
+    } else {
+        printf("# %zu events from %u threads, %llu lost\n", n, header.n_rings, (unsigned long long) lost);
+        for (size_t i = 0; i < n; ++i) {
+            TraceEvent const *e = &entries[i].event;
+            TraceFileRing const *ring = &rings[entries[i].ring];
+            printf("%14.3f %7d %-15.15s %5u %-14s %10u %8u\n", (e->ticks - origin) * ns_per_tick * 1e-3, ring->tid,
+                ring->name, e->session, trace_event_name(e->type), e->arg, e->length);
+        }
+    }
+
+    free(entries);
+    free(rings);
+    return 0;
+}
@@ -0,0 +1,140 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+atomic_uint trace_enabled;
+_Thread_local TraceRing *trace_ring;
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER; /* the list of rings, and the settings below */
+static TraceRing *trace_rings;
+static unsigned int trace_ring_events = TRACE_RING_EVENTS;
+static uint64_t trace_start_ns, trace_start_ticks;
+static atomic_uint trace_sessions;
+
+static char const * const trace_names[TRACE_EVENTS] = {
+    "none", "session-start", "session-end", "packet-built", "retransmit", "sent", "received", "ack-sent", "nak-sent",
+    "ack-received", "nak-received", "timeout", "damaged", "cancel", "rx-read", "rx-full"
+};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec * 1000000000ull + spec.tv_nsec;
+}
+
+/* @brief the ring of the calling thread, made on its first event. NULL if out of memory */
+TraceRing *trace_attach(void) {
+    pthread_mutex_lock(&trace_lock);
+    unsigned long n = trace_ring_events;
+    TraceRing *ring = calloc(1, sizeof (TraceRing) + n * sizeof (TraceSlot));
+    if (ring) {
+        atomic_init(&ring->head, 0);
+        ring->mask = n - 1;
+        ring->tid = syscall(SYS_gettid);
+        pthread_getname_np(pthread_self(), ring->name, sizeof (ring->name));
+        ring->next = trace_rings;
+        trace_rings = ring;
+    }
+    pthread_mutex_unlock(&trace_lock);
+    trace_ring = ring;
+    return ring;
+}
+
+void trace_start(unsigned int events_per_thread) {
+    pthread_mutex_lock(&trace_lock);
+    unsigned int n = 1;
+    while (n < (events_per_thread ? events_per_thread : TRACE_RING_EVENTS)) { n <<= 1; }
+    trace_ring_events = n;
+    if (trace_start_ns == 0) {
+        trace_start_ticks = trace_ticks();
+        trace_start_ns = monotonic_ns();
+    }
+    for (TraceRing *ring = trace_rings; ring; ring = ring->next) {
+        ring->start = atomic_load_explicit(&ring->head, memory_order_acquire);
+    }
+    pthread_mutex_unlock(&trace_lock);
+    atomic_store_explicit(&trace_enabled, 1, memory_order_release);
+}
+
+void trace_stop(void) {
+    atomic_store_explicit(&trace_enabled, 0, memory_order_release);
+}
+
+/* @brief the events of ring still in it, oldest first, into events. returns how many, and counts those lost */
+static uint32_t ring_copy(TraceRing *ring, TraceEvent *events, uint64_t *lost) {
+    unsigned long head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    unsigned long first = (head > ring->mask + 1) ? head - ring->mask - 1 : 0;
+    if (first < ring->start) { first = ring->start; }
+    *lost = first - ring->start;
+    uint32_t n = 0;
+    for (unsigned long i = first; i < head; ++i) {
+        TraceSlot *slot = &ring->slots[i & ring->mask];
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) == i + 1) {
+            events[n] = slot->event;
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&slot->seq, memory_order_relaxed) == i + 1) {
+                ++n;
+                continue;
+            }
+        }
+        ++*lost; /* overwritten while we read it */
+    }
+    return n;
+}
+
+int trace_dump(char const *path) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) { return -1; }
+    pthread_mutex_lock(&trace_lock);
+    TraceFileHeader header;
+    memset(&header, 0, sizeof (header));
+    memcpy(header.magic, TRACE_FILE_MAGIC, sizeof (TRACE_FILE_MAGIC));
+    header.version = TRACE_FILE_VERSION;
+    for (TraceRing *ring = trace_rings; ring; ring = ring->next) { ++header.n_rings; }
+    header.start_ns = trace_start_ns;
+    header.start_ticks = trace_start_ticks;
+    header.end_ticks = trace_ticks();
+    header.end_ns = monotonic_ns();
+    int result = (fwrite(&header, sizeof (header), 1, f) == 1) ? 0 : -1;
+
+    TraceEvent *events = NULL;
+    unsigned long capacity = 0;
+    for (TraceRing *ring = trace_rings; ring && (result == 0); ring = ring->next) {
+        if (capacity < ring->mask + 1) {
+            free(events);
+            capacity = ring->mask + 1;
+            events = malloc(capacity * sizeof (TraceEvent));
+            if (events == NULL) {
+                result = -1;
+                break;
+            }
+        }
+        TraceFileRing file_ring;
+        memset(&file_ring, 0, sizeof (file_ring));
+        file_ring.tid = ring->tid;
+        memcpy(file_ring.name, ring->name, sizeof (file_ring.name));
+        file_ring.n_events = ring_copy(ring, events, &file_ring.lost);
+        if ((fwrite(&file_ring, sizeof (file_ring), 1, f) != 1) ||
+            (fwrite(events, sizeof (TraceEvent), file_ring.n_events, f) != file_ring.n_events)) {
+            result = -1;
+        }
+    }
+    pthread_mutex_unlock(&trace_lock);
+    free(events);
+    if (fclose(f) != 0) { result = -1; }
+    return result;
+}
+
+uint32_t trace_session_id(void) {
+    return atomic_fetch_add_explicit(&trace_sessions, 1, memory_order_relaxed) + 1;
+}
+
+char const *trace_event_name(unsigned int type) {
+    return (type < TRACE_EVENTS) ? trace_names[type] : "unknown";
+}
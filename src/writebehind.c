@@ -0,0 +1,261 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "writebehind.h"
+#include "crc.h"
+
+static int write_batch(WriteBehind *wb, WriteBatch const *batch) {
+    unsigned int index = 0;
+    while (index < batch->length) {
+        int n_write = wb->dst->write(wb->dst->handle, &batch->data[index], batch->length - index,
+            batch->offset + index, 0);
+        if (n_write <= 0) { return -1; }
+        index += n_write;
+    }
+    return 0;
+}
+
+/* @brief resume: a batch is on the device. the checkpoint grows over it if nothing before it is missing */
+static void track_batch(WriteBehind *wb, WriteBatch const *batch) {
+    XmodemCheckpoint *checkpoint = &wb->checkpoint;
+    uint32_t end = batch->offset + batch->length;
+    if (batch->offset > checkpoint->verified) { /* beyond a gap. a checkpoint that stops growing is still right */
+        uint32_t crc = crc32c(batch->data, batch->length);
+        for (unsigned int i = 0; i < wb->n_ahead; ++i) { /* blocks of a window land out of order, but in runs */
+            WriteRange *range = &wb->ahead[i];
+            if (range->offset + range->length == batch->offset) {
+                range->crc = crc32c_combine(range->crc, crc, batch->length);
+                range->length += batch->length;
+                return;
+            }
+            if (end == range->offset) {
+                range->crc = crc32c_combine(crc, range->crc, range->length);
+                range->offset = batch->offset;
+                range->length += batch->length;
+                return;
+            }
+        }
+        if (wb->n_ahead < WRITEBEHIND_AHEAD) {
+            WriteRange *range = &wb->ahead[wb->n_ahead++];
+            range->offset = batch->offset;
+            range->length = batch->length;
+            range->crc = crc;
+        }
+        return;
+    }
+    if (end > checkpoint->verified) {
+        checkpoint->crc = crc32c_update(checkpoint->crc, &batch->data[checkpoint->verified - batch->offset],
+            end - checkpoint->verified);
+        checkpoint->verified = end;
+    }
+    for (unsigned int i = 0; i < wb->n_ahead;) {
+        WriteRange const *range = &wb->ahead[i];
+        if (range->offset > checkpoint->verified) {
+            ++i;
+            continue;
+        }
+        if (range->offset == checkpoint->verified) { /* the gap before it filled */
+            checkpoint->crc = crc32c_combine(checkpoint->crc, range->crc, range->length);
+            checkpoint->verified += range->length;
+        }
+        wb->ahead[i] = wb->ahead[--wb->n_ahead];
+        i = 0;
+    }
+}
+
+/* @brief resume: the checkpoint goes with the device once what it covers is durable */
+static void save_checkpoint(WriteBehind *wb) {
+    if (wb->track && wb->dst->save_checkpoint) { wb->dst->save_checkpoint(wb->dst->handle, &wb->checkpoint); }
+}
+
+static void *writebehind_task(void *ext) {
+    WriteBehind *wb = (WriteBehind *) ext;
+    pthread_mutex_lock(&wb->lock);
+    while (wb->run || wb->ready) {
+        if (wb->ready == 0) {
+            pthread_cond_wait(&wb->cond, &wb->lock);
+            continue;
+        }
+        WriteBatch *batch = &wb->batches[(wb->fill + WRITEBEHIND_BATCHES - wb->ready) % WRITEBEHIND_BATCHES];
+        pthread_mutex_unlock(&wb->lock);
+
+        /* the receiver does not touch a batch once it is handed over */
+        int failed = write_batch(wb, batch);
+        if ((failed == 0) && wb->track) { track_batch(wb, batch); }
+        int sync = 0;
+        wb->unsynced += batch->length;
+        if (wb->sync_bytes && (wb->unsynced >= wb->sync_bytes)) {
+            wb->unsynced = 0;
+            sync = 1;
+        }
+        if ((failed == 0) && sync && wb->dst->sync) { failed = wb->dst->sync(wb->dst->handle); }
+        if ((failed == 0) && sync) { save_checkpoint(wb); }
+
+        pthread_mutex_lock(&wb->lock);
+        if (failed) { wb->failed = 1; }
+        batch->length = 0;
+        --wb->ready;
+        pthread_cond_broadcast(&wb->cond);
+    }
+    pthread_mutex_unlock(&wb->lock);
+    return NULL;
+}
+
+/* @brief hand the batch being filled to the writer and wait for a free one. called with the lock held */
+static void hand_over(WriteBehind *wb) {
+    if (wb->batches[wb->fill].length == 0) { return; }
+    ++wb->ready;
+    wb->fill = (wb->fill + 1) % WRITEBEHIND_BATCHES;
+    pthread_cond_broadcast(&wb->cond);
+    while (wb->ready == WRITEBEHIND_BATCHES) { pthread_cond_wait(&wb->cond, &wb->lock); }
+}
+
+/* @brief append to the batch being filled, starting a new one if the data is not contiguous or does not fit */
+static void stage(WriteBehind *wb, uint32_t offset, uint8_t const *data, unsigned int n) {
+    pthread_mutex_lock(&wb->lock);
+    while (n) {
+        WriteBatch *batch = &wb->batches[wb->fill];
+        if (batch->length && ((batch->offset + batch->length != offset) || (batch->length == wb->batch_size))) {
+            hand_over(wb);
+            continue;
+        }
+        if (batch->length == 0) { batch->offset = offset; }
+        unsigned int chunk = wb->batch_size - batch->length;
+        if (chunk > n) { chunk = n; }
+        memcpy(&batch->data[batch->length], data, chunk);
+        batch->length += chunk;
+        offset += chunk;
+        data += chunk;
+        n -= chunk;
+    }
+    pthread_mutex_unlock(&wb->lock);
+}
+
+/*
+ * @param batch_size = bytes per positioned write, at least one block
+ * @param sync_bytes = fsync cadence, 0 = only at writebehind_finish()
+ */
+int writebehind_start(WriteBehind *wb, GenericDevice *dst, unsigned int batch_size, unsigned int sync_bytes)
+{
+    memset(wb, 0, sizeof (WriteBehind));
+    wb->dst = dst;
+    wb->batch_size = batch_size;
+    wb->sync_bytes = sync_bytes;
+    wb->tail = malloc(batch_size);
+    int failed = (wb->tail == NULL) ? 1 : 0;
+    for (int i = 0; i < WRITEBEHIND_BATCHES; ++i) {
+        wb->batches[i].data = malloc(batch_size);
+        if (wb->batches[i].data == NULL) { failed = 1; }
+    }
+    if (failed == 0) {
+        wb->run = 1;
+        pthread_mutex_init(&wb->lock, NULL);
+        pthread_cond_init(&wb->cond, NULL);
+        if (pthread_create(&wb->thread, NULL, writebehind_task, wb) != 0) {
+            wb->run = 0;
+            failed = 1;
+        }
+    }
+    if (failed) {
+        free(wb->tail);
+        for (int i = 0; i < WRITEBEHIND_BATCHES; ++i) { free(wb->batches[i].data); }
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * @brief queue a verified block. returns immediately unless every batch is waiting on the disk
+ * @return 0, or -1 if an earlier write failed
+ */
+int writebehind_submit(WriteBehind *wb, uint32_t offset, uint8_t const *data, unsigned int n)
+{
+    if ((n == 0) || (n > wb->batch_size)) { return -1; }
+    if (wb->tail_length && (offset <= wb->tail_offset)) { /* behind the held block, e.g. a windowed resend */
+        stage(wb, offset, data, n);
+    } else {
+        if (wb->tail_length) { stage(wb, wb->tail_offset, wb->tail, wb->tail_length); }
+        memcpy(wb->tail, data, n);
+        wb->tail_length = n;
+        wb->tail_offset = offset;
+    }
+    if (offset + n > wb->size) { wb->size = offset + n; }
+    return wb->failed ? -1 : 0;
+}
+
+/*
+ * @brief write out everything submitted so far and sync, keeping the writer for the next file of a batch
+ * @param size = bytes in the file. padding of the final block beyond it is dropped
+ * @return 0 when all data is on the device, -1 otherwise
+ */
+int writebehind_flush(WriteBehind *wb, uint32_t size)
+{
+    if (wb->tail_length && (wb->tail_offset + wb->tail_length > size)) {
+        wb->tail_length = (size > wb->tail_offset) ? size - wb->tail_offset : 0;
+    }
+    if (wb->tail_length) { stage(wb, wb->tail_offset, wb->tail, wb->tail_length); }
+    wb->tail_length = 0;
+    wb->size = 0;
+
+    pthread_mutex_lock(&wb->lock);
+    if (wb->batches[wb->fill].length) {
+        ++wb->ready;
+        wb->fill = (wb->fill + 1) % WRITEBEHIND_BATCHES;
+        pthread_cond_broadcast(&wb->cond);
+    }
+    while (wb->ready) { pthread_cond_wait(&wb->cond, &wb->lock); }
+    int failed = wb->failed;
+    pthread_mutex_unlock(&wb->lock);
+
+    if ((failed == 0) && wb->dst->sync) { failed = wb->dst->sync(wb->dst->handle); }
+    return failed ? -1 : 0;
+}
+
+/*
+ * @brief resume: keep a checkpoint of the file being written from now on, saved to the device after every sync.
+ *     checkpoint has the file's identity and what is already on the device. NULL stops. only with nothing in flight,
+ *     i.e. before the first block of a file or after writebehind_flush()
+ */
+void writebehind_track(WriteBehind *wb, XmodemCheckpoint const *checkpoint)
+{
+    pthread_mutex_lock(&wb->lock);
+    wb->track = checkpoint ? 1 : 0;
+    if (checkpoint) { wb->checkpoint = *checkpoint; }
+    wb->n_ahead = 0;
+    pthread_mutex_unlock(&wb->lock);
+}
+
+/*
+ * @brief write out everything, stop the writer and sync
+ * @param strip_padding = drop trailing CTRL-Z from the final block
+ * @return 0 when all data is on the device, -1 otherwise
+ */
+int writebehind_finish(WriteBehind *wb, unsigned int strip_padding)
+{
+    if (strip_padding) {
+        while (wb->tail_length && (wb->tail[wb->tail_length - 1] == XMODEM_CTZ)) { --wb->tail_length; }
+        wb->size = wb->tail_offset + wb->tail_length;
+    }
+    if (wb->tail_length) { stage(wb, wb->tail_offset, wb->tail, wb->tail_length); }
+
+    pthread_mutex_lock(&wb->lock);
+    if (wb->batches[wb->fill].length) {
+        ++wb->ready;
+        wb->fill = (wb->fill + 1) % WRITEBEHIND_BATCHES;
+    }
+    wb->run = 0;
+    pthread_cond_broadcast(&wb->cond);
+    pthread_mutex_unlock(&wb->lock);
+    pthread_join(wb->thread, NULL);
+
+    int failed = wb->failed;
+    if ((failed == 0) && wb->dst->sync) { failed = wb->dst->sync(wb->dst->handle); }
+    if (failed == 0) { save_checkpoint(wb); } /* everything that made it, for the next try */
+
+    pthread_mutex_destroy(&wb->lock);
+    pthread_cond_destroy(&wb->cond);
+    free(wb->tail);
+    for (int i = 0; i < WRITEBEHIND_BATCHES; ++i) { free(wb->batches[i].data); }
+
+    return failed ? -1 : 0;
+}
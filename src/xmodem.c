@@ -1,57 +1,17 @@
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <sys/uio.h>
 
 #include "xmodem.h"
-
-static uint8_t hex_ascii_lut[16] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
-
-static uint8_t pretty_buff[(1024 + 5 + 128) * 2]; /* x2 to accommodate purdy and some formatting characters */
-
-static unsigned int pretty_buffer(uint8_t * dst, uint8_t const * const src, unsigned int n) {
-    unsigned int index = 0;
-    for (unsigned int i = 0; i < n; ++i) {
-        dst[index++] = hex_ascii_lut[(src[i] >> 4) & 0xf];
-        dst[index++] = hex_ascii_lut[(src[i] >> 0) & 0xf];
-        if (i && ((i & 0x1f) == 0)) { dst[index++] = '\n'; dst[index++] = '\r'; }
-    }
-    return index;
-}
-
-static uint16_t crc16(uint8_t const * const ptr, int count) {
-    const uint16_t polynomial = 0x1021;
-    uint16_t crc = 0;
-    for (int j = 0; j < count; ++j) {
-        crc = crc ^ (int) ptr[j] << 8; /* loop 8x or just expand inline */
-        if (crc & 0x8000) { crc = (crc << 1) ^ polynomial; } else { crc = (crc << 1); }
-        if (crc & 0x8000) { crc = (crc << 1) ^ polynomial; } else { crc = (crc << 1); }
-        if (crc & 0x8000) { crc = (crc << 1) ^ polynomial; } else { crc = (crc << 1); }
-        if (crc & 0x8000) { crc = (crc << 1) ^ polynomial; } else { crc = (crc << 1); }
-        if (crc & 0x8000) { crc = (crc << 1) ^ polynomial; } else { crc = (crc << 1); }
-        if (crc & 0x8000) { crc = (crc << 1) ^ polynomial; } else { crc = (crc << 1); }
-        if (crc & 0x8000) { crc = (crc << 1) ^ polynomial; } else { crc = (crc << 1); }
-        if (crc & 0x8000) { crc = (crc << 1) ^ polynomial; } else { crc = (crc << 1); }
-    }
-    return crc;
-}
-
-#if 0
-    int i;
-    while (--count >= 0)
-    {
-        crc = crc ^ (int) *ptr++ << 8;
-        int i = 8;
-        do {
-            if (crc & 0x8000) {
-                crc = (crc << 1) ^ polynomial;
-            } else {
-                crc = (crc << 1);
-            }
-        } while(--i);
-    }
-    return (crc);
-}
-
-#endif
+#include "session.h"
+#include "readahead.h"
+#include "packer.h"
+#include "writebehind.h"
+#include "crc.h"
+#include "blockhash.h"
 
 #ifdef DEBUG
 #define XMODEM_SOH        ('1')
@@ -66,7 +26,6 @@ static uint16_t crc16(uint8_t const * const ptr, int count) {
 #endif
 
 /* Delays/Timeouts */
-#define XMODEM_DELAY_TOKEN (100)
 #define XMODEM_DELAY_1S (1000)
 
 /* Max Retransmissions and Retries */
@@ -80,277 +39,596 @@ static uint16_t crc16(uint8_t const * const ptr, int count) {
 #define XMODEM_MAX_RETRY       (15000)
 #endif
 
-#define XMODEM_1K_BUFF_SIZE	(1024)
-#define XMODEM_BUFF_SIZE (128)
-#define XMODEM_MAX_PACKET_SIZE (XMODEM_1K_BUFF_SIZE + 5)
-
 /* Xmodem Streambuffer size and trigger level for RX INT */
 #define XMODEM_STREAM_BUFF_SIZE	         (XMODEM_MAX_PACKET_SIZE*2)
 #define XMODEM_STREAM_BUFF_TRIGGER_LEVEL (1)
 
+/* Blocks read ahead of the sender when the source is not mapped */
+#define XMODEM_READAHEAD_BLOCKS (8)
+
+/* Bytes per read from the link. extended packets arrive in a few reads instead of one per classic packet */
+#define XMODEM_RECV_CHUNK (16 * 1024)
+
+/* Bytes per write when the receiver flushes verified blocks to the sink */
+#define XMODEM_WRITEBEHIND_BATCH (64 * 1024)
+
+/* Receiver syncs, and saves its checkpoint, at least this often when transfers may be resumed */
+#define XMODEM_CHECKPOINT_BYTES (1024 * 1024)
+
+/* Bytes per read when a resumed transfer checks the part of the file it skips */
+#define XMODEM_RESUME_CHUNK (64 * 1024)
+
+/* Bytes per read when a delta hashes a file it cannot map: a multiple of every delta block size */
+#define XMODEM_DELTA_CHUNK (4 * 1024 * 1024)
+
 /* Receiver timeout value in baud */
 #define XMODEM_RTO_VALUE                     (100)
 
-/* Buffer to receive/transmit file */
-static uint8_t xmodem_holding_buffer[XMODEM_MAX_PACKET_SIZE];
+/*
+ * Where payloads come from: a mapping of the whole file, or the read-ahead thread's blocks. those are the largest
+ * block size, so a smaller block always lies within one of them. a batch opens its files one after the other. once
+ * the receiver takes packed blocks, a packing thread runs ahead of the link over the same blocks
+ */
+typedef struct {
+    uint32_t file_size;
+    unsigned int packet_size;
+    uint8_t const *mapping;
+    ReadAhead *readahead;
+
+    GenericDevice *files, *dst;
+    unsigned int n_files, n_opened;
+    unsigned int depth; /* read-ahead blocks */
+    unsigned int timeout_ms;
+    unsigned int mapped_size;
+    ReadAhead readahead_state;
+    uint32_t *delta_blocks; /* delta: the blocks the reader reads, in order */
+    Packer packer;
+    unsigned int packing; /* the packer runs for this file */
+    unsigned int packer_failed; /* it could not start. the rest of the transfer goes as it is */
+} XmodemSource;
 
-static uint16_t buffer_index = 0;
+/*
+ * Where verified blocks go: a write-behind thread, and what the device holds of the file for a resumed transfer or
+ * a delta
+ */
+typedef struct {
+    WriteBehind writer;
+    GenericDevice *dst;
+    unsigned int resume; /* the device can keep a checkpoint, and cut a file short */
+    XmodemCheckpoint checkpoint; /* offered to the sender. verified = 0 if there is nothing to offer */
+    XmodemSignature signature; /* offered to the sender for a delta */
+    BlockHash *hashes;
+} XmodemSink;
+
+/* @brief payloads come from src from now on. zero copy when it can be mapped and the link can gather */
+static int source_open(XmodemSource *source, GenericDevice *src) {
+    source->mapping = NULL;
+    source->readahead = NULL;
+    if (src->map && src->unmap && source->dst->sendv) { source->mapping = src->map(src->handle, &source->mapped_size); }
+    if (source->mapping) {
+        source->file_size = source->mapped_size;
+        return 0;
+    }
+    int size = src->size ? src->size(src->handle, source->timeout_ms) : -1;
+    if (size < 0) { return -1; }
+    source->file_size = size;
+    if (size == 0) { return 0; } /* nothing to read ahead */
+    if (readahead_start(&source->readahead_state, src, size, 0, source->packet_size, source->depth) != 0) {
+        return -1;
+    }
+    source->readahead = &source->readahead_state;
+    return 0;
+}
 
-#ifndef DEBUG
-static int read_from_file(char const * const filename, uint32_t offset, void *p, unsigned int n)
-{
-	static int packet_sequence = 0;
-	memset(p, 0x41 + packet_sequence, n);
-	packet_sequence = (packet_sequence + 1) & 0xf; /* repeat pattern after 16 */
-	return n;
+static void source_close(XmodemSource *source, GenericDevice *src) {
+    if (source->packing) { packer_stop(&source->packer); } /* before the blocks it packs from go */
+    if (source->readahead) { readahead_stop(source->readahead); }
+    if (source->mapping) { src->unmap(src->handle, source->mapping, source->mapped_size); }
+    source->packing = 0;
+    source->mapping = NULL;
+    source->readahead = NULL;
+    free(source->delta_blocks);
+    source->delta_blocks = NULL;
 }
-#endif
 
-#ifdef DEBUG
-static int read_from_file(GenericDevice *dev, size_t offset, void *p, unsigned int n)
-{
-    dev->recv(dev->fd, p, n);
-    return n;
+/* @brief batch: done with the file before, on to the next. its name is announced without the directory */
+static int source_next_file(void *context, XmodemFileInfo *info) {
+    XmodemSource *source = (XmodemSource *) context;
+    if (source->n_opened) { source_close(source, &source->files[source->n_opened - 1]); }
+    if (source->n_opened == source->n_files) { return 1; }
+    GenericDevice *src = &source->files[source->n_opened++];
+    if (source_open(source, src) != 0) { return -1; }
+
+    char const *name = strrchr(src->name, '/');
+    snprintf(info->name, sizeof (info->name), "%s", name ? name + 1 : src->name);
+    if (src->info) { src->info(src->handle, info); }
+    info->size = source->file_size;
+    return 0;
 }
-#endif
 
-#ifndef DEBUG
-static int get_filesize(char const * const filename)
-{
-	return 4096;
+/* @brief delta: how many of the blocks the reader reads lie before file block block */
+static uint32_t list_position(ReadAhead const *ra, uint32_t block) {
+    uint32_t lo = 0, hi = ra->n_blocks;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (ra->list[mid] < block) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
 }
-#endif
 
-#ifdef DEBUG
-static int get_filesize(char const * const filename)
-{
-    FIL xFileDesc;
-    if(f_open(&xFileDesc, filename, FA_OPEN_EXISTING | FA_READ) != FR_OK) { return ERROR_CODE_FILE_ACCESS; }
-    int file_size = f_size(&xFileDesc); /* there are no error codes */
-    if(f_close(&xFileDesc) != FR_OK) { return ERROR_CODE_FILE_ACCESS; }
-    return file_size;
+static uint8_t const *source_get_data(void *context, uint32_t offset, unsigned int n) {
+    XmodemSource *source = (XmodemSource *) context;
+    if (source->mapping) { return &source->mapping[offset]; }
+    if ((source->readahead == NULL) || (offset < source->readahead->start)) { return NULL; }
+    ReadAhead *ra = source->readahead;
+    int length;
+    offset -= ra->start;
+    uint32_t index = offset / ra->block_size;
+    if (ra->list) {
+        index = list_position(ra, index);
+        if ((index == ra->n_blocks) || (ra->list[index] != offset / ra->block_size)) { return NULL; }
+    }
+    uint8_t const *block = readahead_get(ra, index, &length);
+    unsigned int skip = offset % ra->block_size;
+    if ((block == NULL) || (length < 0) || (skip + n > (unsigned int) length)) { return NULL; }
+    return &block[skip];
 }
-#endif
 
-int xmodem_recv(GenericDevice *src, GenericDevice *dst, XmodemOptions *options, int *errors)
-{
-    src->putc(&src->fd, options->packet_size_code, options->timeout_ms);
-
-    const unsigned int header_size = 3;
-    const unsigned int footer_size = (options->crc_checksum == CHECKSUM_OPTION_CRC) ? 2 : 1;
-    uint8_t expected_packet_id = 1;
-
-    const unsigned int expected_packet_size = options->packet_size + header_size + footer_size;
-    unsigned int n_read, n_write;
-    int success, done = 0;
-    do {
-        while (1) { /* loop over incoming packets */
-            success = 0;
-            n_read = 0;
-            int remaining = expected_packet_size;
-            int index = 0;
-            do {
-                n_read = src->recv(&src->fd, &xmodem_holding_buffer[index], remaining, 0, options->timeout_ms);
-                remaining -= n_read;
-                index += n_read;
-            } while ((remaining > 0) && (1)); /* TODO timeout */
-            uint8_t packet_id = xmodem_holding_buffer[1];
-            do {
-                if ((n_read == 1) && (xmodem_holding_buffer[0] == XMODEM_EOT)) {
-                    n_write = src->putc(&src->fd, XMODEM_CAN, options->timeout_ms);
-                    n_write = src->putc(&src->fd, XMODEM_CAN, options->timeout_ms);
-                    n_write = src->putc(&src->fd, XMODEM_CAN, options->timeout_ms);
-                    done = 1;
-                    break;
-                }
-                if (n_read != expected_packet_size) { break; }
-                if (packet_id != expected_packet_id) { break; }
-                if (xmodem_holding_buffer[2] != ~packet_id) { break; }
-                uint16_t expected_crc = crc16(&xmodem_holding_buffer[3], options->packet_size);
-                uint8_t crc_hi = xmodem_holding_buffer[3 + options->packet_size + 0];
-                uint8_t crc_lo = xmodem_holding_buffer[3 + options->packet_size + 1];
-                uint16_t crc = (crc_hi << 8) | (crc_lo);
-                if (crc != expected_crc) { break; }
-                success = 1;
-            } while (0);
-            expected_packet_id = packet_id + 1;
-            src->putc(&src->fd, success ? XMODEM_ACK : XMODEM_NAK, options->timeout_ms);
+static void source_release_data(void *context, uint32_t offset) {
+    XmodemSource *source = (XmodemSource *) context;
+    ReadAhead *ra = source->readahead;
+    if (source->packing) { packer_release(&source->packer, offset); }
+    if (ra && ra->list) {
+        readahead_release(ra, list_position(ra, offset / ra->block_size));
+    } else if (ra && (offset > ra->start)) {
+        readahead_release(ra, (offset - ra->start) / ra->block_size);
+    }
+}
+
+/* @brief the packer starts with the first packed block asked for, so a session that never packs costs no thread */
+static uint8_t const *source_get_packed(void *context, uint32_t offset, unsigned int n, unsigned int *length) {
+    XmodemSource *source = (XmodemSource *) context;
+    if ((source->packing == 0) && (source->packer_failed == 0)) {
+        if (packer_start(&source->packer, source_get_data, source, source->file_size, source->packet_size,
+            source->depth) == 0) {
+            source->packing = 1;
+        } else {
+            source->packer_failed = 1; /* not tried again for every block */
         }
-    } while (success && (done == 0));
+    }
+    return source->packing ? packer_get(&source->packer, offset, n, length) : NULL;
+}
+
+/* @brief crc-32c of the first n bytes of a device. 0, or -1 if they could not be read */
+static int device_crc(GenericDevice *dev, uint32_t n, uint32_t *crc) {
+    uint8_t *chunk = malloc(XMODEM_RESUME_CHUNK);
+    if ((chunk == NULL) || (dev->recv == NULL)) {
+        free(chunk);
+        return -1;
+    }
+    uint32_t offset = 0;
+    *crc = 0;
+    while (offset < n) {
+        unsigned int length = (n - offset < XMODEM_RESUME_CHUNK) ? n - offset : XMODEM_RESUME_CHUNK;
+        int n_read = dev->recv(dev->handle, chunk, length, offset, 0);
+        if (n_read <= 0) { break; }
+        *crc = crc32c_update(*crc, chunk, n_read);
+        offset += n_read;
+    }
+    free(chunk);
+    return (offset == n) ? 0 : -1;
 }
 
 /*
- * @param
- *     options->packet_size_code = { XMODEM_SOH (128-byte packets), XMODEM_STX (1024-byte packets)
+ * @brief hashes of the block_size blocks of the first n bytes of a device, read a chunk at a time, each chunk hashed
+ *     over all cpus. 0, or -1 if they could not be read
  */
-int xmodem_send(GenericDevice *src, GenericDevice *dst, XmodemOptions *options, int *errors)
-{
-    uint8_t packet_id = 1;
-    uint32_t file_size;
-    unsigned int payload_size; /* amount of true payload for current packet */
-
-    const uint8_t packet_size = (options->packet_size_code == XMODEM_STX) ? XMODEM_1K_BUFF_SIZE: XMODEM_BUFF_SIZE;
-
-    if ((file_size = get_filesize(src->name)) == 0) { return -1; }
-
-    options->crc_checksum = CHECKSUM_OPTION_UNK;
-    uint8_t byte;
-    unsigned int failure = 0;
-
-	/* NAK = no crc, C = CRC. setting valid for whole session */
-    for (int retry = 0; (options->max_retries == 0) || (retry < options->max_retries); ++retry)
-    {
-        if (dst->getc(&dst->fd, &byte, options->timeout_ms)) {
-            switch (byte)
-            {
-                case XMODEM_CCC: { options->crc_checksum = CHECKSUM_OPTION_CRC; }
-                break;
-
-                case XMODEM_NAK: { options->crc_checksum = CHECKSUM_OPTION_SUM; }
-                break;
-
-                case XMODEM_CAN: {
-                    if (dst->getc(&dst->fd, &byte, options->timeout_ms)) {
-                        if (byte == XMODEM_CAN) {
-                            dst->putc(&dst->fd, XMODEM_ACK, options->timeout_ms);
-                            failure = 1;
-                        }
-                    }
-                }
-                break;
-
-                default:
-                    break;
-            }
+static int device_hashes(GenericDevice *dev, uint32_t n, unsigned int block_size, BlockHash *hashes) {
+    unsigned int chunk_size = (n < XMODEM_DELTA_CHUNK) ? n : XMODEM_DELTA_CHUNK;
+    uint8_t *chunk = malloc(chunk_size ? chunk_size : 1);
+    if ((chunk == NULL) || (dev->recv == NULL)) {
+        free(chunk);
+        return -1;
+    }
+    uint32_t offset = 0;
+    while (offset < n) {
+        unsigned int length = (n - offset < chunk_size) ? n - offset : chunk_size;
+        unsigned int filled = 0;
+        while (filled < length) {
+            int n_read = dev->recv(dev->handle, &chunk[filled], length - filled, offset + filled, 0);
+            if (n_read <= 0) { break; }
+            filled += n_read;
         }
-        if (options->crc_checksum) { break; }
+        if (filled < length) { break; }
+        block_hash_blocks(chunk, length, block_size, &hashes[offset / block_size], 0);
+        offset += length;
     }
+    free(chunk);
+    return (offset == n) ? 0 : -1;
+}
 
-    if (failure) {
+/*
+ * @brief delta: the blocks of our file that differ from the receiver's. the reader starts over on just those, so
+ *     the ones that stay are never read twice. -1 to send them all
+ */
+static int source_delta(void *context, XmodemSignature const *signature, uint32_t *blocks) {
+    XmodemSource *source = (XmodemSource *) context;
+    GenericDevice *src = &source->files[source->n_opened - 1];
+    const unsigned int block_size = signature->block_size;
+    const uint32_t n_blocks = (source->file_size + (uint64_t) block_size - 1) / block_size;
+    BlockHash *hashes = malloc((n_blocks ? n_blocks : 1) * sizeof (BlockHash));
+    uint32_t *list = malloc((n_blocks ? n_blocks : 1) * sizeof (uint32_t));
+    if ((hashes == NULL) || (list == NULL)) {
+        free(hashes);
+        free(list);
+        return -1;
     }
-
-    if ((options->crc_checksum != CHECKSUM_OPTION_CRC) && (options->crc_checksum != CHECKSUM_OPTION_SUM)) {
-        for (int i = 0; i < 3; ++i) { dst->putc(&dst->fd, XMODEM_CAN, options->timeout_ms); }
-        failure = 1;
+    if (source->mapping) {
+        block_hash_blocks(source->mapping, source->file_size, block_size, hashes, 0);
+    } else if ((source->readahead == NULL) || (device_hashes(src, source->file_size, block_size, hashes) != 0)) {
+        free(hashes);
+        free(list);
+        return -1;
+    }
+    int n = xmodem_delta_blocks(signature, hashes, source->file_size, list);
+    free(hashes);
+    memcpy(blocks, list, n * sizeof (uint32_t));
+    if (source->mapping) {
+        free(list);
+        return n;
     }
 
-    if (failure) {
+    /* the reader's ring holds delta blocks from now on. blocks are never larger */
+    readahead_stop(source->readahead);
+    source->readahead = NULL;
+    free(source->delta_blocks);
+    source->delta_blocks = list;
+    unsigned int depth = source->depth * ((source->packet_size > block_size) ? source->packet_size / block_size : 1);
+    if (readahead_start_list(&source->readahead_state, src, source->file_size, list, n, block_size, depth) != 0) {
+        return -1; /* no reader, so the session gives up at the first block */
     }
+    source->readahead = &source->readahead_state;
+    return n;
+}
 
-    uint8_t * const header = &xmodem_holding_buffer[0];
-    uint8_t * const payload = &xmodem_holding_buffer[3];
-    uint8_t * const footer = &xmodem_holding_buffer[options->packet_size + 3];
-    const unsigned int n_bytes = packet_size + 4 + ((options->crc_checksum == CHECKSUM_OPTION_CRC) ? 1 : 0);
-    unsigned int total_retries = 0;
-    uint32_t bytes_sent = 0;
-    for (;;)
-    {
-        header[0] = options->packet_size_code;
-        header[1] = packet_id;
-        header[2] = ~packet_id;
-
-        /* how much payload to send this packet. packet size always 1024 */
-        payload_size = file_size - bytes_sent;
-        if (payload_size > options->packet_size) { payload_size = options->packet_size; }
-
-        if (payload_size == 0) { /* we're done sending whole packets. finish, clean up and go home */
-            byte = XMODEM_NAK; /* set to decoy invalid value */
-            for (int retry = 0; retry < options->max_retries; ++retry) {
-                dst->putc(&dst->fd, XMODEM_EOT, options->timeout_ms);
-                if (dst->getc(&dst->fd, &byte, options->timeout_ms)) {
-                    if (byte == XMODEM_ACK) { break; }
-                }
-            }
-            return (byte == XMODEM_ACK) ? 0 : -1;
+/*
+ * @brief resume: the receiver holds offset bytes of the file, with this crc. if ours start the same, blocks come
+ *     from offset on. reading the skipped part back costs one pass over it, far less than sending it again
+ */
+static uint32_t source_resume(void *context, uint32_t offset, uint32_t crc) {
+    XmodemSource *source = (XmodemSource *) context;
+    GenericDevice *src = &source->files[source->n_opened - 1];
+    uint32_t ours;
+    if (source->mapping) {
+        ours = crc32c(source->mapping, offset);
+    } else if ((source->readahead == NULL) || (device_crc(src, offset, &ours) != 0)) {
+        return 0;
+    }
+    if (ours != crc) { return 0; }
+    if (source->mapping || (source->readahead->start == offset)) { return offset; } /* e.g. the offer again */
+
+    /* the reader starts over at offset, or at the start if it cannot */
+    readahead_stop(source->readahead);
+    source->readahead = NULL;
+    uint32_t start = offset;
+    if (readahead_start(&source->readahead_state, src, source->file_size, start, source->packet_size,
+        source->depth) != 0) {
+        start = 0;
+        if (readahead_start(&source->readahead_state, src, source->file_size, 0, source->packet_size,
+            source->depth) != 0) {
+            return 0; /* no reader, so the session gives up at the first block */
         }
+    }
+    source->readahead = &source->readahead_state;
+    return start;
+}
 
-       	int local_data_read = 0;
-       	int remaining = payload_size - local_data_read;
-        do {
-            int n_read = read_from_file(src->name, bytes_sent, &payload[local_data_read], remaining);
-            if (n_read < 0)
-            {
-                for (int i = 0; i < 3; ++i) { dst->putc(&dst->fd, XMODEM_CAN, options->timeout_ms); }
-                failure = 1;
-            }
-            remaining -= n_read;
-            local_data_read += n_read;
-        } while (local_data_read < payload_size);
-
-        if (failure) {
-        }
+static int sink_put_block(void *context, uint32_t offset, uint8_t const *data, unsigned int n) {
+    XmodemSink *sink = (XmodemSink *) context;
+    return writebehind_submit(&sink->writer, offset, data, n);
+}
+
+/*
+ * @brief resume: what the device holds of the file, going by its checkpoint. that only counts if it is for the same
+ *     file and the bytes it covers still have its crc. otherwise the file starts over. either way the writer keeps
+ *     the checkpoint up to date from here
+ * @param info = the file as announced by block 0, NULL outside a batch
+ */
+static int sink_load(XmodemSink *sink, XmodemFileInfo const *info) {
+    GenericDevice *dst = sink->dst;
+    XmodemCheckpoint *checkpoint = &sink->checkpoint;
+    XmodemCheckpoint saved;
+    memset(checkpoint, 0, sizeof (XmodemCheckpoint));
+    checkpoint->magic = XMODEM_CHECKPOINT_MAGIC;
+    if (info) {
+        checkpoint->size = info->size;
+        checkpoint->mtime = info->mtime;
+    }
+    if (sink->resume == 0) { return 0; }
+
+    uint32_t crc;
+    if ((dst->load_checkpoint(dst->handle, &saved) == 0) && (saved.magic == XMODEM_CHECKPOINT_MAGIC) &&
+        (saved.size == checkpoint->size) && (saved.mtime == checkpoint->mtime) &&
+        ((dst->recv == NULL) || ((device_crc(dst, saved.verified, &crc) == 0) && (crc == saved.crc)))) {
+        checkpoint->verified = saved.verified;
+        checkpoint->crc = saved.crc;
+    } else if (dst->truncate(dst->handle, 0) != 0) {
+        return -1;
+    }
+    writebehind_track(&sink->writer, checkpoint);
+    return 0;
+}
+
+static uint32_t sink_checkpoint(void *context, uint32_t *crc) {
+    XmodemSink *sink = (XmodemSink *) context;
+    *crc = sink->checkpoint.crc;
+    return sink->checkpoint.verified;
+}
 
-        if (payload_size < packet_size) { /* pad to 1024 bytes with 0x1a */
-        	memset(&payload[payload_size], XMODEM_CTZ, packet_size - payload_size);
+/* @brief the sender goes on after what we offered, or starts over */
+static int sink_restart(void *context, uint32_t offset) {
+    XmodemSink *sink = (XmodemSink *) context;
+    if (offset == sink->checkpoint.verified) { return 0; }
+    sink->checkpoint.verified = 0;
+    sink->checkpoint.crc = 0;
+    if (sink->dst->truncate(sink->dst->handle, 0) != 0) { return -1; }
+    writebehind_track(&sink->writer, &sink->checkpoint);
+    return 0;
+}
+
+/* @brief delta: hashes of the file the device holds, in blocks of block_size or, for a large file, larger */
+static XmodemSignature const *sink_signature(void *context, unsigned int block_size) {
+    XmodemSink *sink = (XmodemSink *) context;
+    GenericDevice *dst = sink->dst;
+    int size = dst->size(dst->handle, 0);
+    if (size <= 0) { return NULL; }
+    while (((size + (uint64_t) block_size - 1) / block_size > XMODEM_DELTA_MAX_BLOCKS) &&
+        (block_size < XMODEM_DELTA_MAX_BLOCK)) {
+        block_size *= 2;
+    }
+    uint32_t n_blocks = (size + (uint64_t) block_size - 1) / block_size;
+    if (n_blocks > XMODEM_DELTA_MAX_BLOCKS) { return NULL; }
+    free(sink->hashes);
+    sink->hashes = malloc(n_blocks * sizeof (BlockHash));
+    if ((sink->hashes == NULL) || (device_hashes(dst, size, block_size, sink->hashes) != 0)) { return NULL; }
+    sink->signature.size = size;
+    sink->signature.block_size = block_size;
+    sink->signature.n_blocks = n_blocks;
+    sink->signature.hashes = sink->hashes;
+    return &sink->signature;
+}
+
+/* @brief delta: the file is size bytes from now on. blocks = NULL: all of it comes, so none of what we hold stays */
+static int sink_patch(void *context, uint32_t size, uint32_t const *blocks, uint32_t n_blocks) {
+    XmodemSink *sink = (XmodemSink *) context;
+    (void) n_blocks;
+    return sink->dst->truncate(sink->dst->handle, blocks ? size : 0);
+}
+
+static int sink_open_file(void *context, XmodemFileInfo const *info) {
+    XmodemSink *sink = (XmodemSink *) context;
+    if (sink->dst->open(sink->dst->handle, info) != 0) { return -1; }
+    return sink_load(sink, info);
+}
+
+/* @brief batch: the file is complete once its blocks are on the device, cut to the announced size */
+static int sink_end_file(void *context, XmodemFileInfo const *info) {
+    XmodemSink *sink = (XmodemSink *) context;
+    GenericDevice *dst = sink->dst;
+    if (writebehind_flush(&sink->writer, info->size) != 0) { return -1; }
+    writebehind_track(&sink->writer, NULL);
+    if (dst->close && (dst->close(dst->handle, info) != 0)) { return -1; }
+    if (sink->resume) { dst->save_checkpoint(dst->handle, NULL); } /* nothing left to resume */
+    return 0;
+}
+
+/* @brief hands the link whatever the session has to say, in one writev when the link can gather */
+static int send_output(GenericDevice *dev, struct iovec const *iov, int iovcnt, unsigned int timeout) {
+    if (dev->sendv) { return dev->sendv(dev->handle, iov, iovcnt, timeout); }
+    int sent = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        int n = dev->send(dev->handle, iov[i].iov_base, iov[i].iov_len, timeout);
+        if (n > 0) { sent += n; }
+        if (n < (int) iov[i].iov_len) { break; }
+    }
+    return sent;
+}
+
+static uint64_t thread_cpu_us(void) {
+    struct timespec spec;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &spec);
+    return spec.tv_sec * 1000000ull + spec.tv_nsec / 1000;
+}
+
+/*
+ * @brief drives a session over a blocking device until it is over: output goes out first, then we wait for input
+ *     no longer than the session's next deadline. the session's stats get its times in microseconds as it goes
+ */
+static int run_session(XmodemSession *session, GenericDevice *dev) {
+    uint8_t chunk[XMODEM_RECV_CHUNK];
+    struct iovec iov[XMODEM_SESSION_MAX_IOV];
+    uint64_t wall_start = xmodem_session_clock_us();
+    uint64_t cpu_start = thread_cpu_us();
+
+    session->clock_us = xmodem_session_clock_us;
+    while (xmodem_session_status(session) == XMODEM_SESSION_RUNNING) {
+        int iovcnt = xmodem_session_next_output(session, iov, XMODEM_SESSION_MAX_IOV);
+        if (iovcnt > 0) {
+            unsigned int total = 0;
+            for (int i = 0; i < iovcnt; ++i) { total += iov[i].iov_len; }
+            int n = send_output(dev, iov, iovcnt, session->options.timeout_ms);
+            /* a link that takes nothing loses the bytes, the same as a noisy line. the timeouts recover */
+            xmodem_session_consume_output(session, (n > 0) ? (unsigned int) n : total, xmodem_session_clock());
         }
 
-        /* crc or checksum at end depends on global NACK or C at beginning of session */
-        if (options->crc_checksum == 1) {
-            uint16_t crc = crc16(payload, options->packet_size);
-            footer[0] = (crc >> 8) & 0xff;
-            footer[1] = crc & 0xff;
-        } else {
-            uint8_t checksum = 0;
-            for (int i = 0; i < options->packet_size; ++i) { checksum += payload[i]; }
-            footer[0] = checksum;
+        uint64_t now = xmodem_session_clock();
+        uint64_t deadline = xmodem_session_deadline(session);
+        unsigned int timeout = 0;
+        if ((deadline != XMODEM_SESSION_NEVER) && (deadline > now)) { timeout = deadline - now; }
+
+        int n = dev->recv(dev->handle, chunk, sizeof (chunk), 0, timeout);
+        if (n < 0) { break; } /* the link is gone. nothing more will come */
+        now = xmodem_session_clock();
+        if (n > 0) { xmodem_session_feed(session, chunk, n, now); }
+        xmodem_session_poll(session, now);
+        xmodem_stats_set(&session->stats->wall_us, xmodem_session_clock_us() - wall_start);
+        xmodem_stats_set(&session->stats->cpu_us, thread_cpu_us() - cpu_start);
+    }
+
+    return (xmodem_session_status(session) == XMODEM_SESSION_DONE) ? 0 : -1;
+}
+
+/*
+ * @param
+ *     options->crc_checksum = CHECKSUM_OPTION_CRC (default) or CHECKSUM_OPTION_SUM
+ *     options->streaming = offer ymodem-g streaming with G. set to the negotiated mode
+ *     options->window = offer a sliding window of this many blocks with W. set to the negotiated window
+ *     options->extended = offer extended packets of up to options->extended_block_size. set if the sender took them
+ *     options->batch = take a batch of files. dst->open starts each one
+ *     options->resume = go on after what dst holds of the file by its checkpoint, if the sender agrees. needs
+ *         dst->truncate, dst->load_checkpoint and dst->save_checkpoint. a failed transfer leaves a checkpoint
+ *     options->delta = patch the file dst holds: only blocks of this size that differ from it come. needs
+ *         dst->recv, dst->size and dst->truncate. not in a batch, and instead of resume: a failed delta is simply
+ *         done again
+ *     options->compress = take lz-packed blocks, unpacked before they go to dst. extended packets only. set if the
+ *         sender packed any
+ *     options->fec_group, options->fec_parity = ask for parity blocks: up to fec_parity after every fec_group
+ *         blocks, which rebuild as many damaged blocks of the group. extended packets with a window or streaming
+ *         only. kept if the sender agreed
+ *     options->stats = optional, counted into as the transfer goes. see stats.h
+ */
+int xmodem_recv(GenericDevice *src, GenericDevice *dst, XmodemOptions *options, int *errors)
+{
+    XmodemSession session;
+    XmodemBlocks blocks;
+    XmodemSink sink;
+
+    memset(&blocks, 0, sizeof (blocks));
+    memset(&sink, 0, sizeof (sink));
+    if (options->batch && ((dst == NULL) || (dst->write == NULL) || (dst->open == NULL))) { return -1; }
+
+    /* verified blocks go to the sink on a writer thread, so the ACK never waits on the disk */
+    if (dst && dst->write) {
+        unsigned int sync_bytes = options->sync_bytes;
+        sink.dst = dst;
+        unsigned int delta = (options->delta && (options->batch == 0) && dst->recv && dst->size && dst->truncate) ?
+            1 : 0;
+        sink.resume = (options->resume && (delta == 0) && dst->truncate && dst->load_checkpoint &&
+            dst->save_checkpoint) ? 1 : 0;
+        if (sink.resume && ((sync_bytes == 0) || (sync_bytes > XMODEM_CHECKPOINT_BYTES))) {
+            sync_bytes = XMODEM_CHECKPOINT_BYTES; /* a crash costs no more than this */
+        }
+        if (writebehind_start(&sink.writer, dst, XMODEM_WRITEBEHIND_BATCH, sync_bytes) != 0) { return -1; }
+        blocks.context = &sink;
+        blocks.put_block = sink_put_block;
+        if (options->batch) {
+            blocks.open_file = sink_open_file;
+            blocks.end_file = sink_end_file;
+        } else if (sink_load(&sink, NULL) != 0) {
+            writebehind_finish(&sink.writer, 0);
+            return -1;
+        }
+        if (sink.resume) {
+            blocks.checkpoint = sink_checkpoint;
+            blocks.restart = sink_restart;
         }
+        if (delta) {
+            blocks.signature = sink_signature;
+            blocks.patch = sink_patch;
+        }
+    }
 
-        unsigned int success = 0;
-        unsigned int retries = 0;
+    int result = -1;
+    if (xmodem_session_start_recv(&session, options, &blocks, xmodem_session_clock()) == 0) {
+        result = run_session(&session, src);
+    }
 
-        for (int retry = 0; retry < options->max_retransmissions; ++retry)
-        {
-#ifdef DEBUG
-            pretty(pretty_buff, ucBuff, n_bytes);
-            _Xmodem_OutBytes(pretty_buff, 2 * n_bytes);
-#endif
+    /*
+     * a transfer that fails leaves a checkpoint of what made it to the device. a complete one needs none. a delta
+     * carries no padding, and its last block written need not be the end of the file
+     */
+    unsigned int strip = ((result == 0) && (options->batch == 0) && (session.delta == 0)) ? 1 : 0;
+    if (blocks.context && (writebehind_finish(&sink.writer, strip) != 0)) { result = -1; }
+    free(sink.hashes);
+    if (blocks.context && sink.resume && (result == 0) && (options->batch == 0)) {
+        dst->save_checkpoint(dst->handle, NULL);
+    }
 
-#ifndef DEBUG
-            while (dst->getc(&dst->fd, &byte, options->timeout_ms)) { ; } /* flush away bytes in rx queue */
+    *options = session.options;
+    if (errors) { *errors = session.total_retries; }
+    xmodem_session_end(&session);
 
-            dst->send(&dst->fd, xmodem_holding_buffer, n_bytes, options->timeout_ms); /* send packet */
-#endif
+    return result;
+}
 
-            byte = 0;
-            if (dst->getc(&dst->fd, &byte, options->timeout_ms)) /* wait for confirm (ACK) or retry */
-            {
-                switch (byte)
-                {
-                case XMODEM_ACK:
-                    ++packet_id;
-                    bytes_sent += payload_size;
-                    success = 1;
-                    break;
-
-                case XMODEM_CAN: /* received one cancel. need another to confirm */
-                    if (dst->getc(&dst->fd, &byte, options->timeout_ms) && (byte == XMODEM_CAN)) {
-                        dst->putc(&dst->fd, XMODEM_ACK, options->timeout_ms);
-                        failure = 1;
-                    }
-                    break;
-
-               case XMODEM_NAK: /* resubmit on anything but an ACK or CANCEL */
-               default:
-            	   ++retries;
-                   break;
-               }
-            }
-
-            if (success || failure) { break; }
-
-        } /* retry sending packet */
-
-        total_retries += retries;
-
-        if (success == 0) {
-            for (int i = 0; i < 3; ++i) { dst->putc(&dst->fd, XMODEM_CAN, options->timeout_ms); }
-            failure = 1;
-        }
+/*
+ * @param
+ *     options->packet_size_code = { XMODEM_SOH (128-byte packets), XMODEM_STX (1024-byte packets)
+ *     options->streaming = allow ymodem-g streaming if the receiver asks for it with G. set to the negotiated mode
+ *     options->window = most blocks in flight we allow if the receiver asks for a window with W.
+ *         set to the negotiated window, 0 for classic stop-and-wait
+ *     options->extended = allow extended packets of up to options->extended_block_size. set if negotiated
+ *     options->batch = announce the files with block 0, for a batch receiver. xmodem_send() makes a batch of one
+ *     options->resume = skip what the receiver already holds of a file, once its crc matches
+ *     options->delta = send only the blocks that differ from those the receiver offers hashes of. not in a batch
+ *     options->compress = lz-pack the blocks that shrink, on a thread ahead of the link, if the receiver takes them.
+ *         extended packets only. set if agreed
+ *     options->fec_group, options->fec_parity = send up to fec_parity parity blocks after every fec_group blocks if
+ *         the receiver asks for them. set to what was agreed
+ *     options->stats = optional, counted into as the transfer goes. see stats.h
+ */
+int xmodem_send_batch(GenericDevice *files, unsigned int n_files, GenericDevice *dst, XmodemOptions *options,
+    int *errors)
+{
+    XmodemSource source;
+
+    options->packet_size = (options->packet_size_code == XMODEM_STX) ? XMODEM_1K_BUFF_SIZE: XMODEM_BUFF_SIZE;
+
+    if (errors) { *errors = 0; }
+
+    memset(&source, 0, sizeof (source));
+    source.packet_size = options->extended ? xmodem_extended_block_size(options) : options->packet_size;
+    source.files = files;
+    source.n_files = n_files;
+    source.dst = dst;
+    source.timeout_ms = options->timeout_ms;
+    /* every block of the window stays in the ring until ACKed, plus those read ahead */
+    source.depth = (options->window > XMODEM_MAX_WINDOW) ? XMODEM_MAX_WINDOW : options->window;
+    source.depth += options->readahead ? options->readahead : XMODEM_READAHEAD_BLOCKS;
+
+    XmodemBlocks blocks = { .context = &source, .get_data = source_get_data, .release_data = source_release_data,
+        .gather = dst->sendv ? 1 : 0 };
+    if (options->resume) { blocks.resume = source_resume; }
+    if (options->delta && (options->batch == 0)) { blocks.delta = source_delta; }
+    if (options->compress && options->extended) { blocks.get_packed = source_get_packed; }
+    if (options->batch) {
+        blocks.next_file = source_next_file; /* files are opened as the session gets to them */
+    } else if ((n_files != 1) || (source_open(&source, files) != 0) || (source.file_size == 0)) {
+        source_close(&source, files);
+        return -1;
+    } else {
+        source.n_opened = 1;
+    }
 
-        if (failure) { break; }
+    XmodemSession session;
+    int result = -1;
+    if (xmodem_session_start_send(&session, options, &blocks, source.file_size, xmodem_session_clock()) == 0) {
+        result = run_session(&session, dst);
+        *options = session.options;
+        if (errors) { *errors = session.total_retries; }
     }
+    xmodem_session_end(&session);
 
-    if (errors) { *errors = total_retries; }
+    if (source.n_opened) { source_close(&source, &files[source.n_opened - 1]); }
 
-    return (*errors);
+    return result;
+}
+
+int xmodem_send(GenericDevice *src, GenericDevice *dst, XmodemOptions *options, int *errors)
+{
+    return xmodem_send_batch(src, 1, dst, options, errors);
 }